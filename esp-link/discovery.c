@@ -0,0 +1,53 @@
+// Answer discovery probes with a JSON description of the module and its Propeller loader so
+// espload can pick the reset pin, packet size and baud rate without probing over HTTP. The
+// rates are the ones the loader has found to work on this module's line.
+
+#include <esp8266.h>
+#include "config.h"
+#include "proploader.h"
+#include "cgiprop.h"
+#include "discovery.h"
+
+extern char *esp_link_version;
+
+static struct espconn discoveryConn;
+static esp_udp discoveryUdp;
+static const int secondStageBaudRates[] = SECOND_STAGE_BAUD_RATES;
+
+static void ICACHE_FLASH_ATTR discoveryRecvCb(void *arg, char *data, unsigned short len) {
+  struct espconn *conn = (struct espconn *)arg;
+  remot_info *remote = NULL;
+  char buf[400];
+  uint8_t mac[6];
+  int cnt, i;
+
+  // reply to whoever sent the probe, the contents don't matter
+  if (espconn_get_connection_info(conn, &remote, 0) != 0 || remote == NULL)
+    return;
+  os_memcpy(conn->proto.udp->remote_ip, remote->remote_ip, 4);
+  conn->proto.udp->remote_port = remote->remote_port;
+
+  wifi_get_macaddr(STATION_IF, mac);
+  cnt = os_sprintf(buf,
+      "{ \"name\": \"%s\", \"mac\": \"%02x:%02x:%02x:%02x:%02x:%02x\", \"version\": \"%s\", "
+      "\"path\": \"/propeller\", \"reset-pin\": %d, \"max-packet-size\": %d, "
+      "\"initial-baud\": %d, \"second-stage-baud\": %d, \"second-stage-bauds\": [",
+      flashConfig.hostname, mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], esp_link_version,
+      DEFAULT_RESET_PIN, MAX_PACKET_SIZE, cgiPropInitialBaudRate(), cgiPropSecondStageBaudRate());
+  for (i = 0; i < (int)(sizeof(secondStageBaudRates) / sizeof(secondStageBaudRates[0])); i++)
+    cnt += os_sprintf(buf + cnt, "%s%d", i > 0 ? ", " : "", secondStageBaudRates[i]);
+  cnt += os_sprintf(buf + cnt, "] }\n");
+
+  espconn_sent(conn, (uint8_t *)buf, cnt);
+}
+
+void ICACHE_FLASH_ATTR discoveryInit(void) {
+  os_memset(&discoveryConn, 0, sizeof(discoveryConn));
+  os_memset(&discoveryUdp, 0, sizeof(discoveryUdp));
+  discoveryUdp.local_port = DISCOVERY_PORT;
+  discoveryConn.type = ESPCONN_UDP;
+  discoveryConn.state = ESPCONN_NONE;
+  discoveryConn.proto.udp = &discoveryUdp;
+  espconn_regist_recvcb(&discoveryConn, discoveryRecvCb);
+  espconn_create(&discoveryConn);
+}
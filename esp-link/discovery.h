@@ -0,0 +1,9 @@
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+// UDP port espload broadcasts its discovery probes to
+#define DISCOVERY_PORT 2000
+
+void discoveryInit(void);
+
+#endif
@@ -32,6 +32,8 @@
 #include "gpio.h"
 #include "syslog.h"
 #include "cgiservices.h"
+#include "mdns.h"
+#include "discovery.h"
 
 #define NOTICE(format, ...) do {	                                          \
 	LOG_NOTICE(format, ## __VA_ARGS__ );                                      \
@@ -86,6 +88,7 @@ HttpdBuiltInUrl builtInUrls[] = {
   { "/propeller/load-begin", cgiPropLoadBegin, NULL },
   { "/propeller/load-data", cgiPropLoadData, NULL },
   { "/propeller/load-end", cgiPropLoadEnd, NULL },
+  { "/propeller/stats", cgiPropStats, NULL },
   { "/propeller/blink-fast", cgiPropBlinkFast, NULL },
   { "/propeller/blink-slow", cgiPropBlinkSlow, NULL },
   { "*", cgiEspFsHook, NULL }, //Catch-all cgi function for the filesystem
@@ -116,6 +119,8 @@ void user_rf_pre_init(void) {
 
 // Main routine to initialize esp-link.
 void user_init(void) {
+  // microsecond timers for the Propeller loader, this has to come before any timer is armed
+  system_timer_reinit();
   // get the flash config so we know how to init things
   //configWipe(); // uncomment to reset the config for testing purposes
   bool restoreOk = configRestore();
@@ -134,6 +139,12 @@ void user_init(void) {
   serledInit();
   // Wifi
   wifiInit();
+  // advertise the module and its loader with mDNS once it has an address
+  mdnsInit();
+  // the Propeller loader's remembered baud rates, discovery reports them
+  cgiPropInit();
+  // answer espload's discovery broadcasts (port 2000)
+  discoveryInit();
   // init the flash filesystem with the html stuff
   espFsInit(&_binary_espfs_img_start);
   //EspFsInitResult res = espFsInit(&_binary_espfs_img_start);
@@ -0,0 +1,56 @@
+// Advertise the module with mDNS as <hostname>.local and as an _esp-link._tcp service whose
+// TXT records describe the Propeller loader, so clients don't have to depend on site DNS
+
+#include <esp8266.h>
+#include "config.h"
+#include "cgiwifi.h"
+#include "proploader.h"
+#include "mdns.h"
+
+extern char *esp_link_version;
+
+static struct mdns_info mdnsInfo;
+static char txtVersion[96];
+static char txtMaxPacketSize[32];
+static char txtMac[24];
+static bool mdnsStarted = false;
+
+static void ICACHE_FLASH_ATTR mdnsWifiCb(uint8_t wifiStatus) {
+  struct ip_info ipInfo;
+  uint8_t mac[6];
+
+  // the responder has to be restarted with the new address each time we get one
+  if (mdnsStarted) {
+    espconn_mdns_close();
+    mdnsStarted = false;
+  }
+  if (wifiStatus != wifiGotIP || !wifi_get_ip_info(STATION_IF, &ipInfo) || ipInfo.ip.addr == 0)
+    return;
+
+  os_memset(&mdnsInfo, 0, sizeof(mdnsInfo));
+  mdnsInfo.host_name = flashConfig.hostname;
+  mdnsInfo.server_name = MDNS_SERVICE_NAME;
+  mdnsInfo.server_port = 80;
+  mdnsInfo.ipAddr = ipInfo.ip.addr;
+
+  // TXT records: what espload needs to know before the first load
+  os_sprintf(txtVersion, "version=%s", esp_link_version);
+  os_sprintf(txtMaxPacketSize, "max-packet-size=%d", MAX_PACKET_SIZE);
+  mdnsInfo.txt_data[0] = txtVersion;
+  mdnsInfo.txt_data[1] = txtMaxPacketSize;
+  mdnsInfo.txt_data[2] = "loader=propeller";
+  mdnsInfo.txt_data[3] = "path=/propeller";
+
+  // the MAC address keeps identifying the module in espload's registry when its address changes
+  wifi_get_macaddr(STATION_IF, mac);
+  os_sprintf(txtMac, "mac=%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+  mdnsInfo.txt_data[4] = txtMac;
+
+  espconn_mdns_init(&mdnsInfo);
+  mdnsStarted = true;
+  os_printf("mDNS: %s.local, _%s._tcp port 80\n", flashConfig.hostname, MDNS_SERVICE_NAME);
+}
+
+void ICACHE_FLASH_ATTR mdnsInit(void) {
+  wifiAddStateChangeCb(mdnsWifiCb);
+}
@@ -0,0 +1,9 @@
+#ifndef MDNS_H
+#define MDNS_H
+
+// DNS-SD service type advertised for loaders like espload to browse for
+#define MDNS_SERVICE_NAME "esp-link"
+
+void mdnsInit(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef __MDNS_H__
+#define __MDNS_H__
+
+#include "sock.h"
+#include "registry.h"
+
+/* multicast DNS group and port */
+#define MDNS_ADDRESS            "224.0.0.251"
+#define MDNS_PORT               5353
+
+/* DNS-SD service advertised by esp-link */
+#define MDNS_SERVICE            "_esp-link._tcp.local"
+
+/* milliseconds to wait for answers */
+#define MDNS_RESOLVE_TIMEOUT    500
+#define MDNS_BROWSE_TIMEOUT     1000
+
+int MdnsResolve(const char *hostName, SOCKADDR_IN *addr, int timeout, int *pTtl);
+int MdnsBrowse(ModuleRegistry *registry, int timeout);
+
+#endif
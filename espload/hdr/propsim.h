@@ -0,0 +1,67 @@
+#ifndef __PROPSIM_H__
+#define __PROPSIM_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* simulated Propeller: the ROM boot loader, the IP_Loader second stage and a UART timing model
+
+   Times are in microseconds on whatever clock the caller uses (real or virtual). Bytes from the
+   host are queued on the simulated serial line at the host's baud rate and processed at the time
+   their stop bit would arrive. Bytes the Propeller sends are handed to the transmit function once
+   the last of them has been sent.
+*/
+
+#define PROPSIM_RAM_SIZE        32768
+#define PROPSIM_VERSION         1           /* hardware version returned by the handshake */
+
+typedef enum {
+    psReset,            /* held in reset */
+    psRomCalibrate,     /* ROM waiting for the timing template */
+    psRomHandshake,     /* ROM checking the host's LFSR handshake */
+    psRomRxHandshake,   /* ROM sending its handshake and version */
+    psRomCommand,       /* ROM reading the command */
+    psRomLength,        /* ROM reading the image length */
+    psRomImage,         /* ROM reading the image */
+    psRomChecksum,      /* ROM answering checksum polls */
+    psRomProgram,       /* ROM programming the EEPROM */
+    psLoader,           /* second-stage loader receiving packets */
+    psLaunched,         /* running the loaded program */
+    psShutdown          /* stopped after an error or a shutdown command */
+} PropSimState;
+
+/* when each step of the last load finished (0 if it hasn't) */
+typedef struct {
+    uint64_t resetTime;         /* reset released */
+    uint64_t handshakeTime;     /* ROM handshake and version sent */
+    uint64_t romLoadTime;       /* ROM image checksum verified */
+    uint64_t loaderStartTime;   /* second-stage loader announced itself */
+    uint64_t dataTime;          /* last data packet acknowledged */
+    uint64_t launchTime;        /* program started */
+    int imageSize;              /* bytes of the program that was launched */
+    int packets;                /* second-stage packets received */
+    int retransmissions;        /* second-stage packets received more than once */
+    int framingErrors;          /* bytes garbled by a baud rate mismatch */
+} PropSimStats;
+
+typedef struct PropSim PropSim;
+typedef void PropSimTransmit(void *data, const uint8_t *buf, int len, int baudRate);
+typedef void PropSimEvent(void *data, uint64_t time, const char *message);
+
+PropSim *PropSimOpen(PropSimTransmit *transmit, PropSimEvent *event, void *data);
+void PropSimClose(PropSim *sim);
+void PropSimReset(PropSim *sim, uint64_t now, int level);
+void PropSimReceive(PropSim *sim, uint64_t now, const uint8_t *buf, int len, int baudRate);
+int64_t PropSimPoll(PropSim *sim, uint64_t now);
+PropSimState PropSimGetState(PropSim *sim);
+const PropSimStats *PropSimGetStats(PropSim *sim);
+int PropSimConvertBaud(const uint8_t *in, int len, int txBaud, int rxBaud, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef __REGISTRY_H__
+#define __REGISTRY_H__
+
+#include <time.h>
+
+/* name of the module registry file in the user's home directory */
+#define REGISTRY_FILE_NAME      ".espload-modules"
+
+/* seconds after a module was last seen that its address is still trusted */
+#define REGISTRY_TTL            (24 * 60 * 60)
+
+/* largest number of modules remembered */
+#define MAX_MODULES             64
+
+/* what is known about one module */
+typedef struct {
+    char name[32];              /* host name reported by the module (empty if unknown) */
+    char address[32];           /* IP address */
+    char mac[24];               /* station MAC address (empty if unknown) */
+    char version[96];           /* firmware version (empty if unknown) */
+    int resetPin;               /* pin the loader resets the Propeller with (-1 if unknown) */
+    int maxPacketSize;          /* largest load-data packet the loader accepts (0 if unknown) */
+    int secondStageBaud;        /* fastest second-stage baud rate the loader supports (0 if unknown) */
+    time_t lastSeen;            /* when the module last answered */
+    int ttl;                    /* seconds its address is trusted after that (0 for REGISTRY_TTL) */
+} ModuleEntry;
+
+typedef struct {
+    int count;
+    ModuleEntry entries[MAX_MODULES];
+} ModuleRegistry;
+
+int RegistryLoad(ModuleRegistry *registry);
+int RegistrySave(ModuleRegistry *registry);
+void RegistryUpdate(ModuleRegistry *registry, const ModuleEntry *entry);
+ModuleEntry *RegistryFind(ModuleRegistry *registry, const char *name);
+ModuleEntry *RegistryFindAddress(ModuleRegistry *registry, const char *address);
+int RegistryParseResponse(const char *response, const char *address, ModuleEntry *entry);
+
+#endif
@@ -14,10 +14,12 @@ typedef unsigned long in_addr_t;
 
 /* for linux and mac builds */
 #else
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <poll.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
@@ -44,6 +46,8 @@ const char *AddressToString(SOCKADDR_IN *addr);
 int OpenBroadcastSocket(short port, SOCKET *pSocket);
 int ConnectSocket(SOCKADDR_IN *addr, SOCKET *pSocket);
 int BindSocket(short port, SOCKET *pSocket);
+int OpenListenSocket(short port, SOCKET *pSocket);
+int AcceptSocket(SOCKET listenSock, SOCKET *pSocket, SOCKADDR_IN *addr);
 void CloseSocket(SOCKET sock);
 int SocketDataAvailableP(SOCKET sock, int timeout);
 int SendSocketData(SOCKET sock, void *buf, int len);
@@ -52,8 +56,51 @@ int ReceiveSocketDataAndAddress(SOCKET sock, void *buf, int len, SOCKADDR_IN *ad
 int ReceiveSocketDataTimeout(SOCKET sock, void *buf, int len, int timeout);
 int SendSocketDataTo(SOCKET sock, void *buf, int len, SOCKADDR_IN *addr);
 int ReceiveSocketDataFrom(SOCKET sock, void *buf, int len, SOCKADDR_IN *addr);
+
+/* datagrams sent or received per system call by the batch functions */
+#define SOCKET_BATCH_SIZE   64
+
+int SendSocketDataToMany(SOCKET sock, void *buf, int len, SOCKADDR_IN *addrs, int count);
+int ReceiveSocketDataBatch(SOCKET sock, uint8_t *bufs, int bufSize, int *lens, SOCKADDR_IN *addrs, int count);
 void SocketTerminal(SOCKET sock, int check_for_exit, int pst_mode);
 
+/* terminal settings and the statistics collected while it runs */
+typedef struct {
+    const char *captureFile;    /* timestamped copy of everything received (NULL for none) */
+    uint64_t bytesReceived;     /* bytes read from the socket */
+    uint64_t bytesWritten;      /* bytes written to stdout */
+    uint64_t bytesDropped;      /* bytes lost because stdout failed */
+    uint64_t stdoutBlockedTime; /* microseconds spent waiting for stdout */
+    uint64_t socketPausedTime;  /* microseconds the socket wasn't read because the buffer was full */
+    uint64_t elapsedTime;       /* microseconds the terminal ran */
+} TerminalOptions;
+
+void SocketTerminalWithOptions(SOCKET sock, int check_for_exit, int pst_mode, TerminalOptions *options);
+uint64_t GetTimeMicroseconds(void);
+
+/* socket event loop: epoll on linux, poll everywhere else */
+#define LOOP_READ       0x01
+#define LOOP_WRITE      0x02
+#define LOOP_ERROR      0x04
+
+typedef struct SocketLoop SocketLoop;
+typedef void SocketHandler(SocketLoop *loop, SOCKET sock, int events, void *data);
+typedef void TimerHandler(SocketLoop *loop, void *data);
+
+SocketLoop *OpenSocketLoop(void);
+void CloseSocketLoop(SocketLoop *loop);
+int WatchSocket(SocketLoop *loop, SOCKET sock, int events, SocketHandler *handler, void *data);
+int UnwatchSocket(SocketLoop *loop, SOCKET sock);
+int AddTimer(SocketLoop *loop, int timeout, TimerHandler *handler, void *data);
+void CancelTimer(SocketLoop *loop, int id);
+int RunSocketLoopOnce(SocketLoop *loop, int timeout);
+void RunSocketLoop(SocketLoop *loop);
+void StopSocketLoop(SocketLoop *loop);
+int WaitForSocket(SOCKET sock, int events, int timeout);
+int ConnectSocketAsync(SOCKADDR_IN *addr, SOCKET *pSocket);
+int GetSocketError(SOCKET sock);
+int SetSocketBlocking(SOCKET sock, int blocking);
+
 #ifdef __cplusplus
 }
 #endif
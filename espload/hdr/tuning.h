@@ -0,0 +1,28 @@
+#ifndef __TUNING_H__
+#define __TUNING_H__
+
+/* name of the per-host tuning cache file in the user's home directory */
+#define TUNING_CACHE_NAME       ".espload-cache"
+
+/* largest number of connections opened ahead of the request in progress */
+#define MAX_DEPTH               4
+
+/* a load must send at least this many data requests before its throughput is trusted */
+#define MIN_TUNING_REQUESTS     4
+
+/* learned load parameters for one module */
+typedef struct {
+    char address[32];           /* module IP address */
+    char version[96];           /* firmware version reported by load-begin */
+    int maxPacketSize;          /* largest packet the module accepts (0 if not yet known) */
+    int trial;                  /* next candidate to measure (NUM_CANDIDATES once tuned) */
+    int chunkSize;              /* best chunk size found so far */
+    int depth;                  /* best connection depth found so far */
+    int rate;                   /* best measured data throughput in bytes/second */
+} TuningEntry;
+
+void TuningLookup(const char *address, int defChunkSize, TuningEntry *entry);
+void TuningSelect(TuningEntry *entry, int *pChunkSize, int *pDepth);
+void TuningUpdate(TuningEntry *entry, const char *version, int maxPacketSize, int chunkSize, int depth, int requests, int rate);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/* milliseconds the file must be left alone before a change is reported */
+#define WATCH_DEBOUNCE_TIME     100
+
+/* milliseconds between checks when the file has to be polled */
+#define WATCH_POLL_INTERVAL     250
+
+/* state for watching one file for changes */
+typedef struct {
+    char path[512];
+    const char *name;           /* file name part of path */
+    int fd;                     /* inotify descriptor (-1 when polling) */
+    int wd;                     /* inotify watch on the file's directory */
+    time_t mtime;               /* file state when it was last looked at */
+    long size;
+    int pending;                /* a change has been seen but not reported yet */
+    uint64_t lastEventTime;     /* when the file was last seen changing */
+    uint64_t changeTime;        /* when the last write to the file finished */
+} FileWatch;
+
+int OpenFileWatch(FileWatch *watch, const char *path);
+int WaitForFileChange(FileWatch *watch, int timeout);
+void CloseFileWatch(FileWatch *watch);
+
+#endif
@@ -4,34 +4,85 @@
 #include <string.h>
 #include <errno.h>
 #include "sock.h"
+#include "tuning.h"
+#include "watch.h"
+#include "registry.h"
+#include "mdns.h"
 
 #define DEF_DISCOVER_PORT   2000
 #define DEF_RESET_PIN       12
 #define DEF_CHUNK_SIZE      1024
+#define DEF_TERMINAL_PORT   23
 #define MAX_CHUNK_SIZE      8192
 
 #define MAX_IF_ADDRS        10
+#define MAX_RESPONSE_SIZE   1024
 
-typedef int XbeeAddrList;
+#define SWEEP_RATE          5000    /* probes per second when sweeping a subnet */
+#define SWEEP_TIMEOUT       300     /* milliseconds to wait for responses after the last probe */
+#define MAX_SWEEP_HOSTS     65534   /* largest subnet swept (a /16) */
+#define SWEEP_SEND_WAIT     10      /* milliseconds to wait for room to send when the socket is full */
+#define SWEEP_SEND_RETRIES  10      /* waits for room before the host is skipped */
+
+#define RESPONSE_TIMEOUT    10000   /* milliseconds to wait for load-begin and load-end */
+#define DATA_TIMEOUT        1000    /* milliseconds to wait for a load-data response */
+#define RETRY_WINDOW        1800    /* milliseconds after the last ack that the loader still waits for data */
+#define MAX_DATA_RETRIES    3
+#define WARM_REFRESH        5000    /* milliseconds before the idle connection kept for watch mode is replaced */
+#define EARLY_WAIT_TIMEOUT  25000   /* milliseconds to wait for the build in an early load, inside the module's 30 seconds */
+#define MAX_IMAGE_SIZE      32768
+
+/* connections opened ahead of the request in progress to hide the connect time */
+typedef struct {
+    SOCKADDR_IN addr;
+    int depth;
+    int count;
+    SOCKET socks[MAX_DEPTH];
+} ConnectionPool;
 
 int chunkSize = DEF_CHUNK_SIZE;
+int chunkSizeSet = 0;
 int resetPin = DEF_RESET_PIN;
+int resetPinSet = 0;
 int verbose = 0;
+int timingMode = 0;
+int terminalMode = 0;
+int earlyMode = 0;
+int skipUnchanged = 0;
+const char *captureFile = NULL;
 
-int load(const char *ipAddr, const char *fileName, const char *cmd);
-int sendRequest(SOCKADDR_IN *addr, uint8_t *req, int reqSize, uint8_t *res, int resMax, int *pResult);
+int load(SOCKADDR_IN *addr, const char *fileName, const char *cmd, SOCKET *pTerminalSock, SOCKET *pWarmSock);
+int watch(SOCKADDR_IN *addr, const char *fileName, const char *cmd);
+int imageComplete(const char *fileName);
+uint8_t *readImage(const char *fileName, int *pSize);
+int waitForImage(FileWatch *fileWatch, const char *fileName);
+int openTerminal(SOCKADDR_IN *addr, SOCKET *pSock);
+void terminal(SOCKET sock);
+int sendRequest(ConnectionPool *pool, uint8_t *req, int reqSize, uint8_t *res, int resMax, int *pResult, int timeout);
+int getResponseValue(const uint8_t *res, const char *name, char *value, int valueMax);
+void poolInit(ConnectionPool *pool, SOCKADDR_IN *addr, int depth);
+int poolGet(ConnectionPool *pool, SOCKET *pSocket);
+void poolFill(ConnectionPool *pool);
+void poolClose(ConnectionPool *pool);
 void dumpHdr(const uint8_t *buf, int size);
 void dumpResponse(const uint8_t *buf, int size);
-int discover(XbeeAddrList &addrs, int timeout);
-int discover1(IFADDR *ifaddr, XbeeAddrList &addrs, int timeout);
+int resolveModule(const char *name, SOCKADDR_IN *addr);
+int discover(ModuleRegistry *registry, int timeout, int sweep);
+int discover1(IFADDR *ifaddr, ModuleRegistry *registry, int timeout);
+int discoverSweep(IFADDR *ifaddr, ModuleRegistry *registry, int timeout);
 void Usage();
 
 int main(int argc, char *argv[])
 {
-    XbeeAddrList addrs;
+    ModuleRegistry registry;
     char *infile = NULL;
     char *ipaddr = NULL;
     const char *cmd = "run";
+    SOCKET terminalSock;
+    SOCKADDR_IN addr;
+    int watchMode = 0;
+    int sweepMode = 0;
+    int mdnsMode = 0;
     int ret, i;
 
     /* get the arguments */
@@ -40,6 +91,9 @@ int main(int argc, char *argv[])
         /* handle switches */
         if (argv[i][0] == '-') {
             switch(argv[i][1]) {
+            case 'b':
+                earlyMode = 1;
+                break;
             case 'c':
                 if (argv[i][2])
                     chunkSize = atoi(&argv[i][2]);
@@ -51,6 +105,7 @@ int main(int argc, char *argv[])
                     printf("error: chunk size must be between 1 and %d\n", MAX_CHUNK_SIZE);
                     return 1;
                 }
+                chunkSizeSet = 1;
                 break;
             case 'e':
                 cmd = "program-and-run";
@@ -63,6 +118,20 @@ int main(int argc, char *argv[])
                 else
                     Usage();
                 break;
+            case 'l':
+                if (argv[i][2])
+                    captureFile = &argv[i][2];
+                else if (++i < argc)
+                    captureFile = argv[i];
+                else
+                    Usage();
+                break;
+            case 'm':
+                mdnsMode = 1;
+                break;
+            case 'p':
+                timingMode = 1;
+                break;
             case 'r':
                 if (argv[i][2])
                     resetPin = atoi(&argv[i][2]);
@@ -70,10 +139,23 @@ int main(int argc, char *argv[])
                     resetPin = atoi(argv[i]);
                 else
                     Usage();
+                resetPinSet = 1;
+                break;
+            case 's':
+                sweepMode = 1;
+                break;
+            case 't':
+                terminalMode = 1;
+                break;
+            case 'u':
+                skipUnchanged = 1;
                 break;
             case 'v':
                 verbose = 1;
                 break;
+            case 'w':
+                watchMode = 1;
+                break;
             case '?':
                 /* fall through */
             default:
@@ -95,15 +177,40 @@ int main(int argc, char *argv[])
             printf("error: must specify IP address or host name with -i\n");
             return 1;
         }
-        if (load(ipaddr, infile, cmd) < 0)
+        if (resolveModule(ipaddr, &addr) != 0) {
+            printf("error: invalid host name or IP address '%s'\n", ipaddr);
             return 1;
+        }
+        if (watchMode && earlyMode) {
+            printf("error: -b and -w can't be used together\n");
+            return 1;
+        }
+        if (watchMode) {
+            if (watch(&addr, infile, cmd) < 0)
+                return 1;
+        }
+        else {
+            if (load(&addr, infile, cmd, terminalMode ? &terminalSock : NULL, NULL) < 0)
+                return 1;
+            if (terminalMode)
+                terminal(terminalSock);
+        }
     }
     
     else {
-        if ((ret = discover(addrs, 2000)) < 0) {
+        /* keep the modules that don't answer this time until they expire */
+        RegistryLoad(&registry);
+        if (mdnsMode) {
+            if ((ret = MdnsBrowse(&registry, MDNS_BROWSE_TIMEOUT)) < 0) {
+                printf("error: mDNS browse failed: %d\n", ret);
+                return 1;
+            }
+        }
+        else if ((ret = discover(&registry, sweepMode ? SWEEP_TIMEOUT : 2000, sweepMode)) < 0) {
             printf("error: discover failed: %d\n", ret);
             return 1;
         }
+        RegistrySave(&registry);
     }
     
     return 0;
@@ -113,146 +220,572 @@ void Usage()
 {
     printf("\
 usage: espload\n\
-         [ -c <size> ]     chunk size (default is %d)\n\
+         [ -b ]            begin the load now and send the file once the build has rewritten it\n\
+         [ -c <size> ]     chunk size (default is tuned per module, starting at %d)\n\
          [ -e ]            write program to the EEPROM\n\
-         [ -i <addr> ]     IP address or host name of module to load\n\
-         [ -r <pin> ]      pin to use for resetting the Propeller (default is %d)\n\
+         [ -i <addr> ]     IP address, host name, <name>.local or discovered name of module to load\n\
+                           (append :<port> to use a server like mockesp)\n\
+         [ -l <file> ]     write a timestamped copy of the terminal output to a file\n\
+         [ -m ]            discover by browsing for the esp-link mDNS service\n\
+         [ -p ]            show how long each phase of the load took\n\
+         [ -r <pin> ]      pin to use for resetting the Propeller (default is the module's, else %d)\n\
+         [ -s ]            discover by probing every address in each subnet instead of broadcasting\n\
+         [ -t ]            enter terminal mode after loading (ESC to exit)\n\
+         [ -u ]            with -e, leave the EEPROM alone if the module last wrote this program\n\
          [ -v ]            display verbose debugging output\n\
+         [ -w ]            keep running and reload the file each time it changes\n\
          [ <name> ]        file to load (discover modules if not given)\n", DEF_CHUNK_SIZE, DEF_RESET_PIN);
     exit(1);
 }
 
-int load(const char *hostName, const char *fileName, const char *cmd)
+int load(SOCKADDR_IN *addr, const char *fileName, const char *cmd, SOCKET *pTerminalSock, SOCKET *pWarmSock)
 {
-    uint8_t buffer[MAX_CHUNK_SIZE], *p;
-    int imageSize, remaining, result, cnt;
-    SOCKADDR_IN addr;
-    uint8_t *image;
-    FILE *fp;
-    
-    if (GetInternetAddress(hostName, 80, &addr) != 0) {
-        printf("error: invalid host name or IP address '%s'\n", hostName);
-        return -1;
+    uint8_t buffer[MAX_CHUNK_SIZE + 256];
+    int imageSize, offset, ackOffset, retries, result, cnt, ret;
+    int loadChunkSize, depth, maxPacketSize, requests, loadResetPin;
+    char version[sizeof(((TuningEntry *)0)->version)], value[32], path[16];
+    uint64_t loadStart, dataStart, dataTime, endStart, requestTime, rttTotal, lastAckTime, beginEnd, readyTime;
+    FileWatch fileWatch;
+    ConnectionPool pool;
+    TuningEntry tuning;
+    ModuleRegistry registry;
+    ModuleEntry *module;
+    uint8_t *image = NULL;
+
+    /* an early load reads the file once the build has written it, watching from before load-begin
+       so a build that finishes while the loader boots isn't missed */
+    imageSize = 0;
+    if (earlyMode) {
+        if (OpenFileWatch(&fileWatch, fileName) != 0) {
+            printf("error: can't watch '%s'\n", fileName);
+            return -1;
+        }
     }
-    
-    /* open the image file */
-    if (!(fp = fopen(fileName, "rb"))) {
-        printf("error: can't open '%s'\n", fileName);
+    else if (!(image = readImage(fileName, &imageSize)))
         return -1;
-    }
-    
-    /* get the size of the binary file */
-    fseek(fp, 0, SEEK_END);
-    imageSize = (int)ftell(fp);
-    fseek(fp, 0, SEEK_SET);
 
-    /* allocate space for the file */
-    if (!(image = (uint8_t *)malloc(imageSize)))
-        return -1;
+    /* pick the load parameters learned from previous loads unless the user chose a chunk size */
+    TuningLookup(AddressToString(addr), DEF_CHUNK_SIZE, &tuning);
 
-    /* read the entire image into memory */
-    if ((int)fread(image, 1, imageSize, fp) != imageSize) {
-        free(image);
-        return -1;
+    /* a module that described its loader when it was discovered needs no guessing */
+    loadResetPin = resetPin;
+    RegistryLoad(&registry);
+    if ((module = RegistryFindAddress(&registry, AddressToString(addr))) != NULL) {
+        if (!resetPinSet && module->resetPin >= 0)
+            loadResetPin = module->resetPin;
+        if (tuning.maxPacketSize <= 0 && module->maxPacketSize > 0)
+            tuning.maxPacketSize = module->maxPacketSize;
+        if (verbose)
+            printf("from discovery: reset pin %d, max packet size %d, second-stage baud %d\n",
+                   module->resetPin, module->maxPacketSize, module->secondStageBaud);
     }
-    
-    /* close the file */
-    fclose(fp);
+    if (chunkSizeSet) {
+        loadChunkSize = chunkSize;
+        depth = 1;
+    }
+    else
+        TuningSelect(&tuning, &loadChunkSize, &depth);
+    if (verbose)
+        printf("chunk size %d, connection depth %d\n", loadChunkSize, depth);
+    poolInit(&pool, addr, depth);
 
+    /* start with the connection watch mode kept open */
+    if (pWarmSock && *pWarmSock != INVALID_SOCKET) {
+        pool.socks[pool.count++] = *pWarmSock;
+        *pWarmSock = INVALID_SOCKET;
+    }
+
+    loadStart = GetTimeMicroseconds();
     cnt = snprintf((char *)buffer, sizeof(buffer), "\
-POST /propeller/load-begin?image-size=%d&reset-pin=%d HTTP/1.1\r\n\
-\r\n", imageSize, resetPin);
-    
-    if ((cnt = sendRequest(&addr, buffer, cnt, buffer, sizeof(buffer), &result)) == -1) {
+POST /propeller/load-begin?reset-pin=%d&packet-size=%d&command=%s", loadResetPin, loadChunkSize, cmd);
+    /* without image-size the module boots a loader that takes up to a full RAM and waits for the build */
+    if (!earlyMode)
+        cnt += snprintf((char *)buffer + cnt, sizeof(buffer) - cnt, "&image-size=%d", imageSize);
+    /* the loader can run at the image's own clock, the first five bytes are clkfreq and clkmode */
+    if (imageSize >= 5)
+        cnt += snprintf((char *)buffer + cnt, sizeof(buffer) - cnt, "&clock-freq=%u&clock-mode=%d",
+                        (unsigned)(image[0] | image[1] << 8 | image[2] << 16 | (uint32_t)image[3] << 24), image[4]);
+    /* the baud rates are left to the module, it remembers the fastest its line has taken */
+    cnt += snprintf((char *)buffer + cnt, sizeof(buffer) - cnt, " HTTP/1.1\r\n\
+\r\n");
+
+    if ((cnt = sendRequest(&pool, buffer, cnt, buffer, sizeof(buffer), &result, RESPONSE_TIMEOUT)) == -1) {
         printf("error: load-begin request failed\n");
+        poolClose(&pool);
+        if (earlyMode)
+            CloseFileWatch(&fileWatch);
+        free(image);
         return -1;
     }
     else if (result != 200) {
         printf("error: load-begin returned %d\n", result);
+        poolClose(&pool);
+        if (earlyMode)
+            CloseFileWatch(&fileWatch);
+        free(image);
         return -1;
     }
-    
-    p = image;
-    remaining = imageSize;
-    while (remaining > 0) {
+
+    beginEnd = GetTimeMicroseconds();
+
+    /* older firmware doesn't report what it supports */
+    if (getResponseValue(buffer, "max-packet-size", value, sizeof(value)) == 0)
+        maxPacketSize = atoi(value);
+    else
+        maxPacketSize = 0;
+    if (getResponseValue(buffer, "version", version, sizeof(version)) != 0)
+        version[0] = '\0';
+    /* small images may go straight to the ROM rather than through the second-stage loader */
+    if (getResponseValue(buffer, "path", path, sizeof(path)) != 0)
+        strcpy(path, "loader");
+    if (verbose)
+        printf("load-begin: loading through the %s\n", strcmp(path, "rom") == 0 ? "ROM" : "second-stage loader");
+
+    /* the loader is up, now wait for the image it's to load */
+    if (earlyMode) {
+        /* the spare connections would go stale while the build runs */
+        poolClose(&pool);
+        poolInit(&pool, addr, depth);
+        ret = waitForImage(&fileWatch, fileName);
+        CloseFileWatch(&fileWatch);
+        if (ret != 0 || !(image = readImage(fileName, &imageSize))) {
+            poolClose(&pool);
+            return -1;
+        }
+        if (imageSize > MAX_IMAGE_SIZE) {
+            printf("error: '%s' is larger than the Propeller's RAM\n", fileName);
+            poolClose(&pool);
+            free(image);
+            return -1;
+        }
+    }
+    readyTime = GetTimeMicroseconds();
+
+    offset = 0;
+    retries = 0;
+    requests = 0;
+    rttTotal = 0;
+    dataStart = lastAckTime = readyTime;
+    while (offset < imageSize) {
         int hdrCnt;
-        if ((cnt = remaining) > chunkSize)
-            cnt = chunkSize;
+        if ((cnt = imageSize - offset) > loadChunkSize)
+            cnt = loadChunkSize;
         hdrCnt = snprintf((char *)buffer, sizeof(buffer), "\
-POST /propeller/load-data HTTP/1.1\r\n\
+POST /propeller/load-data?offset=%d HTTP/1.1\r\n\
 Content-Length: %d\r\n\
-\r\n", cnt);
-        memcpy(&buffer[hdrCnt], p, cnt);
-        if (sendRequest(&addr, buffer, hdrCnt + cnt, buffer, sizeof(buffer), &result) == -1) {
-            printf("error: load-data request failed\n");
-            return -1;
+\r\n", offset, cnt);
+        memcpy(&buffer[hdrCnt], &image[offset], cnt);
+        requestTime = GetTimeMicroseconds();
+        ret = sendRequest(&pool, buffer, hdrCnt + cnt, buffer, sizeof(buffer), &result, DATA_TIMEOUT);
+
+        /* the module reports how much it has so we can resume from there */
+        if (ret != -1 && getResponseValue(buffer, "bytes-loaded", value, sizeof(value)) == 0)
+            ackOffset = atoi(value);
+        else
+            ackOffset = -1;
+
+        if (ret != -1 && result == 200) {
+            rttTotal += GetTimeMicroseconds() - requestTime;
+            ++requests;
+            offset = ackOffset >= 0 ? ackOffset : offset + cnt;
+            lastAckTime = GetTimeMicroseconds();
+            retries = 0;
         }
-        else if (result != 200) {
-            printf("error: load-data returned %d\n", result);
+
+        /* retry while the second-stage loader is still waiting for data */
+        else if ((ret == -1 || ackOffset >= 0)
+              && ++retries <= MAX_DATA_RETRIES
+              && GetTimeMicroseconds() - lastAckTime < RETRY_WINDOW * 1000) {
+            if (ackOffset >= 0)
+                offset = ackOffset;
+            if (verbose)
+                printf("load-data failed, resuming at offset %d\n", offset);
+
+            /* connections opened before the failure may be dead too */
+            poolClose(&pool);
+        }
+
+        else {
+            if (ret == -1)
+                printf("error: load-data request failed\n");
+            else
+                printf("error: load-data returned %d\n", result);
+            poolClose(&pool);
+            free(image);
             return -1;
         }
-        p += cnt;
-        remaining -= cnt;
     }
-        
+    dataTime = GetTimeMicroseconds() - dataStart;
+
+    /* the spare connections would only sit idle during load-end */
+    poolClose(&pool);
+    poolInit(&pool, addr, 1);
+    free(image);
+
+    /* attach to the serial bridge before the launch so none of the program's output is lost */
+    if (pTerminalSock && openTerminal(addr, pTerminalSock) != 0)
+        return -1;
+
+    endStart = GetTimeMicroseconds();
     cnt = snprintf((char *)buffer, sizeof(buffer), "\
-POST /propeller/load-end?command=%s HTTP/1.1\r\n\
-\r\n", cmd);
-    
-    if (sendRequest(&addr, buffer, cnt, buffer, sizeof(buffer), &result) == -1) {
+POST /propeller/load-end?command=%s%s HTTP/1.1\r\n\
+\r\n", cmd, skipUnchanged ? "&skip-unchanged=1" : "");
+
+    if (sendRequest(&pool, buffer, cnt, buffer, sizeof(buffer), &result, RESPONSE_TIMEOUT) == -1) {
         printf("error: load-end request failed\n");
+        if (pTerminalSock)
+            CloseSocket(*pTerminalSock);
         return -1;
     }
     else if (result != 200) {
         printf("error: load-end returned %d\n", result);
+        if (pTerminalSock)
+            CloseSocket(*pTerminalSock);
         return -1;
     }
-    
+
+    /* a program command reports whether the EEPROM was written, skipping it on the module's
+       remembered hash of the last image it programmed rather than a read of the EEPROM */
+    if (getResponseValue(buffer, "eeprom-skipped", value, sizeof(value)) == 0 && atoi(value) > 0)
+        printf("the program matches the last one the module wrote to the EEPROM, left it alone\n");
+
+    /* load-end covers the checksum wait and, for program-and-run, the EEPROM write */
+    if (timingMode) {
+        uint64_t now = GetTimeMicroseconds();
+        printf("timing: %d bytes, begin %d ms, data %d ms, end %d ms, total %d ms, path %s", imageSize,
+               (int)((beginEnd - loadStart) / 1000), (int)(dataTime / 1000),
+               (int)((now - endStart) / 1000), (int)((now - (earlyMode ? readyTime : loadStart)) / 1000), path);
+        /* the loader booted while the build ran, so an early load's total starts when the image was ready */
+        if (earlyMode)
+            printf(", ready %d ms after begin", (int)((readyTime - loadStart) / 1000));
+        printf("\n");
+    }
+
+    /* remember how this load went so later loads start at the optimum */
+    if (maxPacketSize > 0 && requests > 0) {
+        int rate = dataTime > 0 ? (int)((uint64_t)imageSize * 1000000 / dataTime) : 0;
+        int rtt = (int)(rttTotal / requests);
+        if (verbose)
+            printf("data: %d bytes in %d requests, %d bytes/sec, average round trip %d usec\n", imageSize, requests, rate, rtt);
+        if (!chunkSizeSet)
+            TuningUpdate(&tuning, version, maxPacketSize, loadChunkSize, depth, requests, rate);
+    }
+
     return 0;
 }
 
-// should try:
-// Connection: keep-alive
+/* watch - reload the file each time a complete new image is written */
+int watch(SOCKADDR_IN *addr, const char *fileName, const char *cmd)
+{
+    SOCKET warmSock = INVALID_SOCKET;
+    uint64_t warmTime = 0, now;
+    FileWatch fileWatch;
+    int ret;
 
-int sendRequest(SOCKADDR_IN *addr, uint8_t *req, int reqSize, uint8_t *res, int resMax, int *pResult)
+    if (OpenFileWatch(&fileWatch, fileName) != 0) {
+        printf("error: can't watch '%s'\n", fileName);
+        return -1;
+    }
+    printf("watching '%s', type Ctrl-C to exit\n", fileName);
+    fflush(stdout);
+
+    for (;;) {
+
+        /* keep a connection open for the next load-begin, replacing it before the module times it out */
+        now = GetTimeMicroseconds();
+        if (warmSock != INVALID_SOCKET && (now - warmTime >= (uint64_t)WARM_REFRESH * 1000 || WaitForSocket(warmSock, LOOP_READ, 0) != 0)) {
+            CloseSocket(warmSock);
+            warmSock = INVALID_SOCKET;
+        }
+        if (warmSock == INVALID_SOCKET) {
+            if (ConnectSocket(addr, &warmSock) != 0)
+                warmSock = INVALID_SOCKET;
+            warmTime = GetTimeMicroseconds();
+        }
+
+        if ((ret = WaitForFileChange(&fileWatch, WARM_REFRESH)) < 0) {
+            printf("error: watching '%s' failed\n", fileName);
+            break;
+        }
+        else if (ret == 0)
+            continue;
+
+        /* the compiler may still be writing the file */
+        if (!imageComplete(fileName)) {
+            if (verbose)
+                printf("'%s' isn't a complete image yet\n", fileName);
+            continue;
+        }
+
+        /* a closed connection would cost a failed load-begin */
+        if (warmSock != INVALID_SOCKET && WaitForSocket(warmSock, LOOP_READ, 0) != 0) {
+            CloseSocket(warmSock);
+            warmSock = INVALID_SOCKET;
+        }
+
+        if (load(addr, fileName, cmd, NULL, &warmSock) == 0) {
+            now = GetTimeMicroseconds();
+            printf("loaded '%s', %.3f seconds from file close to launch\n", fileName,
+                   (now - (fileWatch.changeTime ? fileWatch.changeTime : now)) / 1000000.0);
+        }
+        fflush(stdout);
+    }
+
+    if (warmSock != INVALID_SOCKET)
+        CloseSocket(warmSock);
+    CloseFileWatch(&fileWatch);
+
+    return -1;
+}
+
+/* readImage - read a whole image file into memory */
+uint8_t *readImage(const char *fileName, int *pSize)
+{
+    uint8_t *image;
+    FILE *fp;
+
+    /* open the image file */
+    if (!(fp = fopen(fileName, "rb"))) {
+        printf("error: can't open '%s'\n", fileName);
+        return NULL;
+    }
+
+    /* get the size of the binary file */
+    fseek(fp, 0, SEEK_END);
+    *pSize = (int)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    /* allocate space for the file */
+    if (!(image = (uint8_t *)malloc(*pSize))) {
+        fclose(fp);
+        return NULL;
+    }
+
+    /* read the entire image into memory */
+    if ((int)fread(image, 1, *pSize, fp) != *pSize) {
+        fclose(fp);
+        free(image);
+        return NULL;
+    }
+
+    /* close the file */
+    fclose(fp);
+    return image;
+}
+
+/* waitForImage - wait for the build to write a complete new image */
+int waitForImage(FileWatch *fileWatch, const char *fileName)
+{
+    uint64_t deadline = GetTimeMicroseconds() + (uint64_t)EARLY_WAIT_TIMEOUT * 1000;
+    int ret;
+
+    if (verbose)
+        printf("waiting for '%s' to be built\n", fileName);
+
+    for (;;) {
+        uint64_t now = GetTimeMicroseconds();
+        if (now >= deadline) {
+            printf("error: '%s' wasn't built in time\n", fileName);
+            ret = -1;
+            break;
+        }
+        if ((ret = WaitForFileChange(fileWatch, (int)((deadline - now + 999) / 1000))) < 0) {
+            printf("error: watching '%s' failed\n", fileName);
+            break;
+        }
+        /* the compiler may still be writing the file */
+        if (ret > 0 && imageComplete(fileName)) {
+            ret = 0;
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/* imageComplete - check the size and checksum of a Propeller image */
+int imageComplete(const char *fileName)
+{
+    uint8_t buf[1024];
+    int size, vbase, sum, cnt, i;
+    FILE *fp;
+
+    if (!(fp = fopen(fileName, "rb")))
+        return 0;
+
+    /* the image must contain everything up to the start of variable space */
+    if ((cnt = (int)fread(buf, 1, sizeof(buf), fp)) < 16) {
+        fclose(fp);
+        return 0;
+    }
+    vbase = buf[8] | (buf[9] << 8);
+    if (vbase < 16) {
+        fclose(fp);
+        return 0;
+    }
+
+    /* the bytes up to vbase plus the initial call frame sum to zero */
+    sum = 0xEC;
+    size = 0;
+    do {
+        for (i = 0; i < cnt && size < vbase; ++i, ++size)
+            sum += buf[i];
+    } while (size < vbase && (cnt = (int)fread(buf, 1, sizeof(buf), fp)) > 0);
+    fclose(fp);
+
+    return size == vbase && (sum & 0xff) == 0;
+}
+
+int openTerminal(SOCKADDR_IN *addr, SOCKET *pSock)
+{
+    SOCKADDR_IN terminalAddr = *addr;
+
+    terminalAddr.sin_port = htons(DEF_TERMINAL_PORT);
+    if (ConnectSocket(&terminalAddr, pSock) != 0) {
+        printf("error: can't connect to the serial port of '%s'\n", AddressToString(addr));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* terminal - show the output of the program, starting with anything that arrived during load-end */
+void terminal(SOCKET sock)
+{
+    TerminalOptions options;
+
+    printf("[ Entering terminal mode. Type ESC to exit. ]\n");
+    fflush(stdout);
+
+    memset(&options, 0, sizeof(options));
+    options.captureFile = captureFile;
+    SocketTerminalWithOptions(sock, 0, 0, &options);
+    CloseSocket(sock);
+
+    if (verbose) {
+        double seconds = options.elapsedTime / 1000000.0;
+        printf("\nterminal: %llu bytes received, %llu written, %llu dropped in %.3f seconds (%.0f bytes/sec)\n",
+               (unsigned long long)options.bytesReceived,
+               (unsigned long long)options.bytesWritten,
+               (unsigned long long)options.bytesDropped,
+               seconds,
+               seconds > 0 ? options.bytesReceived / seconds : 0.0);
+        printf("terminal: stdout blocked %.3f seconds, socket paused %.3f seconds\n",
+               options.stdoutBlockedTime / 1000000.0,
+               options.socketPausedTime / 1000000.0);
+    }
+}
+
+int sendRequest(ConnectionPool *pool, uint8_t *req, int reqSize, uint8_t *res, int resMax, int *pResult, int timeout)
 {
     char buf[80];
     SOCKET sock;
-    int cnt;
-    
-    if (ConnectSocket(addr, &sock) != 0) {
+    int cnt, n;
+
+    if (poolGet(pool, &sock) != 0) {
         printf("error: connect failed\n");
         return -1;
     }
-    
+
     if (verbose) {
         printf("REQ:\n");
         dumpHdr(req, reqSize);
     }
-    
+
     if (SendSocketData(sock, req, reqSize) != reqSize) {
         printf("error: send request failed\n");
+        CloseSocket(sock);
         return -1;
     }
-    
-    if ((cnt = ReceiveSocketDataTimeout(sock, res, resMax, 10000)) == -1) {
+
+    /* open the connections for the next requests while the module works on this one */
+    poolFill(pool);
+
+    /* the module closes the connection after the response */
+    cnt = 0;
+    while (cnt < resMax - 1 && (n = ReceiveSocketDataTimeout(sock, res + cnt, resMax - 1 - cnt, timeout)) > 0)
+        cnt += n;
+    if (cnt == 0) {
         printf("error: receive response failed\n");
+        CloseSocket(sock);
         return -1;
     }
-    
+    res[cnt] = '\0';
+
     if (verbose) {
         printf("RES:\n");
         dumpResponse(res, cnt);
     }
-    
+
+    CloseSocket(sock);
+
     if (sscanf((char *)res, "%s %d", buf, pResult) != 2)
         return -1;
-        
-    CloseSocket(sock);
-    
+
     return cnt;
 }
-    
+
+/* getResponseValue - find a 'name=value' line in the body of a response */
+int getResponseValue(const uint8_t *res, const char *name, char *value, int valueMax)
+{
+    const char *p = strstr((const char *)res, "\r\n\r\n");
+    int len = strlen(name);
+
+    if (!p)
+        return -1;
+
+    for (p += 4; *p; p += strcspn(p, "\n"), p += (*p == '\n')) {
+        if (strncmp(p, name, len) == 0 && p[len] == '=') {
+            int cnt = strcspn(p += len + 1, "\r\n");
+            if (cnt >= valueMax)
+                cnt = valueMax - 1;
+            memcpy(value, p, cnt);
+            value[cnt] = '\0';
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+void poolInit(ConnectionPool *pool, SOCKADDR_IN *addr, int depth)
+{
+    pool->addr = *addr;
+    pool->depth = depth < 1 ? 1 : depth > MAX_DEPTH ? MAX_DEPTH : depth;
+    pool->count = 0;
+}
+
+int poolGet(ConnectionPool *pool, SOCKET *pSocket)
+{
+    int i;
+
+    /* use the oldest connection that's already open */
+    if (pool->count > 0) {
+        *pSocket = pool->socks[0];
+        for (i = 1; i < pool->count; ++i)
+            pool->socks[i - 1] = pool->socks[i];
+        --pool->count;
+        return 0;
+    }
+
+    return ConnectSocket(&pool->addr, pSocket);
+}
+
+void poolFill(ConnectionPool *pool)
+{
+    while (pool->count < pool->depth - 1) {
+        if (ConnectSocket(&pool->addr, &pool->socks[pool->count]) != 0)
+            break;
+        ++pool->count;
+    }
+}
+
+void poolClose(ConnectionPool *pool)
+{
+    while (pool->count > 0)
+        CloseSocket(pool->socks[--pool->count]);
+}
+
 void dumpHdr(const uint8_t *buf, int size)
 {
     bool startOfLine = true;
@@ -285,7 +818,60 @@ void dumpResponse(const uint8_t *buf, int size)
     }
 }
 
-int discover(XbeeAddrList &addrs, int timeout)
+/* resolveModule - look up a module found by discovery, then ask mDNS for .local names, then try DNS */
+int resolveModule(const char *name, SOCKADDR_IN *addr)
+{
+    char shortName[sizeof(((ModuleEntry *)0)->name)];
+    ModuleRegistry registry;
+    ModuleEntry *entry;
+    const char *p;
+    int len = strlen(name), ttl;
+
+    /* an explicit port means a stand-in like mockesp, not a module to look up */
+    if ((p = strrchr(name, ':')) != NULL && p[1] && strspn(p + 1, "0123456789") == strlen(p + 1)) {
+        char host[256];
+        snprintf(host, sizeof(host), "%.*s", (int)(p - name), name);
+        return GetInternetAddress(host, (short)atoi(p + 1), addr);
+    }
+
+    /* the registry knows modules by their host name without the .local domain */
+    snprintf(shortName, sizeof(shortName), "%s", name);
+    if (len > 6 && strcasecmp(&name[len - 6], ".local") == 0 && len - 6 < (int)sizeof(shortName))
+        shortName[len - 6] = '\0';
+    else
+        len = 0;
+
+    RegistryLoad(&registry);
+    if ((entry = RegistryFind(&registry, shortName)) != NULL) {
+        if (verbose)
+            printf("'%s' is %s from the registry\n", name, entry->address);
+        return GetInternetAddress(entry->address, 80, addr);
+    }
+
+    /* remember the answer so the next load doesn't have to wait for it */
+    if (len > 0 && MdnsResolve(name, addr, MDNS_RESOLVE_TIMEOUT, &ttl) == 0) {
+        ModuleEntry newEntry;
+        int i;
+        if (verbose)
+            printf("'%s' is %s from mDNS\n", name, AddressToString(addr));
+        memset(&newEntry, 0, sizeof(newEntry));
+        newEntry.resetPin = -1;
+        for (i = 0; i < registry.count; ++i)
+            if (strcmp(registry.entries[i].address, AddressToString(addr)) == 0)
+                newEntry = registry.entries[i];
+        snprintf(newEntry.name, sizeof(newEntry.name), "%s", shortName);
+        snprintf(newEntry.address, sizeof(newEntry.address), "%s", AddressToString(addr));
+        newEntry.lastSeen = time(NULL);
+        newEntry.ttl = ttl > 0 ? ttl : 1;
+        RegistryUpdate(&registry, &newEntry);
+        RegistrySave(&registry);
+        return 0;
+    }
+
+    return GetInternetAddress(name, 80, addr);
+}
+
+int discover(ModuleRegistry *registry, int timeout, int sweep)
 {
     IFADDR ifaddrs[MAX_IF_ADDRS];
     int cnt, i;
@@ -295,19 +881,20 @@ int discover(XbeeAddrList &addrs, int timeout)
     
     for (i = 0; i < cnt; ++i) {
         int ret;
-        if ((ret = discover1(&ifaddrs[i], addrs, timeout)) < 0)
+        if ((ret = sweep ? discoverSweep(&ifaddrs[i], registry, timeout) : discover1(&ifaddrs[i], registry, timeout)) < 0)
             return ret;
     }
     
     return 0;
 }
 
-int discover1(IFADDR *ifaddr, XbeeAddrList &addrs, int timeout)
+int discover1(IFADDR *ifaddr, ModuleRegistry *registry, int timeout)
 {
     uint8_t txBuf[1024]; // BUG: get rid of this magic number!
     uint8_t rxBuf[1024]; // BUG: get rid of this magic number!
     SOCKADDR_IN bcastaddr;
     SOCKADDR_IN addr;
+    ModuleEntry entry;
     SOCKET sock;
     int cnt;
     
@@ -334,13 +921,17 @@ int discover1(IFADDR *ifaddr, XbeeAddrList &addrs, int timeout)
 
         /* get the next response */
         memset(rxBuf, 0, sizeof(rxBuf));
-        if ((cnt = ReceiveSocketDataAndAddress(sock, rxBuf, sizeof(rxBuf), &addr)) < 0) {
+        if ((cnt = ReceiveSocketDataAndAddress(sock, rxBuf, sizeof(rxBuf) - 1, &addr)) < 0) {
             printf("error: ReceiveSocketData failed\n");
             CloseSocket(sock);
             return -3;
         }
         
         printf("from %s got: %s", AddressToString(&addr), rxBuf);
+
+        /* remember the module so it can be loaded by name */
+        RegistryParseResponse((char *)rxBuf, AddressToString(&addr), &entry);
+        RegistryUpdate(registry, &entry);
     }
     
     /* close the socket */
@@ -350,6 +941,104 @@ int discover1(IFADDR *ifaddr, XbeeAddrList &addrs, int timeout)
     return 0;
 }
 
+/* discoverSweep - probe every host in an interface's subnet for networks that block broadcasts */
+int discoverSweep(IFADDR *ifaddr, ModuleRegistry *registry, int timeout)
+{
+    static uint8_t rxBufs[SOCKET_BATCH_SIZE][MAX_RESPONSE_SIZE];
+    SOCKADDR_IN rxAddrs[SOCKET_BATCH_SIZE], *addrs;
+    int rxLens[SOCKET_BATCH_SIZE];
+    const char *probe = "Me here! Ignore this message.\n";
+    uint32_t self, mask, net, hostCount, i;
+    uint64_t start, deadline, now;
+    int sent, skipped, retries, cnt;
+    SOCKET sock;
+
+    self = ntohl(ifaddr->addr.sin_addr.s_addr);
+    mask = ntohl(ifaddr->mask.sin_addr.s_addr);
+    net = self & mask;
+    hostCount = ~mask - 1;
+
+    /* point-to-point links and anything bigger than a /16 aren't worth sweeping */
+    if (mask == 0xffffffff || ~mask < 2 || hostCount > MAX_SWEEP_HOSTS) {
+        if (verbose)
+            printf("not sweeping the subnet of %s\n", AddressToString(&ifaddr->addr));
+        return 0;
+    }
+
+    if (!(addrs = (SOCKADDR_IN *)malloc(hostCount * sizeof(SOCKADDR_IN))))
+        return -1;
+    for (i = 0; i < hostCount; ++i) {
+        memset(&addrs[i], 0, sizeof(SOCKADDR_IN));
+        addrs[i].sin_family = AF_INET;
+        addrs[i].sin_port = htons(DEF_DISCOVER_PORT);
+        addrs[i].sin_addr.s_addr = htonl(net + 1 + i);
+    }
+
+    if (OpenBroadcastSocket(DEF_DISCOVER_PORT, &sock) != 0) {
+        printf("error: OpenBroadcastSocket failed\n");
+        free(addrs);
+        return -2;
+    }
+
+    /* send in batches, pacing them so the switch and the neighbor table keep up */
+    start = GetTimeMicroseconds();
+    deadline = 0;
+    sent = skipped = retries = 0;
+    while (sent < (int)hostCount || (now = GetTimeMicroseconds()) < deadline) {
+        if (sent < (int)hostCount) {
+            uint64_t due = start + (uint64_t)sent * 1000000 / SWEEP_RATE;
+            int batch = hostCount - sent, wait;
+            if (batch > SOCKET_BATCH_SIZE)
+                batch = SOCKET_BATCH_SIZE;
+            if ((now = GetTimeMicroseconds()) >= due) {
+                /* out of buffer space, wait for room rather than drop the host, though a UDP
+                   socket can poll writable while the device queue is still full */
+                if ((cnt = SendSocketDataToMany(sock, (void *)probe, strlen(probe), &addrs[sent], batch)) == 0
+                &&  ++retries <= SWEEP_SEND_RETRIES) {
+                    WaitForSocket(sock, LOOP_WRITE, SWEEP_SEND_WAIT);
+                    continue;
+                }
+                if (cnt <= 0) {
+                    /* a host without a route, or one there was never room to send to, shouldn't stop the sweep */
+                    cnt = 1;
+                    ++skipped;
+                }
+                retries = 0;
+                sent += cnt;
+                if (sent >= (int)hostCount)
+                    deadline = GetTimeMicroseconds() + (uint64_t)timeout * 1000;
+                continue;
+            }
+            wait = (int)((due - now + 999) / 1000);
+            WaitForSocket(sock, LOOP_READ, wait);
+        }
+        else
+            WaitForSocket(sock, LOOP_READ, (int)((deadline - now + 999) / 1000));
+
+        /* handle the responses that arrived while sending */
+        while ((cnt = ReceiveSocketDataBatch(sock, &rxBufs[0][0], MAX_RESPONSE_SIZE, rxLens, rxAddrs, SOCKET_BATCH_SIZE)) > 0) {
+            for (i = 0; i < (uint32_t)cnt; ++i) {
+                ModuleEntry entry;
+                if (rxAddrs[i].sin_addr.s_addr == ifaddr->addr.sin_addr.s_addr)
+                    continue;
+                rxBufs[i][rxLens[i] < MAX_RESPONSE_SIZE ? rxLens[i] : MAX_RESPONSE_SIZE - 1] = '\0';
+                printf("from %s got: %s", AddressToString(&rxAddrs[i]), (char *)rxBufs[i]);
+                RegistryParseResponse((char *)rxBufs[i], AddressToString(&rxAddrs[i]), &entry);
+                RegistryUpdate(registry, &entry);
+            }
+        }
+    }
+
+    if (verbose)
+        printf("swept %d hosts on %s in %.3f seconds, %d not reachable\n", hostCount, AddressToString(&ifaddr->addr),
+               (GetTimeMicroseconds() - start) / 1000000.0, skipped);
+
+    CloseSocket(sock);
+    free(addrs);
+
+    return 0;
+}
+
 #if 0
 #include <stdio.h>
 #include <stdlib.h>
@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "mdns.h"
+
+#define MAX_PACKET          1500
+#define MAX_NAME            256
+#define MAX_RECORDS         64
+#define MAX_IF_ADDRS        10
+
+#define TYPE_A              1
+#define TYPE_PTR            12
+#define TYPE_TXT            16
+#define TYPE_SRV            33
+
+#define CLASS_IN            1
+#define CLASS_UNICAST       0x8000  /* ask for the answer to be sent straight back to us */
+
+/* one resource record from an answer */
+typedef struct {
+    char name[MAX_NAME];
+    int type;
+    char target[MAX_NAME];      /* PTR and SRV target */
+    uint32_t addr;              /* A address (network order) */
+    char txt[MAX_NAME];         /* TXT strings separated by newlines */
+    int ttl;                    /* seconds the record may be cached (0 says it is going away) */
+} MdnsRecord;
+
+typedef struct {
+    int count;
+    MdnsRecord records[MAX_RECORDS];
+} MdnsAnswers;
+
+static int sendQuery(SOCKET sock, const char *name, int type);
+static int collectAnswers(SOCKET sock, MdnsAnswers *answers, int timeout, const char *wantName, int wantType);
+static int parsePacket(const uint8_t *pkt, int len, MdnsAnswers *answers);
+static int readName(const uint8_t *pkt, int len, int offset, char *name, int nameMax);
+static int encodeName(uint8_t *buf, int max, const char *name);
+static MdnsRecord *findRecord(MdnsAnswers *answers, const char *name, int type);
+static int addRecord(MdnsAnswers *answers);
+static int getTxtValue(const char *txt, const char *key, char *value, int valueMax);
+static int openMdnsSocket(SOCKET *pSock);
+static void fullName(const char *hostName, char *name, int nameMax);
+
+/* MdnsResolve - look up <name>.local with a multicast query, and how long the address may be kept */
+int MdnsResolve(const char *hostName, SOCKADDR_IN *addr, int timeout, int *pTtl)
+{
+    MdnsAnswers *answers;
+    MdnsRecord *record;
+    char name[MAX_NAME];
+    SOCKET sock;
+    int ret = -1;
+
+    fullName(hostName, name, sizeof(name));
+
+    if (openMdnsSocket(&sock) != 0)
+        return -1;
+    if (!(answers = (MdnsAnswers *)calloc(1, sizeof(MdnsAnswers)))) {
+        CloseSocket(sock);
+        return -1;
+    }
+
+    if (sendQuery(sock, name, TYPE_A) == 0
+    &&  collectAnswers(sock, answers, timeout, name, TYPE_A) == 0
+    &&  (record = findRecord(answers, name, TYPE_A)) != NULL) {
+        memset(addr, 0, sizeof(SOCKADDR_IN));
+        addr->sin_family = AF_INET;
+        addr->sin_port = htons(80);
+        addr->sin_addr.s_addr = record->addr;
+        if (pTtl)
+            *pTtl = record->ttl;
+        ret = 0;
+    }
+
+    free(answers);
+    CloseSocket(sock);
+    return ret;
+}
+
+/* MdnsBrowse - find the modules advertising the esp-link service and add them to the registry */
+int MdnsBrowse(ModuleRegistry *registry, int timeout)
+{
+    MdnsAnswers *answers;
+    SOCKET sock;
+    int found = 0, i;
+
+    if (openMdnsSocket(&sock) != 0)
+        return -1;
+    if (!(answers = (MdnsAnswers *)calloc(1, sizeof(MdnsAnswers)))) {
+        CloseSocket(sock);
+        return -1;
+    }
+
+    if (sendQuery(sock, MDNS_SERVICE, TYPE_PTR) != 0) {
+        free(answers);
+        CloseSocket(sock);
+        return -1;
+    }
+    collectAnswers(sock, answers, timeout, NULL, 0);
+
+    /* follow each service instance to its host and address */
+    for (i = 0; i < answers->count; ++i) {
+        MdnsRecord *ptr = &answers->records[i], *srv, *txt, *a;
+        ModuleEntry entry;
+        SOCKADDR_IN addr;
+        char value[32], *p;
+        int ttl;
+
+        if (ptr->type != TYPE_PTR || strcasecmp(ptr->name, MDNS_SERVICE) != 0 || ptr->ttl == 0)
+            continue;
+        if (!(srv = findRecord(answers, ptr->target, TYPE_SRV)))
+            continue;
+
+        memset(&addr, 0, sizeof(addr));
+        if ((a = findRecord(answers, srv->target, TYPE_A)) != NULL) {
+            addr.sin_addr.s_addr = a->addr;
+            ttl = a->ttl;
+        }
+        else if (MdnsResolve(srv->target, &addr, MDNS_RESOLVE_TIMEOUT, &ttl) != 0)
+            continue;
+
+        /* the module is where the records say only for as long as the first of them lasts */
+        if (srv->ttl < ttl)
+            ttl = srv->ttl;
+        if (ptr->ttl < ttl)
+            ttl = ptr->ttl;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.resetPin = -1;
+        strncpy(entry.address, AddressToString(&addr), sizeof(entry.address) - 1);
+        strncpy(entry.name, srv->target, sizeof(entry.name) - 1);
+        if ((p = strstr(entry.name, ".local")) != NULL)
+            *p = '\0';
+        if ((txt = findRecord(answers, ptr->target, TYPE_TXT)) != NULL) {
+            getTxtValue(txt->txt, "version", entry.version, sizeof(entry.version));
+            getTxtValue(txt->txt, "mac", entry.mac, sizeof(entry.mac));
+            if (getTxtValue(txt->txt, "max-packet-size", value, sizeof(value)) == 0)
+                entry.maxPacketSize = atoi(value);
+        }
+        entry.lastSeen = time(NULL);
+        entry.ttl = ttl > 0 ? ttl : 1;
+
+        printf("found %s at %s: %s\n", entry.name, entry.address, entry.version);
+        RegistryUpdate(registry, &entry);
+        ++found;
+    }
+
+    free(answers);
+    CloseSocket(sock);
+    return found;
+}
+
+static int openMdnsSocket(SOCKET *pSock)
+{
+    unsigned char ttl = 255, loop = 1;
+    SOCKET sock;
+
+    /* a query from a port other than 5353 gets its answers sent straight back */
+    if (OpenBroadcastSocket(0, &sock) != 0)
+        return -1;
+
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, (char *)&ttl, sizeof(ttl));
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (char *)&loop, sizeof(loop));
+
+    *pSock = sock;
+    return 0;
+}
+
+/* sendQuery - ask for a record on every interface */
+static int sendQuery(SOCKET sock, const char *name, int type)
+{
+    IFADDR ifaddrs[MAX_IF_ADDRS];
+    uint8_t pkt[MAX_PACKET];
+    SOCKADDR_IN group;
+    int len, cnt, sent = 0, i;
+
+    /* header: id 0, standard query, one question */
+    memset(pkt, 0, 12);
+    pkt[5] = 1;
+    if ((len = encodeName(&pkt[12], sizeof(pkt) - 16, name)) < 0)
+        return -1;
+    len += 12;
+    pkt[len++] = type >> 8;
+    pkt[len++] = type;
+    pkt[len++] = (CLASS_UNICAST | CLASS_IN) >> 8;
+    pkt[len++] = CLASS_IN;
+
+    GetInternetAddress(MDNS_ADDRESS, MDNS_PORT, &group);
+
+    /* the default interface, which also covers a responder on this host */
+    if (SendSocketDataTo(sock, pkt, len, &group) == len)
+        ++sent;
+
+    if ((cnt = GetInterfaceAddresses(ifaddrs, MAX_IF_ADDRS)) > 0) {
+        for (i = 0; i < cnt; ++i) {
+            if (setsockopt(sock, IPPROTO_IP, IP_MULTICAST_IF, (char *)&ifaddrs[i].addr.sin_addr, sizeof(IN_ADDR)) == 0
+            &&  SendSocketDataTo(sock, pkt, len, &group) == len)
+                ++sent;
+        }
+    }
+
+    return sent > 0 ? 0 : -1;
+}
+
+/* collectAnswers - gather records until the timeout or until the wanted record arrives */
+static int collectAnswers(SOCKET sock, MdnsAnswers *answers, int timeout, const char *wantName, int wantType)
+{
+    uint64_t deadline = GetTimeMicroseconds() + (uint64_t)timeout * 1000;
+    uint8_t pkt[MAX_PACKET];
+    uint64_t now;
+    int len;
+
+    while ((now = GetTimeMicroseconds()) < deadline) {
+        if (!SocketDataAvailableP(sock, (int)((deadline - now + 999) / 1000)))
+            break;
+        if ((len = ReceiveSocketData(sock, pkt, sizeof(pkt))) <= 0)
+            continue;
+        parsePacket(pkt, len, answers);
+        if (wantName && findRecord(answers, wantName, wantType))
+            return 0;
+    }
+
+    return wantName ? -1 : 0;
+}
+
+/* parsePacket - add the A, PTR, SRV and TXT records in a response to the answers */
+static int parsePacket(const uint8_t *pkt, int len, MdnsAnswers *answers)
+{
+    int qdcount, rrcount, offset, i;
+
+    /* only responses */
+    if (len < 12 || !(pkt[2] & 0x80))
+        return -1;
+
+    qdcount = (pkt[4] << 8) | pkt[5];
+    rrcount = ((pkt[6] << 8) | pkt[7]) + ((pkt[8] << 8) | pkt[9]) + ((pkt[10] << 8) | pkt[11]);
+    offset = 12;
+
+    for (i = 0; i < qdcount; ++i) {
+        char name[MAX_NAME];
+        if ((offset = readName(pkt, len, offset, name, sizeof(name))) < 0 || (offset += 4) > len)
+            return -1;
+    }
+
+    for (i = 0; i < rrcount && answers->count < MAX_RECORDS; ++i) {
+        MdnsRecord *record = &answers->records[answers->count];
+        uint32_t ttl;
+        int type, rdlen;
+
+        memset(record, 0, sizeof(MdnsRecord));
+        if ((offset = readName(pkt, len, offset, record->name, sizeof(record->name))) < 0 || offset + 10 > len)
+            return -1;
+        type = (pkt[offset] << 8) | pkt[offset + 1];
+        ttl = ((uint32_t)pkt[offset + 4] << 24) | (pkt[offset + 5] << 16) | (pkt[offset + 6] << 8) | pkt[offset + 7];
+        rdlen = (pkt[offset + 8] << 8) | pkt[offset + 9];
+        offset += 10;
+        if (offset + rdlen > len)
+            return -1;
+
+        record->type = type;
+        record->ttl = ttl > 0x7fffffff ? 0x7fffffff : (int)ttl;
+        switch (type) {
+        case TYPE_A:
+            if (rdlen != 4)
+                break;
+            memcpy(&record->addr, &pkt[offset], 4);
+            addRecord(answers);
+            break;
+        case TYPE_PTR:
+            if (readName(pkt, len, offset, record->target, sizeof(record->target)) >= 0)
+                addRecord(answers);
+            break;
+        case TYPE_SRV:
+            if (rdlen > 6 && readName(pkt, len, offset + 6, record->target, sizeof(record->target)) >= 0)
+                addRecord(answers);
+            break;
+        case TYPE_TXT:
+            {
+                int p = offset, cnt = 0;
+                while (p < offset + rdlen) {
+                    int strLen = pkt[p++];
+                    if (p + strLen > offset + rdlen || cnt + strLen + 2 > (int)sizeof(record->txt))
+                        break;
+                    memcpy(&record->txt[cnt], &pkt[p], strLen);
+                    cnt += strLen;
+                    record->txt[cnt++] = '\n';
+                    p += strLen;
+                }
+                record->txt[cnt] = '\0';
+                addRecord(answers);
+            }
+            break;
+        default:
+            break;
+        }
+
+        offset += rdlen;
+    }
+
+    return 0;
+}
+
+/* readName - decode a possibly compressed name, returning the offset just past it */
+static int readName(const uint8_t *pkt, int len, int offset, char *name, int nameMax)
+{
+    int next = -1, cnt = 0, jumps = 0;
+
+    while (offset < len) {
+        int labelLen = pkt[offset];
+        if (labelLen == 0) {
+            name[cnt > 0 ? cnt - 1 : 0] = '\0';
+            return next >= 0 ? next : offset + 1;
+        }
+        else if ((labelLen & 0xc0) == 0xc0) {
+            if (offset + 1 >= len || ++jumps > 16)
+                return -1;
+            if (next < 0)
+                next = offset + 2;
+            offset = ((labelLen & 0x3f) << 8) | pkt[offset + 1];
+        }
+        else {
+            if (offset + 1 + labelLen > len || cnt + labelLen + 1 >= nameMax)
+                return -1;
+            memcpy(&name[cnt], &pkt[offset + 1], labelLen);
+            cnt += labelLen;
+            name[cnt++] = '.';
+            offset += labelLen + 1;
+        }
+    }
+
+    return -1;
+}
+
+static int encodeName(uint8_t *buf, int max, const char *name)
+{
+    int cnt = 0;
+
+    while (*name) {
+        int labelLen = strcspn(name, ".");
+        if (labelLen == 0 || labelLen > 63 || cnt + labelLen + 2 > max)
+            return -1;
+        buf[cnt++] = labelLen;
+        memcpy(&buf[cnt], name, labelLen);
+        cnt += labelLen;
+        name += labelLen;
+        if (*name == '.')
+            ++name;
+    }
+    buf[cnt++] = 0;
+
+    return cnt;
+}
+
+/* addRecord - keep the record just parsed unless it repeats one already received */
+static int addRecord(MdnsAnswers *answers)
+{
+    MdnsRecord *record = &answers->records[answers->count];
+    int i;
+
+    /* queries go out on every interface so the same answer can arrive more than once */
+    for (i = 0; i < answers->count; ++i) {
+        MdnsRecord *old = &answers->records[i];
+        if (old->type == record->type && old->addr == record->addr
+        &&  strcasecmp(old->name, record->name) == 0 && strcasecmp(old->target, record->target) == 0)
+            return -1;
+    }
+
+    ++answers->count;
+    return 0;
+}
+
+static MdnsRecord *findRecord(MdnsAnswers *answers, const char *name, int type)
+{
+    int i;
+    for (i = 0; i < answers->count; ++i) {
+        MdnsRecord *record = &answers->records[i];
+        if (record->type == type && strcasecmp(record->name, name) == 0)
+            return record;
+    }
+    return NULL;
+}
+
+static int getTxtValue(const char *txt, const char *key, char *value, int valueMax)
+{
+    int keyLen = strlen(key);
+    const char *p;
+
+    for (p = txt; *p; p += strcspn(p, "\n"), p += (*p == '\n')) {
+        if (strncmp(p, key, keyLen) == 0 && p[keyLen] == '=') {
+            int cnt = strcspn(p += keyLen + 1, "\n");
+            if (cnt >= valueMax)
+                cnt = valueMax - 1;
+            memcpy(value, p, cnt);
+            value[cnt] = '\0';
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* fullName - add the .local domain to a bare host name */
+static void fullName(const char *hostName, char *name, int nameMax)
+{
+    int len = strlen(hostName);
+    if (len >= 6 && strcasecmp(&hostName[len - 6], ".local") == 0)
+        snprintf(name, nameMax, "%s", hostName);
+    else
+        snprintf(name, nameMax, "%s.local", hostName);
+}
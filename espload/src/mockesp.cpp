@@ -0,0 +1,953 @@
+/* mockesp - a stand-in for the Propeller loader in esp-link for benchmarking espload on one host
+
+   It answers /propeller/load-begin, load-data and load-end with the status codes and messages
+   cgiprop.c uses and models the costs a real module adds: network round trips with jitter and
+   TCP retransmissions, the serial link to the Propeller, and the httpd limits on connections
+   and POST size. Like cgiprop.c it takes early sessions begun without image-size and skips
+   programming an image it last wrote to the EEPROM when load-end asks with skip-unchanged.
+
+   With -m it also answers mDNS on this host as esp-link/mdns.c does on a module, the A record
+   for <name>.local and the PTR, SRV and TXT records of its _esp-link._tcp service.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include "sock.h"
+#include "mdns.h"
+
+#define DEF_PORT            8080
+#define DEF_BAUD_RATE       921600      /* second-stage loader baud rate */
+#define DEF_RTO             250         /* milliseconds before a lost segment is retransmitted */
+#define DEF_STARTUP_TIME    350         /* milliseconds to reset the Propeller and start the second-stage loader */
+#define VERIFY_RAM_TIME     20          /* milliseconds for the second-stage loader to checksum RAM */
+#define EEPROM_TIME         3000        /* milliseconds to program and verify a 32K EEPROM */
+#define LAUNCH_TIME         10          /* milliseconds for the ready-to-launch handshake */
+
+/* limits in httpd.c and proploader.h */
+#define MAX_CONN            6
+#define MAX_POST            1024
+#define MAX_PACKET_SIZE     1024
+#define DATA_IDLE_TIMEOUT   2000
+#define EARLY_START_TIMEOUT 30000       /* the idle timeout before the first packet of an early session */
+#define MAX_EEPROM_CLOCK    1000000
+
+#define PACKET_OVERHEAD     8           /* packet ID and length ahead of the data */
+#define ACK_SIZE            8           /* packet ID and tag sent back */
+#define MAX_HEADER          1024
+#define MAX_BODY            (MAX_POST * 8)  /* largest POST size that can be modelled */
+#define MAX_IMAGE_SIZE      32768
+#define VERSION             "mockesp"
+
+/* the TTLs RFC 6762 suggests for records naming a host and for the rest */
+#define MDNS_HOST_TTL       120
+#define MDNS_OTHER_TTL      4500
+#define MDNS_MAX_PACKET     1500
+#define MDNS_MAC            "02:00:00:00:00:01"   /* locally administered, for the registry to key on */
+
+#define TYPE_A              1
+#define TYPE_PTR            12
+#define TYPE_TXT            16
+#define TYPE_SRV            33
+#define TYPE_ANY            255
+#define CLASS_IN            1
+#define CLASS_FLUSH         0x8000  /* the record is the only one of its name and type */
+
+/* FNV-1a, as cgiprop.c uses to tell a changed image from the one programmed last */
+#define IMAGE_HASH_INIT     0x811C9DC5
+#define IMAGE_HASH_PRIME    0x01000193
+
+typedef enum {
+    stIdle,
+    stStartAck,
+    stData,
+    stDataAck,
+    stPadAck,
+    stVerifyRAMAck
+} MockState;
+
+typedef struct {
+    SOCKET sock;
+    int active;
+    int closed;                 /* the client went away, free the slot once nothing refers to it */
+    int pending;                /* timers that will still use the connection */
+    uint8_t buf[MAX_HEADER + MAX_BODY + 1];
+    int len;
+    int headerLen;
+    int contentLength;
+    int bodyLength;             /* bytes of the body httpd buffered (0 until the request is complete) */
+    int complete;
+    char path[64];
+    char args[128];
+    int code;
+    char message[160];
+} MockConnection;
+
+typedef struct {
+    MockState state;
+    MockConnection *conn;       /* request waiting for the Propeller (NULL once lost) */
+    int imageSize;              /* the most it can be for an early session */
+    int early;                  /* begun without image-size */
+    int packetSize;
+    int packetLength;
+    int packets;                /* data packets acked so far */
+    int bytesLoaded;
+    int program;
+    int skipUnchanged;          /* load-end asked to skip programming an unchanged image */
+    int skipped;                /* the EEPROM already held the image */
+    int clockFreq;              /* the target's clock from load-begin, 0 if not given */
+    int clockMode;
+    uint32_t imageHash;
+    int eepromImageSize;        /* the image last programmed with skip-unchanged (0 for none) */
+    uint32_t eepromImageHash;
+    int timer;                  /* Propeller or idle timer (-1 if none) */
+    uint64_t loadStart;
+} MockLoader;
+
+/* model parameters */
+static int port = DEF_PORT;
+static int rtt = 0;
+static int jitter = 0;
+static int lossPercent = 0;
+static int rto = DEF_RTO;
+static int dropPercent = 0;
+static int byteCost = 0;
+static int startupTime = DEF_STARTUP_TIME;
+static int maxConn = MAX_CONN;
+static int maxPost = MAX_POST;
+static int verbose = 0;
+static uint32_t seed = 1;
+static const char *mdnsName = NULL;
+
+static MockConnection *conns;
+static MockLoader loader;
+static SocketLoop *loop;
+
+static void listenHandler(SocketLoop *loop, SOCKET sock, int events, void *data);
+static void connectionHandler(SocketLoop *loop, SOCKET sock, int events, void *data);
+static void requestArrived(SocketLoop *loop, void *data);
+static void responseArrived(SocketLoop *loop, void *data);
+static void loadBegin(MockConnection *c);
+static void loadData(MockConnection *c);
+static void loadEnd(MockConnection *c);
+static void chooseEEPROMProgramming(MockConnection *c, int andRun);
+static void propellerDone(SocketLoop *loop, void *data);
+static void idleTimeout(SocketLoop *loop, void *data);
+static void respond(MockConnection *c, int code, const char *message);
+static void loadDataResponse(MockConnection *c, int code);
+static void abortLoading(void);
+static void deviceTimer(int timeout, TimerHandler *handler);
+static void releaseConnection(MockConnection *c);
+static int getIntArg(MockConnection *c, const char *name, int *pValue);
+static int getArg(MockConnection *c, const char *name, char *value, int valueMax);
+static int oneWayDelay(void);
+static int percentChance(int percent);
+static int openMdnsResponder(void);
+static void mdnsHandler(SocketLoop *loop, SOCKET sock, int events, void *data);
+static int addRecord(uint8_t *pkt, int len, const char *name, int type, int ttl, const uint8_t *rdata, int rdlen);
+static int encodeName(uint8_t *buf, int max, const char *name);
+static int readName(const uint8_t *pkt, int len, int offset, char *name, int nameMax);
+static void Usage(void);
+
+int main(int argc, char *argv[])
+{
+    SOCKET listenSock;
+    int baudRate = DEF_BAUD_RATE;
+    int i;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        const char *value;
+        int opt;
+        if (argv[i][0] != '-' || !(opt = argv[i][1]))
+            Usage();
+        if (opt == 'v') {
+            verbose = 1;
+            continue;
+        }
+        if (argv[i][2])
+            value = &argv[i][2];
+        else if (++i < argc)
+            value = argv[i];
+        else
+            Usage();
+        switch (opt) {
+        case 'b': baudRate = atoi(value); break;
+        case 'c': maxConn = atoi(value); break;
+        case 'd': dropPercent = atoi(value); break;
+        case 'j': jitter = atoi(value); break;
+        case 'l': lossPercent = atoi(value); break;
+        case 'm': mdnsName = value; break;
+        case 'o': rto = atoi(value); break;
+        case 'p': port = atoi(value); break;
+        case 'P': maxPost = atoi(value); break;
+        case 'r': rtt = atoi(value); break;
+        case 's': startupTime = atoi(value); break;
+        case 'S': seed = (uint32_t)strtoul(value, NULL, 10); break;
+        case 'u': byteCost = atoi(value); break;
+        default:  Usage(); break;
+        }
+    }
+
+    /* ten bit times per byte unless the cost was given directly */
+    if (byteCost <= 0) {
+        if (baudRate <= 0)
+            Usage();
+        byteCost = 10000000 / baudRate;
+    }
+    if (maxConn < 1 || maxPost < 1 || maxPost > MAX_BODY || !seed)
+        Usage();
+
+#ifndef __MINGW32__
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    if (!(conns = (MockConnection *)calloc(maxConn, sizeof(MockConnection)))) {
+        printf("error: insufficient memory\n");
+        return 1;
+    }
+    loader.state = stIdle;
+    loader.timer = -1;
+
+    if (OpenListenSocket(port, &listenSock) != 0) {
+        printf("error: can't listen on port %d\n", port);
+        return 1;
+    }
+    if (!(loop = OpenSocketLoop()) || WatchSocket(loop, listenSock, LOOP_READ, listenHandler, NULL) != 0) {
+        printf("error: can't open the socket loop\n");
+        return 1;
+    }
+    if (mdnsName && openMdnsResponder() != 0) {
+        printf("error: can't answer mDNS on port %d\n", MDNS_PORT);
+        return 1;
+    }
+
+    printf("mockesp on port %d: rtt %d ms, jitter %d ms, loss %d%%, drop %d%%, %d usec/byte, %d connections, %d byte POSTs\n",
+           port, rtt, jitter, lossPercent, dropPercent, byteCost, maxConn, maxPost);
+    if (mdnsName)
+        printf("mDNS: %s.local, %s port %d\n", mdnsName, MDNS_SERVICE, port);
+    fflush(stdout);
+
+    RunSocketLoop(loop);
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    printf("\
+usage: mockesp\n\
+         [ -b <baud> ]     second-stage baud rate (default is %d)\n\
+         [ -c <count> ]    connections httpd accepts at once (default is %d)\n\
+         [ -d <percent> ]  responses dropped by closing the connection (default is 0)\n\
+         [ -j <msec> ]     extra random delay added to each direction (default is 0)\n\
+         [ -l <percent> ]  segments lost and retransmitted after the RTO (default is 0)\n\
+         [ -m <name> ]     answer mDNS on this host as <name>.local with the esp-link service\n\
+         [ -o <msec> ]     retransmission timeout (default is %d)\n\
+         [ -p <port> ]     port to listen on (default is %d)\n\
+         [ -P <size> ]     largest POST httpd buffers (default is %d)\n\
+         [ -r <msec> ]     round trip time (default is 0)\n\
+         [ -s <msec> ]     time to reset the Propeller and start the second-stage loader (default is %d)\n\
+         [ -S <seed> ]     random number seed (default is 1)\n\
+         [ -u <usec> ]     serial cost per byte (default is ten bit times at the baud rate)\n\
+         [ -v ]            display each request\n", DEF_BAUD_RATE, MAX_CONN, DEF_RTO, DEF_PORT, MAX_POST, DEF_STARTUP_TIME);
+    exit(1);
+}
+
+/* listenHandler - accept a connection, refusing it like httpd does when the pool is full */
+static void listenHandler(SocketLoop *loop, SOCKET sock, int events, void *data)
+{
+    MockConnection *c = NULL;
+    SOCKET newSock;
+    int i;
+
+    if (AcceptSocket(sock, &newSock, NULL) != 0)
+        return;
+
+    for (i = 0; i < maxConn; ++i) {
+        if (!conns[i].active) {
+            c = &conns[i];
+            break;
+        }
+    }
+    if (!c) {
+        if (verbose)
+            printf("conn pool overflow!\n");
+        closesocket(newSock);
+        return;
+    }
+
+    memset(c, 0, sizeof(MockConnection));
+    c->sock = newSock;
+    c->active = 1;
+    c->contentLength = -1;
+    SetSocketBlocking(newSock, 0);
+    WatchSocket(loop, newSock, LOOP_READ, connectionHandler, c);
+}
+
+/* connectionHandler - collect a request and pass it on after the one-way delay */
+static void connectionHandler(SocketLoop *loop, SOCKET sock, int events, void *data)
+{
+    MockConnection *c = (MockConnection *)data;
+    int cnt;
+
+    /* once the request is in, only watch for the client going away */
+    if (c->complete) {
+        char discard[512];
+        if (recv(sock, discard, sizeof(discard), 0) <= 0)
+            releaseConnection(c);
+        return;
+    }
+
+    if ((cnt = recv(sock, (char *)c->buf + c->len, sizeof(c->buf) - 1 - c->len, 0)) <= 0) {
+        releaseConnection(c);
+        return;
+    }
+    c->len += cnt;
+    c->buf[c->len] = '\0';
+
+    /* parse the request line and the content length once the headers are in */
+    if (!c->headerLen) {
+        char *end, *p;
+        if (!(end = strstr((char *)c->buf, "\r\n\r\n"))) {
+            if (c->len >= MAX_HEADER)
+                releaseConnection(c);
+            return;
+        }
+        c->headerLen = end + 4 - (char *)c->buf;
+        c->contentLength = 0;
+        if ((p = strstr((char *)c->buf, "Content-Length:")) != NULL && p < end)
+            c->contentLength = atoi(p + 15);
+        if (sscanf((char *)c->buf, "%*s %63[^? ]%*[?]%127s", c->path, c->args) < 1) {
+            releaseConnection(c);
+            return;
+        }
+        if (strncmp(c->args, "HTTP/", 5) == 0)
+            c->args[0] = '\0';
+    }
+
+    /* httpd only buffers the first MAX_POST bytes of a larger body */
+    if (c->len - c->headerLen >= c->contentLength || c->len - c->headerLen >= maxPost) {
+        c->bodyLength = c->len - c->headerLen;
+        if (c->bodyLength > c->contentLength)
+            c->bodyLength = c->contentLength;
+        if (c->bodyLength > maxPost)
+            c->bodyLength = maxPost;
+        c->complete = 1;
+        ++c->pending;
+        AddTimer(loop, oneWayDelay(), requestArrived, c);
+    }
+}
+
+/* requestArrived - handle a request the way cgiprop.c does */
+static void requestArrived(SocketLoop *loop, void *data)
+{
+    MockConnection *c = (MockConnection *)data;
+
+    --c->pending;
+    if (c->closed) {
+        releaseConnection(c);
+        return;
+    }
+
+    if (verbose)
+        printf("%s%s%s (%d bytes), state %d, loaded %d\n", c->path, c->args[0] ? "?" : "", c->args,
+               c->contentLength, loader.state, loader.bytesLoaded);
+
+    if (strcmp(c->path, "/propeller/load-begin") == 0)
+        loadBegin(c);
+    else if (strcmp(c->path, "/propeller/load-data") == 0)
+        loadData(c);
+    else if (strcmp(c->path, "/propeller/load-end") == 0)
+        loadEnd(c);
+    else
+        respond(c, 404, "Not Found\r\n");
+}
+
+static void loadBegin(MockConnection *c)
+{
+    int eepromClock;
+
+    if (loader.state != stIdle) {
+        respond(c, 400, "Transfer already in progress\r\n");
+        abortLoading();
+        return;
+    }
+    loader.conn = c;
+
+    /* without image-size the loader is built for a full RAM and the rest is padded at load-end */
+    if ((loader.early = !getIntArg(c, "image-size", &loader.imageSize)) != 0)
+        loader.imageSize = MAX_IMAGE_SIZE;
+    else if (loader.imageSize < 1 || loader.imageSize > MAX_IMAGE_SIZE) {
+        respond(c, 400, "Invalid image-size\r\n");
+        return;
+    }
+    if (!getIntArg(c, "clock-freq", &loader.clockFreq) || loader.clockFreq < 0)
+        loader.clockFreq = 0;
+    if (!getIntArg(c, "clock-mode", &loader.clockMode))
+        loader.clockMode = 0;
+    if (getIntArg(c, "eeprom-clock", &eepromClock) && (eepromClock <= 0 || eepromClock > MAX_EEPROM_CLOCK)) {
+        respond(c, 400, "Invalid eeprom-clock\r\n");
+        return;
+    }
+    if (!getIntArg(c, "packet-size", &loader.packetSize))
+        loader.packetSize = maxPost < MAX_PACKET_SIZE ? maxPost : MAX_PACKET_SIZE;
+    else if (loader.packetSize < 1 || loader.packetSize > MAX_PACKET_SIZE || loader.packetSize > maxPost) {
+        respond(c, 400, "Invalid packet-size\r\n");
+        return;
+    }
+    /* the loader runs at the target's clock or its own, either way the rates are the same */
+    if (verbose)
+        printf("load-begin: %simage-size %d, clock %d, mode 0x%02x\n", loader.early ? "early, " : "",
+               loader.imageSize, loader.clockFreq, loader.clockMode);
+
+    loader.bytesLoaded = 0;
+    loader.packets = 0;
+    loader.imageHash = IMAGE_HASH_INIT;
+    loader.loadStart = GetTimeMicroseconds();
+    loader.state = stStartAck;
+    deviceTimer(startupTime, propellerDone);
+}
+
+static void loadData(MockConnection *c)
+{
+    int offset, length = c->bodyLength, i;
+
+    if (loader.state != stData && loader.state != stDataAck) {
+        respond(c, 400, "Not ready for a data transfer\r\n");
+        abortLoading();
+        return;
+    }
+
+    /* clients that don't send an offset always send the next packet */
+    if (!getIntArg(c, "offset", &offset))
+        offset = loader.bytesLoaded;
+
+    /* a retry of the packet in flight waits for its ack in place of the lost request */
+    if (loader.state == stDataAck) {
+        if (offset != loader.bytesLoaded || length != loader.packetLength) {
+            loadDataResponse(c, 400);
+            return;
+        }
+        loader.conn = c;
+        return;
+    }
+
+    /* a retry of a packet that was acked after its request was lost */
+    if (offset < loader.bytesLoaded && offset + length <= loader.bytesLoaded) {
+        loadDataResponse(c, 200);
+        return;
+    }
+
+    /* tell the client where to resume */
+    else if (offset != loader.bytesLoaded) {
+        loadDataResponse(c, 400);
+        return;
+    }
+
+    loader.conn = c;
+
+    if (length == 0) {
+        respond(c, 400, "No data to load\r\n");
+        abortLoading();
+        return;
+    }
+    if (loader.bytesLoaded + length > loader.imageSize) {
+        respond(c, 400, "More data than image-size\r\n");
+        abortLoading();
+        return;
+    }
+    if (c->contentLength > loader.packetSize) {
+        respond(c, 400, "Packet too large\r\n");
+        abortLoading();
+        return;
+    }
+    for (i = 0; i < length; ++i)
+        loader.imageHash = (loader.imageHash ^ c->buf[c->headerLen + i]) * IMAGE_HASH_PRIME;
+
+    /* the packet goes out over the serial link and the ack comes back */
+    loader.packetLength = length;
+    loader.state = stDataAck;
+    deviceTimer((int)(((int64_t)(PACKET_OVERHEAD + length + ACK_SIZE) * byteCost + 999) / 1000), propellerDone);
+}
+
+static void loadEnd(MockConnection *c)
+{
+    char cmd[32];
+
+    if (loader.state != stData) {
+        respond(c, 400, "Not ready for a data transfer\r\n");
+        abortLoading();
+        return;
+    }
+    else if (loader.early ? loader.bytesLoaded == 0 : loader.bytesLoaded < loader.imageSize) {
+        respond(c, 400, "More data expected\r\n");
+        abortLoading();
+        return;
+    }
+    loader.conn = c;
+
+    if (!getArg(c, "command", cmd, sizeof(cmd)))
+        strcpy(cmd, "run");
+    if (strcmp(cmd, "run") == 0)
+        loader.program = 0;
+    else if (strcmp(cmd, "program-and-run") == 0 || strcmp(cmd, "program") == 0)
+        loader.program = 1;
+    else {
+        respond(c, 400, "Unknown command\r\n");
+        abortLoading();
+        return;
+    }
+
+    chooseEEPROMProgramming(c, strcmp(cmd, "program-and-run") == 0);
+
+    /* an early session's loader still expects a full RAM's packets, each padded with a long of zeros */
+    if (loader.early && loader.packets < (MAX_IMAGE_SIZE + loader.packetSize - 1) / loader.packetSize) {
+        int pads = (MAX_IMAGE_SIZE + loader.packetSize - 1) / loader.packetSize - loader.packets;
+        loader.state = stPadAck;
+        deviceTimer((int)(((int64_t)pads * (PACKET_OVERHEAD + 4 + ACK_SIZE) * byteCost + 999) / 1000), propellerDone);
+        return;
+    }
+
+    loader.state = stVerifyRAMAck;
+    deviceTimer(VERIFY_RAM_TIME + (loader.program ? EEPROM_TIME : 0) + LAUNCH_TIME, propellerDone);
+}
+
+/* chooseEEPROMProgramming - skip programming the image last programmed with skip-unchanged, and
+   forget it on any other load since what ran may have written the EEPROM, as cgiprop.c does */
+static void chooseEEPROMProgramming(MockConnection *c, int andRun)
+{
+    int size = loader.bytesLoaded;
+
+    if (!getIntArg(c, "skip-unchanged", &loader.skipUnchanged))
+        loader.skipUnchanged = 0;
+    loader.skipped = loader.program && andRun && loader.skipUnchanged
+                  && loader.eepromImageSize == size && loader.eepromImageHash == loader.imageHash;
+    if (loader.skipped)
+        loader.program = 0;
+    else {
+        loader.eepromImageSize = 0;
+        loader.eepromImageHash = 0;
+    }
+
+    /* remembered once verified, which the mock takes as given */
+    if (loader.program && loader.skipUnchanged) {
+        loader.eepromImageSize = size;
+        loader.eepromImageHash = loader.imageHash;
+    }
+}
+
+/* propellerDone - the Propeller has answered the operation in progress */
+static void propellerDone(SocketLoop *loop, void *data)
+{
+    char buf[160];
+
+    loader.timer = -1;
+
+    switch (loader.state) {
+    case stStartAck:
+        snprintf(buf, sizeof(buf), "packet-size=%d\r\nmax-packet-size=%d\r\nversion=%s\r\npath=loader\r\n",
+                 loader.packetSize, maxPost < MAX_PACKET_SIZE ? maxPost : MAX_PACKET_SIZE, VERSION);
+        respond(loader.conn, 200, buf);
+        loader.conn = NULL;
+        loader.state = stData;
+        deviceTimer(loader.early ? EARLY_START_TIMEOUT : DATA_IDLE_TIMEOUT, idleTimeout);
+        break;
+    case stDataAck:
+        loader.bytesLoaded += loader.packetLength;
+        ++loader.packets;
+        loadDataResponse(loader.conn, 200);
+        loader.conn = NULL;
+        loader.state = stData;
+        deviceTimer(DATA_IDLE_TIMEOUT, idleTimeout);
+        break;
+    case stPadAck:
+        loader.state = stVerifyRAMAck;
+        deviceTimer(VERIFY_RAM_TIME + (loader.program ? EEPROM_TIME : 0) + LAUNCH_TIME, propellerDone);
+        break;
+    case stVerifyRAMAck:
+        buf[0] = '\0';
+        if (loader.program || loader.skipped)
+            snprintf(buf, sizeof(buf), "eeprom-skipped=%d\r\n%s", loader.skipped,
+                     loader.skipUnchanged ? "eeprom-check=cached-hash\r\n" : "");
+        respond(loader.conn, 200, buf);
+        loader.conn = NULL;
+        loader.state = stIdle;
+        printf("loaded %d bytes in %d ms\n", loader.bytesLoaded, (int)((GetTimeMicroseconds() - loader.loadStart) / 1000));
+        fflush(stdout);
+        break;
+    default:
+        break;
+    }
+}
+
+/* idleTimeout - the second-stage loader has given up waiting for the next packet */
+static void idleTimeout(SocketLoop *loop, void *data)
+{
+    loader.timer = -1;
+    if (verbose)
+        printf("no data from client, abandoning load\n");
+    abortLoading();
+}
+
+static void abortLoading(void)
+{
+    if (loader.timer >= 0) {
+        CancelTimer(loop, loader.timer);
+        loader.timer = -1;
+    }
+    loader.conn = NULL;
+    loader.state = stIdle;
+}
+
+static void deviceTimer(int timeout, TimerHandler *handler)
+{
+    if (loader.timer >= 0)
+        CancelTimer(loop, loader.timer);
+    loader.timer = AddTimer(loop, timeout, handler, NULL);
+}
+
+static void loadDataResponse(MockConnection *c, int code)
+{
+    char buf[40];
+    snprintf(buf, sizeof(buf), "bytes-loaded=%d\r\n", loader.bytesLoaded);
+    respond(c, code, buf);
+}
+
+/* respond - send a response after the one-way delay (a lost request has nowhere to go) */
+static void respond(MockConnection *c, int code, const char *message)
+{
+    if (!c)
+        return;
+    if (loader.conn == c)
+        loader.conn = NULL;
+    c->code = code;
+    snprintf(c->message, sizeof(c->message), "%s", message);
+    ++c->pending;
+    AddTimer(loop, oneWayDelay(), responseArrived, c);
+}
+
+static void responseArrived(SocketLoop *loop, void *data)
+{
+    MockConnection *c = (MockConnection *)data;
+    char buf[512];
+    int cnt;
+
+    --c->pending;
+    if (!c->closed && !percentChance(dropPercent)) {
+        cnt = snprintf(buf, sizeof(buf), "\
+HTTP/1.0 %d OK\r\n\
+Server: esp-link\r\n\
+Connection: close\r\n\
+Cache-Control: no-cache, no-store, must-revalidate\r\n\
+Pragma: no-cache\r\n\
+Expires: 0\r\n\
+\r\n\
+%s", c->code, c->message);
+        send(c->sock, buf, cnt, 0);
+    }
+    else if (verbose && !c->closed)
+        printf("dropping %d response\n", c->code);
+    releaseConnection(c);
+}
+
+/* releaseConnection - close a connection and free its slot once no timer refers to it */
+static void releaseConnection(MockConnection *c)
+{
+    if (!c->closed) {
+        UnwatchSocket(loop, c->sock);
+        closesocket(c->sock);
+        c->closed = 1;
+
+        /* the loader keeps going so a retry can pick up the result */
+        if (loader.conn == c)
+            loader.conn = NULL;
+    }
+    if (!c->pending)
+        c->active = 0;
+}
+
+static int getArg(MockConnection *c, const char *name, char *value, int valueMax)
+{
+    int nameLen = strlen(name);
+    const char *p = c->args;
+
+    while (*p) {
+        if (strncmp(p, name, nameLen) == 0 && p[nameLen] == '=') {
+            int cnt = strcspn(p += nameLen + 1, "&");
+            if (cnt >= valueMax)
+                cnt = valueMax - 1;
+            memcpy(value, p, cnt);
+            value[cnt] = '\0';
+            return 1;
+        }
+        p += strcspn(p, "&");
+        if (*p == '&')
+            ++p;
+    }
+
+    return 0;
+}
+
+static int getIntArg(MockConnection *c, const char *name, int *pValue)
+{
+    char buf[16];
+    if (!getArg(c, name, buf, sizeof(buf)))
+        return 0;
+    *pValue = atoi(buf);
+    return 1;
+}
+
+/* xorshift so a run can be repeated with the same seed */
+static uint32_t nextRandom(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static int percentChance(int percent)
+{
+    return percent > 0 && (int)(nextRandom() % 100) < percent;
+}
+
+/* oneWayDelay - half the round trip plus jitter plus a retransmission if the segment is lost */
+static int oneWayDelay(void)
+{
+    int delay = rtt / 2;
+    if (jitter > 0)
+        delay += nextRandom() % (jitter + 1);
+    if (percentChance(lossPercent))
+        delay += rto;
+    return delay;
+}
+
+/* openMdnsResponder - join the mDNS group on loopback, and on the default interface if there is one */
+static int openMdnsResponder(void)
+{
+    struct ip_mreq mreq;
+    SOCKADDR_IN addr;
+    unsigned char loopback = 1;
+    int reuse = 1, joined = 0;
+    SOCKET sock;
+
+    if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+        return -1;
+
+    /* share the port with a system responder like avahi */
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&reuse, sizeof(reuse));
+#ifdef SO_REUSEPORT
+    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (char *)&reuse, sizeof(reuse));
+#endif
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(MDNS_PORT);
+    if (bind(sock, (SOCKADDR *)&addr, sizeof(addr)) != 0) {
+        closesocket(sock);
+        return -1;
+    }
+
+    /* espload's query leaves on the default interface and is looped back to this host */
+    mreq.imr_multiaddr.s_addr = inet_addr(MDNS_ADDRESS);
+    mreq.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&mreq, sizeof(mreq)) == 0)
+        ++joined;
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&mreq, sizeof(mreq)) == 0)
+        ++joined;
+    if (!joined) {
+        closesocket(sock);
+        return -1;
+    }
+    setsockopt(sock, IPPROTO_IP, IP_MULTICAST_LOOP, (char *)&loopback, sizeof(loopback));
+
+    return WatchSocket(loop, sock, LOOP_READ, mdnsHandler, NULL);
+}
+
+/* mdnsHandler - answer the questions about this host and its service in a query */
+static void mdnsHandler(SocketLoop *loop, SOCKET sock, int events, void *data)
+{
+    uint8_t query[MDNS_MAX_PACKET], pkt[MDNS_MAX_PACKET], rdata[256];
+    char host[128], instance[192], name[256];
+    int len, qdcount, offset, cnt, answers = 0, extras = 0, i;
+    int wantA = 0, wantPtr = 0, wantSrv = 0, wantTxt = 0;
+    SOCKADDR_IN from;
+
+    if ((len = ReceiveSocketDataAndAddress(sock, query, sizeof(query), &from)) < 12 || (query[2] & 0x80))
+        return;
+
+    snprintf(host, sizeof(host), "%s.local", mdnsName);
+    snprintf(instance, sizeof(instance), "%s.%s", mdnsName, MDNS_SERVICE);
+
+    qdcount = (query[4] << 8) | query[5];
+    offset = 12;
+    for (i = 0; i < qdcount; ++i) {
+        int type;
+        if ((offset = readName(query, len, offset, name, sizeof(name))) < 0 || offset + 4 > len)
+            return;
+        type = (query[offset] << 8) | query[offset + 1];
+        offset += 4;
+        if (strcasecmp(name, host) == 0 && (type == TYPE_A || type == TYPE_ANY))
+            wantA = 1;
+        else if (strcasecmp(name, MDNS_SERVICE) == 0 && (type == TYPE_PTR || type == TYPE_ANY))
+            wantPtr = 1;
+        else if (strcasecmp(name, instance) == 0) {
+            wantSrv |= type == TYPE_SRV || type == TYPE_ANY;
+            wantTxt |= type == TYPE_TXT || type == TYPE_ANY;
+        }
+    }
+    if (!wantA && !wantPtr && !wantSrv && !wantTxt)
+        return;
+
+    /* a legacy unicast query, from a port other than 5353, gets its ID and questions back */
+    memset(pkt, 0, 12);
+    if (ntohs(from.sin_port) != MDNS_PORT) {
+        memcpy(pkt, query, 6);
+        memcpy(&pkt[12], &query[12], offset - 12);
+        len = offset;
+    }
+    else
+        len = 12;
+    pkt[2] = 0x84;              /* an authoritative response */
+    pkt[3] = 0;
+
+    /* the service instance, with what a browser needs to follow it as additional records */
+    if (wantPtr) {
+        cnt = encodeName(rdata, sizeof(rdata), instance);
+        len = addRecord(pkt, len, MDNS_SERVICE, TYPE_PTR, MDNS_OTHER_TTL, rdata, cnt);
+        ++answers;
+    }
+    if (wantSrv || wantPtr) {
+        memset(rdata, 0, 6);
+        rdata[4] = port >> 8;
+        rdata[5] = port;
+        cnt = 6 + encodeName(&rdata[6], sizeof(rdata) - 6, host);
+        len = addRecord(pkt, len, instance, TYPE_SRV, MDNS_HOST_TTL, rdata, cnt);
+        wantPtr ? ++extras : ++answers;
+    }
+    if (wantTxt || wantPtr) {
+        const char *txt[5];
+        char version[32], maxPacketSize[32];
+        snprintf(version, sizeof(version), "version=%s", VERSION);
+        snprintf(maxPacketSize, sizeof(maxPacketSize), "max-packet-size=%d", maxPost < MAX_PACKET_SIZE ? maxPost : MAX_PACKET_SIZE);
+        txt[0] = version;
+        txt[1] = maxPacketSize;
+        txt[2] = "loader=propeller";
+        txt[3] = "path=/propeller";
+        txt[4] = "mac=" MDNS_MAC;
+        for (i = 0, cnt = 0; i < 5; ++i) {
+            rdata[cnt] = strlen(txt[i]);
+            memcpy(&rdata[cnt + 1], txt[i], rdata[cnt]);
+            cnt += rdata[cnt] + 1;
+        }
+        len = addRecord(pkt, len, instance, TYPE_TXT, MDNS_OTHER_TTL, rdata, cnt);
+        wantPtr ? ++extras : ++answers;
+    }
+    if (wantA || wantSrv || wantPtr) {
+        uint32_t addr = htonl(INADDR_LOOPBACK);
+        memcpy(rdata, &addr, 4);
+        len = addRecord(pkt, len, host, TYPE_A, MDNS_HOST_TTL, rdata, 4);
+        wantA ? ++answers : ++extras;
+    }
+    if (len < 0)
+        return;
+    pkt[6] = answers >> 8;
+    pkt[7] = answers;
+    pkt[10] = extras >> 8;
+    pkt[11] = extras;
+
+    if (verbose) {
+        printf("mDNS: answered %s with %d records\n", AddressToString(&from), answers + extras);
+        fflush(stdout);
+    }
+    if (ntohs(from.sin_port) != MDNS_PORT)
+        SendSocketDataTo(sock, pkt, len, &from);
+    else {
+        SOCKADDR_IN group;
+        GetInternetAddress(MDNS_ADDRESS, MDNS_PORT, &group);
+        SendSocketDataTo(sock, pkt, len, &group);
+    }
+}
+
+/* addRecord - append a resource record, returning the new length (-1 once it doesn't fit) */
+static int addRecord(uint8_t *pkt, int len, const char *name, int type, int ttl, const uint8_t *rdata, int rdlen)
+{
+    int cnt, cls = CLASS_IN;
+
+    if (len < 0 || (cnt = encodeName(&pkt[len], MDNS_MAX_PACKET - len, name)) < 0 || len + cnt + 10 + rdlen > MDNS_MAX_PACKET)
+        return -1;
+    len += cnt;
+
+    /* every record but the PTR is this host's alone */
+    if (type != TYPE_PTR)
+        cls |= CLASS_FLUSH;
+    pkt[len++] = type >> 8;
+    pkt[len++] = type;
+    pkt[len++] = cls >> 8;
+    pkt[len++] = cls;
+    pkt[len++] = ttl >> 24;
+    pkt[len++] = ttl >> 16;
+    pkt[len++] = ttl >> 8;
+    pkt[len++] = ttl;
+    pkt[len++] = rdlen >> 8;
+    pkt[len++] = rdlen;
+    memcpy(&pkt[len], rdata, rdlen);
+
+    return len + rdlen;
+}
+
+static int encodeName(uint8_t *buf, int max, const char *name)
+{
+    int cnt = 0;
+
+    while (*name) {
+        int labelLen = strcspn(name, ".");
+        if (labelLen == 0 || labelLen > 63 || cnt + labelLen + 2 > max)
+            return -1;
+        buf[cnt++] = labelLen;
+        memcpy(&buf[cnt], name, labelLen);
+        cnt += labelLen;
+        name += labelLen;
+        if (*name == '.')
+            ++name;
+    }
+    buf[cnt++] = 0;
+
+    return cnt;
+}
+
+/* readName - decode a possibly compressed name, returning the offset just past it */
+static int readName(const uint8_t *pkt, int len, int offset, char *name, int nameMax)
+{
+    int next = -1, cnt = 0, jumps = 0;
+
+    while (offset < len) {
+        int labelLen = pkt[offset];
+        if (labelLen == 0) {
+            name[cnt > 0 ? cnt - 1 : 0] = '\0';
+            return next >= 0 ? next : offset + 1;
+        }
+        else if ((labelLen & 0xc0) == 0xc0) {
+            if (offset + 1 >= len || ++jumps > 16)
+                return -1;
+            if (next < 0)
+                next = offset + 2;
+            offset = ((labelLen & 0x3f) << 8) | pkt[offset + 1];
+        }
+        else {
+            if (offset + 1 + labelLen > len || cnt + labelLen + 1 >= nameMax)
+                return -1;
+            memcpy(&name[cnt], &pkt[offset + 1], labelLen);
+            cnt += labelLen;
+            name[cnt++] = '.';
+            offset += labelLen + 1;
+        }
+    }
+
+    return -1;
+}
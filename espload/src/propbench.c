@@ -0,0 +1,486 @@
+/* propbench - time the loader core's per-byte kernels and check their output against golden streams
+
+   The kernels are the ones every load runs over the whole image: the encoding of the image into
+   the ROM's download stream (ploadLoadImage), the image checksum (pimageUpdateChecksum), the
+   running checksum of the second-stage packets (fplUpdateChecksum) and the check of the ROM's
+   handshake response (ploadVerifyHandshakeResponse). Each runs over a few synthetic images and
+   any image files given. The serial port is replaced by a buffer, so the encoder's output can be
+   compared byte for byte with the stream recorded in the golden directory by an earlier run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "proploader.h"
+#include "fastproploader.h"
+#include "propimage.h"
+
+#define DEF_RUN_TIME        200     /* milliseconds to repeat each kernel for */
+#define MAX_INPUTS          32
+#define MAX_NAME            64
+#define SYNTH_SIZE          4096
+#define HANDSHAKE_BITS      250
+#define VERSION_BITS        8
+#define PROP_VERSION        1
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TICK_UNITS          "cycles/byte"
+#else
+#define TICK_UNITS          "ns/byte"
+#endif
+
+typedef struct {
+    char name[MAX_NAME];
+    uint8_t *data;          /* one byte longer than the image, ploadLoadImage reads a byte past the end */
+    int size;
+    uint8_t *stream;        /* what ploadLoadImage sent */
+    int streamSize;
+    int imageChecksum;      /* what pimageUpdateChecksum returned */
+    int32_t packetChecksum; /* connection->checksum after all the packets */
+} Input;
+
+static Input inputs[MAX_INPUTS];
+static int inputCount = 0;
+static PropellerConnection connection;
+static uint8_t handshake[sizeof(connection.buffer)];
+static uint8_t *txBuffer;
+static int txCount, txMax;
+static int runTime = DEF_RUN_TIME;
+
+static void addSynthetic(const char *name, int size, int fill);
+static int addFile(const char *path);
+static Input *newInput(const char *name, int size);
+static void makeHandshake(void);
+static void encodeKernel(Input *input);
+static void imageChecksumKernel(Input *input);
+static void packetChecksumKernel(Input *input);
+static void handshakeKernel(Input *input);
+static double timeKernel(void (*kernel)(Input *input), Input *input, int size);
+static uint64_t ticks(void);
+static uint64_t microseconds(void);
+static int recordGolden(const char *dir);
+static int checkGolden(const char *dir);
+static void Usage(void);
+
+int main(int argc, char *argv[])
+{
+    const char *goldenDir = NULL;
+    int recordMode = 0, version, errors, i;
+    Input *input;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-') {
+            if (addFile(argv[i]) != 0)
+                return 1;
+            continue;
+        }
+        switch (argv[i][1]) {
+        case 'g':
+            if (argv[i][2])
+                goldenDir = &argv[i][2];
+            else if (++i < argc)
+                goldenDir = argv[i];
+            else
+                Usage();
+            break;
+        case 'n':
+            if (argv[i][2])
+                runTime = atoi(&argv[i][2]);
+            else if (++i < argc)
+                runTime = atoi(argv[i]);
+            else
+                Usage();
+            break;
+        case 'w':
+            recordMode = 1;
+            break;
+        default:
+            Usage();
+            break;
+        }
+    }
+    if (recordMode && !goldenDir)
+        Usage();
+
+    /* the images the encoder finds easiest and hardest and one that doesn't end on a long */
+    addSynthetic("synth-zeros", SYNTH_SIZE, 0x00);
+    addSynthetic("synth-ones", SYNTH_SIZE, 0xFF);
+    addSynthetic("synth-random", SYNTH_SIZE, -1);
+    addSynthetic("synth-odd", SYNTH_SIZE - 3, -1);
+
+    memset(&connection, 0, sizeof(connection));
+    connection.baudRate = DEFAULT_BAUD_RATE;
+    connection.packetSize = MAX_PACKET_SIZE;
+
+    printf("%-16s %8s %10s %10s %10s   (%s)\n", "image", "bytes", "encode", "image", "packet", TICK_UNITS);
+    for (i = 0; i < inputCount; ++i) {
+        double encode, image, packet;
+        input = &inputs[i];
+
+        /* room for the command, the length field and at worst one byte per bit */
+        txMax = 11 + 11 + input->size * 8;
+        if (!(txBuffer = (uint8_t *)malloc(txMax))) {
+            printf("error: insufficient memory\n");
+            return 1;
+        }
+
+        encode = timeKernel(encodeKernel, input, input->size);
+        image = timeKernel(imageChecksumKernel, input, input->size);
+        packet = timeKernel(packetChecksumKernel, input, input->size);
+        printf("%-16s %8d %10.2f %10.2f %10.2f\n", input->name, input->size, encode, image, packet);
+
+        /* keep the results of the last run for the golden streams */
+        input->stream = txBuffer;
+        input->streamSize = txCount;
+        input->packetChecksum = connection.checksum;
+        txBuffer = NULL;
+    }
+
+    makeHandshake();
+    printf("handshake %.2f %s\n", timeKernel(handshakeKernel, NULL, sizeof(handshake)), TICK_UNITS);
+
+    /* the handshake isn't recorded, the ROM's answer is fixed */
+    errors = 0;
+    memcpy(connection.buffer, handshake, sizeof(handshake));
+    if (ploadVerifyHandshakeResponse(&connection, &version) != 0 || version != PROP_VERSION) {
+        printf("error: handshake response not accepted\n");
+        ++errors;
+    }
+    connection.buffer[sizeof(handshake) / 2] ^= 0x01;
+    if (ploadVerifyHandshakeResponse(&connection, &version) == 0) {
+        printf("error: corrupted handshake response accepted\n");
+        ++errors;
+    }
+
+    if (recordMode)
+        errors += recordGolden(goldenDir);
+    else if (goldenDir)
+        errors += checkGolden(goldenDir);
+
+    return errors == 0 ? 0 : 1;
+}
+
+static void Usage(void)
+{
+    printf("\
+usage: propbench\n\
+         [ -g <dir> ]      check the output against the golden streams in a directory\n\
+         [ -n <ms> ]       time to repeat each kernel for (default is %d)\n\
+         [ -w ]            record the golden streams instead of checking them\n\
+         [ <file>... ]     images to run besides the synthetic ones\n", DEF_RUN_TIME);
+    exit(1);
+}
+
+/* the serial port is a buffer */
+
+void halSerialTx(const uint8_t *buf, int len)
+{
+    if (txCount + len <= txMax)
+        memcpy(&txBuffer[txCount], buf, len);
+    txCount += len;
+}
+
+void halSerialTxByte(uint8_t byte)
+{
+    if (txCount < txMax)
+        txBuffer[txCount] = byte;
+    ++txCount;
+}
+
+void halSerialSetBaud(int baudRate)
+{
+}
+
+int halSerialTxQueued(void)
+{
+    return 0;
+}
+
+void halResetPin(int pin, int level)
+{
+}
+
+void halTimerArm(HalTimer *timer, int ms)
+{
+}
+
+void halTimerDisarm(HalTimer *timer)
+{
+}
+
+/* addSynthetic - an image of one byte value or, with a fill of -1, of xorshift noise */
+static void addSynthetic(const char *name, int size, int fill)
+{
+    uint32_t x = 2463534242u;
+    Input *input;
+    int i;
+
+    if (!(input = newInput(name, size)))
+        return;
+    for (i = 0; i < size; ++i) {
+        if (fill >= 0)
+            input->data[i] = fill;
+        else {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            input->data[i] = x;
+        }
+    }
+}
+
+/* addFile - an image from a file, named after the file without its directory or extension */
+static int addFile(const char *path)
+{
+    char name[MAX_NAME], *p;
+    Input *input;
+    FILE *fp;
+    int size;
+
+    if (!(fp = fopen(path, "rb"))) {
+        printf("error: can't open '%s'\n", path);
+        return -1;
+    }
+    fseek(fp, 0, SEEK_END);
+    size = (int)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if ((p = strrchr(path, '/')) != NULL)
+        path = p + 1;
+    strncpy(name, path, sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    if ((p = strrchr(name, '.')) != NULL)
+        *p = '\0';
+
+    if (size < (int)sizeof(SpinHdr) || !(input = newInput(name, size))) {
+        printf("error: can't use '%s'\n", path);
+        fclose(fp);
+        return -1;
+    }
+    if ((int)fread(input->data, 1, size, fp) != size) {
+        printf("error: can't read '%s'\n", path);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+static Input *newInput(const char *name, int size)
+{
+    Input *input;
+
+    if (inputCount >= MAX_INPUTS)
+        return NULL;
+    input = &inputs[inputCount];
+    if (!(input->data = (uint8_t *)calloc(size + 1, 1)))
+        return NULL;
+    strncpy(input->name, name, sizeof(input->name) - 1);
+    input->size = size;
+    ++inputCount;
+
+    return input;
+}
+
+/* makeHandshake - the ROM's answer: the 250 LFSR bits after the ones we send, then its version */
+static void makeHandshake(void)
+{
+    uint8_t lfsr = 'P';
+    int bits = 0, bit, i;
+
+    for (i = 0; i < HANDSHAKE_BITS * 2 + VERSION_BITS; ++i) {
+        if (i < HANDSHAKE_BITS * 2) {
+            bit = lfsr & 1;
+            lfsr = ((lfsr << 1) & 0xFE) | (((lfsr >> 7) ^ (lfsr >> 5) ^ (lfsr >> 4) ^ (lfsr >> 1)) & 1);
+            if (i < HANDSHAKE_BITS)
+                continue;
+        }
+        else
+            bit = (PROP_VERSION >> (i - HANDSHAKE_BITS * 2)) & 1;
+
+        /* two bits to a byte */
+        if (++bits & 1)
+            handshake[bits / 2] = 0xCE | bit;
+        else
+            handshake[bits / 2 - 1] |= bit << 5;
+    }
+}
+
+static void encodeKernel(Input *input)
+{
+    txCount = 0;
+    ploadLoadImage(&connection, ltDownloadAndRun, input->data, input->size);
+}
+
+static void imageChecksumKernel(Input *input)
+{
+    PropellerImage image;
+    uint8_t chksum = input->data[offsetof(SpinHdr, chksum)];
+
+    /* the checksum byte is rewritten, put it back so the image still matches its golden stream */
+    pimageSetImage(&image, input->data, input->size);
+    input->imageChecksum = pimageUpdateChecksum(&image);
+    input->data[offsetof(SpinHdr, chksum)] = chksum;
+}
+
+/* packetChecksumKernel - as the load-data requests do it, a packet at a time */
+static void packetChecksumKernel(Input *input)
+{
+    int offset, size;
+
+    connection.checksum = 0;
+    for (offset = 0; offset < input->size; offset += size) {
+        if ((size = input->size - offset) > connection.packetSize)
+            size = connection.packetSize;
+        fplUpdateChecksum(&connection, input->data + offset, size);
+    }
+}
+
+static void handshakeKernel(Input *input)
+{
+    int version;
+    memcpy(connection.buffer, handshake, sizeof(handshake));
+    ploadVerifyHandshakeResponse(&connection, &version);
+}
+
+/* timeKernel - the fastest of the runs in the time allowed, per byte of input */
+static double timeKernel(void (*kernel)(Input *input), Input *input, int size)
+{
+    uint64_t deadline, start, best = 0, elapsed;
+    int runs = 0;
+
+    deadline = microseconds() + (uint64_t)runTime * 1000;
+    do {
+        start = ticks();
+        (*kernel)(input);
+        elapsed = ticks() - start;
+        if (runs++ == 0 || elapsed < best)
+            best = elapsed;
+    } while (microseconds() < deadline);
+
+    return (double)best / size;
+}
+
+static uint64_t ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static uint64_t microseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* recordGolden - write <name>.pdst with each download stream and checksums.txt with the checksums */
+static int recordGolden(const char *dir)
+{
+    char path[1024];
+    FILE *fp;
+    int i;
+
+    for (i = 0; i < inputCount; ++i) {
+        snprintf(path, sizeof(path), "%s/%s.pdst", dir, inputs[i].name);
+        if (!(fp = fopen(path, "wb"))) {
+            printf("error: can't create '%s'\n", path);
+            return 1;
+        }
+        fwrite(inputs[i].stream, 1, inputs[i].streamSize, fp);
+        fclose(fp);
+    }
+
+    snprintf(path, sizeof(path), "%s/checksums.txt", dir);
+    if (!(fp = fopen(path, "w"))) {
+        printf("error: can't create '%s'\n", path);
+        return 1;
+    }
+    for (i = 0; i < inputCount; ++i)
+        fprintf(fp, "%s %d %d %d\n", inputs[i].name, inputs[i].size, inputs[i].imageChecksum, inputs[i].packetChecksum);
+    fclose(fp);
+
+    printf("recorded %d golden streams in %s\n", inputCount, dir);
+    return 0;
+}
+
+/* checkGolden - compare each stream and the checksums with what was recorded */
+static int checkGolden(const char *dir)
+{
+    char path[1024], name[MAX_NAME];
+    int size, imageChecksum, packetChecksum, errors = 0, found, i, j;
+    uint8_t *golden;
+    FILE *fp;
+
+    for (i = 0; i < inputCount; ++i) {
+        Input *input = &inputs[i];
+        snprintf(path, sizeof(path), "%s/%s.pdst", dir, input->name);
+        if (!(fp = fopen(path, "rb"))) {
+            printf("error: no golden stream for %s\n", input->name);
+            ++errors;
+            continue;
+        }
+        fseek(fp, 0, SEEK_END);
+        size = (int)ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        if (!(golden = (uint8_t *)malloc(size)) || (int)fread(golden, 1, size, fp) != size) {
+            printf("error: can't read '%s'\n", path);
+            fclose(fp);
+            free(golden);
+            return errors + 1;
+        }
+        fclose(fp);
+
+        for (j = 0; j < size && j < input->streamSize; ++j)
+            if (input->stream[j] != golden[j])
+                break;
+        if (j < size || j < input->streamSize) {
+            printf("error: %s stream differs at byte %d of %d (golden %d)\n", input->name, j, input->streamSize, size);
+            ++errors;
+        }
+        free(golden);
+    }
+
+    snprintf(path, sizeof(path), "%s/checksums.txt", dir);
+    if (!(fp = fopen(path, "r"))) {
+        printf("error: can't open '%s'\n", path);
+        return errors + 1;
+    }
+    for (i = 0; i < inputCount; ++i) {
+        Input *input = &inputs[i];
+        found = 0;
+        rewind(fp);
+        while (fscanf(fp, "%63s %d %d %d", name, &size, &imageChecksum, &packetChecksum) == 4) {
+            if (strcmp(name, input->name) == 0) {
+                found = 1;
+                break;
+            }
+        }
+        if (!found)
+            printf("error: no golden checksums for %s\n", input->name);
+        else if (size != input->size || imageChecksum != input->imageChecksum || packetChecksum != input->packetChecksum)
+            printf("error: %s checksums %d %d, golden %d %d\n", input->name,
+                   input->imageChecksum, input->packetChecksum, imageChecksum, packetChecksum);
+        else
+            continue;
+        ++errors;
+    }
+    fclose(fp);
+
+    if (errors == 0)
+        printf("all %d streams match the golden ones\n", inputCount);
+    return errors;
+}
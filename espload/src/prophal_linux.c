@@ -0,0 +1,208 @@
+/* prophal_linux.c - serial port, reset and timer backend for running the loader core on a Linux host
+
+   Any baud rate the USB serial adapter supports can be set through termios2. The reset line is
+   either DTR (the Prop Plug wiring), a sysfs GPIO named "gpio<n>" (a Raspberry Pi header) or any
+   file that takes '0' and '1', like the reset FIFO of propsim.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+#include "prophal.h"
+
+#define GPIO_EXPORT_DELAY   100     /* milliseconds for udev to set up a newly exported GPIO */
+
+static int serialFd = -1;
+static int resetFd = -1;
+
+static int openGpio(int gpio);
+static void writeFile(const char *path, const char *value);
+
+int halSerialOpen(const char *port, const char *reset, int baudRate)
+{
+    struct termios2 tio;
+
+    if ((serialFd = open(port, O_RDWR | O_NOCTTY)) < 0) {
+        printf("error: can't open '%s'\n", port);
+        return -1;
+    }
+
+    /* raw 8N1 with reads that don't wait, halSerialRx does its own timing */
+    if (ioctl(serialFd, TCGETS2, &tio) != 0) {
+        printf("error: '%s' isn't a serial port\n", port);
+        close(serialFd);
+        serialFd = -1;
+        return -1;
+    }
+    tio.c_iflag = IGNBRK;
+    tio.c_oflag = 0;
+    tio.c_lflag = 0;
+    tio.c_cflag = CS8 | CREAD | CLOCAL | BOTHER;
+    tio.c_ispeed = tio.c_ospeed = baudRate;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (ioctl(serialFd, TCSETS2, &tio) != 0) {
+        printf("error: can't set '%s' to %d baud\n", port, baudRate);
+        close(serialFd);
+        serialFd = -1;
+        return -1;
+    }
+
+    /* DTR is used when nothing else is given */
+    if (reset && strcmp(reset, "dtr") != 0) {
+        if (strncmp(reset, "gpio", 4) == 0)
+            resetFd = openGpio(atoi(&reset[4]));
+        else
+            resetFd = open(reset, O_WRONLY);
+        if (resetFd < 0) {
+            printf("error: can't open reset '%s'\n", reset);
+            close(serialFd);
+            serialFd = -1;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void halSerialClose(void)
+{
+    if (serialFd >= 0) {
+        ioctl(serialFd, TCSBRK, 1);
+        close(serialFd);
+        serialFd = -1;
+    }
+    if (resetFd >= 0) {
+        close(resetFd);
+        resetFd = -1;
+    }
+}
+
+void halSerialTx(const uint8_t *buf, int len)
+{
+    while (len > 0) {
+        int cnt = write(serialFd, buf, len);
+        if (cnt < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            return;
+        }
+        buf += cnt;
+        len -= cnt;
+    }
+}
+
+void halSerialTxByte(uint8_t byte)
+{
+    halSerialTx(&byte, 1);
+}
+
+/* halSerialSetBaud - change the baud rate once what has been written is on the wire */
+void halSerialSetBaud(int baudRate)
+{
+    struct termios2 tio;
+    if (ioctl(serialFd, TCGETS2, &tio) == 0) {
+        tio.c_cflag = (tio.c_cflag & ~CBAUD) | BOTHER;
+        tio.c_ispeed = tio.c_ospeed = baudRate;
+        ioctl(serialFd, TCSETSW2, &tio);
+    }
+}
+
+/* halResetPin - the pin number is the firmware's GPIO, the host always uses the reset it was opened with */
+void halResetPin(int pin, int level)
+{
+    if (resetFd >= 0) {
+        if (write(resetFd, level ? "1" : "0", 1) != 1)
+            printf("error: can't set the reset line\n");
+    }
+    else {
+        int bits = TIOCM_DTR;
+        ioctl(serialFd, level ? TIOCMBIC : TIOCMBIS, &bits);
+    }
+}
+
+/* halSerialRx - read up to len bytes, returns the number read once they arrive or the timeout passes */
+int halSerialRx(uint8_t *buf, int len, int timeout)
+{
+    uint64_t deadline = halMilliseconds() + (timeout > 0 ? timeout : 0);
+    int total = 0;
+
+    while (total < len) {
+        struct pollfd pfd;
+        uint64_t now = halMilliseconds();
+        int cnt;
+
+        if (now >= deadline)
+            break;
+        pfd.fd = serialFd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, (int)(deadline - now)) <= 0)
+            continue;
+        if ((cnt = read(serialFd, buf + total, len - total)) > 0)
+            total += cnt;
+    }
+
+    return total;
+}
+
+/* halSerialTxQueued - bytes written that the port hasn't sent yet */
+int halSerialTxQueued(void)
+{
+    int queued;
+    if (ioctl(serialFd, TIOCOUTQ, &queued) != 0)
+        return 0;
+    return queued;
+}
+
+void halTimerArm(HalTimer *timer, int ms)
+{
+    timer->deadline = halMilliseconds() + ms;
+}
+
+void halTimerDisarm(HalTimer *timer)
+{
+    timer->deadline = 0;
+}
+
+uint64_t halMilliseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* openGpio - export a sysfs GPIO as an output that starts high (reset released) */
+static int openGpio(int gpio)
+{
+    char path[64], value[16];
+
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", gpio);
+    if (access(path, F_OK) != 0) {
+        snprintf(value, sizeof(value), "%d", gpio);
+        writeFile("/sys/class/gpio/export", value);
+        usleep(GPIO_EXPORT_DELAY * 1000);
+    }
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/direction", gpio);
+    writeFile(path, "high");
+
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", gpio);
+    return open(path, O_WRONLY);
+}
+
+static void writeFile(const char *path, const char *value)
+{
+    int fd;
+    if ((fd = open(path, O_WRONLY)) >= 0) {
+        if (write(fd, value, strlen(value)) < 0)
+            printf("error: can't write '%s'\n", path);
+        close(fd);
+    }
+}
@@ -0,0 +1,300 @@
+/* propload - load a Propeller over a local serial port with the same loader core esp-link runs
+
+   This walks the steps cgiprop.c goes through for a load-begin, the load-data requests and a
+   load-end but with the image coming from a file, so a wired load can be timed against one
+   over WiFi with espload.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "proploader.h"
+#include "fastproploader.h"
+#include "propimage.h"
+
+#define DEF_PORT            "/dev/ttyUSB0"
+
+static int verbose = 0;
+
+static int loadImage(PropellerConnection *connection, const uint8_t *image, int imageSize);
+static int resetAndStartLoader(PropellerConnection *connection, int imageSize);
+static int waitForAck(PropellerConnection *connection, const char *what);
+static int timerRemaining(PropellerConnection *connection);
+static uint8_t *readFile(const char *fileName, int *pSize);
+static void Usage(void);
+
+int main(int argc, char *argv[])
+{
+    const char *port = DEF_PORT, *reset = NULL, *fileName = NULL;
+    PropellerConnection connection;
+    uint8_t *image;
+    int imageSize, ret, i;
+
+    memset(&connection, 0, sizeof(connection));
+    connection.baudRate = DEFAULT_BAUD_RATE;
+    connection.secondStageBaudRate = DEFAULT_SECOND_STAGE_BAUD;
+    connection.finalBaudRate = 0;
+    connection.packetSize = MAX_PACKET_SIZE;
+    connection.eepromClock = DEFAULT_EEPROM_CLOCK;
+    connection.loadType = ltDownloadAndRun;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        const char *value;
+        int opt;
+        if (argv[i][0] != '-') {
+            if (fileName)
+                Usage();
+            fileName = argv[i];
+            continue;
+        }
+        if (!(opt = argv[i][1]))
+            Usage();
+        if (opt == 'e') {
+            connection.loadType = ltDownloadAndProgramAndRun;
+            continue;
+        }
+        if (opt == 'v') {
+            verbose = 1;
+            continue;
+        }
+        if (argv[i][2])
+            value = &argv[i][2];
+        else if (++i < argc)
+            value = argv[i];
+        else
+            Usage();
+        switch (opt) {
+        case 'b': connection.baudRate = atoi(value); break;
+        case 'B': connection.secondStageBaudRate = atoi(value); break;
+        case 'c': connection.eepromClock = atoi(value); break;
+        case 'f': connection.finalBaudRate = atoi(value); break;
+        case 'p': port = value; break;
+        case 'r': reset = value; break;
+        case 's': connection.packetSize = atoi(value); break;
+        default:  Usage(); break;
+        }
+    }
+    if (!fileName || connection.baudRate <= 0 || connection.secondStageBaudRate <= 0
+    ||  connection.packetSize < 1 || connection.packetSize > MAX_PACKET_SIZE
+    ||  connection.eepromClock <= 0 || connection.eepromClock > MAX_EEPROM_CLOCK)
+        Usage();
+    if (connection.finalBaudRate <= 0)
+        connection.finalBaudRate = connection.baudRate;
+
+    if (!(image = readFile(fileName, &imageSize))) {
+        printf("error: can't read '%s'\n", fileName);
+        return 1;
+    }
+
+    /* the second-stage loader runs at the image's clock when it is crystal driven */
+    if (imageSize >= (int)sizeof(SpinHdr)) {
+        PropellerImage header;
+        pimageSetImage(&header, image, imageSize);
+        connection.clockFreq = pimageClkFreq(&header);
+        connection.clockMode = pimageClkMode(&header);
+    }
+
+    if (halSerialOpen(port, reset, connection.baudRate) != 0)
+        return 1;
+
+    ret = loadImage(&connection, image, imageSize);
+
+    halSerialClose();
+    free(image);
+
+    return ret == 0 ? 0 : 1;
+}
+
+static void Usage(void)
+{
+    printf("\
+usage: propload\n\
+         [ -b <baud> ]     initial baud rate (default is %d)\n\
+         [ -B <baud> ]     second-stage baud rate (default is %d)\n\
+         [ -c <hz> ]       I2C clock for programming the EEPROM (default is %d)\n\
+         [ -e ]            program the EEPROM before running\n\
+         [ -f <baud> ]     baud rate to leave the port at (default is the initial rate)\n\
+         [ -p <port> ]     serial port (default is %s)\n\
+         [ -r <reset> ]    dtr, gpio<n> or a file that takes '0' and '1' (default is dtr)\n\
+         [ -s <size> ]     second-stage packet size (default is %d)\n\
+         [ -v ]            verbose output\n\
+         <file>            binary image to load\n", DEFAULT_BAUD_RATE, DEFAULT_SECOND_STAGE_BAUD, DEFAULT_EEPROM_CLOCK, DEF_PORT, MAX_PACKET_SIZE);
+    exit(1);
+}
+
+/* loadImage - the whole load, from reset to launch */
+static int loadImage(PropellerConnection *connection, const uint8_t *image, int imageSize)
+{
+    uint64_t start, loaderTime, dataTime, endTime;
+    int offset, size;
+
+    start = halMilliseconds();
+
+    /* load-begin */
+    if (resetAndStartLoader(connection, imageSize) != 0)
+        return -1;
+    loaderTime = halMilliseconds();
+
+    /* load-data, with the packet resent when its ack doesn't come */
+    for (offset = 0; offset < imageSize; offset += size) {
+        if ((size = imageSize - offset) > connection->packetSize)
+            size = connection->packetSize;
+        memcpy(connection->packet, image + offset, size);
+        connection->packetLength = size;
+        connection->dataRetriesRemaining = DATA_RETRIES;
+        fplUpdateChecksum(connection, connection->packet, connection->packetLength);
+        fplData(connection, connection->packet, connection->packetLength);
+        while (waitForAck(connection, "data") != 0) {
+            if (connection->dataRetriesRemaining-- <= 0)
+                return -1;
+            if (verbose)
+                printf("resending packet at offset %d\n", offset);
+            fplData(connection, connection->packet, connection->packetLength);
+        }
+        connection->bytesLoaded += size;
+    }
+    dataTime = halMilliseconds();
+
+    /* load-end */
+    fplVerifyRAM(connection);
+    if (waitForAck(connection, "verify RAM") != 0)
+        return -1;
+    if (connection->loadType & ltDownloadAndProgram) {
+        fplProgramVerifyEEPROM(connection);
+        if (waitForAck(connection, "program and verify EEPROM") != 0)
+            return -1;
+    }
+    fplReadyToLaunch(connection);
+    if (waitForAck(connection, "ready to launch") != 0)
+        return -1;
+    fplLaunchNow(connection);
+    halSerialSetBaud(connection->finalBaudRate);
+    endTime = halMilliseconds();
+
+    printf("loaded %d bytes in %d ms: loader %d ms, data %d ms (%d bytes/sec), launch %d ms\n",
+           imageSize, (int)(endTime - start), (int)(loaderTime - start), (int)(dataTime - loaderTime),
+           dataTime > loaderTime ? (int)((uint64_t)imageSize * 1000 / (dataTime - loaderTime)) : 0,
+           (int)(endTime - dataTime));
+
+    return 0;
+}
+
+/* resetAndStartLoader - reset the Propeller, load the second-stage loader through the ROM and wait for it to start */
+static int resetAndStartLoader(PropellerConnection *connection, int imageSize)
+{
+    PropellerImage loaderImage;
+    uint8_t response;
+    int version;
+
+    if (fplGenerateInitialLoaderImage(connection, imageSize, &loaderImage) != 0) {
+        printf("error: generate loader image failed\n");
+        return -1;
+    }
+
+    /* the same reset pulse the firmware gives */
+    halResetPin(connection->resetPin, 1);
+    usleep(RESET_DELAY_1 * 1000);
+    halResetPin(connection->resetPin, 0);
+    usleep(RESET_DELAY_2 * 1000);
+    halResetPin(connection->resetPin, 1);
+    usleep(RESET_DELAY_3 * 1000);
+
+    ploadInitiateHandshake(connection);
+    if (halSerialRx(connection->buffer, connection->bytesRemaining, RX_HANDSHAKE_TIMEOUT) != connection->bytesRemaining) {
+        printf("error: RX handshake timeout\n");
+        return -1;
+    }
+    if (ploadVerifyHandshakeResponse(connection, &version) != 0) {
+        printf("error: RX handshake failed\n");
+        return -1;
+    }
+    if (verbose)
+        printf("found a version %d Propeller\n", version);
+
+    if (ploadLoadImage(connection, ltDownloadAndRun, loaderImage.imageData, loaderImage.imageSize) != 0) {
+        printf("error: load image failed\n");
+        return -1;
+    }
+
+    /* poll for the checksum result once the stream has gone out */
+    usleep(connection->drainDelay);
+    for (;;) {
+        if (connection->retriesRemaining-- <= 0) {
+            printf("error: checksum timeout\n");
+            return -1;
+        }
+        halSerialTxByte(0xF9);
+        if (halSerialRx(&response, 1, (connection->retryDelay + 999) / 1000) == 1)
+            break;
+    }
+    if (response != 0xFE) {
+        printf("error: checksum error\n");
+        return -1;
+    }
+
+    /* the second-stage loader announces itself at the initial baud rate */
+    connection->packetTag = 0;
+    halTimerArm(&connection->timer, STARTUP_TIMEOUT);
+    if (waitForAck(connection, "second-stage loader startup") != 0)
+        return -1;
+    connection->packetID = connection->expectedID;
+    halSerialSetBaud(connection->secondStageBaudRate);
+
+    return 0;
+}
+
+/* waitForAck - wait for the ack of the last packet until the timer the loader core armed runs out */
+static int waitForAck(PropellerConnection *connection, const char *what)
+{
+    uint8_t *buf = connection->buffer;
+
+    if (halSerialRx(buf, sizeof(fplResponse), timerRemaining(connection)) != sizeof(fplResponse)) {
+        printf("error: %s timeout\n", what);
+        return -1;
+    }
+    halTimerDisarm(&connection->timer);
+
+    if (fplGetLong(&buf[4]) != connection->packetTag) {
+        printf("error: %s: wrong tag: expected %d, got %d\n", what, (int)connection->packetTag, (int)fplGetLong(&buf[4]));
+        return -1;
+    }
+    if (fplGetLong(&buf[0]) != connection->expectedID) {
+        printf("error: %s: wrong id: expected %d, got %d\n", what, (int)connection->expectedID, (int)fplGetLong(&buf[0]));
+        return -1;
+    }
+    connection->packetID = connection->expectedID;
+
+    return 0;
+}
+
+static int timerRemaining(PropellerConnection *connection)
+{
+    uint64_t now = halMilliseconds();
+    return connection->timer.deadline > now ? (int)(connection->timer.deadline - now) : 0;
+}
+
+static uint8_t *readFile(const char *fileName, int *pSize)
+{
+    uint8_t *image;
+    FILE *fp;
+
+    if (!(fp = fopen(fileName, "rb")))
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    *pSize = (int)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (!(image = (uint8_t *)malloc(*pSize))) {
+        fclose(fp);
+        return NULL;
+    }
+    if ((int)fread(image, 1, *pSize, fp) != *pSize) {
+        fclose(fp);
+        free(image);
+        return NULL;
+    }
+    fclose(fp);
+    return image;
+}
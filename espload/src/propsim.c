@@ -0,0 +1,750 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "propsim.h"
+
+/* the second-stage loader image and the code packets cgiprop.c sends to it */
+#include "IP_Loader.h"
+
+#define ROM_MAX_BAUD            230400  /* fastest rate the ROM can follow running on RCFAST */
+#define ROM_CHECKSUM_TIME       5000    /* microseconds for the ROM to checksum RAM */
+#define LOADER_START_TIME       2000    /* microseconds for the ROM to start the loader image */
+#define LOADER_PACKET_TIME      20      /* microseconds for the loader to handle a packet */
+#define VERIFY_RAM_TIME         2000    /* microseconds for the loader to checksum RAM */
+#define EEPROM_PAGE_TIME        5000    /* microseconds to write a 64 byte EEPROM page */
+#define EEPROM_VERIFY_TIME      750000  /* microseconds for the ROM to read back 32K at 400 KHz */
+#define I2C_BIT_OVERHEAD        48      /* cycles the loader's I2C code adds to the SCL high and low times a bit */
+#define MIN_SCL_HIGH_TIME       260     /* nanoseconds, the shortest any EEPROM takes (fast mode plus) */
+#define MIN_SCL_LOW_TIME        500
+#define HANDSHAKE_BITS          250
+#define VERSION_BITS            8
+#define MAX_PACKET              8192
+#define MAX_TX_QUEUE            64
+#define BAUD_TOLERANCE          2       /* percent a UART can be off and still read every bit */
+
+/* offset from the end of the loader image of the values cgiprop.c fills in */
+#define LOADER_INIT_OFFSET      ((int)sizeof(rawLoaderImage) - (10 * 4) - 8)
+
+typedef struct {
+    uint64_t time;              /* when the last byte has been sent (nanoseconds) */
+    int baudRate;
+    int len;
+    uint8_t buf[132];
+} PropSimTx;
+
+struct PropSim {
+    PropSimTransmit *transmit;
+    PropSimEvent *event;
+    void *data;
+    PropSimState state;
+    PropSimStats stats;
+
+    /* the serial lines, in nanoseconds */
+    uint64_t rxFree;            /* when the host's last byte will have arrived */
+    uint64_t txFree;            /* when the Propeller's last byte will have been sent */
+    uint64_t busyUntil;         /* the Propeller isn't listening until this time */
+
+    /* ROM boot loader */
+    uint8_t lfsr;
+    int bitCount;
+    uint32_t value;
+    int templateHalf;           /* the '1' of a '1' '0' timing template has been seen */
+    int templates;
+    int responseBits;
+    int command;
+    int longs;
+    int checksumOk;
+    int programStep;
+    uint8_t ram[PROPSIM_RAM_SIZE];
+    int imageSize;
+    uint8_t eeprom[PROPSIM_RAM_SIZE];
+    int eepromSize;
+
+    /* second-stage loader */
+    int initialBaud;
+    int finalBaud;
+    int32_t expectedID;
+    int32_t lastID;
+    int dataSize;
+    uint64_t eopTime;           /* idle time that ends a packet */
+    uint64_t failsafeTime;      /* idle time after which the loader gives up */
+    uint64_t lastByteTime;      /* when the last byte of the packet being received arrived */
+    uint64_t failsafeDeadline;
+    uint64_t i2cBitTime;        /* nanoseconds the loader takes to clock a bit to or from the EEPROM */
+    int i2cTooFast;             /* its SCL times are shorter than an EEPROM can follow */
+    uint8_t packet[MAX_PACKET];
+    int packetLength;
+
+    PropSimTx txQueue[MAX_TX_QUEUE];
+    int txCount;
+};
+
+static const uint8_t initCallFrame[] = { 0xFF, 0xFF, 0xF9, 0xFF, 0xFF, 0xFF, 0xF9, 0xFF };
+
+static void romByte(PropSim *sim, uint64_t time, uint8_t byte);
+static void romBit(PropSim *sim, uint64_t time, int bit);
+static void romTemplate(PropSim *sim, uint64_t time);
+static void launch(PropSim *sim, uint64_t time, const uint8_t *image, int imageSize, const char *how);
+static void startLoader(PropSim *sim, uint64_t time);
+static void loaderByte(PropSim *sim, uint64_t start, uint64_t end, uint8_t byte);
+static void loaderPacket(PropSim *sim, uint64_t time);
+static void loaderAck(PropSim *sim, uint64_t time, int32_t id, int32_t tag, int baudRate);
+static void halt(PropSim *sim, uint64_t time, const char *reason);
+static void transmit(PropSim *sim, uint64_t time, const uint8_t *buf, int len, int baudRate);
+static void report(PropSim *sim, uint64_t time, const char *format, ...);
+static int lfsrBit(PropSim *sim);
+static int decodePulses(uint8_t byte, int *bits);
+static int isLoaderImage(const uint8_t *image, int imageSize);
+static int sameBaud(int baud1, int baud2);
+static int lineLevel(const uint8_t *buf, int len, double bitTime, double time);
+static uint32_t getLong(const uint8_t *buf);
+static void setLong(uint8_t *buf, uint32_t value);
+
+PropSim *PropSimOpen(PropSimTransmit *transmit, PropSimEvent *event, void *data)
+{
+    PropSim *sim;
+
+    if (!(sim = (PropSim *)calloc(1, sizeof(PropSim))))
+        return NULL;
+    sim->transmit = transmit;
+    sim->event = event;
+    sim->data = data;
+
+    /* start out of reset with the ROM waiting for a host */
+    PropSimReset(sim, 0, 0);
+    PropSimReset(sim, 0, 1);
+
+    return sim;
+}
+
+void PropSimClose(PropSim *sim)
+{
+    free(sim);
+}
+
+/* PropSimReset - drive the RESn pin: 0 holds the Propeller in reset, 1 lets the ROM run */
+void PropSimReset(PropSim *sim, uint64_t now, int level)
+{
+    uint64_t time = now * 1000;
+
+    if (!level) {
+        sim->state = psReset;
+        sim->txCount = 0;
+        return;
+    }
+    if (sim->state != psReset)
+        return;
+
+    memset(sim->ram, 0, sizeof(sim->ram));
+    memset(&sim->stats, 0, sizeof(sim->stats));
+    sim->stats.resetTime = now;
+    sim->state = psRomCalibrate;
+    sim->lfsr = 'P';
+    sim->bitCount = 0;
+    sim->templateHalf = 0;
+    sim->templates = 0;
+    sim->imageSize = 0;
+    sim->packetLength = 0;
+    sim->rxFree = sim->txFree = sim->busyUntil = time;
+}
+
+/* PropSimReceive - put bytes the host wrote at baudRate on the line */
+void PropSimReceive(PropSim *sim, uint64_t now, const uint8_t *buf, int len, int baudRate)
+{
+    uint64_t byteTime = 10000000000ULL / baudRate;
+    uint64_t time = now * 1000;
+    uint8_t *converted = NULL;
+    int i;
+
+    /* catch up on packet ends and timeouts before the new bytes */
+    PropSimPoll(sim, now);
+
+    /* bytes written while the line is still busy follow the ones before them */
+    if (sim->rxFree > time)
+        time = sim->rxFree;
+
+    switch (sim->state) {
+    case psReset:
+    case psLaunched:
+    case psShutdown:
+        break;
+
+    /* the ROM times the pulses in each byte, it doesn't care about the baud rate until it's too fast */
+    case psRomCalibrate:
+    case psRomHandshake:
+    case psRomRxHandshake:
+    case psRomCommand:
+    case psRomLength:
+    case psRomImage:
+    case psRomChecksum:
+    case psRomProgram:
+        for (i = 0; i < len && sim->state >= psRomCalibrate && sim->state <= psRomProgram; ++i) {
+            time += byteTime;
+            if (baudRate > ROM_MAX_BAUD)
+                halt(sim, time, "baud rate too fast for the ROM");
+            else
+                romByte(sim, time, buf[i]);
+        }
+        break;
+
+    /* the loader samples bits at its own rate, so a mismatched host garbles them */
+    case psLoader:
+        if (!sameBaud(baudRate, sim->finalBaud)) {
+            if (!(converted = (uint8_t *)malloc(len * 5 + 1)))
+                break;
+            len = PropSimConvertBaud(buf, len, baudRate, sim->finalBaud, converted);
+            buf = converted;
+            byteTime = 10000000000ULL / sim->finalBaud;
+            ++sim->stats.framingErrors;
+        }
+        for (i = 0; i < len; ++i) {
+            loaderByte(sim, time, time + byteTime, buf[i]);
+            time += byteTime;
+        }
+        break;
+    }
+
+    sim->rxFree = time;
+    if (converted)
+        free(converted);
+}
+
+/* PropSimPoll - run the timeouts and deliver what has been sent, returns microseconds to the next event (-1 for none) */
+int64_t PropSimPoll(PropSim *sim, uint64_t now)
+{
+    uint64_t time = now * 1000, next = 0;
+    int i;
+
+    /* a quiet line ends a packet */
+    if (sim->state == psLoader && sim->packetLength > 0) {
+        if (time >= sim->lastByteTime + sim->eopTime)
+            loaderPacket(sim, sim->lastByteTime + sim->eopTime);
+        else
+            next = sim->lastByteTime + sim->eopTime;
+    }
+
+    /* the loader gives up when the host stops sending, rebooting from EEPROM */
+    if (sim->state == psLoader && sim->packetLength == 0) {
+        if (time >= sim->failsafeDeadline) {
+            report(sim, sim->failsafeDeadline, "loader failsafe timeout");
+            if (sim->eepromSize > 0)
+                launch(sim, sim->failsafeDeadline, sim->eeprom, sim->eepromSize, "from EEPROM");
+            else
+                halt(sim, sim->failsafeDeadline, "loader failsafe timeout with nothing in EEPROM");
+        }
+        else if (!next || sim->failsafeDeadline < next)
+            next = sim->failsafeDeadline;
+    }
+
+    /* deliver what has been completely sent */
+    while (sim->txCount > 0 && sim->txQueue[0].time <= time) {
+        PropSimTx tx = sim->txQueue[0];
+        for (i = 1; i < sim->txCount; ++i)
+            sim->txQueue[i - 1] = sim->txQueue[i];
+        --sim->txCount;
+        if (sim->transmit)
+            (*sim->transmit)(sim->data, tx.buf, tx.len, tx.baudRate);
+    }
+    if (sim->txCount > 0 && (!next || sim->txQueue[0].time < next))
+        next = sim->txQueue[0].time;
+
+    return next ? (int64_t)((next - time + 999) / 1000) : -1;
+}
+
+PropSimState PropSimGetState(PropSim *sim)
+{
+    return sim->state;
+}
+
+const PropSimStats *PropSimGetStats(PropSim *sim)
+{
+    return &sim->stats;
+}
+
+/* PropSimConvertBaud - what a UART at rxBaud reads from back-to-back bytes sent at txBaud */
+int PropSimConvertBaud(const uint8_t *in, int len, int txBaud, int rxBaud, uint8_t *out)
+{
+    double txBit = 1.0 / txBaud, rxBit = 1.0 / rxBaud, t = 0, end = len * 10 * txBit;
+    int cnt = 0;
+
+    if (sameBaud(txBaud, rxBaud)) {
+        memcpy(out, in, len);
+        return len;
+    }
+
+    while (t < end) {
+        int byte = 0, bit;
+
+        /* wait for the line to go low, it can only change on a transmitted bit boundary,
+           stepping a hair past it since rounding can put the boundary back in the bit before */
+        if (lineLevel(in, len, txBit, t)) {
+            t = ((int)(t / txBit) + 1.000001) * txBit;
+            continue;
+        }
+
+        /* a glitch rather than a start bit */
+        if (lineLevel(in, len, txBit, t + rxBit / 2)) {
+            t += rxBit / 2;
+            continue;
+        }
+
+        for (bit = 0; bit < 8; ++bit)
+            byte |= lineLevel(in, len, txBit, t + (1.5 + bit) * rxBit) << bit;
+
+        /* a framing error reads as a null the way the tty driver reports it */
+        out[cnt++] = lineLevel(in, len, txBit, t + 9.5 * rxBit) ? byte : 0;
+        t += 9.5 * rxBit;
+    }
+
+    return cnt;
+}
+
+/* romByte - each low pulse is a bit: one bit time for a '1', two for a '0' */
+static void romByte(PropSim *sim, uint64_t time, uint8_t byte)
+{
+    int bits[5], cnt, i;
+
+    if ((cnt = decodePulses(byte, bits)) < 0) {
+        halt(sim, time, "ROM got a pulse it can't decode");
+        return;
+    }
+    for (i = 0; i < cnt && sim->state >= psRomCalibrate && sim->state <= psRomProgram; ++i)
+        romBit(sim, time, bits[i]);
+}
+
+static void romBit(PropSim *sim, uint64_t time, int bit)
+{
+    switch (sim->state) {
+    case psRomCalibrate:
+        if (bit != (sim->bitCount == 0 ? 1 : 0)) {
+            halt(sim, time, "ROM timing template not found");
+            break;
+        }
+        if (++sim->bitCount == 2) {
+            sim->state = psRomHandshake;
+            sim->bitCount = 0;
+        }
+        break;
+
+    case psRomHandshake:
+        if (bit != lfsrBit(sim)) {
+            halt(sim, time, "ROM handshake mismatch");
+            break;
+        }
+        if (++sim->bitCount == HANDSHAKE_BITS) {
+            sim->state = psRomRxHandshake;
+            sim->templates = 0;
+            sim->templateHalf = 0;
+            sim->responseBits = 0;
+        }
+        break;
+
+    case psRomRxHandshake:
+    case psRomChecksum:
+    case psRomProgram:
+        if (bit == 1 && !sim->templateHalf)
+            sim->templateHalf = 1;
+        else if (bit == 0 && sim->templateHalf) {
+            sim->templateHalf = 0;
+            romTemplate(sim, time);
+        }
+        else
+            halt(sim, time, "ROM expected a timing template");
+        break;
+
+    case psRomCommand:
+    case psRomLength:
+        sim->value |= (uint32_t)bit << sim->bitCount;
+        if (++sim->bitCount < 32)
+            break;
+        if (sim->state == psRomCommand) {
+            sim->command = sim->value;
+            if (sim->command == 0)
+                halt(sim, time, "ROM shutdown command");
+            else if (sim->command > 3)
+                halt(sim, time, "ROM unknown command");
+            else
+                sim->state = psRomLength;
+        }
+        else {
+            sim->longs = sim->value;
+            if (sim->longs <= 0 || sim->longs > PROPSIM_RAM_SIZE / 4)
+                halt(sim, time, "ROM invalid image length");
+            else {
+                sim->state = psRomImage;
+                sim->imageSize = 0;
+            }
+        }
+        sim->bitCount = 0;
+        sim->value = 0;
+        break;
+
+    case psRomImage:
+        sim->ram[sim->bitCount / 8] |= bit << (sim->bitCount % 8);
+        if (++sim->bitCount == sim->longs * 32) {
+            int checksum = 0xEC, i;     /* the initial call frame the ROM adds */
+            sim->imageSize = sim->longs * 4;
+            for (i = 0; i < sim->imageSize; ++i)
+                checksum += sim->ram[i];
+            sim->checksumOk = (checksum & 0xFF) == 0;
+            sim->busyUntil = time + ROM_CHECKSUM_TIME * 1000ULL;
+            sim->state = psRomChecksum;
+            sim->templateHalf = 0;
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* romTemplate - answer a timing template with the next bit of the response */
+static void romTemplate(PropSim *sim, uint64_t time)
+{
+    uint8_t response;
+    int bit;
+
+    switch (sim->state) {
+    case psRomRxHandshake:
+        /* the rest of the LFSR sequence followed by the version, two bits to a byte */
+        if (sim->templates < HANDSHAKE_BITS)
+            bit = lfsrBit(sim);
+        else
+            bit = (PROPSIM_VERSION >> (sim->templates - HANDSHAKE_BITS)) & 1;
+        if (++sim->templates & 1)
+            sim->responseBits = bit;
+        else {
+            response = 0xCE | sim->responseBits | (bit << 5);
+            transmit(sim, time, &response, 1, 0);
+        }
+        if (sim->templates == HANDSHAKE_BITS + VERSION_BITS) {
+            sim->stats.handshakeTime = time / 1000;
+            sim->state = psRomCommand;
+            sim->bitCount = 0;
+            sim->value = 0;
+        }
+        break;
+
+    /* polls before the checksum is done go unanswered */
+    case psRomChecksum:
+        if (time < sim->busyUntil)
+            break;
+        response = sim->checksumOk ? 0xFE : 0xFF;
+        transmit(sim, time, &response, 1, 0);
+        if (!sim->checksumOk) {
+            halt(sim, time, "ROM checksum error");
+            break;
+        }
+        sim->stats.romLoadTime = time / 1000;
+        if (sim->command & 2) {
+            sim->state = psRomProgram;
+            sim->programStep = 0;
+            sim->busyUntil = time + (uint64_t)(PROPSIM_RAM_SIZE / 64) * EEPROM_PAGE_TIME * 1000;
+        }
+        else
+            launch(sim, time, sim->ram, sim->imageSize, "from the ROM");
+        break;
+
+    /* one answer once programming is done and another once the EEPROM is verified */
+    case psRomProgram:
+        if (time < sim->busyUntil)
+            break;
+        response = 0xFE;
+        transmit(sim, time, &response, 1, 0);
+        if (sim->programStep++ == 0) {
+            memcpy(sim->eeprom, sim->ram, sim->imageSize);
+            sim->eepromSize = sim->imageSize;
+            sim->busyUntil = time + EEPROM_VERIFY_TIME * 1000ULL;
+        }
+        else if (sim->command == 3)
+            launch(sim, time, sim->ram, sim->imageSize, "from the ROM after programming");
+        else
+            halt(sim, time, "ROM programmed EEPROM");
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* launch - start a program, which for the IP_Loader image means a second stage */
+static void launch(PropSim *sim, uint64_t time, const uint8_t *image, int imageSize, const char *how)
+{
+    if (image == sim->ram && isLoaderImage(image, imageSize)) {
+        startLoader(sim, time);
+        return;
+    }
+    if (image != sim->ram)
+        memcpy(sim->ram, image, imageSize);
+    sim->imageSize = imageSize;
+    sim->state = psLaunched;
+    sim->stats.launchTime = time / 1000;
+    sim->stats.imageSize = imageSize;
+    report(sim, time, "launched %d byte image %s", imageSize, how);
+}
+
+/* startLoader - pick up the values the host patched into the loader and announce it is running */
+static void startLoader(PropSim *sim, uint64_t time)
+{
+    const uint8_t *init = &sim->ram[LOADER_INIT_OFFSET];
+    uint32_t initialBitTime = getLong(init + 4);
+    uint32_t finalBitTime = getLong(init + 8);
+    uint32_t clockFreq;
+
+    if (initialBitTime == 0 || finalBitTime == 0) {
+        halt(sim, time, "loader bit times not set");
+        return;
+    }
+    /* the ROM started the loader at the clock in its header */
+    if ((clockFreq = getLong(sim->ram)) == 0) {
+        halt(sim, time, "loader clkfreq not set");
+        return;
+    }
+    sim->initialBaud = clockFreq / initialBitTime;
+    sim->finalBaud = clockFreq / finalBitTime;
+
+    /* the loader's receive loop takes 12 clocks an iteration */
+    sim->failsafeTime = (uint64_t)getLong(init + 16) * 12 * 1000000000ULL / clockFreq;
+    sim->eopTime = (uint64_t)getLong(init + 20) * 12 * 1000000000ULL / clockFreq;
+    sim->expectedID = (int32_t)getLong(init + 36);
+    sim->lastID = sim->expectedID;
+
+    /* the loader waits out the EEPROM times it was given in cycles */
+    sim->i2cBitTime = (uint64_t)(getLong(init + 28) + getLong(init + 32) + I2C_BIT_OVERHEAD) * 1000000000ULL / clockFreq;
+    sim->i2cTooFast = (uint64_t)getLong(init + 28) * 1000000000ULL / clockFreq < MIN_SCL_HIGH_TIME
+                   || (uint64_t)getLong(init + 32) * 1000000000ULL / clockFreq < MIN_SCL_LOW_TIME;
+    sim->dataSize = 0;
+    sim->packetLength = 0;
+    memset(sim->ram, 0, sizeof(sim->ram));
+
+    sim->state = psLoader;
+    time += LOADER_START_TIME * 1000ULL;
+    sim->stats.loaderStartTime = time / 1000;
+
+    /* the first ack goes out at the initial baud rate before the loader switches to the final one */
+    loaderAck(sim, time, sim->expectedID, 0, sim->initialBaud);
+    report(sim, time, "loader started: %d packets, %d baud then %d baud", sim->expectedID, sim->initialBaud, sim->finalBaud);
+}
+
+static void loaderByte(PropSim *sim, uint64_t start, uint64_t end, uint8_t byte)
+{
+    /* not listening while handling the last packet */
+    if (start < sim->busyUntil)
+        return;
+
+    /* a gap ends the packet before this byte */
+    if (sim->packetLength > 0 && start >= sim->lastByteTime + sim->eopTime)
+        loaderPacket(sim, sim->lastByteTime + sim->eopTime);
+    if (sim->state != psLoader)
+        return;
+
+    if (sim->packetLength < MAX_PACKET)
+        sim->packet[sim->packetLength++] = byte;
+    sim->lastByteTime = end;
+}
+
+/* loaderPacket - handle a packet: an ID and a tag followed by image data or code to run */
+static void loaderPacket(PropSim *sim, uint64_t time)
+{
+    int32_t id, tag;
+    const uint8_t *payload = &sim->packet[8];
+    int payloadSize = sim->packetLength - 8;
+
+    sim->packetLength = 0;
+    sim->failsafeDeadline = time + sim->failsafeTime;
+    if (payloadSize <= 0)
+        return;
+    id = (int32_t)getLong(sim->packet);
+    tag = (int32_t)getLong(sim->packet + 4);
+    ++sim->stats.packets;
+
+    /* image data counts down to packet zero, a repeated packet is only acked again */
+    if (sim->expectedID > 0) {
+        if (id == sim->expectedID) {
+            if (sim->dataSize + payloadSize > PROPSIM_RAM_SIZE) {
+                halt(sim, time, "loader image too large");
+                return;
+            }
+            memcpy(&sim->ram[sim->dataSize], payload, payloadSize);
+            sim->dataSize += payloadSize;
+            --sim->expectedID;
+            if (sim->expectedID == 0)
+                sim->stats.dataTime = time / 1000;
+        }
+        else
+            ++sim->stats.retransmissions;
+        loaderAck(sim, time + LOADER_PACKET_TIME * 1000ULL, sim->expectedID, tag, sim->finalBaud);
+    }
+
+    /* the rest are code snippets the loader runs */
+    else if (payloadSize == sizeof(verifyRAM) && memcmp(payload, verifyRAM, payloadSize) == 0) {
+        int32_t checksum = 0;
+        int i;
+        for (i = 0; i < (int)sizeof(initCallFrame); ++i)
+            checksum += initCallFrame[i];
+        for (i = 0; i < sim->dataSize; ++i)
+            checksum += sim->ram[i];
+        sim->lastID = -checksum;
+        loaderAck(sim, time + VERIFY_RAM_TIME * 1000ULL, sim->lastID, tag, sim->finalBaud);
+    }
+    else if (payloadSize == sizeof(programVerifyEEPROM) && memcmp(payload, programVerifyEEPROM, payloadSize) == 0) {
+        /* page writes, then a read back of nine clocks a byte */
+        uint64_t programTime = (uint64_t)((sim->dataSize + 63) / 64) * EEPROM_PAGE_TIME
+                             + (uint64_t)sim->dataSize * 9 * sim->i2cBitTime / 1000;
+        if (sim->i2cTooFast) {
+            halt(sim, time, "loader clocks the EEPROM faster than it can follow");
+            return;
+        }
+        memcpy(sim->eeprom, sim->ram, sim->dataSize);
+        sim->eepromSize = sim->dataSize;
+        sim->lastID *= 2;
+        loaderAck(sim, time + programTime * 1000, sim->lastID, tag, sim->finalBaud);
+    }
+    else if (payloadSize == sizeof(readyToLaunch) && memcmp(payload, readyToLaunch, payloadSize) == 0) {
+        sim->lastID = id - 1;
+        loaderAck(sim, time + LOADER_PACKET_TIME * 1000ULL, sim->lastID, tag, sim->finalBaud);
+    }
+    else if (payloadSize == sizeof(launchNow) && memcmp(payload, launchNow, payloadSize) == 0)
+        launch(sim, time, sim->ram, sim->dataSize, "by the loader");
+    else
+        report(sim, time, "loader ignored an unknown %d byte packet", payloadSize);
+}
+
+static void loaderAck(PropSim *sim, uint64_t time, int32_t id, int32_t tag, int baudRate)
+{
+    uint8_t ack[8];
+
+    setLong(&ack[0], id);
+    setLong(&ack[4], tag);
+    transmit(sim, time, ack, sizeof(ack), baudRate);
+
+    /* the failsafe timer restarts once the loader is listening again */
+    sim->busyUntil = time;
+    sim->failsafeDeadline = time + sim->failsafeTime;
+}
+
+static void halt(PropSim *sim, uint64_t time, const char *reason)
+{
+    sim->state = psShutdown;
+    report(sim, time, "%s", reason);
+}
+
+/* transmit - queue bytes on the Propeller's transmit line (baud 0 means in step with the host's templates) */
+static void transmit(PropSim *sim, uint64_t time, const uint8_t *buf, int len, int baudRate)
+{
+    PropSimTx *tx;
+
+    if (sim->txCount >= MAX_TX_QUEUE || len > (int)sizeof(tx->buf))
+        return;
+    if (baudRate > 0) {
+        if (sim->txFree > time)
+            time = sim->txFree;
+        time += (uint64_t)len * 10000000000ULL / baudRate;
+        sim->txFree = time;
+    }
+
+    /* merge the handshake response into as few writes as possible */
+    if (sim->txCount > 0 && baudRate == 0) {
+        tx = &sim->txQueue[sim->txCount - 1];
+        if (tx->baudRate == 0 && tx->len + len <= (int)sizeof(tx->buf) && time - tx->time < 1000000) {
+            memcpy(&tx->buf[tx->len], buf, len);
+            tx->len += len;
+            tx->time = time;
+            return;
+        }
+    }
+
+    tx = &sim->txQueue[sim->txCount++];
+    tx->time = time;
+    tx->baudRate = baudRate;
+    tx->len = len;
+    memcpy(tx->buf, buf, len);
+}
+
+static void report(PropSim *sim, uint64_t time, const char *format, ...)
+{
+    char message[128];
+    va_list ap;
+
+    if (!sim->event)
+        return;
+    va_start(ap, format);
+    vsnprintf(message, sizeof(message), format, ap);
+    va_end(ap);
+    (*sim->event)(sim->data, time / 1000, message);
+}
+
+/* lfsrBit - the next bit of the handshake sequence */
+static int lfsrBit(PropSim *sim)
+{
+    uint8_t lfsr = sim->lfsr;
+    int bit = lfsr & 1;
+    sim->lfsr = ((lfsr << 1) & 0xFE) | (((lfsr >> 7) ^ (lfsr >> 5) ^ (lfsr >> 4) ^ (lfsr >> 1)) & 1);
+    return bit;
+}
+
+/* decodePulses - split a byte's frame into its low pulses, returns the number of bits or -1 */
+static int decodePulses(uint8_t byte, int *bits)
+{
+    int frame = (byte << 1) | 0x200;    /* start bit, data bits lsb first, stop bit */
+    int cnt = 0, run = 0, i;
+
+    for (i = 0; i < 10; ++i) {
+        if (!(frame & (1 << i)))
+            ++run;
+        else if (run > 0) {
+            if (run > 2)
+                return -1;
+            bits[cnt++] = run == 1 ? 1 : 0;
+            run = 0;
+        }
+    }
+
+    return cnt;
+}
+
+/* isLoaderImage - the IP_Loader image apart from its clock and the values the host patches in */
+static int isLoaderImage(const uint8_t *image, int imageSize)
+{
+    int i;
+    if (imageSize != (int)sizeof(rawLoaderImage))
+        return 0;
+    for (i = 0; i < imageSize; ++i) {
+        if (i < 6 || (i >= LOADER_INIT_OFFSET && i < LOADER_INIT_OFFSET + 40))
+            continue;
+        if (image[i] != rawLoaderImage[i])
+            return 0;
+    }
+    return 1;
+}
+
+static int sameBaud(int baud1, int baud2)
+{
+    int diff = baud1 > baud2 ? baud1 - baud2 : baud2 - baud1;
+    return diff * 100 <= baud2 * BAUD_TOLERANCE;
+}
+
+/* lineLevel - the level of a serial line carrying buf at time */
+static int lineLevel(const uint8_t *buf, int len, double bitTime, double time)
+{
+    int i = (int)(time / bitTime), bit = i % 10;
+    if (i >= len * 10 || bit == 9)
+        return 1;
+    if (bit == 0)
+        return 0;
+    return (buf[i / 10] >> (bit - 1)) & 1;
+}
+
+static uint32_t getLong(const uint8_t *buf)
+{
+    return (buf[3] << 24) | (buf[2] << 16) | (buf[1] << 8) | buf[0];
+}
+
+static void setLong(uint8_t *buf, uint32_t value)
+{
+    buf[3] = value >> 24;
+    buf[2] = value >> 16;
+    buf[1] = value >>  8;
+    buf[0] = value;
+}
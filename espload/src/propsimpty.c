@@ -0,0 +1,265 @@
+/* propsim - a simulated Propeller on a pseudo-terminal for testing loaders without hardware
+
+   The slave side of the pty stands in for the serial port the Propeller is wired to. A pty has
+   no modem control lines so the reset pin is driven by writing '0' (hold in reset) and '1'
+   (release) to a FIFO given with -r. Without one, the Propeller is reset when the host starts
+   talking again after a quiet spell once the last load has finished or failed.
+*/
+
+/* posix_openpt and friends */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <asm/termbits.h>
+#else
+#include <termios.h>
+#endif
+#include "sock.h"
+#include "propsim.h"
+
+#define DEF_HOST_BAUD       115200
+#define AUTO_RESET_IDLE     100000      /* microseconds of quiet before new data means a new load */
+#define MAX_READ            4096
+
+static int master = -1;
+static int verbose = 0;
+static uint64_t lastReceive = 0;
+static PropSimState lastState = psReset;
+
+static void transmitHandler(void *data, const uint8_t *buf, int len, int baudRate);
+static void eventHandler(void *data, uint64_t time, const char *message);
+static int openPty(const char *link, int *pSlave);
+static int hostBaudRate(void);
+static void showStats(PropSim *sim);
+static void Usage(void);
+
+int main(int argc, char *argv[])
+{
+    const char *link = NULL, *resetPath = NULL;
+    uint8_t buf[MAX_READ];
+    struct pollfd fds[2];
+    int slave, reset = -1, nfds, i;
+    PropSim *sim;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        const char *value;
+        int opt;
+        if (argv[i][0] != '-' || !(opt = argv[i][1]))
+            Usage();
+        if (opt == 'v') {
+            verbose = 1;
+            continue;
+        }
+        if (argv[i][2])
+            value = &argv[i][2];
+        else if (++i < argc)
+            value = argv[i];
+        else
+            Usage();
+        switch (opt) {
+        case 'l': link = value; break;
+        case 'r': resetPath = value; break;
+        default:  Usage(); break;
+        }
+    }
+
+    if (openPty(link, &slave) != 0)
+        return 1;
+
+    /* opened for writing too so the FIFO doesn't report end of file between writers */
+    if (resetPath) {
+        if (mkfifo(resetPath, 0666) != 0 && errno != EEXIST) {
+            printf("error: can't create reset FIFO %s\n", resetPath);
+            return 1;
+        }
+        if ((reset = open(resetPath, O_RDWR | O_NONBLOCK)) < 0) {
+            printf("error: can't open reset FIFO %s\n", resetPath);
+            return 1;
+        }
+    }
+
+    if (!(sim = PropSimOpen(transmitHandler, eventHandler, NULL))) {
+        printf("error: insufficient memory\n");
+        return 1;
+    }
+
+    printf("propsim on %s%s%s\n", link ? link : ptsname(master), resetPath ? ", reset with " : "", resetPath ? resetPath : "");
+    fflush(stdout);
+
+    for (;;) {
+        int64_t next = PropSimPoll(sim, GetTimeMicroseconds());
+        int timeout = next < 0 ? -1 : (int)((next + 999) / 1000);
+
+        /* summarize each load as it finishes */
+        if (PropSimGetState(sim) != lastState) {
+            lastState = PropSimGetState(sim);
+            if (lastState == psLaunched)
+                showStats(sim);
+        }
+
+        fds[0].fd = master;
+        fds[0].events = POLLIN;
+        nfds = 1;
+        if (reset >= 0) {
+            fds[1].fd = reset;
+            fds[1].events = POLLIN;
+            nfds = 2;
+        }
+        if (poll(fds, nfds, timeout) < 0 && errno != EINTR)
+            break;
+
+        if (nfds > 1 && (fds[1].revents & POLLIN)) {
+            int cnt = read(reset, buf, sizeof(buf));
+            for (i = 0; i < cnt; ++i) {
+                if (buf[i] == '0' || buf[i] == '1') {
+                    PropSimReset(sim, GetTimeMicroseconds(), buf[i] - '0');
+                    if (verbose)
+                        printf("reset %s\n", buf[i] == '0' ? "asserted" : "released");
+                }
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            uint64_t now = GetTimeMicroseconds();
+            int cnt = read(master, buf, sizeof(buf));
+            if (cnt > 0) {
+                PropSimState state = PropSimGetState(sim);
+                if (reset < 0 && (state == psLaunched || state == psShutdown) && now - lastReceive >= AUTO_RESET_IDLE) {
+                    PropSimReset(sim, now, 0);
+                    PropSimReset(sim, now, 1);
+                    if (verbose)
+                        printf("reset after %d msec idle\n", (int)((now - lastReceive) / 1000));
+                }
+                PropSimReceive(sim, now, buf, cnt, hostBaudRate());
+                lastReceive = now;
+            }
+        }
+
+    }
+
+    PropSimClose(sim);
+    close(slave);
+    close(master);
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    printf("\
+usage: propsim\n\
+         [ -l <path> ]     symbolic link to create to the serial port\n\
+         [ -r <path> ]     FIFO that drives the reset pin ('0' asserts, '1' releases)\n\
+         [ -v ]            display what the Propeller is doing\n");
+    exit(1);
+}
+
+/* transmitHandler - put the Propeller's bytes on the host's side of the pty as its UART would read them */
+static void transmitHandler(void *data, const uint8_t *buf, int len, int baudRate)
+{
+    int hostBaud = hostBaudRate();
+    uint8_t converted[MAX_READ];
+
+    if (baudRate > 0 && len * 5 < (int)sizeof(converted)) {
+        len = PropSimConvertBaud(buf, len, baudRate, hostBaud, converted);
+        buf = converted;
+    }
+    if (write(master, buf, len) != len && verbose)
+        printf("error: write to the pty failed\n");
+}
+
+static void eventHandler(void *data, uint64_t time, const char *message)
+{
+    if (verbose) {
+        printf("%llu.%03llu: %s\n", (unsigned long long)(time / 1000000), (unsigned long long)(time / 1000 % 1000), message);
+        fflush(stdout);
+    }
+}
+
+/* openPty - open a pty with the slave in raw mode and held open so the master never sees a hangup */
+static int openPty(const char *link, int *pSlave)
+{
+    const char *name;
+
+    if ((master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(master) != 0 || unlockpt(master) != 0 || !(name = ptsname(master))) {
+        printf("error: can't open a pty\n");
+        return -1;
+    }
+    if ((*pSlave = open(name, O_RDWR | O_NOCTTY)) < 0) {
+        printf("error: can't open %s\n", name);
+        return -1;
+    }
+
+#ifdef __linux__
+    {
+        struct termios2 tio;
+        if (ioctl(*pSlave, TCGETS2, &tio) == 0) {
+            tio.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+            tio.c_oflag &= ~OPOST;
+            tio.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+            tio.c_cflag &= ~(CSIZE | PARENB | CBAUD);
+            tio.c_cflag |= CS8 | BOTHER;
+            tio.c_ispeed = tio.c_ospeed = DEF_HOST_BAUD;
+            ioctl(*pSlave, TCSETS2, &tio);
+        }
+    }
+#else
+    {
+        struct termios tio;
+        if (tcgetattr(*pSlave, &tio) == 0) {
+            cfmakeraw(&tio);
+            cfsetspeed(&tio, DEF_HOST_BAUD);
+            tcsetattr(*pSlave, TCSANOW, &tio);
+        }
+    }
+#endif
+
+    if (link) {
+        unlink(link);
+        if (symlink(name, link) != 0) {
+            printf("error: can't link %s to %s\n", link, name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* hostBaudRate - the baud rate the host last set on its side of the pty */
+static int hostBaudRate(void)
+{
+#ifdef __linux__
+    struct termios2 tio;
+    if (ioctl(master, TCGETS2, &tio) == 0 && tio.c_ospeed > 0)
+        return tio.c_ospeed;
+#else
+    struct termios tio;
+    if (tcgetattr(master, &tio) == 0 && cfgetospeed(&tio) > 0)
+        return cfgetospeed(&tio);
+#endif
+    return DEF_HOST_BAUD;
+}
+
+static void showStats(PropSim *sim)
+{
+    const PropSimStats *stats = PropSimGetStats(sim);
+    uint64_t start = stats->resetTime;
+
+#define MSEC(t) ((t) ? (int)(((t) - start) / 1000) : -1)
+    printf("launched %d bytes: handshake %d ms, rom %d ms, loader %d ms, data %d ms, launch %d ms, %d packets, %d retransmitted, %d framing errors\n",
+           stats->imageSize, MSEC(stats->handshakeTime), MSEC(stats->romLoadTime), MSEC(stats->loaderStartTime),
+           MSEC(stats->dataTime), MSEC(stats->launchTime), stats->packets, stats->retransmissions, stats->framingErrors);
+#undef MSEC
+    fflush(stdout);
+}
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "registry.h"
+
+#define MAX_REGISTRY_LINE   256
+
+static int getRegistryPath(char *path, int size);
+static int getJsonString(const char *json, const char *key, char *value, int valueMax);
+static const char *getJsonValue(const char *json, const char *key);
+static int getJsonInt(const char *json, const char *key, int *pValue);
+static int getJsonMaxInt(const char *json, const char *key, int *pValue);
+static void copyField(char *dst, const char *src, int size);
+static int isCurrent(const ModuleEntry *entry, time_t now);
+
+/* RegistryLoad - read the registry file (an empty registry if there isn't one) */
+int RegistryLoad(ModuleRegistry *registry)
+{
+    char path[512], line[MAX_REGISTRY_LINE];
+    FILE *fp;
+
+    registry->count = 0;
+
+    if (getRegistryPath(path, sizeof(path)) != 0 || !(fp = fopen(path, "r")))
+        return -1;
+
+    /* lines look like: name address mac last-seen reset-pin max-packet baud ttl version... with '-' for an unknown field */
+    while (registry->count < MAX_MODULES && fgets(line, sizeof(line), fp)) {
+        ModuleEntry *entry = &registry->entries[registry->count];
+        char name[sizeof(entry->name)], mac[sizeof(entry->mac)];
+        long lastSeen;
+        int cnt;
+        if (line[0] == '#')
+            continue;
+        memset(entry, 0, sizeof(ModuleEntry));
+        if (sscanf(line, "%31s %31s %23s %ld %d %d %d %d %n", name, entry->address, mac, &lastSeen,
+                   &entry->resetPin, &entry->maxPacketSize, &entry->secondStageBaud, &entry->ttl, &cnt) != 8
+        ||  !isspace((unsigned char)line[cnt - 1])) {
+
+            /* files written before the time to trust an address was recorded, whose version can start with a digit */
+            entry->ttl = 0;
+            if (sscanf(line, "%31s %31s %23s %ld %d %d %d %n", name, entry->address, mac, &lastSeen,
+                       &entry->resetPin, &entry->maxPacketSize, &entry->secondStageBaud, &cnt) != 7) {
+
+                /* files written before the loader capabilities were recorded */
+                entry->resetPin = -1;
+                entry->maxPacketSize = entry->secondStageBaud = 0;
+                if (sscanf(line, "%31s %31s %23s %ld %n", name, entry->address, mac, &lastSeen, &cnt) != 4)
+                    continue;
+            }
+        }
+        copyField(entry->name, strcmp(name, "-") == 0 ? "" : name, sizeof(entry->name));
+        copyField(entry->mac, strcmp(mac, "-") == 0 ? "" : mac, sizeof(entry->mac));
+        copyField(entry->version, &line[cnt], sizeof(entry->version));
+        entry->version[strcspn(entry->version, "\r\n")] = '\0';
+        entry->lastSeen = (time_t)lastSeen;
+        ++registry->count;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/* RegistrySave - write the registry file */
+int RegistrySave(ModuleRegistry *registry)
+{
+    char path[512];
+    FILE *fp;
+    int i;
+
+    if (getRegistryPath(path, sizeof(path)) != 0 || !(fp = fopen(path, "w")))
+        return -1;
+
+    fprintf(fp, "# espload module registry: name address mac last-seen reset-pin max-packet baud ttl version\n");
+    for (i = 0; i < registry->count; ++i) {
+        ModuleEntry *entry = &registry->entries[i];
+        fprintf(fp, "%s %s %s %ld %d %d %d %d %s\n",
+                entry->name[0] ? entry->name : "-",
+                entry->address,
+                entry->mac[0] ? entry->mac : "-",
+                (long)entry->lastSeen,
+                entry->resetPin,
+                entry->maxPacketSize,
+                entry->secondStageBaud,
+                entry->ttl,
+                entry->version);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+/* RegistryUpdate - add a module or replace what was known about it */
+void RegistryUpdate(ModuleRegistry *registry, const ModuleEntry *entry)
+{
+    int i, j;
+
+    /* the MAC address identifies a module that has moved, otherwise go by its IP address */
+    for (i = 0; i < registry->count; ++i) {
+        ModuleEntry *old = &registry->entries[i];
+        if (entry->mac[0] ? strcmp(old->mac, entry->mac) == 0 : strcmp(old->address, entry->address) == 0)
+            break;
+    }
+
+    /* replace the module seen longest ago when the registry is full */
+    if (i >= MAX_MODULES) {
+        int oldest = 0;
+        for (i = 1; i < registry->count; ++i)
+            if (registry->entries[i].lastSeen < registry->entries[oldest].lastSeen)
+                oldest = i;
+        i = oldest;
+    }
+    else if (i == registry->count)
+        ++registry->count;
+
+    registry->entries[i] = *entry;
+
+    /* another module can't still be at this address */
+    for (j = 0; j < registry->count; ++j) {
+        if (j != i && strcmp(registry->entries[j].address, entry->address) == 0) {
+            registry->entries[j] = registry->entries[--registry->count];
+            if (i == registry->count)
+                i = j;
+            --j;
+        }
+    }
+}
+
+/* RegistryFind - find a module whose address is still trusted by name or MAC address */
+ModuleEntry *RegistryFind(ModuleRegistry *registry, const char *name)
+{
+    time_t now = time(NULL);
+    int i;
+
+    for (i = 0; i < registry->count; ++i) {
+        ModuleEntry *entry = &registry->entries[i];
+        if (!isCurrent(entry, now))
+            continue;
+        if ((entry->name[0] && strcmp(entry->name, name) == 0) || (entry->mac[0] && strcmp(entry->mac, name) == 0))
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* RegistryFindAddress - find a module whose address is still trusted by IP address */
+ModuleEntry *RegistryFindAddress(ModuleRegistry *registry, const char *address)
+{
+    time_t now = time(NULL);
+    int i;
+
+    for (i = 0; i < registry->count; ++i) {
+        ModuleEntry *entry = &registry->entries[i];
+        if (isCurrent(entry, now) && strcmp(entry->address, address) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+/* RegistryParseResponse - fill in a registry entry from a discovery response */
+int RegistryParseResponse(const char *response, const char *address, ModuleEntry *entry)
+{
+    memset(entry, 0, sizeof(ModuleEntry));
+    copyField(entry->address, address, sizeof(entry->address));
+    entry->lastSeen = time(NULL);
+
+    /* older firmware doesn't describe itself, only its address is known */
+    getJsonString(response, "name", entry->name, sizeof(entry->name));
+    getJsonString(response, "mac", entry->mac, sizeof(entry->mac));
+    getJsonString(response, "version", entry->version, sizeof(entry->version));
+
+    /* the loader's capabilities let a load skip the defaults and the HTTP probing */
+    if (getJsonInt(response, "reset-pin", &entry->resetPin) != 0)
+        entry->resetPin = -1;
+    if (getJsonInt(response, "max-packet-size", &entry->maxPacketSize) != 0)
+        entry->maxPacketSize = 0;
+    if (getJsonMaxInt(response, "second-stage-bauds", &entry->secondStageBaud) != 0
+    &&  getJsonInt(response, "second-stage-baud", &entry->secondStageBaud) != 0)
+        entry->secondStageBaud = 0;
+
+    /* names and MAC addresses are whitespace separated in the registry file */
+    entry->name[strcspn(entry->name, " \t")] = '\0';
+    entry->mac[strcspn(entry->mac, " \t")] = '\0';
+
+    return 0;
+}
+
+static int getRegistryPath(char *path, int size)
+{
+#ifdef __MINGW32__
+    const char *home = getenv("USERPROFILE");
+#else
+    const char *home = getenv("HOME");
+#endif
+    if (!home)
+        return -1;
+    snprintf(path, size, "%s/%s", home, REGISTRY_FILE_NAME);
+    return 0;
+}
+
+/* getJsonString - find the string value of "key" in a flat JSON object */
+static int getJsonString(const char *json, const char *key, char *value, int valueMax)
+{
+    const char *p;
+    int cnt = 0;
+
+    if (!(p = getJsonValue(json, key)) || *p++ != '"')
+        return -1;
+    while (*p && *p != '"' && cnt < valueMax - 1) {
+        if (*p == '\\' && p[1])
+            ++p;
+        value[cnt++] = *p++;
+    }
+    value[cnt] = '\0';
+
+    return 0;
+}
+
+/* getJsonValue - find the start of the value of "key" in a flat JSON object */
+static const char *getJsonValue(const char *json, const char *key)
+{
+    int keyLen = strlen(key);
+    const char *p = json;
+
+    while ((p = strchr(p, '"')) != NULL) {
+        if (strncmp(p + 1, key, keyLen) == 0 && p[keyLen + 1] == '"') {
+            p += keyLen + 2;
+            p += strspn(p, " \t\r\n");
+            if (*p++ != ':')
+                continue;
+            return p + strspn(p, " \t\r\n");
+        }
+        ++p;
+    }
+
+    return NULL;
+}
+
+static int getJsonInt(const char *json, const char *key, int *pValue)
+{
+    const char *p;
+    char *end;
+    long value;
+
+    if (!(p = getJsonValue(json, key)))
+        return -1;
+    value = strtol(p, &end, 10);
+    if (end == p)
+        return -1;
+    *pValue = (int)value;
+    return 0;
+}
+
+/* getJsonMaxInt - find the largest number in the array value of "key" */
+static int getJsonMaxInt(const char *json, const char *key, int *pValue)
+{
+    const char *p;
+    int found = 0;
+
+    if (!(p = getJsonValue(json, key)) || *p++ != '[')
+        return -1;
+    while (*p && *p != ']') {
+        char *end;
+        long value = strtol(p, &end, 10);
+        if (end == p)
+            ++p;
+        else {
+            if (!found || value > *pValue)
+                *pValue = (int)value;
+            found = 1;
+            p = end;
+        }
+    }
+
+    return found ? 0 : -1;
+}
+
+/* isCurrent - an address from mDNS is trusted for its record's TTL, one from discovery for REGISTRY_TTL */
+static int isCurrent(const ModuleEntry *entry, time_t now)
+{
+    return now - entry->lastSeen <= (entry->ttl > 0 ? entry->ttl : REGISTRY_TTL);
+}
+
+static void copyField(char *dst, const char *src, int size)
+{
+    strncpy(dst, src, size - 1);
+    dst[size - 1] = '\0';
+}
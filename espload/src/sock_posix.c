@@ -1,20 +1,39 @@
+/* for sendmmsg and recvmmsg */
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 
 #ifdef __MINGW32__
 #include <ws2tcpip.h>
 #include <iphlpapi.h>
 #include <conio.h>
+#define poll(fds, cnt, timeout) WSAPoll(fds, cnt, timeout)
 #else
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <termios.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#define USE_EPOLL
+#define USE_MMSG
 #endif
 
 #include "sock.h"
 
+/* how long ConnectSocket waits for the connection to complete */
+#define CONNECT_TIMEOUT     10000
+
 #ifdef __MINGW32__
 
 static int socketsInitialized = FALSE;
@@ -110,23 +129,21 @@ int OpenBroadcastSocket(short port, SOCKET *pSocket)
 int ConnectSocket(SOCKADDR_IN *addr, SOCKET *pSocket)
 {
     SOCKET sock;
-    
-#ifdef __MINGW32__
-    if (InitWinSock() != 0)
-        return INVALID_SOCKET;
-#endif
+    int ret;
 
-    /* create the socket */
-    if ((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+    /* start the connection */
+    if ((ret = ConnectSocketAsync(addr, &sock)) < 0)
         return -1;
 
-    /* connect to the server */
-    if (connect(sock, (SOCKADDR *)addr, sizeof(*addr)) != 0) {
-    printf("connect failed\n");
+    /* wait for the connection to complete */
+    if (ret > 0 && (WaitForSocket(sock, LOOP_WRITE, CONNECT_TIMEOUT) <= 0 || GetSocketError(sock) != 0)) {
         closesocket(sock);
         return -1;
     }
 
+    /* the synchronous calls expect a blocking socket */
+    SetSocketBlocking(sock, 1);
+
     /* return the socket */
     *pSocket = sock;
     return 0;
@@ -164,26 +181,71 @@ int BindSocket(short port, SOCKET *pSocket)
     return 0;
 }
 
+/* OpenListenSocket - open a TCP socket accepting connections on a port */
+int OpenListenSocket(short port, SOCKET *pSocket)
+{
+    int reuse = 1;
+    SOCKADDR_IN addr;
+    SOCKET sock;
+
+#ifdef __MINGW32__
+    if (InitWinSock() != 0)
+        return -1;
+#endif
+
+    /* create the socket */
+    if ((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+
+    /* allow a restarted server to bind while old connections linger */
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(reuse));
+
+    /* setup the address */
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+
+    /* bind the socket to the port and start listening */
+    if (bind(sock, (SOCKADDR *)&addr, sizeof(addr)) != 0 || listen(sock, SOMAXCONN) != 0) {
+        closesocket(sock);
+        return -1;
+    }
+
+    /* return the socket */
+    *pSocket = sock;
+    return 0;
+}
+
+/* AcceptSocket - accept a connection on a listening socket */
+int AcceptSocket(SOCKET listenSock, SOCKET *pSocket, SOCKADDR_IN *addr)
+{
+    SOCKADDR_IN tmp;
+#ifdef __MINGW32__
+    int len = sizeof(tmp);
+#else
+    socklen_t len = sizeof(tmp);
+#endif
+    SOCKET sock;
+
+    if ((sock = accept(listenSock, (SOCKADDR *)&tmp, &len)) < 0)
+        return -1;
+    if (addr)
+        *addr = tmp;
+
+    /* return the socket */
+    *pSocket = sock;
+    return 0;
+}
+
 /* CloseSocket - close a socket */
 void CloseSocket(SOCKET sock)
 {
-    struct timeval tv;
-    fd_set sockets;
     char buf[512];
 
-    tv.tv_sec = 0;
-    tv.tv_usec = 1000;
-
     /* wait for the close to complete */
-    for (;;) {
-        FD_ZERO(&sockets);
-        FD_SET(sock, &sockets);
-        if (select(sock + 1, &sockets, NULL, NULL, &tv) > 0) {
-            if (FD_ISSET(sock, &sockets))
-                if (recv(sock, buf, sizeof(buf), 0) == 0)
-                    break;
-        }
-        else
+    while (WaitForSocket(sock, LOOP_READ, 1) > 0) {
+        if (recv(sock, buf, sizeof(buf), 0) <= 0)
             break;
     }
 
@@ -194,22 +256,7 @@ void CloseSocket(SOCKET sock)
 /* SocketDataAvailableP - check for data being available on a socket */
 int SocketDataAvailableP(SOCKET sock, int timeout)
 {
-    struct timeval timeVal;
-    fd_set sockets;
-    int cnt;
-
-    /* setup the read socket set */
-    FD_ZERO(&sockets);
-    FD_SET(sock, &sockets);
-
-    timeVal.tv_sec = timeout / 1000;
-    timeVal.tv_usec = (timeout % 1000) * 1000;
-
-    /* check for data available */
-    cnt = select(sock + 1, &sockets, NULL, NULL, timeout < 0 ? NULL : &timeVal);
-
-    /* return whether data is available */
-    return cnt > 0 && FD_ISSET(sock, &sockets);
+    return WaitForSocket(sock, LOOP_READ, timeout) > 0;
 }
 
 /* SendSocketData - send socket data */
@@ -244,19 +291,9 @@ int ReceiveSocketDataAndAddress(SOCKET sock, void *buf, int len, SOCKADDR_IN *ad
 int ReceiveSocketDataTimeout(SOCKET sock, void *buf, int len, int timeout)
 {
     ssize_t bytes = 0;
-    struct timeval toval;
-    fd_set set;
-
-    FD_ZERO(&set);
-    FD_SET(sock, &set);
 
-    toval.tv_sec = timeout / 1000;
-    toval.tv_usec = (timeout % 1000) * 1000;
-
-    if (select(sock + 1, &set, NULL, NULL, &toval) > 0) {
-        if (FD_ISSET(sock, &set))
-            bytes = recv(sock, buf, len, 0);
-    }
+    if (WaitForSocket(sock, LOOP_READ, timeout) > 0)
+        bytes = recv(sock, buf, len, 0);
 
     return (int)(bytes > 0 ? bytes : -1);
 }
@@ -267,6 +304,106 @@ int SendSocketDataTo(SOCKET sock, void *buf, int len, SOCKADDR_IN *addr)
     return sendto(sock, buf, len, 0, (SOCKADDR *)addr, sizeof(SOCKADDR));
 }
 
+/* sendWouldBlock - whether the last send failed only for want of buffer space */
+static int sendWouldBlock(void)
+{
+#ifdef __MINGW32__
+    int err = WSAGetLastError();
+    return err == WSAEWOULDBLOCK || err == WSAENOBUFS;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS;
+#endif
+}
+
+/* SendSocketDataToMany - send the same datagram to each address, batched with sendmmsg where available
+ *   returns the number sent, 0 if the socket had no room for the first one or -1 if it couldn't be sent
+ */
+int SendSocketDataToMany(SOCKET sock, void *buf, int len, SOCKADDR_IN *addrs, int count)
+{
+#ifdef USE_MMSG
+    struct mmsghdr msgs[SOCKET_BATCH_SIZE];
+    struct iovec iov;
+    int sent = 0;
+
+    iov.iov_base = buf;
+    iov.iov_len = len;
+
+    while (sent < count) {
+        int batch = count - sent, ret, i;
+        if (batch > SOCKET_BATCH_SIZE)
+            batch = SOCKET_BATCH_SIZE;
+        memset(msgs, 0, batch * sizeof(struct mmsghdr));
+        for (i = 0; i < batch; ++i) {
+            msgs[i].msg_hdr.msg_name = &addrs[sent + i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(SOCKADDR_IN);
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        if ((ret = sendmmsg(sock, msgs, batch, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return sent > 0 ? sent : sendWouldBlock() ? 0 : -1;
+        }
+        sent += ret;
+    }
+
+    return sent;
+#else
+    int sent;
+    for (sent = 0; sent < count; ++sent) {
+        if (sendto(sock, buf, len, 0, (SOCKADDR *)&addrs[sent], sizeof(SOCKADDR)) != len)
+            return sent > 0 ? sent : sendWouldBlock() ? 0 : -1;
+    }
+    return sent;
+#endif
+}
+
+/* ReceiveSocketDataBatch - receive up to count datagrams that have already arrived, batched with recvmmsg where available
+ *   bufs holds count buffers of bufSize bytes, lens and addrs get the length and sender of each
+ *   returns the number of datagrams received (0 if none were waiting) or -1 on error
+ */
+int ReceiveSocketDataBatch(SOCKET sock, uint8_t *bufs, int bufSize, int *lens, SOCKADDR_IN *addrs, int count)
+{
+#ifdef USE_MMSG
+    struct mmsghdr msgs[SOCKET_BATCH_SIZE];
+    struct iovec iovs[SOCKET_BATCH_SIZE];
+    int ret, i;
+
+    if (count > SOCKET_BATCH_SIZE)
+        count = SOCKET_BATCH_SIZE;
+
+    memset(msgs, 0, count * sizeof(struct mmsghdr));
+    for (i = 0; i < count; ++i) {
+        iovs[i].iov_base = &bufs[i * bufSize];
+        iovs[i].iov_len = bufSize;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(SOCKADDR_IN);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    if ((ret = recvmmsg(sock, msgs, count, MSG_DONTWAIT, NULL)) < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < ret; ++i)
+        lens[i] = msgs[i].msg_len;
+
+    return ret;
+#else
+    int received;
+
+    for (received = 0; received < count && WaitForSocket(sock, LOOP_READ, 0) > 0; ++received) {
+        socklen_t addrLen = sizeof(SOCKADDR_IN);
+        int len = recvfrom(sock, (char *)&bufs[received * bufSize], bufSize, 0, (SOCKADDR *)&addrs[received], &addrLen);
+        if (len < 0)
+            return received > 0 ? received : -1;
+        lens[received] = len;
+    }
+
+    return received;
+#endif
+}
+
 /* escape from terminal mode */
 #define ESC         0x1b
 
@@ -276,17 +413,27 @@ int SendSocketDataTo(SOCKET sock, void *buf, int len, SOCKADDR_IN *addr)
  */
 #define EXIT_CHAR   0xff
 
+/* SocketTerminal - pass data between the socket and the console */
 void SocketTerminal(SOCKET sock, int check_for_exit, int pst_mode)
 {
+    SocketTerminalWithOptions(sock, check_for_exit, pst_mode, NULL);
+}
+
 #ifdef __MINGW32__
+
+void SocketTerminalWithOptions(SOCKET sock, int check_for_exit, int pst_mode, TerminalOptions *options)
+{
     int sawexit_char = 0;
     int sawexit_valid = 0;
     int exitcode = 0;
     int continue_terminal = 1;
+    uint64_t start = GetTimeMicroseconds();
 
     while (continue_terminal) {
         uint8_t buf[1];
         if (ReceiveSocketDataTimeout(sock, buf, 1, 0) != -1) {
+            if (options)
+                ++options->bytesReceived;
             if (sawexit_valid) {
                 exitcode = buf[0];
                 continue_terminal = 0;
@@ -317,19 +464,99 @@ void SocketTerminal(SOCKET sock, int check_for_exit, int pst_mode)
         }
     }
 
+    if (options)
+        options->elapsedTime = GetTimeMicroseconds() - start;
+
     if (check_for_exit && sawexit_valid) {
         exit(exitcode);
     }
+}
+
 #else
+
+/* size of the buffer between the socket and stdout (a power of two) */
+#define TERMINAL_BUFFER_SIZE    (256 * 1024)
+
+/* largest single read from the socket */
+#define TERMINAL_READ_SIZE      (16 * 1024)
+
+/* the capture file grows by this much at a time */
+#define CAPTURE_WINDOW_SIZE     (4 * 1024 * 1024)
+
+/* timestamped capture file written through a memory mapping */
+typedef struct {
+    int fd;
+    uint8_t *window;            /* mapping of the current window of the file */
+    uint64_t windowOffset;      /* file offset of the window */
+    int windowUsed;             /* bytes written into the window */
+    int atLineStart;
+} CaptureLog;
+
+typedef struct {
+    SocketLoop *loop;
+    SOCKET sock;
+    int check_for_exit;
+    int pst_mode;
+    int exit_char;
+    int sawexit_char;
+    int sawexit_valid;
+    int exitcode;
+    int done;
+    uint8_t *ring;
+    uint32_t head;              /* total bytes put into the ring */
+    uint32_t tail;              /* total bytes written to stdout */
+    int socketPaused;           /* not reading the socket because the ring is full */
+    int stdoutBlocked;          /* waiting for stdout to accept more data */
+    int stdoutWatchable;        /* stdout can be used with the event loop */
+    uint64_t pausedSince;
+    uint64_t blockedSince;
+    uint64_t start;
+    CaptureLog *capture;
+    TerminalOptions *options;
+} TerminalState;
+
+static int captureOpen(CaptureLog *log, const char *fileName);
+static void captureWrite(CaptureLog *log, uint64_t timestamp, const uint8_t *buf, int len);
+static void captureClose(CaptureLog *log);
+static void terminalUpdate(TerminalState *state);
+static void terminalSocketHandler(SocketLoop *loop, SOCKET sock, int events, void *data);
+static void terminalStdinHandler(SocketLoop *loop, SOCKET sock, int events, void *data);
+static void terminalStdoutHandler(SocketLoop *loop, SOCKET sock, int events, void *data);
+
+void SocketTerminalWithOptions(SOCKET sock, int check_for_exit, int pst_mode, TerminalOptions *options)
+{
+    TerminalOptions localOptions;
     struct termios oldt, newt;
-    char buf[128], realbuf[256]; // double in case buf is filled with \r in PST mode
-    ssize_t cnt;
-    fd_set set;
-    int exit_char = 0xdead; /* not a valid character */
-    int sawexit_char = 0;
-    int sawexit_valid = 0; 
-    int exitcode = 0;
-    int continue_terminal = 1;
+    TerminalState state;
+    CaptureLog capture;
+    int stdinFlags, stdoutFlags;
+
+    if (!options) {
+        memset(&localOptions, 0, sizeof(localOptions));
+        options = &localOptions;
+    }
+
+    memset(&state, 0, sizeof(state));
+    state.sock = sock;
+    state.check_for_exit = check_for_exit;
+    state.pst_mode = pst_mode;
+    state.exit_char = check_for_exit ? EXIT_CHAR : 0xdead; /* 0xdead is not a valid character */
+    state.options = options;
+    state.start = GetTimeMicroseconds();
+
+    if (!(state.ring = (uint8_t *)malloc(TERMINAL_BUFFER_SIZE)))
+        return;
+    if (!(state.loop = OpenSocketLoop())) {
+        free(state.ring);
+        return;
+    }
+
+    if (options->captureFile) {
+        if (captureOpen(&capture, options->captureFile) == 0)
+            state.capture = &capture;
+        else
+            fprintf(stderr, "warning: can't open capture file '%s'\n", options->captureFile);
+    }
 
     tcgetattr(STDIN_FILENO, &oldt);
     newt = oldt;
@@ -338,73 +565,293 @@ void SocketTerminal(SOCKET sock, int check_for_exit, int pst_mode)
     newt.c_oflag &= ~OPOST;
     tcsetattr(STDIN_FILENO, TCSANOW, &newt);
 
-    if (check_for_exit)
-        exit_char = EXIT_CHAR;
+    /* stdin and stdout often share a file description so save both modes */
+    stdinFlags = fcntl(STDIN_FILENO, F_GETFL, 0);
+    stdoutFlags = fcntl(STDOUT_FILENO, F_GETFL, 0);
 
-#if 0
-    /* make it possible to detect breaks */
-    tcgetattr(sock, &newt);
-    newt.c_iflag &= ~IGNBRK;
-    newt.c_iflag |= PARMRK;
-    tcsetattr(sock, TCSANOW, &newt);
-#endif
+    /* never block on stdout while data is arriving, unless it's something that can't be polled */
+    state.stdoutWatchable = fcntl(STDOUT_FILENO, F_SETFL, stdoutFlags | O_NONBLOCK) == 0
+                         && WatchSocket(state.loop, STDOUT_FILENO, 0, terminalStdoutHandler, &state) == 0;
+    if (!state.stdoutWatchable)
+        fcntl(STDOUT_FILENO, F_SETFL, stdoutFlags);
 
-    do {
-        FD_ZERO(&set);
-        FD_SET(sock, &set);
-        FD_SET(STDIN_FILENO, &set);
-        if (select(sock + 1, &set, NULL, NULL, NULL) > 0) {
-            if (FD_ISSET(sock, &set)) {
-                if ((cnt = recv(sock, buf, sizeof(buf), 0)) > 0) {
-                    int i;
-                    // check for breaks
-                    ssize_t realbytes = 0;
-                    for (i = 0; i < cnt; i++) {
-                      if (sawexit_valid)
-                        {
-                          exitcode = buf[i];
-                          continue_terminal = 0;
-                        }
-                      else if (sawexit_char) {
-                        if (buf[i] == 0) {
-                          sawexit_valid = 1;
-                        } else {
-                          realbuf[realbytes++] = exit_char;
-                          realbuf[realbytes++] = buf[i];
-                          sawexit_char = 0;
-                        }
-                      } else if (((int)buf[i] & 0xff) == exit_char) {
-                        sawexit_char = 1;
-                      } else {
-                        realbuf[realbytes++] = buf[i];
-                        if (pst_mode && buf[i] == '\r')
-                            realbuf[realbytes++] = '\n';
-                      }
-                    }
-                    write(fileno(stdout), realbuf, realbytes);
+    WatchSocket(state.loop, STDIN_FILENO, LOOP_READ, terminalStdinHandler, &state);
+    terminalUpdate(&state);
+
+    while (!state.done) {
+        if (RunSocketLoopOnce(state.loop, -1) < 0)
+            break;
+    }
+
+    /* write whatever is left in the buffer */
+    fcntl(STDOUT_FILENO, F_SETFL, stdoutFlags);
+    while (state.tail != state.head) {
+        uint32_t offset = state.tail & (TERMINAL_BUFFER_SIZE - 1);
+        uint32_t cnt = state.head - state.tail;
+        ssize_t n;
+        if (cnt > TERMINAL_BUFFER_SIZE - offset)
+            cnt = TERMINAL_BUFFER_SIZE - offset;
+        if ((n = write(STDOUT_FILENO, &state.ring[offset], cnt)) <= 0) {
+            options->bytesDropped += state.head - state.tail;
+            break;
+        }
+        options->bytesWritten += n;
+        state.tail += n;
+    }
+
+    if (state.socketPaused)
+        options->socketPausedTime += GetTimeMicroseconds() - state.pausedSince;
+    if (state.stdoutBlocked)
+        options->stdoutBlockedTime += GetTimeMicroseconds() - state.blockedSince;
+    options->elapsedTime = GetTimeMicroseconds() - state.start;
+
+    fcntl(STDIN_FILENO, F_SETFL, stdinFlags);
+    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+
+    if (state.capture)
+        captureClose(state.capture);
+    CloseSocketLoop(state.loop);
+    free(state.ring);
+
+    if (state.sawexit_valid)
+        exit(state.exitcode);
+}
+
+/* terminalUpdate - watch for the events the terminal can handle right now */
+static void terminalUpdate(TerminalState *state)
+{
+    uint32_t used = state->head - state->tail;
+    uint64_t now = GetTimeMicroseconds();
+
+    /* a read can double in size in PST mode, stop reading when that won't fit */
+    if (!state->socketPaused && TERMINAL_BUFFER_SIZE - used < TERMINAL_READ_SIZE * 2) {
+        state->socketPaused = 1;
+        state->pausedSince = now;
+        UnwatchSocket(state->loop, state->sock);
+    }
+    else if (state->socketPaused && TERMINAL_BUFFER_SIZE - used >= TERMINAL_READ_SIZE * 2) {
+        state->socketPaused = 0;
+        state->options->socketPausedTime += now - state->pausedSince;
+    }
+    if (!state->socketPaused)
+        WatchSocket(state->loop, state->sock, LOOP_READ, terminalSocketHandler, state);
+
+    if (state->stdoutWatchable)
+        WatchSocket(state->loop, STDOUT_FILENO, used > 0 ? LOOP_WRITE : 0, terminalStdoutHandler, state);
+}
+
+/* terminalFlush - write as much of the ring as stdout will take without blocking */
+static void terminalFlush(TerminalState *state)
+{
+    while (state->tail != state->head) {
+        uint32_t offset = state->tail & (TERMINAL_BUFFER_SIZE - 1);
+        uint32_t cnt = state->head - state->tail;
+        ssize_t n;
+        if (cnt > TERMINAL_BUFFER_SIZE - offset)
+            cnt = TERMINAL_BUFFER_SIZE - offset;
+        if ((n = write(STDOUT_FILENO, &state->ring[offset], cnt)) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (!state->stdoutBlocked) {
+                    state->stdoutBlocked = 1;
+                    state->blockedSince = GetTimeMicroseconds();
                 }
             }
-            if (FD_ISSET(STDIN_FILENO, &set)) {
-                if ((cnt = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
-                    int i;
-                    for (i = 0; i < cnt; ++i) {
-                        if (buf[i] == ESC)
-                            goto done;
-                    }
-                    write(sock, buf, cnt);
+            else if (errno != EINTR) {
+                state->options->bytesDropped += state->head - state->tail;
+                state->tail = state->head;
+            }
+            break;
+        }
+        state->options->bytesWritten += n;
+        state->tail += n;
+    }
+
+    if (state->stdoutBlocked && state->tail == state->head) {
+        state->stdoutBlocked = 0;
+        state->options->stdoutBlockedTime += GetTimeMicroseconds() - state->blockedSince;
+    }
+}
+
+static void terminalSocketHandler(SocketLoop *loop, SOCKET sock, int events, void *data)
+{
+    TerminalState *state = (TerminalState *)data;
+    uint8_t buf[TERMINAL_READ_SIZE], out[TERMINAL_READ_SIZE * 2];
+    uint32_t offset;
+    int outCnt, cnt, i;
+
+    if ((cnt = recv(sock, buf, sizeof(buf), 0)) <= 0) {
+        if (cnt < 0 && (errno == EAGAIN || errno == EINTR))
+            return;
+        state->done = 1;
+        return;
+    }
+    state->options->bytesReceived += cnt;
+
+    /* handle the exit sequence and PST line endings */
+    if (!state->check_for_exit && !state->pst_mode && !state->sawexit_char) {
+        memcpy(out, buf, cnt);
+        outCnt = cnt;
+    }
+    else {
+        outCnt = 0;
+        for (i = 0; i < cnt; ++i) {
+            if (state->sawexit_valid) {
+                state->exitcode = buf[i];
+                state->done = 1;
+                break;
+            }
+            else if (state->sawexit_char) {
+                if (buf[i] == 0) {
+                    state->sawexit_valid = 1;
+                } else {
+                    out[outCnt++] = state->exit_char;
+                    out[outCnt++] = buf[i];
+                    state->sawexit_char = 0;
                 }
             }
+            else if (((int)buf[i] & 0xff) == state->exit_char) {
+                state->sawexit_char = 1;
+            }
+            else {
+                out[outCnt++] = buf[i];
+                if (state->pst_mode && buf[i] == '\r')
+                    out[outCnt++] = '\n';
+            }
         }
-    } while (continue_terminal);
+    }
 
-done:
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
+    if (state->capture)
+        captureWrite(state->capture, GetTimeMicroseconds() - state->start, out, outCnt);
 
-    if (sawexit_valid)
-        exit(exitcode);
-#endif
+    /* copy into the ring, wrapping if necessary */
+    offset = state->head & (TERMINAL_BUFFER_SIZE - 1);
+    if (outCnt > TERMINAL_BUFFER_SIZE - (int)offset) {
+        int first = TERMINAL_BUFFER_SIZE - offset;
+        memcpy(&state->ring[offset], out, first);
+        memcpy(state->ring, &out[first], outCnt - first);
+    }
+    else
+        memcpy(&state->ring[offset], out, outCnt);
+    state->head += outCnt;
+
+    /* without the event loop stdout gets ordinary blocking writes */
+    terminalFlush(state);
+    terminalUpdate(state);
+}
+
+static void terminalStdoutHandler(SocketLoop *loop, SOCKET sock, int events, void *data)
+{
+    TerminalState *state = (TerminalState *)data;
+
+    /* stdout went away, stop watching it rather than spin on the error */
+    if ((events & LOOP_ERROR) && !(events & LOOP_WRITE)) {
+        UnwatchSocket(loop, STDOUT_FILENO);
+        state->stdoutWatchable = 0;
+    }
+
+    terminalFlush(state);
+    terminalUpdate(state);
+}
+
+static void terminalStdinHandler(SocketLoop *loop, SOCKET sock, int events, void *data)
+{
+    TerminalState *state = (TerminalState *)data;
+    char buf[128];
+    ssize_t cnt;
+    int i;
+
+    if ((cnt = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < cnt; ++i) {
+            if (buf[i] == ESC) {
+                state->done = 1;
+                return;
+            }
+        }
+        SendSocketData(state->sock, buf, cnt);
+    }
+
+    /* stdin is at end of file, keep showing what arrives from the socket */
+    else if (cnt == 0)
+        UnwatchSocket(loop, STDIN_FILENO);
+}
+
+static int captureMapWindow(CaptureLog *log)
+{
+    if (ftruncate(log->fd, log->windowOffset + CAPTURE_WINDOW_SIZE) != 0)
+        return -1;
+    log->window = (uint8_t *)mmap(NULL, CAPTURE_WINDOW_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, log->windowOffset);
+    if (log->window == MAP_FAILED) {
+        log->window = NULL;
+        return -1;
+    }
+    log->windowUsed = 0;
+    return 0;
+}
+
+static void capturePut(CaptureLog *log, const uint8_t *buf, int len)
+{
+    while (len > 0 && log->window) {
+        int cnt = CAPTURE_WINDOW_SIZE - log->windowUsed;
+        if (cnt > len)
+            cnt = len;
+        memcpy(&log->window[log->windowUsed], buf, cnt);
+        log->windowUsed += cnt;
+        buf += cnt;
+        len -= cnt;
+        if (log->windowUsed == CAPTURE_WINDOW_SIZE) {
+            munmap(log->window, CAPTURE_WINDOW_SIZE);
+            log->windowOffset += CAPTURE_WINDOW_SIZE;
+            captureMapWindow(log);
+        }
+    }
+}
+
+static int captureOpen(CaptureLog *log, const char *fileName)
+{
+    memset(log, 0, sizeof(CaptureLog));
+    if ((log->fd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+        return -1;
+    if (captureMapWindow(log) != 0) {
+        close(log->fd);
+        return -1;
+    }
+    log->atLineStart = 1;
+    return 0;
+}
+
+/* captureWrite - log data with the time since the terminal started at the start of each line */
+static void captureWrite(CaptureLog *log, uint64_t timestamp, const uint8_t *buf, int len)
+{
+    const uint8_t *end = buf + len;
+    char stamp[32];
+    int stampLen;
+
+    stampLen = snprintf(stamp, sizeof(stamp), "[%6u.%06u] ",
+                        (unsigned)(timestamp / 1000000), (unsigned)(timestamp % 1000000));
+
+    while (buf < end) {
+        const uint8_t *eol = (const uint8_t *)memchr(buf, '\n', end - buf);
+        const uint8_t *next = eol ? eol + 1 : end;
+        if (log->atLineStart)
+            capturePut(log, (const uint8_t *)stamp, stampLen);
+        capturePut(log, buf, next - buf);
+        log->atLineStart = eol != NULL;
+        buf = next;
+    }
+}
+
+static void captureClose(CaptureLog *log)
+{
+    uint64_t length = log->windowOffset + log->windowUsed;
+    if (log->window)
+        munmap(log->window, CAPTURE_WINDOW_SIZE);
+    if (ftruncate(log->fd, length) != 0)
+        perror("warning: can't trim capture file");
+    close(log->fd);
 }
 
+#endif
+
 /* GetInterfaceAddresses - get the addresses of all IPv4 interfaces */
 int GetInterfaceAddresses(IFADDR *addrs, int max)
 {
@@ -480,3 +927,482 @@ const char *AddressToString(SOCKADDR_IN *addr)
     return inet_ntoa(addr->sin_addr);
 }
 
+
+/* GetTimeMicroseconds - get a monotonic time stamp in microseconds */
+uint64_t GetTimeMicroseconds(void)
+{
+#ifdef __MINGW32__
+    LARGE_INTEGER count, freq;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)(count.QuadPart / freq.QuadPart) * 1000000
+         + (uint64_t)(count.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/*
+ * Socket event loop
+ *
+ * A loop dispatches readiness callbacks for any number of sockets and
+ * one-shot millisecond timers. Linux uses epoll so the cost of a wait
+ * doesn't grow with the number of sockets. Other systems fall back to
+ * poll, which at least isn't limited by FD_SETSIZE like select is.
+ */
+
+typedef struct {
+    SOCKET sock;
+    int events;                 /* LOOP_READ/LOOP_WRITE, 0 if the slot is free */
+    SocketHandler *handler;
+    void *data;
+} SocketWatch;
+
+typedef struct {
+    uint64_t deadline;          /* GetTimeMicroseconds() time to fire */
+    int id;
+    TimerHandler *handler;
+    void *data;
+} LoopTimer;
+
+struct SocketLoop {
+#ifdef USE_EPOLL
+    int epfd;
+    SocketWatch *watches;       /* indexed by file descriptor */
+    int watchMax;
+#else
+    struct pollfd *pollfds;     /* parallel to watches */
+    SocketWatch *watches;       /* dense, compacted after each dispatch */
+    int watchMax;
+    int watchCount;
+#endif
+    int activeCount;
+    LoopTimer *timers;          /* binary heap ordered by deadline */
+    int timerCount;
+    int timerMax;
+    int nextTimerId;
+    int running;
+};
+
+static int growArray(void **pArray, int *pMax, int needed, int size)
+{
+    int newMax = *pMax ? *pMax : 16;
+    void *array;
+    while (newMax < needed)
+        newMax *= 2;
+    if (newMax == *pMax)
+        return 0;
+    if (!(array = realloc(*pArray, newMax * size)))
+        return -1;
+    memset((char *)array + *pMax * size, 0, (newMax - *pMax) * size);
+    *pArray = array;
+    *pMax = newMax;
+    return 0;
+}
+
+static int pollEventsToLoop(int revents)
+{
+    int events = 0;
+    if (revents & (POLLIN | POLLHUP))
+        events |= LOOP_READ;
+    if (revents & POLLOUT)
+        events |= LOOP_WRITE;
+    if (revents & (POLLERR | POLLHUP | POLLNVAL))
+        events |= LOOP_ERROR;
+    return events;
+}
+
+/* OpenSocketLoop - create an event loop */
+SocketLoop *OpenSocketLoop(void)
+{
+    SocketLoop *loop;
+
+#ifdef __MINGW32__
+    if (InitWinSock() != 0)
+        return NULL;
+#endif
+
+    if (!(loop = (SocketLoop *)calloc(1, sizeof(SocketLoop))))
+        return NULL;
+
+#ifdef USE_EPOLL
+    if ((loop->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        free(loop);
+        return NULL;
+    }
+#endif
+
+    loop->nextTimerId = 1;
+    return loop;
+}
+
+/* CloseSocketLoop - free an event loop (the watched sockets are left open) */
+void CloseSocketLoop(SocketLoop *loop)
+{
+#ifdef USE_EPOLL
+    close(loop->epfd);
+#else
+    free(loop->pollfds);
+#endif
+    free(loop->watches);
+    free(loop->timers);
+    free(loop);
+}
+
+#ifdef USE_EPOLL
+
+/* WatchSocket - call a handler when a socket is ready (replaces any earlier watch) */
+int WatchSocket(SocketLoop *loop, SOCKET sock, int events, SocketHandler *handler, void *data)
+{
+    struct epoll_event ev;
+    int op;
+
+    if (sock < 0 || growArray((void **)&loop->watches, &loop->watchMax, sock + 1, sizeof(SocketWatch)) != 0)
+        return -1;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = ((events & LOOP_READ) ? EPOLLIN : 0) | ((events & LOOP_WRITE) ? EPOLLOUT : 0);
+    ev.data.fd = sock;
+    op = loop->watches[sock].events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(loop->epfd, op, sock, &ev) != 0)
+        return -1;
+
+    if (!loop->watches[sock].events)
+        ++loop->activeCount;
+    loop->watches[sock].sock = sock;
+    loop->watches[sock].events = events | LOOP_ERROR;
+    loop->watches[sock].handler = handler;
+    loop->watches[sock].data = data;
+    return 0;
+}
+
+/* UnwatchSocket - stop watching a socket (call before closing it) */
+int UnwatchSocket(SocketLoop *loop, SOCKET sock)
+{
+    if (sock < 0 || sock >= loop->watchMax || !loop->watches[sock].events)
+        return -1;
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, sock, NULL);
+    loop->watches[sock].events = 0;
+    --loop->activeCount;
+    return 0;
+}
+
+static int waitAndDispatch(SocketLoop *loop, int timeout)
+{
+    struct epoll_event events[256];
+    int cnt, i;
+
+    if ((cnt = epoll_wait(loop->epfd, events, sizeof(events) / sizeof(events[0]), timeout)) < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < cnt; ++i) {
+        int fd = events[i].data.fd;
+        SocketWatch *watch;
+        int ready = 0;
+
+        /* an earlier handler may have removed this socket */
+        if (fd >= loop->watchMax || !(watch = &loop->watches[fd])->events)
+            continue;
+
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP))
+            ready |= LOOP_READ;
+        if (events[i].events & EPOLLOUT)
+            ready |= LOOP_WRITE;
+        if (events[i].events & (EPOLLERR | EPOLLHUP))
+            ready |= LOOP_ERROR;
+
+        (*watch->handler)(loop, fd, ready & watch->events, watch->data);
+    }
+
+    return cnt;
+}
+
+#else
+
+static int findWatch(SocketLoop *loop, SOCKET sock)
+{
+    int i;
+    for (i = 0; i < loop->watchCount; ++i)
+        if (loop->watches[i].sock == sock && loop->watches[i].events)
+            return i;
+    return -1;
+}
+
+/* WatchSocket - call a handler when a socket is ready (replaces any earlier watch) */
+int WatchSocket(SocketLoop *loop, SOCKET sock, int events, SocketHandler *handler, void *data)
+{
+    int i;
+
+    if ((i = findWatch(loop, sock)) < 0) {
+        int max = loop->watchMax;
+        if (growArray((void **)&loop->watches, &loop->watchMax, loop->watchCount + 1, sizeof(SocketWatch)) != 0
+        ||  growArray((void **)&loop->pollfds, &max, loop->watchCount + 1, sizeof(struct pollfd)) != 0)
+            return -1;
+        i = loop->watchCount++;
+        ++loop->activeCount;
+    }
+
+    loop->watches[i].sock = sock;
+    loop->watches[i].events = events | LOOP_ERROR;
+    loop->watches[i].handler = handler;
+    loop->watches[i].data = data;
+    loop->pollfds[i].fd = sock;
+    loop->pollfds[i].events = ((events & LOOP_READ) ? POLLIN : 0) | ((events & LOOP_WRITE) ? POLLOUT : 0);
+    loop->pollfds[i].revents = 0;
+    return 0;
+}
+
+/* UnwatchSocket - stop watching a socket (call before closing it) */
+int UnwatchSocket(SocketLoop *loop, SOCKET sock)
+{
+    int i;
+    if ((i = findWatch(loop, sock)) < 0)
+        return -1;
+
+    /* the slot is reclaimed after the current dispatch */
+    loop->watches[i].events = 0;
+    loop->pollfds[i].events = 0;
+    --loop->activeCount;
+    return 0;
+}
+
+static int waitAndDispatch(SocketLoop *loop, int timeout)
+{
+    int count = loop->watchCount;
+    int cnt, i, j;
+
+    if ((cnt = poll(loop->pollfds, count, timeout)) < 0)
+        return errno == EINTR ? 0 : -1;
+
+    for (i = 0; i < count && cnt > 0; ++i) {
+        SocketWatch *watch = &loop->watches[i];
+        int ready;
+        if (!loop->pollfds[i].revents)
+            continue;
+        --cnt;
+        if (!watch->events)
+            continue;
+        ready = pollEventsToLoop(loop->pollfds[i].revents) & watch->events;
+        loop->pollfds[i].revents = 0;
+        (*watch->handler)(loop, watch->sock, ready, watch->data);
+    }
+
+    /* squeeze out the sockets removed by the handlers */
+    for (i = j = 0; i < loop->watchCount; ++i) {
+        if (loop->watches[i].events) {
+            loop->watches[j] = loop->watches[i];
+            loop->pollfds[j] = loop->pollfds[i];
+            ++j;
+        }
+    }
+    loop->watchCount = j;
+
+    return count;
+}
+
+#endif
+
+static void timerSwap(SocketLoop *loop, int i, int j)
+{
+    LoopTimer tmp = loop->timers[i];
+    loop->timers[i] = loop->timers[j];
+    loop->timers[j] = tmp;
+}
+
+static void timerUp(SocketLoop *loop, int i)
+{
+    while (i > 0 && loop->timers[(i - 1) / 2].deadline > loop->timers[i].deadline) {
+        timerSwap(loop, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void timerDown(SocketLoop *loop, int i)
+{
+    for (;;) {
+        int smallest = i, child;
+        for (child = 2 * i + 1; child <= 2 * i + 2 && child < loop->timerCount; ++child)
+            if (loop->timers[child].deadline < loop->timers[smallest].deadline)
+                smallest = child;
+        if (smallest == i)
+            break;
+        timerSwap(loop, i, smallest);
+        i = smallest;
+    }
+}
+
+static void timerRemove(SocketLoop *loop, int i)
+{
+    loop->timers[i] = loop->timers[--loop->timerCount];
+    if (i < loop->timerCount) {
+        timerUp(loop, i);
+        timerDown(loop, i);
+    }
+}
+
+/* AddTimer - call a handler once after timeout milliseconds, returns the timer id */
+int AddTimer(SocketLoop *loop, int timeout, TimerHandler *handler, void *data)
+{
+    LoopTimer *timer;
+
+    if (growArray((void **)&loop->timers, &loop->timerMax, loop->timerCount + 1, sizeof(LoopTimer)) != 0)
+        return -1;
+
+    timer = &loop->timers[loop->timerCount];
+    timer->deadline = GetTimeMicroseconds() + (uint64_t)(timeout < 0 ? 0 : timeout) * 1000;
+    timer->id = loop->nextTimerId++;
+    timer->handler = handler;
+    timer->data = data;
+    timerUp(loop, loop->timerCount++);
+
+    return timer->id;
+}
+
+/* CancelTimer - cancel a timer that hasn't fired yet */
+void CancelTimer(SocketLoop *loop, int id)
+{
+    int i;
+    for (i = 0; i < loop->timerCount; ++i) {
+        if (loop->timers[i].id == id) {
+            timerRemove(loop, i);
+            break;
+        }
+    }
+}
+
+/* RunSocketLoopOnce - wait up to timeout milliseconds (-1 forever) and dispatch what's ready */
+int RunSocketLoopOnce(SocketLoop *loop, int timeout)
+{
+    uint64_t now;
+    int cnt;
+
+    /* don't sleep past the next timer */
+    if (loop->timerCount > 0) {
+        uint64_t deadline = loop->timers[0].deadline;
+        now = GetTimeMicroseconds();
+        if (deadline <= now)
+            timeout = 0;
+        else if (timeout < 0 || (deadline - now + 999) / 1000 < (uint64_t)timeout)
+            timeout = (int)((deadline - now + 999) / 1000);
+    }
+
+    if ((cnt = waitAndDispatch(loop, timeout)) < 0)
+        return -1;
+
+    /* run the timers that have expired, including ones they add with a zero timeout */
+    now = GetTimeMicroseconds();
+    while (loop->timerCount > 0 && loop->timers[0].deadline <= now) {
+        LoopTimer timer = loop->timers[0];
+        timerRemove(loop, 0);
+        (*timer.handler)(loop, timer.data);
+        ++cnt;
+    }
+
+    return cnt;
+}
+
+/* RunSocketLoop - dispatch events until stopped or there's nothing left to wait for */
+void RunSocketLoop(SocketLoop *loop)
+{
+    loop->running = 1;
+    while (loop->running && (loop->activeCount > 0 || loop->timerCount > 0)) {
+        if (RunSocketLoopOnce(loop, -1) < 0)
+            break;
+    }
+    loop->running = 0;
+}
+
+/* StopSocketLoop - make RunSocketLoop return after the current dispatch */
+void StopSocketLoop(SocketLoop *loop)
+{
+    loop->running = 0;
+}
+
+/* WaitForSocket - wait up to timeout milliseconds (-1 forever) for a single socket */
+int WaitForSocket(SOCKET sock, int events, int timeout)
+{
+    struct pollfd pfd;
+    int cnt;
+
+    pfd.fd = sock;
+    pfd.events = ((events & LOOP_READ) ? POLLIN : 0) | ((events & LOOP_WRITE) ? POLLOUT : 0);
+    pfd.revents = 0;
+
+    do {
+        cnt = poll(&pfd, 1, timeout);
+    } while (cnt < 0 && errno == EINTR);
+
+    if (cnt <= 0)
+        return cnt;
+
+    return pollEventsToLoop(pfd.revents);
+}
+
+/* SetSocketBlocking - switch a socket between blocking and non-blocking mode */
+int SetSocketBlocking(SOCKET sock, int blocking)
+{
+#ifdef __MINGW32__
+    u_long nonBlocking = !blocking;
+    return ioctlsocket(sock, FIONBIO, &nonBlocking) == 0 ? 0 : -1;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    flags = blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK;
+    return fcntl(sock, F_SETFL, flags);
+#endif
+}
+
+/* ConnectSocketAsync - start a connection: 0 if connected, 1 if in progress, -1 on error */
+int ConnectSocketAsync(SOCKADDR_IN *addr, SOCKET *pSocket)
+{
+    SOCKET sock;
+
+#ifdef __MINGW32__
+    if (InitWinSock() != 0)
+        return -1;
+#endif
+
+    /* create a non-blocking socket */
+    if ((sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0)
+        return -1;
+    if (SetSocketBlocking(sock, 0) != 0) {
+        closesocket(sock);
+        return -1;
+    }
+
+    /* start connecting to the server */
+    if (connect(sock, (SOCKADDR *)addr, sizeof(*addr)) != 0) {
+#ifdef __MINGW32__
+        if (WSAGetLastError() != WSAEWOULDBLOCK) {
+#else
+        if (errno != EINPROGRESS) {
+#endif
+            closesocket(sock);
+            return -1;
+        }
+        *pSocket = sock;
+        return 1;
+    }
+
+    /* return the socket */
+    *pSocket = sock;
+    return 0;
+}
+
+/* GetSocketError - get the pending error on a socket (the result of an async connect) */
+int GetSocketError(SOCKET sock)
+{
+    int err = 0;
+#ifdef __MINGW32__
+    int len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&err, &len) != 0)
+#else
+    socklen_t len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (void *)&err, &len) != 0)
+#endif
+        return -1;
+    return err;
+}
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tuning.h"
+
+#define MAX_CACHE_LINE      256
+#define MAX_CACHE_ENTRIES   64
+
+/* first line of the cache, the version changes with the line format and older files are ignored */
+#define CACHE_HEADER        "# espload tuning cache v2: address max-packet trial chunk depth rate version\n"
+
+/* candidate parameters measured during the first loads to a module */
+static const struct {
+    int chunkSize;
+    int depth;
+} candidates[] = {
+    { 1024, 1 },
+    { 1024, 2 },
+    {  512, 2 },
+    {  256, 2 },
+    { 1024, 3 }
+};
+#define NUM_CANDIDATES  ((int)(sizeof(candidates) / sizeof(candidates[0])))
+
+static int getCachePath(char *path, int size);
+static FILE *openCache(const char *path);
+static int parseEntry(const char *line, TuningEntry *entry);
+static void formatEntry(const TuningEntry *entry, char *line, int size);
+static void saveEntry(const TuningEntry *entry);
+
+/* TuningLookup - find the learned parameters for a module */
+void TuningLookup(const char *address, int defChunkSize, TuningEntry *entry)
+{
+    char path[512], line[MAX_CACHE_LINE];
+    FILE *fp;
+
+    /* start with the defaults in case the module isn't in the cache */
+    memset(entry, 0, sizeof(TuningEntry));
+    strncpy(entry->address, address, sizeof(entry->address) - 1);
+    entry->chunkSize = defChunkSize;
+    entry->depth = 1;
+
+    if (getCachePath(path, sizeof(path)) != 0 || !(fp = openCache(path)))
+        return;
+
+    while (fgets(line, sizeof(line), fp)) {
+        TuningEntry tmp;
+        if (parseEntry(line, &tmp) == 0 && strcmp(tmp.address, address) == 0) {
+            *entry = tmp;
+            break;
+        }
+    }
+
+    fclose(fp);
+}
+
+/* TuningSelect - choose the parameters to use for the next load */
+void TuningSelect(TuningEntry *entry, int *pChunkSize, int *pDepth)
+{
+    /* only try smaller packets once the module has told us it supports them */
+    if (entry->maxPacketSize > 0 && entry->trial < NUM_CANDIDATES) {
+        *pChunkSize = candidates[entry->trial].chunkSize;
+        if (*pChunkSize > entry->maxPacketSize)
+            *pChunkSize = entry->maxPacketSize;
+        *pDepth = candidates[entry->trial].depth;
+    }
+    else {
+        *pChunkSize = entry->chunkSize;
+        *pDepth = entry->depth;
+    }
+}
+
+/* TuningUpdate - record the measurements from a successful load */
+void TuningUpdate(TuningEntry *entry, const char *version, int maxPacketSize, int chunkSize, int depth, int requests, int rate)
+{
+    /* a firmware change invalidates everything we've learned */
+    if (entry->version[0] && strcmp(entry->version, version) != 0) {
+        entry->trial = 0;
+        entry->rate = 0;
+    }
+    strncpy(entry->version, version, sizeof(entry->version) - 1);
+    entry->version[sizeof(entry->version) - 1] = '\0';
+
+    /* the first load just learns what the module supports */
+    if (entry->maxPacketSize <= 0) {
+        entry->maxPacketSize = maxPacketSize;
+        saveEntry(entry);
+        return;
+    }
+    entry->maxPacketSize = maxPacketSize;
+
+    /* small images don't say much about throughput */
+    if (requests >= MIN_TUNING_REQUESTS) {
+        /* a better rate during exploration picks a new winner */
+        if (entry->trial < NUM_CANDIDATES) {
+            if (rate > entry->rate) {
+                entry->chunkSize = chunkSize;
+                entry->depth = depth;
+                entry->rate = rate;
+            }
+            ++entry->trial;
+        }
+
+        /* once tuned, track the winner's rate as conditions change */
+        else if (chunkSize == entry->chunkSize && depth == entry->depth)
+            entry->rate = (entry->rate * 3 + rate) / 4;
+    }
+
+    saveEntry(entry);
+}
+
+static int getCachePath(char *path, int size)
+{
+#ifdef __MINGW32__
+    const char *home = getenv("USERPROFILE");
+#else
+    const char *home = getenv("HOME");
+#endif
+    if (!home)
+        return -1;
+    snprintf(path, size, "%s/%s", home, TUNING_CACHE_NAME);
+    return 0;
+}
+
+/* openCache - open the cache for reading past its header, NULL if it's missing or in an older format */
+static FILE *openCache(const char *path)
+{
+    char line[MAX_CACHE_LINE];
+    FILE *fp;
+
+    if (!(fp = fopen(path, "r")))
+        return NULL;
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, CACHE_HEADER) != 0) {
+        fclose(fp);
+        return NULL;
+    }
+    return fp;
+}
+
+/* cache lines look like: address max-packet trial chunk depth rate version... */
+static int parseEntry(const char *line, TuningEntry *entry)
+{
+    int cnt;
+    memset(entry, 0, sizeof(TuningEntry));
+    if (line[0] == '#')
+        return -1;
+    if (sscanf(line, "%31s %d %d %d %d %d %n",
+               entry->address,
+               &entry->maxPacketSize,
+               &entry->trial,
+               &entry->chunkSize,
+               &entry->depth,
+               &entry->rate,
+               &cnt) != 6)
+        return -1;
+    strncpy(entry->version, &line[cnt], sizeof(entry->version) - 1);
+    entry->version[strcspn(entry->version, "\r\n")] = '\0';
+    if (entry->chunkSize < 1 || entry->depth < 1 || entry->depth > MAX_DEPTH)
+        return -1;
+    return 0;
+}
+
+static void formatEntry(const TuningEntry *entry, char *line, int size)
+{
+    snprintf(line, size, "%s %d %d %d %d %d %s\n",
+             entry->address,
+             entry->maxPacketSize,
+             entry->trial,
+             entry->chunkSize,
+             entry->depth,
+             entry->rate,
+             entry->version);
+}
+
+static void saveEntry(const TuningEntry *entry)
+{
+    char path[512], line[MAX_CACHE_LINE];
+    static char lines[MAX_CACHE_ENTRIES][MAX_CACHE_LINE];
+    int lineCount = 0, i;
+    FILE *fp;
+
+    if (getCachePath(path, sizeof(path)) != 0)
+        return;
+
+    /* keep the entries for the other modules */
+    if ((fp = openCache(path)) != NULL) {
+        while (lineCount < MAX_CACHE_ENTRIES - 1 && fgets(line, sizeof(line), fp)) {
+            TuningEntry tmp;
+            if (parseEntry(line, &tmp) == 0 && strcmp(tmp.address, entry->address) != 0)
+                formatEntry(&tmp, lines[lineCount++], MAX_CACHE_LINE);
+        }
+        fclose(fp);
+    }
+    formatEntry(entry, lines[lineCount++], MAX_CACHE_LINE);
+
+    if (!(fp = fopen(path, "w")))
+        return;
+    fputs(CACHE_HEADER, fp);
+    for (i = 0; i < lineCount; ++i)
+        fputs(lines[i], fp);
+    fclose(fp);
+}
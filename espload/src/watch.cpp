@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#define USE_INOTIFY
+#endif
+
+#ifdef __MINGW32__
+#include <windows.h>
+#define sleepMilliseconds(ms)   Sleep(ms)
+#else
+#include <unistd.h>
+#define sleepMilliseconds(ms)   usleep((ms) * 1000)
+#endif
+
+#include "sock.h"
+#include "watch.h"
+
+static int getFileState(const char *path, time_t *pMtime, long *pSize);
+static int waitForEvents(FileWatch *watch, int timeout);
+
+/* OpenFileWatch - start watching a file for changes */
+int OpenFileWatch(FileWatch *watch, const char *path)
+{
+    char *p;
+
+    memset(watch, 0, sizeof(FileWatch));
+    strncpy(watch->path, path, sizeof(watch->path) - 1);
+    getFileState(watch->path, &watch->mtime, &watch->size);
+    watch->fd = -1;
+
+#ifdef USE_INOTIFY
+    {
+        char dir[sizeof(watch->path)];
+
+        /* watch the directory so files replaced by a rename are seen too */
+        strcpy(dir, watch->path);
+        if ((p = strrchr(dir, '/')) != NULL) {
+            watch->name = &watch->path[p - dir + 1];
+            if (p == dir)
+                p[1] = '\0';
+            else
+                *p = '\0';
+        }
+        else {
+            watch->name = watch->path;
+            strcpy(dir, ".");
+        }
+
+        if ((watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) >= 0) {
+            watch->wd = inotify_add_watch(watch->fd, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+            if (watch->wd < 0) {
+                close(watch->fd);
+                watch->fd = -1;
+            }
+        }
+    }
+#else
+    watch->name = (p = strrchr(watch->path, '/')) != NULL ? p + 1 : watch->path;
+#endif
+
+    return 0;
+}
+
+/* CloseFileWatch - stop watching a file */
+void CloseFileWatch(FileWatch *watch)
+{
+#ifdef USE_INOTIFY
+    if (watch->fd >= 0)
+        close(watch->fd);
+#endif
+    watch->fd = -1;
+}
+
+/* WaitForFileChange - wait for a change to the file that has been finished for WATCH_DEBOUNCE_TIME
+ *   returns 1 if the file changed, 0 on timeout, -1 on error
+ */
+int WaitForFileChange(FileWatch *watch, int timeout)
+{
+    uint64_t deadline = GetTimeMicroseconds() + (uint64_t)timeout * 1000;
+
+    for (;;) {
+        uint64_t now = GetTimeMicroseconds();
+        int wait;
+
+        /* report a change once the writer has left the file alone long enough */
+        if (watch->pending && now - watch->lastEventTime >= WATCH_DEBOUNCE_TIME * 1000) {
+            watch->pending = 0;
+            if (getFileState(watch->path, &watch->mtime, &watch->size) == 0 && watch->size > 0)
+                return 1;
+        }
+
+        if (now >= deadline)
+            return 0;
+
+        /* wake up in time to finish the debounce */
+        wait = (int)((deadline - now + 999) / 1000);
+        if (watch->pending) {
+            int debounce = WATCH_DEBOUNCE_TIME - (int)((now - watch->lastEventTime) / 1000);
+            if (debounce < wait)
+                wait = debounce < 1 ? 1 : debounce;
+        }
+
+        if (waitForEvents(watch, wait) < 0)
+            return -1;
+    }
+}
+
+/* waitForEvents - wait for the file to be touched, noting when that happened */
+static int waitForEvents(FileWatch *watch, int timeout)
+{
+#ifdef USE_INOTIFY
+    if (watch->fd >= 0) {
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        struct pollfd pfd;
+        ssize_t len;
+        char *p;
+
+        pfd.fd = watch->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        if (poll(&pfd, 1, timeout) < 0)
+            return errno == EINTR ? 0 : -1;
+
+        while ((len = read(watch->fd, buf, sizeof(buf))) > 0) {
+            for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+                struct inotify_event *event = (struct inotify_event *)p;
+                if (event->len > 0 && strcmp(event->name, watch->name) == 0) {
+                    watch->pending = 1;
+                    watch->lastEventTime = GetTimeMicroseconds();
+                    if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                        watch->changeTime = watch->lastEventTime;
+                }
+            }
+        }
+        return 0;
+    }
+#endif
+
+    /* no change notification, look at the file every so often */
+    {
+        time_t mtime;
+        long size;
+
+        sleepMilliseconds(timeout < WATCH_POLL_INTERVAL ? timeout : WATCH_POLL_INTERVAL);
+        if (getFileState(watch->path, &mtime, &size) == 0 && (mtime != watch->mtime || size != watch->size)) {
+            watch->mtime = mtime;
+            watch->size = size;
+            watch->pending = 1;
+            watch->lastEventTime = watch->changeTime = GetTimeMicroseconds();
+        }
+    }
+
+    return 0;
+}
+
+static int getFileState(const char *path, time_t *pMtime, long *pSize)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return -1;
+    *pMtime = st.st_mtime;
+    *pSize = (long)st.st_size;
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef CGI_H
+#define CGI_H
+
+/* the parts of esp-link's esp-link/cgi.h the loader and the page stand-ins use (simcgi.c) */
+
+#include "httpd.h"
+
+void noCacheHeaders(HttpdConnData *connData, int code);
+void errorResponse(HttpdConnData *connData, int code, char *message);
+void jsonHeader(HttpdConnData *connData, int code);
+
+#endif
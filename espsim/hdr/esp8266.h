@@ -0,0 +1,158 @@
+#ifndef ESP8266_H
+#define ESP8266_H
+
+/* stand-in for the SDK headers so firmware sources build on a host against the simulator
+
+   Only what httpd.c and the Propeller loader use is here. Timers, the system clock and
+   espconn run in the simulator's virtual time (simloop.c, simnet.c) and the UART and GPIO
+   pins are wired to a simulated Propeller (simuart.c).
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RAM_ATTR
+
+typedef uint8_t uint8;
+typedef int8_t sint8;
+typedef uint16_t uint16;
+typedef int16_t sint16;
+typedef uint32_t uint32;
+typedef int32_t sint32;
+
+/* osapi.h */
+int SimLog(const char *format, ...);
+#define os_printf SimLog
+#define os_sprintf sprintf
+#define os_strcpy strcpy
+#define os_strncpy strncpy
+#define os_strcmp strcmp
+#define os_strncmp strncmp
+#define os_strlen strlen
+#define os_strstr strstr
+#define os_memcpy memcpy
+#define os_memset memset
+#define os_memcmp memcmp
+#define os_malloc SimMalloc
+#define os_zalloc SimZalloc
+#define os_free SimFree
+#define os_delay_us(us) SimBusy(us)
+
+/* timers */
+typedef void ETSTimerFunc(void *timer_arg);
+typedef struct _ETSTIMER_ {
+    ETSTimerFunc *timer_func;
+    void *timer_arg;
+    uint64_t timer_expire;      /* when it next fires (virtual microseconds) */
+    uint32_t timer_period;      /* microseconds, 0 for a one-shot timer */
+    int event;                  /* pending simulator event (0 when disarmed) */
+} ETSTimer;
+
+void os_timer_setfn(ETSTimer *timer, ETSTimerFunc *func, void *arg);
+void os_timer_arm(ETSTimer *timer, uint32 ms, bool repeat);
+void os_timer_arm_us(ETSTimer *timer, uint32 us, bool repeat);
+void os_timer_disarm(ETSTimer *timer);
+
+/* user_interface.h */
+uint32 system_get_time(void);
+uint32 system_get_free_heap_size(void);
+void SimBusy(uint32 us);
+
+/* mem.h, allocations are counted against the heap the ESP8266 would have free */
+#define SIM_HEAP_SIZE   40000
+void *SimMalloc(size_t size);
+void *SimZalloc(size_t size);
+void SimFree(void *p);
+
+/* spi_flash.h, a few sectors kept in memory (simflash.c) */
+#define SPI_FLASH_SEC_SIZE  4096
+typedef enum {
+    SPI_FLASH_RESULT_OK,
+    SPI_FLASH_RESULT_ERR,
+    SPI_FLASH_RESULT_TIMEOUT
+} SpiFlashOpResult;
+SpiFlashOpResult spi_flash_erase_sector(uint16 sec);
+SpiFlashOpResult spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size);
+SpiFlashOpResult spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size);
+
+/* eagle_soc.h, only the UART status register is modelled (simuart.c) */
+uint32 SimReadPeriReg(uint32 addr);
+#define READ_PERI_REG(addr) SimReadPeriReg(addr)
+
+/* gpio.h, the reset pin goes to the simulated Propeller */
+void SimGpioSet(int pin, int level);
+#define GPIO_OUTPUT_SET(pin, level) SimGpioSet((pin), (level))
+void makeGpio(int pin);
+
+/* espconn.h */
+#define ESPCONN_OK          0
+#define ESPCONN_MEM         -1
+#define ESPCONN_TIMEOUT     -3
+#define ESPCONN_RTE         -4
+#define ESPCONN_INPROGRESS  -5
+#define ESPCONN_MAXNUM      -7
+#define ESPCONN_ABRT        -8
+#define ESPCONN_RST         -9
+#define ESPCONN_CLSD        -10
+#define ESPCONN_CONN        -11
+#define ESPCONN_ARG         -12
+#define ESPCONN_ISCONN      -15
+
+enum espconn_type { ESPCONN_INVALID = 0, ESPCONN_TCP = 0x10, ESPCONN_UDP = 0x20 };
+enum espconn_state { ESPCONN_NONE, ESPCONN_WAIT, ESPCONN_LISTEN, ESPCONN_CONNECT, ESPCONN_WRITE, ESPCONN_READ, ESPCONN_CLOSE };
+enum espconn_option { ESPCONN_START = 0x00, ESPCONN_REUSEADDR = 0x01, ESPCONN_NODELAY = 0x02, ESPCONN_COPY = 0x04, ESPCONN_KEEPALIVE = 0x08, ESPCONN_END };
+
+typedef void (*espconn_connect_callback)(void *arg);
+typedef void (*espconn_reconnect_callback)(void *arg, sint8 err);
+typedef void (*espconn_recv_callback)(void *arg, char *pdata, unsigned short len);
+typedef void (*espconn_sent_callback)(void *arg);
+
+typedef struct _esp_tcp {
+    int remote_port;
+    int local_port;
+    uint8 local_ip[4];
+    uint8 remote_ip[4];
+    espconn_connect_callback connect_callback;
+    espconn_reconnect_callback reconnect_callback;
+    espconn_connect_callback disconnect_callback;
+} esp_tcp;
+
+typedef struct _esp_udp {
+    int remote_port;
+    int local_port;
+    uint8 local_ip[4];
+    uint8 remote_ip[4];
+} esp_udp;
+
+struct SimConn;
+
+struct espconn {
+    enum espconn_type type;
+    enum espconn_state state;
+    union {
+        esp_tcp *tcp;
+        esp_udp *udp;
+    } proto;
+    espconn_recv_callback recv_callback;
+    espconn_sent_callback sent_callback;
+    uint8 link_cnt;
+    void *reverse;
+    struct SimConn *sim;        /* the simulated connection behind an accepted espconn */
+};
+
+sint8 espconn_accept(struct espconn *espconn);
+sint8 espconn_tcp_set_max_con_allow(struct espconn *espconn, uint8 num);
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb);
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb);
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb);
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb);
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb);
+sint8 espconn_set_opt(struct espconn *espconn, uint8 opt);
+sint8 espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length);
+sint8 espconn_disconnect(struct espconn *espconn);
+
+#endif
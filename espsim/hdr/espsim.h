@@ -0,0 +1,79 @@
+#ifndef ESPSIM_H
+#define ESPSIM_H
+
+/* espsim - run esp-link's httpd.c and the Propeller loader on a host in virtual time
+
+   Everything happens in a single thread driven by a queue of events ordered by virtual time
+   (microseconds) and then by the order they were scheduled, so a run is repeatable for a
+   given scenario and seed. Work done by a handler takes no virtual time unless it calls
+   SimBusy, the way the SDK's busy-waiting UART functions hold up the CPU.
+*/
+
+#include "esp8266.h"
+#include "propsim.h"
+
+typedef void SimHandler(void *data);
+
+/* simloop.c */
+void SimInit(void);
+uint64_t SimNow(void);
+int SimSchedule(uint64_t time, SimHandler *handler, void *data);
+void SimCancel(int id);
+int SimRunOnce(void);
+void SimSetTime(uint64_t time);
+int SimNextEvent(uint64_t *pTime);
+size_t SimHeapUsed(void);
+size_t SimHeapPeak(void);
+
+#define SIM_TIMER_ARM       0
+#define SIM_TIMER_DISARM    1
+#define SIM_TIMER_FIRE      2
+
+extern int SimVerbose;
+extern void (*SimDispatchHook)(void);
+extern void (*SimTimerHook)(ETSTimer *timer, int what);
+
+/* simuart.c */
+void SimUartInit(int resetPin);
+void SimUartClose(void);
+PropSim *SimUartPropeller(void);
+uint64_t SimUartBlockedTime(void);
+
+/* simnet.c */
+typedef struct {
+    int rtt;                    /* round trip time (microseconds) */
+    int jitter;                 /* most random delay added to each direction (microseconds) */
+    int lossPercent;            /* segments lost and resent after the rto */
+    int rto;                    /* retransmission timeout (microseconds) */
+    uint32_t seed;
+} SimNetwork;
+
+#define SIM_CONNECTED       0
+#define SIM_DATA            1
+#define SIM_CLOSED          2
+#define SIM_REFUSED         3
+
+typedef struct SimConn SimConn;
+typedef void SimClientHandler(SimConn *conn, int event, const char *buf, int len, void *data);
+
+void SimNetInit(const SimNetwork *network);
+void SimNetClose(void);
+SimConn *SimConnect(int port, SimClientHandler *handler, void *data);
+void SimSend(SimConn *conn, const char *buf, int len);
+void SimClose(SimConn *conn);
+int SimNetConnections(void);
+uint32_t SimRandom(void);
+
+/* simsock.c */
+typedef struct {
+    int accepted;               /* connections handed to httpd */
+    int refused;                /* turned away past max_con_allow */
+    int poolOverflows;          /* turned away by httpd with its pool full */
+    int peakConnections;
+} SimSockStats;
+
+void SimSockInit(void);
+int SimSockRun(volatile int *pStop);
+const SimSockStats *SimSockGetStats(void);
+
+#endif
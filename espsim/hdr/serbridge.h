@@ -0,0 +1,9 @@
+#ifndef SERBRIDGE_H
+#define SERBRIDGE_H
+
+/* esp-link serial/serbridge.h stand-in */
+
+// callback when receiving UART chars when in programming mode
+extern void (*programmingCB)(char *buffer, short length);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef SERLED_H
+#define SERLED_H
+
+/* esp-link serial/serled.h stand-in, the LEDs aren't simulated */
+
+#define serledFlash(duration)
+
+#endif
@@ -0,0 +1,2 @@
+/* SDK header stand-in, everything is in esp8266.h */
+#include "esp8266.h"
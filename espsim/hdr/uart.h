@@ -0,0 +1,20 @@
+#ifndef UART_H
+#define UART_H
+
+/* esp-link serial/uart.h stand-in, UART0 talks to the simulated Propeller (simuart.c) */
+
+#include "esp8266.h"
+
+#define UART0   0
+#define UART1   1
+
+/* from serial/uart_hw.h, the transmit FIFO count in the status register */
+#define UART_STATUS(i)      (0x60000000 + (i) * 0xF00 + 0x1C)
+#define UART_TXFIFO_CNT     0x000000FF
+#define UART_TXFIFO_CNT_S   16
+
+void uart0_tx_buffer(char *buf, uint16 len);
+void uart_tx_one_char(uint8 uart, uint8 c);
+void uart0_baud(int rate);
+
+#endif
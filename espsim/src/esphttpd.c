@@ -0,0 +1,257 @@
+/* esphttpd - esp-link's httpd.c serving on a host port over real sockets
+
+   The URL table follows esp-link/main.c. The Propeller loader is the real cgiprop.c driving
+   a simulated Propeller, the web UI's ajax handlers are stand-ins that send replies of about
+   the size the real ones do, and the catch-all serves stand-in files a send buffer at a time
+   the way cgiEspFsHook does. GET /sim/stats reports what the server has seen so a load
+   generator (httpload) can collect it at the end of a run.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include "espsim.h"
+#include "httpd.h"
+#include "cgi.h"
+#include "cgiprop.h"
+#include "proploader.h"
+
+#define DEF_PORT            8080
+#define FILE_CHUNK_SIZE     1024
+
+typedef struct {
+    const char *url;
+    int size;
+} SimFile;
+
+/* about what the espfs image holds */
+static const SimFile files[] = {
+    { "/home.html",         4200 },
+    { "/console.html",      3100 },
+    { "/log.html",          1600 },
+    { "/wifi/wifi.html",    4800 },
+    { "/style.css",         7400 },
+    { "/ui.js",             13800 },
+    { "/favicon.ico",       1150 },
+    { NULL,                 0 }
+};
+
+extern PropellerConnection myConnection;
+
+char *esp_link_version = "esphttpd";
+
+static int cgiMenu(HttpdConnData *connData);
+static int ajaxText(HttpdConnData *connData);
+static int ajaxJson(HttpdConnData *connData);
+static int cgiStats(HttpdConnData *connData);
+static int cgiFile(HttpdConnData *connData);
+
+static const char menuJson[] =
+    "{ \"menu\": [ \"Home\", \"/home.html\", \"WiFi Station\", \"/wifi/wifiSta.html\", "
+    "\"WiFi Soft-AP\", \"/wifi/wifiAp.html\", \"&#xb5;C Console\", \"/console.html\", "
+    "\"Services\", \"/services.html\", \"Debug log\", \"/log.html\" ], "
+    "\"version\": \"esphttpd\", \"name\": \"esp-link\" }";
+
+static const char smallJson[] =
+    "{ \"mode\": \"STA\", \"ssid\": \"network\", \"status\": \"got IP address\", "
+    "\"phy\": \"11n\", \"rssi\": \"-52dB\", \"warn\": \"\", \"apwarn\": \"\", "
+    "\"mac\":\"5c:cf:7f:01:02:03\", \"chan\":\"6\", \"apssid\": \"ESP_010203\", "
+    "\"appass\": \"\", \"apchan\": \"1\", \"apmaxc\": \"4\", \"aphidd\": \"disabled\", "
+    "\"apbeac\": \"100\", \"apauth\": \"OPEN\",\"apmac\":\"5e:cf:7f:01:02:03\", "
+    "\"ip\": \"192.168.1.42\", \"netmask\": \"255.255.255.0\", \"gateway\": \"192.168.1.1\", "
+    "\"hostname\": \"esp-link\", \"staticip\": \"0.0.0.0\", \"dhcp\": \"on\" }";
+
+HttpdBuiltInUrl builtInUrls[] = {
+    { "/", cgiRedirect, "/home.html" },
+    { "/menu", cgiMenu, NULL },
+    { "/log/text", ajaxText, NULL },
+    { "/log/dbg", ajaxJson, NULL },
+    { "/console/text", ajaxText, NULL },
+    { "/console/send", ajaxJson, NULL },
+    { "/wifi", cgiRedirect, "/wifi/wifi.html" },
+    { "/wifi/", cgiRedirect, "/wifi/wifi.html" },
+    { "/wifi/info", ajaxJson, NULL },
+    { "/wifi/scan", ajaxJson, NULL },
+    { "/wifi/connstatus", ajaxJson, NULL },
+    { "/system/info", ajaxJson, NULL },
+    { "/services/info", ajaxJson, NULL },
+    { "/pins", ajaxJson, NULL },
+    { "/propeller/load-begin", cgiPropLoadBegin, NULL },
+    { "/propeller/load-data", cgiPropLoadData, NULL },
+    { "/propeller/load-end", cgiPropLoadEnd, NULL },
+    { "/propeller/stats", cgiPropStats, NULL },
+    { "/sim/stats", cgiStats, NULL },
+    { "*", cgiFile, NULL },
+    { NULL, NULL, NULL }
+};
+
+static volatile int stop = 0;
+
+static void report(void);
+static void handleSignal(int sig);
+static void Usage(void);
+
+int main(int argc, char *argv[])
+{
+    int port = DEF_PORT, i;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        if (argv[i][0] != '-')
+            Usage();
+        switch (argv[i][1]) {
+        case 'p':
+            if (argv[i][2])
+                port = atoi(&argv[i][2]);
+            else if (++i < argc)
+                port = atoi(argv[i]);
+            else
+                Usage();
+            break;
+        case 'v':
+            SimVerbose = 1;
+            break;
+        default:
+            Usage();
+            break;
+        }
+    }
+
+    signal(SIGINT, handleSignal);
+    signal(SIGTERM, handleSignal);
+
+    SimSockInit();
+    SimUartInit(DEFAULT_RESET_PIN);
+    cgiPropInit();
+    httpdInit(builtInUrls, port);
+
+    printf("serving on port %d\n", port);
+    fflush(stdout);
+    if (SimSockRun(&stop) != 0)
+        return 1;
+
+    report();
+    SimUartClose();
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    printf("\
+usage: esphttpd\n\
+         [ -p <port> ]     port to serve on (default is %d)\n\
+         [ -v ]            show the firmware's debug output\n", DEF_PORT);
+    exit(1);
+}
+
+static void handleSignal(int sig)
+{
+    stop = 1;
+}
+
+static void report(void)
+{
+    const SimSockStats *stats = SimSockGetStats();
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    printf("accepted %d, refused %d, pool overflows %d, peak connections %d\n",
+           stats->accepted, stats->refused, stats->poolOverflows, stats->peakConnections);
+    printf("peak heap %d bytes (of %d), peak rss %ld KB\n",
+           (int)SimHeapPeak(), SIM_HEAP_SIZE, (long)usage.ru_maxrss);
+}
+
+static int cgiMenu(HttpdConnData *connData)
+{
+    if (connData->conn == NULL)
+        return HTTPD_CGI_DONE;
+    jsonHeader(connData, 200);
+    httpdSend(connData, menuJson, -1);
+    return HTTPD_CGI_DONE;
+}
+
+/* ajaxText - the console and log buffers, which the UI polls for */
+static int ajaxText(HttpdConnData *connData)
+{
+    char buf[1100];
+    int len, i;
+
+    if (connData->conn == NULL)
+        return HTTPD_CGI_DONE;
+    jsonHeader(connData, 200);
+    len = sprintf(buf, "{\"len\":1024, \"start\":0, \"text\": \"");
+    for (i = 0; i < 1024; ++i)
+        buf[len++] = 'a' + (i % 26);
+    len += sprintf(&buf[len], "\"}");
+    httpdSend(connData, buf, len);
+    return HTTPD_CGI_DONE;
+}
+
+static int ajaxJson(HttpdConnData *connData)
+{
+    if (connData->conn == NULL)
+        return HTTPD_CGI_DONE;
+    jsonHeader(connData, 200);
+    httpdSend(connData, smallJson, -1);
+    return HTTPD_CGI_DONE;
+}
+
+static int cgiStats(HttpdConnData *connData)
+{
+    const SimSockStats *stats = SimSockGetStats();
+    char buf[256];
+
+    if (connData->conn == NULL)
+        return HTTPD_CGI_DONE;
+    sprintf(buf, "accepted=%d\r\nrefused=%d\r\npool-overflows=%d\r\npeak-connections=%d\r\npeak-heap=%d\r\n",
+            stats->accepted, stats->refused, stats->poolOverflows, stats->peakConnections, (int)SimHeapPeak());
+    errorResponse(connData, 200, buf);
+    return HTTPD_CGI_DONE;
+}
+
+/* cgiFile - send a file a chunk at a time from the sent callback, as cgiEspFsHook does */
+static int cgiFile(HttpdConnData *connData)
+{
+    const SimFile *file = (const SimFile *)connData->cgiData;
+    char buf[FILE_CHUNK_SIZE];
+    int *pSent, cnt;
+
+    if (connData->conn == NULL) {
+        if (file) {
+            os_free(connData->cgiPrivData);
+            connData->cgiPrivData = NULL;
+        }
+        return HTTPD_CGI_DONE;
+    }
+
+    if (file == NULL) {
+        for (file = files; file->url; ++file)
+            if (strcmp(file->url, connData->url) == 0)
+                break;
+        if (!file->url)
+            return HTTPD_CGI_NOTFOUND;
+        if (!(connData->cgiPrivData = os_zalloc(sizeof(int))))
+            return HTTPD_CGI_DONE;
+        connData->cgiData = (void *)file;
+        httpdStartResponse(connData, 200);
+        httpdHeader(connData, "Content-Type", httpdGetMimetype(connData->url));
+        httpdHeader(connData, "Cache-Control", "max-age=7200, public, must-revalidate");
+        httpdEndHeaders(connData);
+        return HTTPD_CGI_MORE;
+    }
+
+    pSent = (int *)connData->cgiPrivData;
+    if ((cnt = file->size - *pSent) > FILE_CHUNK_SIZE)
+        cnt = FILE_CHUNK_SIZE;
+    memset(buf, 'x', cnt);
+    httpdSend(connData, buf, cnt);
+    if ((*pSent += cnt) < file->size)
+        return HTTPD_CGI_MORE;
+
+    os_free(connData->cgiPrivData);
+    connData->cgiPrivData = NULL;
+    return HTTPD_CGI_DONE;
+}
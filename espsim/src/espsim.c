@@ -0,0 +1,703 @@
+/* espsim - run esp-link's httpd.c and cgiprop.c against a simulated Propeller in virtual time
+
+   A scenario is a list of key=value settings: the image to load, the network's round trip
+   time, jitter and loss, how often a request's connection is dropped before the response
+   comes back and the loader parameters. The client makes the same requests espload does,
+   including its resume after a lost load-data response, and the report shows where the time
+   went in each state of the loader, how close each state's timeout came to firing and the
+   throughput, all without waiting for the real time to pass.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include "espsim.h"
+#include "httpd.h"
+#include "cgiprop.h"
+#include "proploader.h"
+
+#define HTTP_PORT           80
+#define MAX_LINE            1024
+#define MAX_RESPONSE        2048
+
+/* espload's timeouts (milliseconds) */
+#define RESPONSE_TIMEOUT    10000
+#define DATA_TIMEOUT        1000
+#define RETRY_WINDOW        1800
+#define MAX_DATA_RETRIES    3
+
+typedef struct {
+    char name[64];
+    char image[256];            /* file to load, a random image of size bytes when empty */
+    int size;
+    int rtt;                    /* microseconds */
+    int jitter;                 /* microseconds */
+    int loss;                   /* percent */
+    int rto;                    /* microseconds */
+    int drop;                   /* percent of requests whose connection is closed before the response */
+    int packetSize;
+    int baudRate;               /* second-stage baud rate */
+    char command[32];
+    int skipUnchanged;          /* don't program an EEPROM that already holds the image */
+    int eepromClock;            /* I2C clock for programming the EEPROM, 0 for the module's default */
+    int early;                  /* microseconds from load-begin to the image being built, 0 to begin with it built */
+    uint32_t seed;
+} Scenario;
+
+typedef enum {
+    cpBegin,
+    cpData,
+    cpEnd,
+    cpDone,
+    cpFailed
+} ClientPhase;
+
+/* the load as espload drives it */
+typedef struct {
+    const Scenario *scenario;
+    const uint8_t *image;
+    int imageSize;
+    ClientPhase phase;
+    SimConn *conn;
+    int timeoutEvent;
+    char response[MAX_RESPONSE + 1];
+    int responseLength;
+    int offset;
+    int count;                  /* bytes in the load-data request in flight */
+    int retries;
+    uint64_t requestTime;
+    uint64_t readyTime;         /* when the image is there to send */
+    uint64_t lastAckTime;
+    uint64_t startTime;
+    uint64_t beginTime;
+    uint64_t dataTime;
+    uint64_t endTime;
+    uint64_t dataMax;
+    uint64_t dataTotal;
+    int requests;
+    int resumes;
+    int drops;
+    int refused;
+    char path[16];              /* how load-begin said the image would be loaded */
+    char eepromSkipped[4];      /* what load-end said it did with the EEPROM and how it decided */
+    char eepromCheck[16];
+    char error[80];
+} Client;
+
+/* what the loader spent in each of its states */
+typedef struct {
+    uint64_t time;
+    int entries;
+    int timeouts;
+    int64_t minSlack;           /* -1 until a timer is stopped in the state */
+} StateStats;
+
+/* the order here must match the definition of LoadState in proploader.h */
+static const char *stateNames[] = {
+    "Idle",
+    "Reset1",
+    "Reset2",
+    "TxHandshake",
+    "RxHandshake",
+    "VerifyChecksum",
+    "StartAck",
+    "Data",
+    "DataAck",
+    "VerifyRAMAck",
+    "ProgramVerifyEEPROMAck",
+    "ReadyToLaunchAck",
+    "RomProgramAck",
+    "RomVerifyAck",
+    "PadAck"
+};
+
+extern PropellerConnection myConnection;
+
+char *esp_link_version = "espsim";
+
+HttpdBuiltInUrl builtInUrls[] = {
+    { "/propeller/load-begin", cgiPropLoadBegin, NULL },
+    { "/propeller/load-data", cgiPropLoadData, NULL },
+    { "/propeller/load-end", cgiPropLoadEnd, NULL },
+    { NULL, NULL, NULL }
+};
+
+static StateStats stateStats[stMAX];
+static LoadState lastState;
+static uint64_t lastStateTime;
+
+static int runScenario(const Scenario *scenario);
+static void startRequest(Client *client);
+static void sendRequest(Client *client);
+static void clientHandler(SimConn *conn, int event, const char *buf, int len, void *data);
+static void timeoutHandler(void *data);
+static void readyHandler(void *data);
+static void requestDone(Client *client, int result);
+static void requestFailed(Client *client);
+static void fail(Client *client, const char *error);
+static int getResponseValue(const char *response, const char *key, char *value, int maxValue);
+static void dispatchHook(void);
+static void timerHook(ETSTimer *timer, int what);
+static void report(const Scenario *scenario, const Client *client, uint64_t wallTime);
+static int parseSetting(Scenario *scenario, const char *setting);
+static uint8_t *readFile(const char *fileName, int *pSize);
+static uint64_t wallMicroseconds(void);
+static void Usage(void);
+
+int main(int argc, char *argv[])
+{
+    const char *scenarioFile = NULL;
+    Scenario defaults;
+    int failures = 0, i;
+
+    memset(&defaults, 0, sizeof(defaults));
+    strcpy(defaults.name, "default");
+    defaults.size = 20000;
+    defaults.rtt = 4000;
+    defaults.rto = 200000;
+    defaults.packetSize = MAX_PACKET_SIZE;
+    defaults.baudRate = DEFAULT_SECOND_STAGE_BAUD;
+    strcpy(defaults.command, "run");
+    defaults.seed = 1;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            switch (argv[i][1]) {
+            case 'f':
+                if (argv[i][2])
+                    scenarioFile = &argv[i][2];
+                else if (++i < argc)
+                    scenarioFile = argv[i];
+                else
+                    Usage();
+                break;
+            case 'v':
+                SimVerbose = 1;
+                break;
+            default:
+                Usage();
+                break;
+            }
+        }
+        else if (parseSetting(&defaults, argv[i]) != 0)
+            Usage();
+    }
+
+    /* settings on the command line apply to every scenario in the file */
+    if (scenarioFile) {
+        char line[MAX_LINE], *setting;
+        FILE *fp;
+        if (!(fp = fopen(scenarioFile, "r"))) {
+            printf("error: can't open '%s'\n", scenarioFile);
+            return 1;
+        }
+        while (fgets(line, sizeof(line), fp)) {
+            Scenario scenario = defaults;
+            char *comment;
+            if ((comment = strchr(line, '#')) != NULL)
+                *comment = '\0';
+            if (!(setting = strtok(line, " \t\r\n")))
+                continue;
+            do {
+                if (parseSetting(&scenario, setting) != 0) {
+                    printf("error: bad setting '%s' in '%s'\n", setting, scenarioFile);
+                    fclose(fp);
+                    return 1;
+                }
+            } while ((setting = strtok(NULL, " \t\r\n")) != NULL);
+            if (runScenario(&scenario) != 0)
+                ++failures;
+        }
+        fclose(fp);
+    }
+    else if (runScenario(&defaults) != 0)
+        ++failures;
+
+    return failures == 0 ? 0 : 1;
+}
+
+static void Usage(void)
+{
+    printf("\
+usage: espsim\n\
+         [ -f <file> ]          run the scenarios in a file, one per line\n\
+         [ -v ]                 show the firmware's debug output with virtual timestamps\n\
+         [ <key>=<value> ... ]  scenario settings, defaults for the scenarios in a file\n\
+\n\
+keys:\n\
+         name=<text>            name shown in the report\n\
+         image=<file>           binary image to load\n\
+         size=<bytes>           size of a random image to load (default is 20000)\n\
+         rtt=<ms>               network round trip time (default is 4)\n\
+         jitter=<ms>            most random delay added in each direction (default is 0)\n\
+         loss=<percent>         segments lost and resent after the rto (default is 0)\n\
+         rto=<ms>               retransmission timeout (default is 200)\n\
+         drop=<percent>         requests whose connection closes before the response (default is 0)\n\
+         packet=<bytes>         load-data packet size (default is %d)\n\
+         baud=<rate>            second-stage baud rate (default is %d)\n\
+         command=<command>      run, program-and-run or program (default is run)\n\
+         skip-unchanged=<0|1>   don't program the EEPROM with the image it already holds (default is 0)\n\
+         eeprom-clock=<hz>      I2C clock for programming the EEPROM (default is the module's)\n\
+         early=<ms>             begin the load without image-size this long before the image is built\n\
+         seed=<n>               random seed (default is 1)\n", MAX_PACKET_SIZE, DEFAULT_SECOND_STAGE_BAUD);
+    exit(1);
+}
+
+static int parseSetting(Scenario *scenario, const char *setting)
+{
+    const char *value = strchr(setting, '=');
+    int keyLength;
+
+    if (!value)
+        return -1;
+    keyLength = value++ - setting;
+
+#define KEY(k)  (keyLength == (int)strlen(k) && strncmp(setting, k, keyLength) == 0)
+    if (KEY("name"))
+        snprintf(scenario->name, sizeof(scenario->name), "%s", value);
+    else if (KEY("image"))
+        snprintf(scenario->image, sizeof(scenario->image), "%s", value);
+    else if (KEY("size")) {
+        scenario->image[0] = '\0';
+        scenario->size = atoi(value);
+    }
+    else if (KEY("rtt"))
+        scenario->rtt = (int)(atof(value) * 1000);
+    else if (KEY("jitter"))
+        scenario->jitter = (int)(atof(value) * 1000);
+    else if (KEY("loss"))
+        scenario->loss = atoi(value);
+    else if (KEY("rto"))
+        scenario->rto = (int)(atof(value) * 1000);
+    else if (KEY("drop"))
+        scenario->drop = atoi(value);
+    else if (KEY("packet"))
+        scenario->packetSize = atoi(value);
+    else if (KEY("baud"))
+        scenario->baudRate = atoi(value);
+    else if (KEY("command"))
+        snprintf(scenario->command, sizeof(scenario->command), "%s", value);
+    else if (KEY("skip-unchanged"))
+        scenario->skipUnchanged = atoi(value);
+    else if (KEY("eeprom-clock"))
+        scenario->eepromClock = atoi(value);
+    else if (KEY("early"))
+        scenario->early = (int)(atof(value) * 1000);
+    else if (KEY("seed"))
+        scenario->seed = (uint32_t)strtoul(value, NULL, 0);
+    else
+        return -1;
+#undef KEY
+
+    return 0;
+}
+
+/* runScenario - one load from load-begin to load-end */
+static int runScenario(const Scenario *scenario)
+{
+    SimNetwork network;
+    uint64_t wallStart;
+    Client client;
+    uint8_t *image;
+    int imageSize, i;
+
+    if (scenario->image[0]) {
+        if (!(image = readFile(scenario->image, &imageSize))) {
+            printf("error: can't read '%s'\n", scenario->image);
+            return -1;
+        }
+    }
+    else {
+        if ((imageSize = scenario->size) <= 0 || !(image = (uint8_t *)malloc(imageSize))) {
+            printf("error: bad image size %d\n", scenario->size);
+            return -1;
+        }
+    }
+
+    network.rtt = scenario->rtt;
+    network.jitter = scenario->jitter;
+    network.lossPercent = scenario->loss;
+    network.rto = scenario->rto;
+    network.seed = scenario->seed;
+
+    SimInit();
+    SimNetInit(&network);
+    SimUartInit(DEFAULT_RESET_PIN);
+    if (!scenario->image[0]) {
+        for (i = 0; i < imageSize; ++i)
+            image[i] = (uint8_t)SimRandom();
+    }
+
+    memset(stateStats, 0, sizeof(stateStats));
+    for (i = 0; i < stMAX; ++i)
+        stateStats[i].minSlack = -1;
+    lastState = stIdle;
+    lastStateTime = 0;
+    stateStats[stIdle].entries = 1;
+    SimDispatchHook = dispatchHook;
+    SimTimerHook = timerHook;
+
+    cgiPropInit();
+    httpdInit(builtInUrls, HTTP_PORT);
+
+    memset(&client, 0, sizeof(client));
+    client.scenario = scenario;
+    client.image = image;
+    client.imageSize = imageSize;
+    client.phase = cpBegin;
+
+    wallStart = wallMicroseconds();
+    startRequest(&client);
+    while (client.phase != cpDone && client.phase != cpFailed && SimRunOnce())
+        ;
+    stateStats[lastState].time += SimNow() - lastStateTime;
+    SimDispatchHook = NULL;
+    SimTimerHook = NULL;
+
+    report(scenario, &client, wallMicroseconds() - wallStart);
+
+    /* let whatever the firmware still has going run down before the next scenario */
+    while (SimRunOnce())
+        ;
+    SimUartClose();
+    SimNetClose();
+    free(image);
+
+    return client.phase == cpDone ? 0 : -1;
+}
+
+/* startRequest - open a connection for the next request of the load */
+static void startRequest(Client *client)
+{
+    client->conn = SimConnect(HTTP_PORT, clientHandler, client);
+    client->responseLength = 0;
+    client->requestTime = SimNow();
+    client->timeoutEvent = SimSchedule(SimNow() + (client->phase == cpData ? DATA_TIMEOUT : RESPONSE_TIMEOUT) * 1000,
+                                       timeoutHandler, client);
+}
+
+static void sendRequest(Client *client)
+{
+    const Scenario *scenario = client->scenario;
+    char buffer[MAX_PACKET_SIZE + 256];
+    int cnt = 0;
+
+    switch (client->phase) {
+    case cpBegin:
+        client->readyTime = SimNow() + scenario->early;
+        if (scenario->early > 0)
+            cnt = sprintf(buffer, "POST /propeller/load-begin?");
+        else
+            cnt = sprintf(buffer, "POST /propeller/load-begin?image-size=%d&", client->imageSize);
+        cnt += sprintf(&buffer[cnt], "reset-pin=%d&packet-size=%d&second-stage-baud=%d&command=%s",
+                       DEFAULT_RESET_PIN, scenario->packetSize, scenario->baudRate, scenario->command);
+        if (scenario->eepromClock > 0)
+            cnt += sprintf(&buffer[cnt], "&eeprom-clock=%d", scenario->eepromClock);
+        cnt += sprintf(&buffer[cnt], " HTTP/1.1\r\n\r\n");
+        break;
+    case cpData:
+        if ((client->count = client->imageSize - client->offset) > scenario->packetSize)
+            client->count = scenario->packetSize;
+        cnt = sprintf(buffer, "\
+POST /propeller/load-data?offset=%d HTTP/1.1\r\n\
+Content-Length: %d\r\n\
+\r\n", client->offset, client->count);
+        memcpy(&buffer[cnt], &client->image[client->offset], client->count);
+        cnt += client->count;
+        break;
+    case cpEnd:
+        cnt = sprintf(buffer, "POST /propeller/load-end?command=%s%s HTTP/1.1\r\n\r\n",
+                      scenario->command, scenario->skipUnchanged ? "&skip-unchanged=1" : "");
+        break;
+    default:
+        return;
+    }
+    SimSend(client->conn, buffer, cnt);
+
+    /* the connection goes away after the request is on its way */
+    if (scenario->drop > 0 && (int)(SimRandom() % 100) < scenario->drop) {
+        ++client->drops;
+        SimClose(client->conn);
+        SimCancel(client->timeoutEvent);
+        requestFailed(client);
+    }
+}
+
+static void clientHandler(SimConn *conn, int event, const char *buf, int len, void *data)
+{
+    Client *client = (Client *)data;
+    int result;
+
+    /* ignore what's left of a request that has been given up on */
+    if (conn != client->conn)
+        return;
+
+    switch (event) {
+    case SIM_CONNECTED:
+        sendRequest(client);
+        break;
+    case SIM_DATA:
+        if (len > MAX_RESPONSE - client->responseLength)
+            len = MAX_RESPONSE - client->responseLength;
+        memcpy(&client->response[client->responseLength], buf, len);
+        client->responseLength += len;
+        break;
+    case SIM_CLOSED:
+        SimCancel(client->timeoutEvent);
+        client->response[client->responseLength] = '\0';
+        if (sscanf(client->response, "HTTP/%*s %d", &result) == 1)
+            requestDone(client, result);
+        else
+            requestFailed(client);
+        break;
+    case SIM_REFUSED:
+        SimCancel(client->timeoutEvent);
+        ++client->refused;
+        requestFailed(client);
+        break;
+    }
+}
+
+static void timeoutHandler(void *data)
+{
+    Client *client = (Client *)data;
+    SimClose(client->conn);
+    requestFailed(client);
+}
+
+/* requestDone - the response to a request has arrived */
+static void requestDone(Client *client, int result)
+{
+    uint64_t latency = SimNow() - client->requestTime;
+    char value[32];
+    int ackOffset;
+
+    client->conn = NULL;
+
+    switch (client->phase) {
+    case cpBegin:
+        if (result != 200) {
+            fail(client, "load-begin returned an error");
+            return;
+        }
+        client->beginTime = latency;
+        if (getResponseValue(client->response, "path", client->path, sizeof(client->path)) != 0)
+            strcpy(client->path, "loader");
+        client->phase = cpData;
+        /* an early load waits for the build before sending the first packet */
+        if (SimNow() < client->readyTime) {
+            client->startTime = client->lastAckTime = client->readyTime;
+            SimSchedule(client->readyTime, readyHandler, client);
+            return;
+        }
+        client->startTime = client->lastAckTime = SimNow();
+        break;
+    case cpData:
+        ackOffset = getResponseValue(client->response, "bytes-loaded", value, sizeof(value)) == 0 ? atoi(value) : -1;
+        if (result == 200) {
+            client->offset = ackOffset >= 0 ? ackOffset : client->offset + client->count;
+            client->lastAckTime = SimNow();
+            client->retries = 0;
+            client->dataTotal += latency;
+            if (latency > client->dataMax)
+                client->dataMax = latency;
+            ++client->requests;
+        }
+        else if (ackOffset >= 0 && ++client->retries <= MAX_DATA_RETRIES
+             &&  SimNow() - client->lastAckTime < RETRY_WINDOW * 1000) {
+            client->offset = ackOffset;
+            ++client->resumes;
+        }
+        else {
+            fail(client, "load-data returned an error");
+            return;
+        }
+        if (client->offset >= client->imageSize) {
+            client->dataTime = SimNow() - client->startTime;
+            client->phase = cpEnd;
+        }
+        break;
+    case cpEnd:
+        if (result != 200) {
+            fail(client, "load-end returned an error");
+            return;
+        }
+        client->endTime = latency;
+        getResponseValue(client->response, "eeprom-skipped", client->eepromSkipped, sizeof(client->eepromSkipped));
+        getResponseValue(client->response, "eeprom-check", client->eepromCheck, sizeof(client->eepromCheck));
+        client->phase = cpDone;
+        return;
+    default:
+        return;
+    }
+
+    startRequest(client);
+}
+
+static void readyHandler(void *data)
+{
+    startRequest((Client *)data);
+}
+
+/* requestFailed - no response, only a load-data request can be tried again */
+static void requestFailed(Client *client)
+{
+    client->conn = NULL;
+    if (client->phase == cpData && ++client->retries <= MAX_DATA_RETRIES
+    &&  SimNow() - client->lastAckTime < RETRY_WINDOW * 1000) {
+        ++client->resumes;
+        startRequest(client);
+    }
+    else {
+        switch (client->phase) {
+        case cpBegin:   fail(client, "load-begin request failed"); break;
+        case cpData:    fail(client, "load-data request failed"); break;
+        case cpEnd:     fail(client, "load-end request failed"); break;
+        default:        break;
+        }
+    }
+}
+
+static void fail(Client *client, const char *error)
+{
+    snprintf(client->error, sizeof(client->error), "%s", error);
+    client->phase = cpFailed;
+}
+
+/* getResponseValue - find key=value in the body of a response */
+static int getResponseValue(const char *response, const char *key, char *value, int maxValue)
+{
+    const char *p = strstr(response, "\r\n\r\n");
+    int keyLength = strlen(key), i;
+
+    for (p = p ? p + 4 : response; *p; ) {
+        if (strncmp(p, key, keyLength) == 0 && p[keyLength] == '=') {
+            p += keyLength + 1;
+            for (i = 0; i < maxValue - 1 && *p && *p != '\r' && *p != '\n'; ++i)
+                value[i] = *p++;
+            value[i] = '\0';
+            return 0;
+        }
+        if (!(p = strchr(p, '\n')))
+            break;
+        ++p;
+    }
+
+    return -1;
+}
+
+/* dispatchHook - charge the time since the last event to the state the loader was in */
+static void dispatchHook(void)
+{
+    uint64_t now = SimNow();
+    if (myConnection.state != lastState) {
+        stateStats[lastState].time += now - lastStateTime;
+        lastState = myConnection.state;
+        lastStateTime = now;
+        if (lastState >= 0 && lastState < stMAX)
+            ++stateStats[lastState].entries;
+    }
+}
+
+/* timerHook - note how much time was left when the loader's timer was stopped and when it ran out */
+static void timerHook(ETSTimer *timer, int what)
+{
+    StateStats *stats;
+    int64_t slack;
+
+    if (timer != &myConnection.timer || myConnection.state < 0 || myConnection.state >= stMAX)
+        return;
+    stats = &stateStats[myConnection.state];
+
+    switch (what) {
+    case SIM_TIMER_DISARM:
+        slack = (int64_t)(timer->timer_expire - SimNow());
+        if (stats->minSlack < 0 || slack < stats->minSlack)
+            stats->minSlack = slack;
+        break;
+    case SIM_TIMER_FIRE:
+        ++stats->timeouts;
+        break;
+    }
+}
+
+static void report(const Scenario *scenario, const Client *client, uint64_t wallTime)
+{
+    const PropSimStats *stats = PropSimGetStats(SimUartPropeller());
+    uint64_t total = SimNow();
+    int i;
+
+    printf("%s: ", scenario->name);
+    if (client->phase == cpDone)
+        printf("loaded %d bytes in %.1f ms", client->imageSize, total / 1000.0);
+    else
+        printf("FAILED: %s after %.1f ms", client->error, total / 1000.0);
+    printf(" (%.1f ms of real time)\n", wallTime / 1000.0);
+    if (scenario->early > 0 && client->phase == cpDone)
+        printf("  began %.1f ms before the image was built, loaded %.1f ms after\n",
+               scenario->early / 1000.0, (total - client->readyTime) / 1000.0);
+
+    printf("  load-begin %.1f ms, load-end %.1f ms, path %s\n", client->beginTime / 1000.0, client->endTime / 1000.0, client->path);
+    printf("  load-data %d requests, average %.1f ms, max %.1f ms, %d resumes, %d dropped, %d refused",
+           client->requests, client->requests ? client->dataTotal / 1000.0 / client->requests : 0.0,
+           client->dataMax / 1000.0, client->resumes, client->drops, client->refused);
+    if (client->dataTime > 0)
+        printf(", %d bytes/sec", (int)((uint64_t)client->imageSize * 1000000 / client->dataTime));
+    printf("\n");
+    /* the loader writes the image's pages, the ROM all of the EEPROM */
+    if (stateStats[stProgramVerifyEEPROMAck].time > 0)
+        printf("  eeprom %.1f ms, %.1f ms per 32K\n", stateStats[stProgramVerifyEEPROMAck].time / 1000.0,
+               stateStats[stProgramVerifyEEPROMAck].time * 32768.0 / client->imageSize / 1000.0);
+    else if (stateStats[stRomProgramAck].time > 0)
+        printf("  eeprom %.1f ms, all 32K\n", (stateStats[stRomProgramAck].time + stateStats[stRomVerifyAck].time) / 1000.0);
+    if (client->eepromSkipped[0])
+        printf("  eeprom %s%s%s\n", atoi(client->eepromSkipped) ? "skipped" : "programmed",
+               client->eepromCheck[0] ? ", checked by " : "", client->eepromCheck);
+    printf("  uart blocked %.1f ms, propeller got %d packets (%d resent), %d framing errors\n",
+           SimUartBlockedTime() / 1000.0, stats->packets, stats->retransmissions, stats->framingErrors);
+
+    printf("  %-24s %10s %8s %9s %10s\n", "state", "time ms", "entries", "timeouts", "min slack");
+    for (i = 0; i < stMAX; ++i) {
+        const StateStats *s = &stateStats[i];
+        if (s->entries == 0)
+            continue;
+        printf("  %-24s %10.1f %8d %9d ", stateNames[i], s->time / 1000.0, s->entries, s->timeouts);
+        if (s->minSlack >= 0)
+            printf("%10.1f\n", s->minSlack / 1000.0);
+        else
+            printf("%10s\n", "-");
+    }
+}
+
+static uint8_t *readFile(const char *fileName, int *pSize)
+{
+    uint8_t *image;
+    FILE *fp;
+
+    if (!(fp = fopen(fileName, "rb")))
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    *pSize = (int)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (!(image = (uint8_t *)malloc(*pSize))) {
+        fclose(fp);
+        return NULL;
+    }
+    if ((int)fread(image, 1, *pSize, fp) != *pSize) {
+        fclose(fp);
+        free(image);
+        return NULL;
+    }
+    fclose(fp);
+    return image;
+}
+
+static uint64_t wallMicroseconds(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
@@ -0,0 +1,584 @@
+/* httpload - a load generator for esp-link's web server
+
+   A number of clients each make one request at a time from a mix like the one the web UI
+   makes while it's open (the console and log are polled, the pages and their files are
+   fetched now and then), optionally with Propeller loads running back to back alongside
+   them. Each request gets its own connection the way the browser and espload use the
+   server. At the end the server's counters come from /sim/stats if it has that page.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define DEF_HOST            "127.0.0.1"
+#define DEF_PORT            8080
+#define DEF_CLIENTS         4
+#define DEF_DURATION        10
+#define DEF_TIMEOUT         5000
+#define DEF_PACKET_SIZE     1024
+#define MAX_CLIENTS         64
+#define MAX_REQUEST         (DEF_PACKET_SIZE + 256)
+#define MAX_RESPONSE        2048
+#define LOAD_RETRY_DELAY    500     /* milliseconds before starting over after a failed load */
+
+typedef struct {
+    const char *url;
+    int weight;
+} MixEntry;
+
+/* roughly what an open UI page asks for */
+static const MixEntry mix[] = {
+    { "/console/text",      30 },
+    { "/log/text",          10 },
+    { "/menu",              10 },
+    { "/wifi/info",         10 },
+    { "/wifi/connstatus",   5 },
+    { "/system/info",       5 },
+    { "/pins",              5 },
+    { "/home.html",         5 },
+    { "/style.css",         5 },
+    { "/ui.js",             5 },
+    { "/favicon.ico",       5 },
+    { "/missing.html",      5 },
+    { NULL,                 0 }
+};
+
+typedef enum {
+    csIdle,
+    csConnecting,
+    csSending,
+    csReceiving
+} ClientState;
+
+typedef enum {
+    lpNone,             /* not a loader */
+    lpBegin,
+    lpData,
+    lpEnd
+} LoadPhase;
+
+typedef struct {
+    uint32_t *values;
+    int count;
+    int max;
+} Samples;
+
+/* what happened to the requests of one kind */
+typedef struct {
+    Samples latency;
+    int ok;
+    int notFound;
+    int httpErrors;
+    int noResponse;     /* the connection closed or was reset before a response (pool full) */
+    int timeouts;
+    int connectErrors;
+} RequestStats;
+
+typedef struct {
+    ClientState state;
+    LoadPhase phase;
+    int fd;
+    uint64_t startTime;
+    uint64_t nextTime;
+    char request[MAX_REQUEST];
+    int requestLength;
+    int requestSent;
+    char response[MAX_RESPONSE + 1];
+    int responseLength;
+    int offset;         /* load progress */
+    int count;
+    uint64_t loadStart;
+} Client;
+
+static struct sockaddr_in serverAddr;
+static int timeout = DEF_TIMEOUT;
+static int thinkTime = 0;
+static int verbose = 0;
+static int mixTotal = 0;
+static uint8_t *image = NULL;
+static int imageSize = 0;
+static RequestStats uiStats;
+static RequestStats loadStats;
+static Samples loadTimes;
+static int loadFailures = 0;
+
+static void startRequest(Client *client, uint64_t now);
+static void buildRequest(Client *client);
+static void finishRequest(Client *client, uint64_t now, int status);
+static void closeClient(Client *client);
+static int getStatus(const char *response);
+static int getResponseValue(const char *response, const char *key, char *value, int maxValue);
+static void addSample(Samples *samples, uint32_t value);
+static void reportRequests(const char *what, RequestStats *stats, double seconds);
+static void reportPercentiles(Samples *samples);
+static void fetchServerStats(void);
+static uint64_t clockMicroseconds(void);
+static void Usage(void);
+
+int main(int argc, char *argv[])
+{
+    const char *host = DEF_HOST;
+    Client clients[MAX_CLIENTS + 1];
+    struct pollfd fds[MAX_CLIENTS + 1];
+    int clientCount = DEF_CLIENTS, duration = DEF_DURATION, port = DEF_PORT;
+    uint64_t start, end, now;
+    struct hostent *hostEntry;
+    char *p;
+    int count, i;
+
+    /* get the arguments */
+    for (i = 1; i < argc; ++i) {
+        const char *value;
+        int opt;
+        if (argv[i][0] != '-' || !(opt = argv[i][1]))
+            Usage();
+        if (opt == 'v') {
+            verbose = 1;
+            continue;
+        }
+        if (argv[i][2])
+            value = &argv[i][2];
+        else if (++i < argc)
+            value = argv[i];
+        else
+            Usage();
+        switch (opt) {
+        case 'a':
+            host = value;
+            break;
+        case 'c':
+            clientCount = atoi(value);
+            break;
+        case 'd':
+            duration = atoi(value);
+            break;
+        case 'i':
+            thinkTime = atoi(value);
+            break;
+        case 'l':
+            imageSize = atoi(value);
+            break;
+        case 't':
+            timeout = atoi(value);
+            break;
+        default:
+            Usage();
+            break;
+        }
+    }
+    if (clientCount < 0 || clientCount > MAX_CLIENTS || duration <= 0 || imageSize < 0
+    ||  (clientCount == 0 && imageSize == 0))
+        Usage();
+
+    /* host[:port] */
+    if ((p = strchr(host, ':')) != NULL) {
+        static char hostName[256];
+        snprintf(hostName, sizeof(hostName), "%.*s", (int)(p - host), host);
+        port = atoi(p + 1);
+        host = hostName;
+    }
+    if (!(hostEntry = gethostbyname(host))) {
+        printf("error: can't find '%s'\n", host);
+        return 1;
+    }
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    memcpy(&serverAddr.sin_addr, hostEntry->h_addr, sizeof(serverAddr.sin_addr));
+    serverAddr.sin_port = htons(port);
+
+    for (i = 0; mix[i].url; ++i)
+        mixTotal += mix[i].weight;
+
+    if (imageSize > 0) {
+        if (!(image = (uint8_t *)malloc(imageSize))) {
+            printf("error: insufficient memory\n");
+            return 1;
+        }
+        srand(1);
+        for (i = 0; i < imageSize; ++i)
+            image[i] = (uint8_t)rand();
+    }
+
+    /* the loader, if any, is the last client */
+    memset(clients, 0, sizeof(clients));
+    for (i = 0; i < clientCount; ++i)
+        clients[i].phase = lpNone;
+    if (imageSize > 0)
+        clients[clientCount++].phase = lpBegin;
+
+    start = clockMicroseconds();
+    end = start + (uint64_t)duration * 1000000;
+    for (i = 0; i < clientCount; ++i) {
+        clients[i].fd = -1;
+        clients[i].nextTime = start;
+    }
+
+    while ((now = clockMicroseconds()) < end) {
+        int waitTime = 100;
+
+        /* start the requests that are due and give up on those that have taken too long */
+        for (i = 0; i < clientCount; ++i) {
+            Client *client = &clients[i];
+            if (client->state == csIdle) {
+                if (client->nextTime <= now)
+                    startRequest(client, now);
+                else if ((int)((client->nextTime - now) / 1000) < waitTime)
+                    waitTime = (int)((client->nextTime - now) / 1000);
+            }
+            else if (now - client->startTime >= (uint64_t)timeout * 1000)
+                finishRequest(client, now, -2);
+        }
+
+        count = 0;
+        for (i = 0; i < clientCount; ++i) {
+            Client *client = &clients[i];
+            fds[i].fd = client->state == csIdle ? -1 : client->fd;
+            fds[i].events = client->state == csReceiving ? POLLIN : POLLOUT;
+            fds[i].revents = 0;
+            if (fds[i].fd >= 0)
+                ++count;
+        }
+        if (poll(fds, clientCount, waitTime) < 0 && errno != EINTR) {
+            perror("poll");
+            return 1;
+        }
+        now = clockMicroseconds();
+
+        for (i = 0; i < clientCount; ++i) {
+            Client *client = &clients[i];
+            int cnt;
+
+            if (client->state == csIdle || !fds[i].revents)
+                continue;
+
+            switch (client->state) {
+            case csConnecting:
+                {
+                    int err = 0;
+                    socklen_t errLength = sizeof(err);
+                    getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &err, &errLength);
+                    if (err != 0) {
+                        finishRequest(client, now, -3);
+                        break;
+                    }
+                    client->state = csSending;
+                }
+                /* fall through */
+            case csSending:
+                cnt = (int)send(client->fd, client->request + client->requestSent,
+                                client->requestLength - client->requestSent, MSG_NOSIGNAL);
+                if (cnt < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                        finishRequest(client, now, -1);
+                }
+                else if ((client->requestSent += cnt) >= client->requestLength)
+                    client->state = csReceiving;
+                break;
+            case csReceiving:
+                cnt = (int)recv(client->fd, client->response + client->responseLength,
+                                MAX_RESPONSE - client->responseLength, 0);
+                if (cnt > 0 && (client->responseLength += cnt) < MAX_RESPONSE)
+                    break;
+                if (cnt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+                    break;
+                /* the server closes the connection once it has sent the response */
+                client->response[client->responseLength] = '\0';
+                finishRequest(client, now, client->responseLength > 0 ? getStatus(client->response) : -1);
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < clientCount; ++i)
+        closeClient(&clients[i]);
+
+    reportRequests("ui", &uiStats, duration);
+    if (imageSize > 0) {
+        reportRequests("propeller", &loadStats, duration);
+        printf("  loads: %d completed, %d failed", loadTimes.count, loadFailures);
+        if (loadTimes.count > 0) {
+            printf(", load time");
+            reportPercentiles(&loadTimes);
+        }
+        printf("\n");
+    }
+    fetchServerStats();
+
+    free(image);
+
+    return 0;
+}
+
+static void Usage(void)
+{
+    printf("\
+usage: httpload\n\
+         [ -a <host>[:<port>] ] server (default is %s:%d)\n\
+         [ -c <count> ]         clients making ui requests (default is %d)\n\
+         [ -d <seconds> ]       how long to run (default is %d)\n\
+         [ -i <ms> ]            time each client waits between requests (default is 0)\n\
+         [ -l <size> ]          also load a random image of this size over and over\n\
+         [ -t <ms> ]            request timeout (default is %d)\n\
+         [ -v ]                 verbose output\n", DEF_HOST, DEF_PORT, DEF_CLIENTS, DEF_DURATION, DEF_TIMEOUT);
+    exit(1);
+}
+
+/* startRequest - open a connection for the client's next request */
+static void startRequest(Client *client, uint64_t now)
+{
+    buildRequest(client);
+    client->requestSent = 0;
+    client->responseLength = 0;
+    client->startTime = now;
+
+    if ((client->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        finishRequest(client, now, -3);
+        return;
+    }
+    fcntl(client->fd, F_SETFL, O_NONBLOCK);
+    if (connect(client->fd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) != 0 && errno != EINPROGRESS) {
+        finishRequest(client, now, -3);
+        return;
+    }
+    client->state = csConnecting;
+}
+
+static void buildRequest(Client *client)
+{
+    int pick, i;
+
+    switch (client->phase) {
+    case lpNone:
+        pick = rand() % mixTotal;
+        for (i = 0; pick >= mix[i].weight; ++i)
+            pick -= mix[i].weight;
+        client->requestLength = sprintf(client->request, "\
+GET %s HTTP/1.1\r\n\
+\r\n", mix[i].url);
+        break;
+    case lpBegin:
+        client->requestLength = sprintf(client->request, "\
+POST /propeller/load-begin?image-size=%d&packet-size=%d HTTP/1.1\r\n\
+\r\n", imageSize, DEF_PACKET_SIZE);
+        break;
+    case lpData:
+        if ((client->count = imageSize - client->offset) > DEF_PACKET_SIZE)
+            client->count = DEF_PACKET_SIZE;
+        client->requestLength = sprintf(client->request, "\
+POST /propeller/load-data?offset=%d HTTP/1.1\r\n\
+Content-Length: %d\r\n\
+\r\n", client->offset, client->count);
+        memcpy(&client->request[client->requestLength], &image[client->offset], client->count);
+        client->requestLength += client->count;
+        break;
+    case lpEnd:
+        client->requestLength = sprintf(client->request, "\
+POST /propeller/load-end?command=run HTTP/1.1\r\n\
+\r\n");
+        break;
+    }
+}
+
+/* finishRequest - record the outcome (an http status, -1 no response, -2 timeout, -3 connect failed) */
+static void finishRequest(Client *client, uint64_t now, int status)
+{
+    RequestStats *stats = client->phase == lpNone ? &uiStats : &loadStats;
+    char value[32];
+
+    closeClient(client);
+    client->nextTime = now + (uint64_t)thinkTime * 1000;
+
+    switch (status) {
+    case -1:
+        ++stats->noResponse;
+        break;
+    case -2:
+        ++stats->timeouts;
+        break;
+    case -3:
+        ++stats->connectErrors;
+        break;
+    case 200:
+    case 302:
+        ++stats->ok;
+        addSample(&stats->latency, (uint32_t)(now - client->startTime));
+        break;
+    case 404:
+        ++stats->notFound;
+        addSample(&stats->latency, (uint32_t)(now - client->startTime));
+        break;
+    default:
+        ++stats->httpErrors;
+        break;
+    }
+    if (verbose && status != 200 && status != 302)
+        printf("request %.*s: %d\n", (int)strcspn(client->request, "\r"), client->request, status);
+
+    /* move the load along, starting over when a step fails */
+    switch (client->phase) {
+    case lpNone:
+        break;
+    case lpBegin:
+        if (status == 200) {
+            client->loadStart = client->startTime;
+            client->offset = 0;
+            client->phase = lpData;
+        }
+        else {
+            ++loadFailures;
+            client->nextTime = now + LOAD_RETRY_DELAY * 1000;
+        }
+        break;
+    case lpData:
+        if (status == 200 || status == 400) {
+            if (getResponseValue(client->response, "bytes-loaded", value, sizeof(value)) == 0)
+                client->offset = atoi(value);
+            else if (status == 200)
+                client->offset += client->count;
+        }
+        if (status != 200 && status != 400 && status != -1 && status != -2) {
+            ++loadFailures;
+            client->phase = lpBegin;
+            client->nextTime = now + LOAD_RETRY_DELAY * 1000;
+        }
+        else if (client->offset >= imageSize)
+            client->phase = lpEnd;
+        break;
+    case lpEnd:
+        if (status == 200)
+            addSample(&loadTimes, (uint32_t)(now - client->loadStart));
+        else {
+            ++loadFailures;
+            client->nextTime = now + LOAD_RETRY_DELAY * 1000;
+        }
+        client->phase = lpBegin;
+        break;
+    }
+}
+
+static void closeClient(Client *client)
+{
+    if (client->fd >= 0) {
+        close(client->fd);
+        client->fd = -1;
+    }
+    client->state = csIdle;
+}
+
+static int getStatus(const char *response)
+{
+    int status;
+    if (sscanf(response, "HTTP/%*s %d", &status) != 1)
+        return -1;
+    return status;
+}
+
+/* getResponseValue - find key=value in the body of a response */
+static int getResponseValue(const char *response, const char *key, char *value, int maxValue)
+{
+    const char *p = strstr(response, "\r\n\r\n");
+    int keyLength = strlen(key), i;
+
+    for (p = p ? p + 4 : response; *p; ) {
+        if (strncmp(p, key, keyLength) == 0 && p[keyLength] == '=') {
+            p += keyLength + 1;
+            for (i = 0; i < maxValue - 1 && *p && *p != '\r' && *p != '\n'; ++i)
+                value[i] = *p++;
+            value[i] = '\0';
+            return 0;
+        }
+        if (!(p = strchr(p, '\n')))
+            break;
+        ++p;
+    }
+
+    return -1;
+}
+
+static void addSample(Samples *samples, uint32_t value)
+{
+    if (samples->count >= samples->max) {
+        int newMax = samples->max ? samples->max * 2 : 1024;
+        uint32_t *newValues = (uint32_t *)realloc(samples->values, newMax * sizeof(uint32_t));
+        if (!newValues)
+            return;
+        samples->values = newValues;
+        samples->max = newMax;
+    }
+    samples->values[samples->count++] = value;
+}
+
+static int compareSamples(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void reportRequests(const char *what, RequestStats *stats, double seconds)
+{
+    int total = stats->ok + stats->notFound + stats->httpErrors + stats->noResponse + stats->timeouts + stats->connectErrors;
+
+    printf("%s: %d requests, %.1f requests/sec", what, total, total / seconds);
+    if (stats->latency.count > 0) {
+        printf(", latency");
+        reportPercentiles(&stats->latency);
+    }
+    printf("\n");
+    printf("  %d ok, %d not found, %d errors, %d closed without a response, %d timeouts, %d connect failures\n",
+           stats->ok, stats->notFound, stats->httpErrors, stats->noResponse, stats->timeouts, stats->connectErrors);
+}
+
+static void reportPercentiles(Samples *samples)
+{
+    uint32_t *v = samples->values;
+    int n = samples->count;
+    qsort(v, n, sizeof(uint32_t), compareSamples);
+    printf(" p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms",
+           v[n * 50 / 100] / 1000.0, v[n * 90 / 100] / 1000.0, v[n * 99 / 100] / 1000.0, v[n - 1] / 1000.0);
+}
+
+/* fetchServerStats - show what esphttpd counted */
+static void fetchServerStats(void)
+{
+    static const char request[] = "GET /sim/stats HTTP/1.1\r\n\r\n";
+    char response[MAX_RESPONSE + 1], *body;
+    int fd, length = 0, cnt;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return;
+    if (connect(fd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) != 0
+    ||  send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != (int)sizeof(request) - 1) {
+        close(fd);
+        return;
+    }
+    while (length < MAX_RESPONSE && (cnt = (int)recv(fd, response + length, MAX_RESPONSE - length, 0)) > 0)
+        length += cnt;
+    close(fd);
+    response[length] = '\0';
+
+    if (getStatus(response) != 200 || !(body = strstr(response, "\r\n\r\n")))
+        return;
+    printf("server:\n");
+    for (body = strtok(body + 4, "\r\n"); body; body = strtok(NULL, "\r\n"))
+        printf("  %s\n", body);
+}
+
+static uint64_t clockMicroseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
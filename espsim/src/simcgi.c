@@ -0,0 +1,26 @@
+/* simcgi.c - the response helpers from esp-link's cgi.c */
+
+#include "espsim.h"
+#include "cgi.h"
+
+void noCacheHeaders(HttpdConnData *connData, int code)
+{
+    httpdStartResponse(connData, code);
+    httpdHeader(connData, "Cache-Control", "no-cache, no-store, must-revalidate");
+    httpdHeader(connData, "Pragma", "no-cache");
+    httpdHeader(connData, "Expires", "0");
+}
+
+void errorResponse(HttpdConnData *connData, int code, char *message)
+{
+    noCacheHeaders(connData, code);
+    httpdEndHeaders(connData);
+    httpdSend(connData, message, -1);
+}
+
+void jsonHeader(HttpdConnData *connData, int code)
+{
+    noCacheHeaders(connData, code);
+    httpdHeader(connData, "Content-Type", "application/json");
+    httpdEndHeaders(connData);
+}
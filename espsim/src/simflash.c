@@ -0,0 +1,75 @@
+/* simflash.c - the flash sectors firmware writes its settings to, kept in memory
+
+   Erased flash reads as 0xFF and a write can only clear bits, as on the real part. Nothing
+   is kept between runs, so each run starts as a freshly flashed module would.
+*/
+
+#include "espsim.h"
+
+#define MAX_SECTORS     4
+
+typedef struct {
+    int used;
+    uint16 sector;
+    uint8_t data[SPI_FLASH_SEC_SIZE];
+} SimSector;
+
+static SimSector sectors[MAX_SECTORS];
+
+static SimSector *findSector(uint16 sector, int create);
+
+SpiFlashOpResult spi_flash_erase_sector(uint16 sec)
+{
+    SimSector *s;
+    if (!(s = findSector(sec, 1)))
+        return SPI_FLASH_RESULT_ERR;
+    memset(s->data, 0xFF, sizeof(s->data));
+    SimBusy(30000);
+    return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_write(uint32 des_addr, uint32 *src_addr, uint32 size)
+{
+    const uint8_t *src = (const uint8_t *)src_addr;
+    uint32 offset = des_addr % SPI_FLASH_SEC_SIZE, i;
+    SimSector *s;
+
+    if (offset + size > SPI_FLASH_SEC_SIZE || !(s = findSector(des_addr / SPI_FLASH_SEC_SIZE, 1)))
+        return SPI_FLASH_RESULT_ERR;
+    for (i = 0; i < size; ++i)
+        s->data[offset + i] &= src[i];
+    return SPI_FLASH_RESULT_OK;
+}
+
+SpiFlashOpResult spi_flash_read(uint32 src_addr, uint32 *des_addr, uint32 size)
+{
+    uint32 offset = src_addr % SPI_FLASH_SEC_SIZE;
+    SimSector *s;
+
+    if (offset + size > SPI_FLASH_SEC_SIZE)
+        return SPI_FLASH_RESULT_ERR;
+    if ((s = findSector(src_addr / SPI_FLASH_SEC_SIZE, 0)) != NULL)
+        memcpy(des_addr, &s->data[offset], size);
+    else
+        memset(des_addr, 0xFF, size);
+    return SPI_FLASH_RESULT_OK;
+}
+
+/* findSector - a sector that has been written to, or a new erased one */
+static SimSector *findSector(uint16 sector, int create)
+{
+    int i;
+    for (i = 0; i < MAX_SECTORS; ++i)
+        if (sectors[i].used && sectors[i].sector == sector)
+            return &sectors[i];
+    if (!create)
+        return NULL;
+    for (i = 0; i < MAX_SECTORS; ++i)
+        if (!sectors[i].used) {
+            sectors[i].used = 1;
+            sectors[i].sector = sector;
+            memset(sectors[i].data, 0xFF, sizeof(sectors[i].data));
+            return &sectors[i];
+        }
+    return NULL;
+}
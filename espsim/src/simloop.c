@@ -0,0 +1,276 @@
+/* simloop.c - the virtual clock, the event queue and the SDK timer functions */
+
+#include <stdarg.h>
+#include "espsim.h"
+
+/* what os_malloc keeps in front of each block so the heap in use can be tracked */
+typedef union {
+    size_t size;
+    long double align;
+} SimBlock;
+
+typedef struct {
+    uint64_t time;
+    uint64_t seq;               /* events at the same time run in the order they were scheduled */
+    int id;
+    SimHandler *handler;        /* NULL once cancelled */
+    void *data;
+} SimEvent;
+
+int SimVerbose = 0;
+void (*SimDispatchHook)(void) = NULL;
+void (*SimTimerHook)(ETSTimer *timer, int what) = NULL;
+
+static SimEvent *events = NULL;
+static int eventCount = 0;
+static int eventMax = 0;
+static uint64_t now = 0;
+static uint64_t nextSeq = 0;
+static int nextId = 1;
+static size_t heapUsed = 0;
+static size_t heapPeak = 0;
+
+static void timerHandler(void *data);
+static int before(const SimEvent *a, const SimEvent *b);
+
+void SimInit(void)
+{
+    eventCount = 0;
+    now = 0;
+    nextSeq = 0;
+    nextId = 1;
+    heapPeak = heapUsed;
+}
+
+uint64_t SimNow(void)
+{
+    return now;
+}
+
+/* SimSchedule - run handler at time (or now if that has passed), returns an id for SimCancel */
+int SimSchedule(uint64_t time, SimHandler *handler, void *data)
+{
+    SimEvent event;
+    int i;
+
+    if (eventCount >= eventMax) {
+        int newMax = eventMax ? eventMax * 2 : 64;
+        SimEvent *newEvents = (SimEvent *)realloc(events, newMax * sizeof(SimEvent));
+        if (!newEvents) {
+            printf("error: insufficient memory\n");
+            exit(1);
+        }
+        events = newEvents;
+        eventMax = newMax;
+    }
+
+    event.time = time < now ? now : time;
+    event.seq = nextSeq++;
+    event.id = nextId++;
+    event.handler = handler;
+    event.data = data;
+
+    /* sift up the heap */
+    for (i = eventCount++; i > 0 && before(&event, &events[(i - 1) / 2]); i = (i - 1) / 2)
+        events[i] = events[(i - 1) / 2];
+    events[i] = event;
+
+    return event.id;
+}
+
+void SimCancel(int id)
+{
+    int i;
+    for (i = 0; i < eventCount; ++i) {
+        if (events[i].id == id) {
+            events[i].handler = NULL;
+            break;
+        }
+    }
+}
+
+/* SimSetTime - move the clock up to a real time clock when the loop waits on sockets */
+void SimSetTime(uint64_t time)
+{
+    if (time > now)
+        now = time;
+}
+
+/* SimNextEvent - when the next event is due, returns 0 when there are none */
+int SimNextEvent(uint64_t *pTime)
+{
+    uint64_t time = 0;
+    int found = 0, i;
+
+    /* cancelled events stay in the heap until they reach the top so look past them */
+    for (i = 0; i < eventCount; ++i) {
+        if (events[i].handler && (!found || events[i].time < time)) {
+            time = events[i].time;
+            found = 1;
+        }
+    }
+    *pTime = time;
+
+    return found;
+}
+
+/* SimRunOnce - run the next event, returns 0 when there are none left */
+int SimRunOnce(void)
+{
+    SimEvent event, last;
+    int i, child;
+
+    do {
+        if (eventCount == 0)
+            return 0;
+
+        /* take the earliest event off the heap */
+        event = events[0];
+        last = events[--eventCount];
+        for (i = 0; (child = 2 * i + 1) < eventCount; i = child) {
+            if (child + 1 < eventCount && before(&events[child + 1], &events[child]))
+                ++child;
+            if (!before(&events[child], &last))
+                break;
+            events[i] = events[child];
+        }
+        events[i] = last;
+    } while (!event.handler);
+
+    /* an event can't run before the CPU is free */
+    if (event.time > now)
+        now = event.time;
+    (*event.handler)(event.data);
+
+    if (SimDispatchHook)
+        (*SimDispatchHook)();
+
+    return 1;
+}
+
+/* SimBusy - the CPU is tied up (os_delay_us or waiting for room in the UART FIFO) */
+void SimBusy(uint32 us)
+{
+    now += us;
+}
+
+uint32 system_get_time(void)
+{
+    return (uint32)now;
+}
+
+/* the ESP8266 has around 40K of heap free once esp-link is running */
+uint32 system_get_free_heap_size(void)
+{
+    return heapUsed < SIM_HEAP_SIZE ? (uint32)(SIM_HEAP_SIZE - heapUsed) : 0;
+}
+
+void *SimMalloc(size_t size)
+{
+    SimBlock *block = (SimBlock *)malloc(sizeof(SimBlock) + size);
+    if (!block)
+        return NULL;
+    block->size = size;
+    if ((heapUsed += size) > heapPeak)
+        heapPeak = heapUsed;
+    return block + 1;
+}
+
+void *SimZalloc(size_t size)
+{
+    void *p = SimMalloc(size);
+    if (p)
+        memset(p, 0, size);
+    return p;
+}
+
+void SimFree(void *p)
+{
+    SimBlock *block;
+    if (p) {
+        block = (SimBlock *)p - 1;
+        heapUsed -= block->size;
+        free(block);
+    }
+}
+
+size_t SimHeapUsed(void)
+{
+    return heapUsed;
+}
+
+size_t SimHeapPeak(void)
+{
+    return heapPeak;
+}
+
+void os_timer_setfn(ETSTimer *timer, ETSTimerFunc *func, void *arg)
+{
+    timer->timer_func = func;
+    timer->timer_arg = arg;
+}
+
+void os_timer_arm(ETSTimer *timer, uint32 ms, bool repeat)
+{
+    os_timer_arm_us(timer, ms * 1000, repeat);
+}
+
+void os_timer_arm_us(ETSTimer *timer, uint32 us, bool repeat)
+{
+    os_timer_disarm(timer);
+    timer->timer_period = repeat ? us : 0;
+    timer->timer_expire = now + us;
+    timer->event = SimSchedule(timer->timer_expire, timerHandler, timer);
+    if (SimTimerHook)
+        (*SimTimerHook)(timer, SIM_TIMER_ARM);
+}
+
+void os_timer_disarm(ETSTimer *timer)
+{
+    if (timer->event) {
+        SimCancel(timer->event);
+        timer->event = 0;
+        if (SimTimerHook)
+            (*SimTimerHook)(timer, SIM_TIMER_DISARM);
+    }
+}
+
+static void timerHandler(void *data)
+{
+    ETSTimer *timer = (ETSTimer *)data;
+
+    if (timer->timer_period) {
+        timer->timer_expire = now + timer->timer_period;
+        timer->event = SimSchedule(timer->timer_expire, timerHandler, timer);
+    }
+    else
+        timer->event = 0;
+    if (SimTimerHook)
+        (*SimTimerHook)(timer, SIM_TIMER_FIRE);
+    if (timer->timer_func)
+        (*timer->timer_func)(timer->timer_arg);
+}
+
+/* SimLog - os_printf, prefixed with the virtual time and only shown with -v */
+int SimLog(const char *format, ...)
+{
+    static int lineStart = 1;
+    va_list ap;
+    int cnt;
+
+    if (!SimVerbose)
+        return 0;
+    if (lineStart)
+        printf("%10.3f: ", now / 1000.0);
+    va_start(ap, format);
+    cnt = vprintf(format, ap);
+    va_end(ap);
+    lineStart = format[0] && format[strlen(format) - 1] == '\n';
+
+    return cnt;
+}
+
+static int before(const SimEvent *a, const SimEvent *b)
+{
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
@@ -0,0 +1,333 @@
+/* simnet.c - espconn for the httpd listener with simulated clients on the other end
+
+   Each direction of a connection is an ordered stream of segments that take half the round
+   trip time plus some jitter to arrive, and a lost segment arrives a retransmission timeout
+   late without overtaking anything sent after it. espconn_sent calls the sent callback once
+   the last segment has been acknowledged, like the SDK does.
+*/
+
+#include "espsim.h"
+
+#define MSS                 1460
+
+#define SEG_SYN             0   /* client to server: open */
+#define SEG_ACCEPT          1   /* server to client: connected */
+#define SEG_REFUSE          2   /* server to client: no room for another connection */
+#define SEG_DATA            3   /* either way */
+#define SEG_ACK             4   /* client to server: everything from the last espconn_sent arrived */
+#define SEG_FIN             5   /* either way: close */
+
+struct SimConn {
+    struct espconn esp;
+    esp_tcp tcp;
+    SimClientHandler *handler;
+    void *data;
+    int serverOpen;             /* accepted and not yet disconnected */
+    int serverClosing;          /* espconn_disconnect called */
+    int clientOpen;
+    int sending;                /* espconn_sent waiting for its ack */
+    int unacked;                /* its segments still on the way to the client */
+    uint64_t toServer;          /* arrival of the last segment in each direction */
+    uint64_t toClient;
+    SimConn *next;
+};
+
+typedef struct {
+    SimConn *conn;
+    int type;
+    int len;
+    char buf[MSS];
+} Segment;
+
+static SimNetwork network;
+static struct espconn *listener = NULL;
+static int maxConnections = 5;
+static SimConn *connections = NULL;
+static int nextPort = 49152;
+static uint32_t randomState = 1;
+
+static void sendSegment(SimConn *conn, int toServer, int type, const char *buf, int len);
+static void serverHandler(void *data);
+static void clientHandler(void *data);
+static uint64_t oneWayDelay(void);
+
+void SimNetInit(const SimNetwork *settings)
+{
+    network = *settings;
+    randomState = network.seed ? network.seed : 1;
+    listener = NULL;
+    connections = NULL;
+    nextPort = 49152;
+}
+
+void SimNetClose(void)
+{
+    while (connections) {
+        SimConn *next = connections->next;
+        free(connections);
+        connections = next;
+    }
+}
+
+/* SimConnect - open a connection to the listener on port, events go to handler */
+SimConn *SimConnect(int port, SimClientHandler *handler, void *data)
+{
+    SimConn *conn;
+
+    if (!(conn = (SimConn *)calloc(1, sizeof(SimConn)))) {
+        printf("error: insufficient memory\n");
+        exit(1);
+    }
+    conn->handler = handler;
+    conn->data = data;
+    conn->clientOpen = 1;
+    conn->esp.type = ESPCONN_TCP;
+    conn->esp.state = ESPCONN_NONE;
+    conn->esp.proto.tcp = &conn->tcp;
+    conn->esp.sim = conn;
+    conn->tcp.local_port = port;
+    conn->tcp.remote_port = nextPort++;
+    conn->tcp.remote_ip[0] = 192;
+    conn->tcp.remote_ip[1] = 168;
+    conn->tcp.remote_ip[2] = 4;
+    conn->tcp.remote_ip[3] = 2;
+    conn->next = connections;
+    connections = conn;
+
+    sendSegment(conn, 1, SEG_SYN, NULL, 0);
+
+    return conn;
+}
+
+void SimSend(SimConn *conn, const char *buf, int len)
+{
+    int cnt;
+    if (!conn->clientOpen)
+        return;
+    for (cnt = 0; cnt < len; cnt += MSS)
+        sendSegment(conn, 1, SEG_DATA, buf + cnt, len - cnt > MSS ? MSS : len - cnt);
+}
+
+void SimClose(SimConn *conn)
+{
+    if (conn->clientOpen) {
+        conn->clientOpen = 0;
+        sendSegment(conn, 1, SEG_FIN, NULL, 0);
+    }
+}
+
+/* SimNetConnections - connections the server hasn't seen the end of */
+int SimNetConnections(void)
+{
+    SimConn *conn;
+    int count = 0;
+    for (conn = connections; conn; conn = conn->next)
+        if (conn->serverOpen)
+            ++count;
+    return count;
+}
+
+/* SimRandom - xorshift32, so a scenario's seed gives the same run every time */
+uint32_t SimRandom(void)
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+sint8 espconn_accept(struct espconn *espconn)
+{
+    listener = espconn;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_tcp_set_max_con_allow(struct espconn *espconn, uint8 num)
+{
+    maxConnections = num;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb)
+{
+    espconn->proto.tcp->connect_callback = connect_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb)
+{
+    espconn->proto.tcp->reconnect_callback = recon_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb)
+{
+    espconn->proto.tcp->disconnect_callback = discon_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb)
+{
+    espconn->recv_callback = recv_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb)
+{
+    espconn->sent_callback = sent_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_set_opt(struct espconn *espconn, uint8 opt)
+{
+    return ESPCONN_OK;
+}
+
+sint8 espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length)
+{
+    SimConn *conn = espconn->sim;
+    int cnt;
+
+    if (!conn || !conn->serverOpen || conn->serverClosing)
+        return ESPCONN_ARG;
+    if (conn->sending)
+        return ESPCONN_MAXNUM;
+
+    for (cnt = 0; cnt < length; cnt += MSS) {
+        sendSegment(conn, 0, SEG_DATA, (char *)psent + cnt, length - cnt > MSS ? MSS : length - cnt);
+        ++conn->unacked;
+    }
+    conn->sending = 1;
+
+    return ESPCONN_OK;
+}
+
+sint8 espconn_disconnect(struct espconn *espconn)
+{
+    SimConn *conn = espconn->sim;
+
+    if (!conn || !conn->serverOpen || conn->serverClosing)
+        return ESPCONN_ARG;
+    conn->serverClosing = 1;
+    sendSegment(conn, 0, SEG_FIN, NULL, 0);
+
+    return ESPCONN_OK;
+}
+
+/* sendSegment - queue a segment behind anything already on its way in the same direction */
+static void sendSegment(SimConn *conn, int toServer, int type, const char *buf, int len)
+{
+    uint64_t *last = toServer ? &conn->toServer : &conn->toClient;
+    uint64_t arrival = SimNow() + oneWayDelay();
+    Segment *segment;
+
+    if (!(segment = (Segment *)malloc(sizeof(Segment)))) {
+        printf("error: insufficient memory\n");
+        exit(1);
+    }
+    segment->conn = conn;
+    segment->type = type;
+    segment->len = len;
+    if (len > 0)
+        memcpy(segment->buf, buf, len);
+
+    if (arrival < *last)
+        arrival = *last;
+    *last = arrival;
+
+    SimSchedule(arrival, toServer ? serverHandler : clientHandler, segment);
+}
+
+/* serverHandler - a segment reaches the ESP */
+static void serverHandler(void *data)
+{
+    Segment *segment = (Segment *)data;
+    SimConn *conn = segment->conn;
+    struct espconn *esp = &conn->esp;
+
+    switch (segment->type) {
+    case SEG_SYN:
+        if (!listener || listener->proto.tcp->local_port != conn->tcp.local_port
+        ||  SimNetConnections() >= maxConnections) {
+            sendSegment(conn, 0, SEG_REFUSE, NULL, 0);
+            break;
+        }
+        conn->serverOpen = 1;
+        esp->state = ESPCONN_CONNECT;
+        conn->tcp.connect_callback = listener->proto.tcp->connect_callback;
+        conn->tcp.reconnect_callback = listener->proto.tcp->reconnect_callback;
+        conn->tcp.disconnect_callback = listener->proto.tcp->disconnect_callback;
+        sendSegment(conn, 0, SEG_ACCEPT, NULL, 0);
+        if (conn->tcp.connect_callback)
+            (*conn->tcp.connect_callback)(esp);
+        break;
+    case SEG_DATA:
+        if (conn->serverOpen && !conn->serverClosing && esp->recv_callback)
+            (*esp->recv_callback)(esp, segment->buf, (unsigned short)segment->len);
+        break;
+    case SEG_ACK:
+        conn->sending = 0;
+        if (conn->serverOpen && !conn->serverClosing && esp->sent_callback)
+            (*esp->sent_callback)(esp);
+        break;
+    case SEG_FIN:
+        /* the client closed or our own close was acknowledged, either way the SDK is done with it */
+        if (conn->serverOpen) {
+            conn->serverOpen = 0;
+            esp->state = ESPCONN_CLOSE;
+            if (conn->tcp.disconnect_callback)
+                (*conn->tcp.disconnect_callback)(esp);
+        }
+        break;
+    }
+
+    free(segment);
+}
+
+/* clientHandler - a segment reaches the client */
+static void clientHandler(void *data)
+{
+    Segment *segment = (Segment *)data;
+    SimConn *conn = segment->conn;
+
+    switch (segment->type) {
+    case SEG_ACCEPT:
+        if (conn->clientOpen)
+            (*conn->handler)(conn, SIM_CONNECTED, NULL, 0, conn->data);
+        break;
+    case SEG_REFUSE:
+        if (conn->clientOpen) {
+            conn->clientOpen = 0;
+            (*conn->handler)(conn, SIM_REFUSED, NULL, 0, conn->data);
+        }
+        break;
+    case SEG_DATA:
+        /* ack the last segment of an espconn_sent, the client stack does this even after a close */
+        if (conn->unacked > 0 && --conn->unacked == 0)
+            sendSegment(conn, 1, SEG_ACK, NULL, 0);
+        if (conn->clientOpen)
+            (*conn->handler)(conn, SIM_DATA, segment->buf, segment->len, conn->data);
+        break;
+    case SEG_FIN:
+        if (conn->clientOpen) {
+            conn->clientOpen = 0;
+            (*conn->handler)(conn, SIM_CLOSED, NULL, 0, conn->data);
+        }
+        /* answer with our own FIN so the server's close completes */
+        sendSegment(conn, 1, SEG_FIN, NULL, 0);
+        break;
+    }
+
+    free(segment);
+}
+
+/* oneWayDelay - half the round trip, jitter and, now and then, a retransmission */
+static uint64_t oneWayDelay(void)
+{
+    uint64_t delay = network.rtt / 2;
+    if (network.jitter > 0)
+        delay += SimRandom() % (network.jitter + 1);
+    if (network.lossPercent > 0 && (int)(SimRandom() % 100) < network.lossPercent)
+        delay += network.rto;
+    return delay;
+}
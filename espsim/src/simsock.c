@@ -0,0 +1,390 @@
+/* simsock.c - espconn for the httpd listener on real sockets, with the event loop on the real clock
+
+   The SDK calls the sent callback once the peer has acknowledged the data. Here it is called
+   once the kernel has taken all of it, which is as close as a socket gets. Like the SDK,
+   connections beyond the limit set with espconn_tcp_set_max_con_allow are refused before
+   httpd sees them, and a connection httpd turns away in its connect callback without taking
+   it (its "conn pool overflow!") is counted separately.
+*/
+
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "espsim.h"
+
+#define MAX_SOCKS           64
+#define RECV_SIZE           1460
+
+typedef struct {
+    struct espconn esp;
+    esp_tcp tcp;
+    int fd;
+    uint8_t *out;               /* data from espconn_sent the kernel hasn't taken yet */
+    int outLength;
+    int outSent;
+    int closing;                /* espconn_disconnect called */
+    int dead;                   /* closed and waiting for its last callback */
+    sint8 err;                  /* why, for the reconnect callback (0 for a clean close) */
+} SockConn;
+
+static struct espconn *listener = NULL;
+static int listenFd = -1;
+static int maxConnections = 5;
+static SockConn *socks[MAX_SOCKS];
+static int sockCount = 0;
+static SimSockStats stats;
+static uint64_t startTime;
+
+static void acceptConnection(void);
+static void readConnection(SockConn *conn);
+static void writeConnection(SockConn *conn);
+static void closeConnection(SockConn *conn, int err);
+static void sentHandler(void *data);
+static void disconnectHandler(void *data);
+static void freeHandler(void *data);
+static int openConnections(void);
+static uint64_t clockMicroseconds(void);
+
+void SimSockInit(void)
+{
+    SimInit();
+    startTime = clockMicroseconds();
+    memset(&stats, 0, sizeof(stats));
+    listener = NULL;
+    listenFd = -1;
+    sockCount = 0;
+}
+
+const SimSockStats *SimSockGetStats(void)
+{
+    return &stats;
+}
+
+/* SimSockRun - wait on the sockets and run timers as they come due until *pStop is set */
+int SimSockRun(volatile int *pStop)
+{
+    struct pollfd fds[MAX_SOCKS + 1];
+    SockConn *polled[MAX_SOCKS];
+    uint64_t next;
+    int timeout, cnt, i;
+
+    while (!*pStop) {
+
+        /* run everything that's due */
+        SimSetTime(clockMicroseconds() - startTime);
+        while (SimNextEvent(&next) && next <= SimNow())
+            SimRunOnce();
+
+        if (SimNextEvent(&next))
+            timeout = (int)((next - SimNow() + 999) / 1000);
+        else
+            timeout = 100;  /* look at *pStop now and then */
+        if (timeout > 100)
+            timeout = 100;
+
+        cnt = 0;
+        if (listenFd >= 0) {
+            fds[cnt].fd = listenFd;
+            fds[cnt].events = POLLIN;
+            ++cnt;
+        }
+        for (i = 0; i < sockCount; ++i) {
+            SockConn *conn = socks[i];
+            if (conn->fd < 0)
+                continue;
+            fds[cnt].fd = conn->fd;
+            fds[cnt].events = (conn->closing ? 0 : POLLIN) | (conn->outSent < conn->outLength ? POLLOUT : 0);
+            polled[cnt - (listenFd >= 0 ? 1 : 0)] = conn;
+            ++cnt;
+        }
+
+        if (poll(fds, cnt, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return -1;
+        }
+        SimSetTime(clockMicroseconds() - startTime);
+
+        for (i = 0; i < cnt; ++i) {
+            if (!fds[i].revents)
+                continue;
+            if (fds[i].fd == listenFd)
+                acceptConnection();
+            else {
+                SockConn *conn = polled[i - (listenFd >= 0 ? 1 : 0)];
+                if (conn->fd >= 0 && (fds[i].revents & POLLOUT))
+                    writeConnection(conn);
+                if (conn->fd >= 0 && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                    readConnection(conn);
+            }
+        }
+    }
+
+    return 0;
+}
+
+sint8 espconn_accept(struct espconn *espconn)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+
+    if ((listenFd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        return ESPCONN_MEM;
+    }
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(espconn->proto.tcp->local_port);
+    if (bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenFd, 16) != 0) {
+        perror("bind");
+        close(listenFd);
+        listenFd = -1;
+        return ESPCONN_ISCONN;
+    }
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    listener = espconn;
+
+    return ESPCONN_OK;
+}
+
+sint8 espconn_tcp_set_max_con_allow(struct espconn *espconn, uint8 num)
+{
+    maxConnections = num;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_connectcb(struct espconn *espconn, espconn_connect_callback connect_cb)
+{
+    espconn->proto.tcp->connect_callback = connect_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_reconcb(struct espconn *espconn, espconn_reconnect_callback recon_cb)
+{
+    espconn->proto.tcp->reconnect_callback = recon_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_disconcb(struct espconn *espconn, espconn_connect_callback discon_cb)
+{
+    espconn->proto.tcp->disconnect_callback = discon_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_recvcb(struct espconn *espconn, espconn_recv_callback recv_cb)
+{
+    espconn->recv_callback = recv_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_regist_sentcb(struct espconn *espconn, espconn_sent_callback sent_cb)
+{
+    espconn->sent_callback = sent_cb;
+    return ESPCONN_OK;
+}
+
+sint8 espconn_set_opt(struct espconn *espconn, uint8 opt)
+{
+    SockConn *conn = (SockConn *)espconn;
+    int on = 1;
+    if ((opt & ESPCONN_NODELAY) && conn->fd >= 0)
+        setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return ESPCONN_OK;
+}
+
+sint8 espconn_sent(struct espconn *espconn, uint8 *psent, uint16 length)
+{
+    SockConn *conn = (SockConn *)espconn;
+
+    if (conn->fd < 0 || conn->closing)
+        return ESPCONN_ARG;
+    if (conn->outLength > 0)
+        return ESPCONN_MAXNUM;
+    if (!(conn->out = (uint8_t *)malloc(length)))
+        return ESPCONN_MEM;
+    memcpy(conn->out, psent, length);
+    conn->outLength = length;
+    conn->outSent = 0;
+    writeConnection(conn);
+
+    return ESPCONN_OK;
+}
+
+sint8 espconn_disconnect(struct espconn *espconn)
+{
+    SockConn *conn = (SockConn *)espconn;
+
+    if (conn->fd < 0 || conn->closing)
+        return ESPCONN_ARG;
+    conn->closing = 1;
+
+    /* the SDK sends what's queued before the FIN */
+    if (conn->outSent >= conn->outLength)
+        closeConnection(conn, 0);
+
+    return ESPCONN_OK;
+}
+
+static void acceptConnection(void)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLength = sizeof(addr);
+    SockConn *conn;
+    uint32_t ip;
+    int fd;
+
+    if ((fd = accept(listenFd, (struct sockaddr *)&addr, &addrLength)) < 0)
+        return;
+
+    /* what the SDK does past max_con_allow */
+    if (openConnections() >= maxConnections || sockCount >= MAX_SOCKS) {
+        ++stats.refused;
+        close(fd);
+        return;
+    }
+
+    if (!(conn = (SockConn *)calloc(1, sizeof(SockConn)))) {
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    conn->fd = fd;
+    conn->esp.type = ESPCONN_TCP;
+    conn->esp.state = ESPCONN_CONNECT;
+    conn->esp.proto.tcp = &conn->tcp;
+    conn->tcp.local_port = listener->proto.tcp->local_port;
+    conn->tcp.remote_port = ntohs(addr.sin_port);
+    ip = ntohl(addr.sin_addr.s_addr);
+    conn->tcp.remote_ip[0] = (uint8)(ip >> 24);
+    conn->tcp.remote_ip[1] = (uint8)(ip >> 16);
+    conn->tcp.remote_ip[2] = (uint8)(ip >> 8);
+    conn->tcp.remote_ip[3] = (uint8)ip;
+    conn->tcp.connect_callback = listener->proto.tcp->connect_callback;
+    socks[sockCount++] = conn;
+
+    ++stats.accepted;
+    if (openConnections() > stats.peakConnections)
+        stats.peakConnections = openConnections();
+
+    if (conn->tcp.connect_callback)
+        (*conn->tcp.connect_callback)(&conn->esp);
+
+    /* httpd closes a connection it has no room for without taking it */
+    if (!conn->esp.reverse)
+        ++stats.poolOverflows;
+}
+
+static void readConnection(SockConn *conn)
+{
+    char buf[RECV_SIZE];
+    int cnt;
+
+    if ((cnt = (int)recv(conn->fd, buf, sizeof(buf), 0)) > 0) {
+        if (!conn->closing && conn->esp.recv_callback)
+            (*conn->esp.recv_callback)(&conn->esp, buf, (unsigned short)cnt);
+    }
+    else if (cnt == 0)
+        closeConnection(conn, 0);
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        closeConnection(conn, ESPCONN_RST);
+}
+
+static void writeConnection(SockConn *conn)
+{
+    int cnt;
+
+    while (conn->outSent < conn->outLength) {
+        if ((cnt = (int)send(conn->fd, conn->out + conn->outSent, conn->outLength - conn->outSent, MSG_NOSIGNAL)) < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return;
+            closeConnection(conn, ESPCONN_RST);
+            return;
+        }
+        conn->outSent += cnt;
+    }
+
+    free(conn->out);
+    conn->out = NULL;
+    conn->outLength = conn->outSent = 0;
+
+    /* the callback doesn't run inside espconn_sent on the ESP either */
+    if (conn->closing)
+        closeConnection(conn, 0);
+    else
+        SimSchedule(SimNow(), sentHandler, conn);
+}
+
+/* closeConnection - close the socket, httpd hears about it from the event loop */
+static void closeConnection(SockConn *conn, int err)
+{
+    if (conn->fd < 0)
+        return;
+    close(conn->fd);
+    conn->fd = -1;
+    conn->dead = 1;
+    conn->esp.state = ESPCONN_CLOSE;
+    conn->err = (sint8)err;
+    SimSchedule(SimNow(), disconnectHandler, conn);
+}
+
+static void sentHandler(void *data)
+{
+    SockConn *conn = (SockConn *)data;
+    if (!conn->dead && conn->esp.sent_callback)
+        (*conn->esp.sent_callback)(&conn->esp);
+}
+
+static void disconnectHandler(void *data)
+{
+    SockConn *conn = (SockConn *)data;
+
+    /* the SDK calls one or the other, never both */
+    if (conn->err && conn->tcp.reconnect_callback)
+        (*conn->tcp.reconnect_callback)(&conn->esp, conn->err);
+    else if (!conn->err && conn->tcp.disconnect_callback)
+        (*conn->tcp.disconnect_callback)(&conn->esp);
+
+    /* after any sent callback that was already queued */
+    SimSchedule(SimNow(), freeHandler, conn);
+}
+
+static void freeHandler(void *data)
+{
+    SockConn *conn = (SockConn *)data;
+    int i;
+
+    for (i = 0; i < sockCount; ++i) {
+        if (socks[i] == conn) {
+            socks[i] = socks[--sockCount];
+            break;
+        }
+    }
+    free(conn->out);
+    free(conn);
+}
+
+/* openConnections - connections the SDK still counts against max_con_allow */
+static int openConnections(void)
+{
+    int count = 0, i;
+    for (i = 0; i < sockCount; ++i)
+        if (!socks[i]->dead)
+            ++count;
+    return count;
+}
+
+static uint64_t clockMicroseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
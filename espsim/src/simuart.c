@@ -0,0 +1,183 @@
+/* simuart.c - UART0 and the reset pin wired to a simulated Propeller
+
+   uart0_tx_buffer and uart_tx_one_char busy-wait for room in the 128 byte transmit FIFO on
+   the ESP8266, so writing more than that holds up the CPU until the rest has drained. Bytes
+   from the Propeller reach programmingCB once the receive FIFO timeout (two byte times of
+   quiet) has passed, the way esp-link's receive interrupt hands them on.
+*/
+
+#include "espsim.h"
+#include "uart.h"
+#include "serbridge.h"
+
+#define TX_FIFO_SIZE        128
+#define RX_TIMEOUT_BYTES    2
+#define MAX_RX_CHUNK        128
+
+typedef struct {
+    int len;
+    uint8_t buf[MAX_RX_CHUNK];
+} RxChunk;
+
+void (*programmingCB)(char *buffer, short length) = NULL;
+
+static PropSim *propeller = NULL;
+static int resetPin = -1;
+static int baudRate = 115200;
+static uint64_t txLineFree = 0;     /* when the last byte written will have been sent */
+static uint64_t blockedTime = 0;    /* time the CPU spent waiting on the transmit FIFO */
+static int pollEvent = 0;
+
+static void transmitHandler(void *data, const uint8_t *buf, int len, int rate);
+static void eventHandler(void *data, uint64_t time, const char *message);
+static void pollHandler(void *data);
+static void rxHandler(void *data);
+static void schedulePoll(void);
+static void txBytes(const uint8_t *buf, int len);
+
+void SimUartInit(int pin)
+{
+    resetPin = pin;
+    baudRate = 115200;
+    txLineFree = 0;
+    blockedTime = 0;
+    pollEvent = 0;
+    programmingCB = NULL;
+    if (!(propeller = PropSimOpen(transmitHandler, eventHandler, NULL))) {
+        printf("error: insufficient memory\n");
+        exit(1);
+    }
+}
+
+void SimUartClose(void)
+{
+    if (propeller) {
+        PropSimClose(propeller);
+        propeller = NULL;
+    }
+}
+
+PropSim *SimUartPropeller(void)
+{
+    return propeller;
+}
+
+uint64_t SimUartBlockedTime(void)
+{
+    return blockedTime;
+}
+
+void uart0_tx_buffer(char *buf, uint16 len)
+{
+    txBytes((uint8_t *)buf, len);
+}
+
+void uart_tx_one_char(uint8 uart, uint8 c)
+{
+    if (uart == UART0)
+        txBytes(&c, 1);
+}
+
+uint32 SimReadPeriReg(uint32 addr)
+{
+    uint64_t byteTime = 10000000 / baudRate, now = SimNow();
+    uint32 queued;
+
+    if (addr != UART_STATUS(UART0))
+        return 0;
+
+    /* the bytes not yet started out, at most a FIFO's worth */
+    queued = txLineFree > now ? (uint32)((txLineFree - now + byteTime - 1) / byteTime) : 0;
+    if (queued > TX_FIFO_SIZE)
+        queued = TX_FIFO_SIZE;
+    return queued << UART_TXFIFO_CNT_S;
+}
+
+void uart0_baud(int rate)
+{
+    baudRate = rate;
+}
+
+void SimGpioSet(int pin, int level)
+{
+    if (pin == resetPin) {
+        PropSimReset(propeller, SimNow(), level);
+        schedulePoll();
+    }
+}
+
+void makeGpio(int pin)
+{
+}
+
+/* txBytes - put bytes on the line, waiting for room in the FIFO for all but the last 128 */
+static void txBytes(const uint8_t *buf, int len)
+{
+    uint64_t byteTime = 10000000 / baudRate, start = SimNow(), drained;
+
+    PropSimReceive(propeller, start, buf, len, baudRate);
+
+    if (txLineFree < start)
+        txLineFree = start;
+    txLineFree += len * byteTime;
+
+    /* the call returns once everything but a FIFO's worth has started out */
+    if (txLineFree > start + TX_FIFO_SIZE * byteTime) {
+        drained = txLineFree - TX_FIFO_SIZE * byteTime - start;
+        blockedTime += drained;
+        SimBusy((uint32)drained);
+    }
+
+    schedulePoll();
+}
+
+static void transmitHandler(void *data, const uint8_t *buf, int len, int rate)
+{
+    uint8_t *converted = NULL;
+    int cnt;
+
+    /* what the ESP's UART makes of bytes sent at some other baud rate */
+    if (rate > 0 && (converted = (uint8_t *)malloc(len * 5 + 1)) != NULL) {
+        len = PropSimConvertBaud(buf, len, rate, baudRate, converted);
+        buf = converted;
+    }
+
+    for (cnt = 0; cnt < len; cnt += MAX_RX_CHUNK) {
+        RxChunk *chunk = (RxChunk *)malloc(sizeof(RxChunk));
+        if (!chunk)
+            break;
+        chunk->len = len - cnt > MAX_RX_CHUNK ? MAX_RX_CHUNK : len - cnt;
+        memcpy(chunk->buf, buf + cnt, chunk->len);
+        SimSchedule(SimNow() + RX_TIMEOUT_BYTES * 10000000 / baudRate, rxHandler, chunk);
+    }
+
+    free(converted);
+}
+
+static void eventHandler(void *data, uint64_t time, const char *message)
+{
+    SimLog("propeller: %s\n", message);
+}
+
+static void rxHandler(void *data)
+{
+    RxChunk *chunk = (RxChunk *)data;
+    if (programmingCB)
+        (*programmingCB)((char *)chunk->buf, (short)chunk->len);
+    free(chunk);
+}
+
+static void pollHandler(void *data)
+{
+    pollEvent = 0;
+    schedulePoll();
+}
+
+/* schedulePoll - run the Propeller again when it next has something to do */
+static void schedulePoll(void)
+{
+    int64_t next = PropSimPoll(propeller, SimNow());
+    if (pollEvent)
+        SimCancel(pollEvent);
+    pollEvent = next >= 0 ? SimSchedule(SimNow() + (next > 0 ? next : 1), pollHandler, NULL) : 0;
+}
@@ -42,6 +42,7 @@ struct HttpdPriv {
   char head[MAX_HEAD_LEN];  // buffer to accumulate header
   char from[24];            // source ip&port
   char *sendBuff;           // output buffer
+  char *heapBuff;           // output buffer for responses sent outside a callback
   short headPos;            // offset into header
   short sendBuffLen;        // offset into output buffer
   short code;               // http response code (only for logging)
@@ -129,6 +130,8 @@ static void ICACHE_FLASH_ATTR httpdRetireConn(HttpdConnData *conn) {
   conn->conn = NULL; // don't try to send anything, the SDK crashes...
   if (conn->cgi != NULL) conn->cgi(conn); // free cgi data
   if (conn->post->buff != NULL) os_free(conn->post->buff);
+  if (conn->priv->heapBuff != NULL) os_free(conn->priv->heapBuff);
+  conn->priv->sendBuff = conn->priv->heapBuff = NULL;
   conn->cgi = NULL;
   conn->post->buff = NULL;
 }
@@ -277,6 +280,14 @@ int ICACHE_FLASH_ATTR cgiRedirect(HttpdConnData *connData) {
 //Returns 1 for success, 0 for out-of-memory.
 int ICACHE_FLASH_ATTR httpdSend(HttpdConnData *conn, const char *data, int len) {
   if (len<0) len = strlen(data);
+  // a cgi answering from a timer or the UART has no callback stack buffer to write into
+  if (conn->priv->sendBuff == NULL) {
+    // one left unflushed when a callback took over is reused rather than leaked
+    if (conn->priv->heapBuff == NULL) conn->priv->heapBuff = (char*)os_malloc(MAX_SENDBUFF_LEN);
+    if (conn->priv->heapBuff == NULL) return 0;
+    conn->priv->sendBuff = conn->priv->heapBuff;
+    conn->priv->sendBuffLen = 0;
+  }
   if (conn->priv->sendBuffLen + len>MAX_SENDBUFF_LEN) {
     DBG("%sERROR! httpdSend full (%d of %d)\n",
       connStr, conn->priv->sendBuffLen, MAX_SENDBUFF_LEN);
@@ -297,6 +308,12 @@ void ICACHE_FLASH_ATTR httpdFlush(HttpdConnData *conn) {
     }
     conn->priv->sendBuffLen = 0;
   }
+  if (conn->priv->heapBuff != NULL) {
+    // a flush inside a callback keeps the callback's stack buffer
+    if (conn->priv->sendBuff == conn->priv->heapBuff) conn->priv->sendBuff = NULL;
+    os_free(conn->priv->heapBuff);
+    conn->priv->heapBuff = NULL;
+  }
 }
 
 //Callback called when the data on a socket has been successfully sent.
@@ -312,6 +329,7 @@ static void ICACHE_FLASH_ATTR httpdSentCb(void *arg) {
 
   if (conn->cgi == NULL) { //Marked for destruction?
     //os_printf("Closing 0x%p/0x%p->0x%p\n", arg, conn->conn, conn);
+    conn->priv->sendBuff = NULL;
     espconn_disconnect(conn->conn); // we will get a disconnect callback
     return; //No need to call httpdFlush.
   }
@@ -325,6 +343,7 @@ static void ICACHE_FLASH_ATTR httpdSentCb(void *arg) {
     conn->cgi = NULL; //mark for destruction.
   }
   httpdFlush(conn);
+  conn->priv->sendBuff = NULL; // the stack buffer goes away on return
 }
 
 static const char *httpNotFoundHeader = "HTTP/1.0 404 Not Found\r\nConnection: close\r\n"
@@ -533,6 +552,7 @@ static void ICACHE_FLASH_ATTR httpdRecvCb(void *arg, char *data, unsigned short
       }
     }
   }
+  conn->priv->sendBuff = NULL; // the stack buffer goes away on return
 }
 
 static void ICACHE_FLASH_ATTR httpdDisconCb(void *arg) {
@@ -579,6 +599,8 @@ static void ICACHE_FLASH_ATTR httpdConnectCb(void *arg) {
   connData[i].conn = conn;
   conn->reverse = connData+i;
   connData[i].priv->headPos = 0;
+  connData[i].priv->sendBuff = NULL;
+  connData[i].priv->heapBuff = NULL;
 
   esp_tcp *tcp = conn->proto.tcp;
   os_sprintf(connData[i].priv->from, "%d.%d.%d.%d:%d", tcp->remote_ip[0], tcp->remote_ip[1],
@@ -5,6 +5,7 @@
 #include "serbridge.h"
 #include "proploader.h"
 #include "fastproploader.h"
+#include "propconfig.h"
 #include "uart.h"
 #include "serled.h"
 
@@ -30,7 +31,6 @@ static const uint8_t blink_slow_array[] = {
 };
 #endif
 
-#if 0
 /* the order here must match the definition of LoadState in proploader.h */
 static const char *stateNames[] = {
     "Idle",
@@ -44,24 +44,128 @@ static const char *stateNames[] = {
     "DataAck",
     "VerifyRAMAck",
     "ProgramVerifyEEPROMAck",
-    "ReadyToLaunchAck"
+    "ReadyToLaunchAck",
+    "RomProgramAck",
+    "RomVerifyAck",
+    "PadAck"
 };
-#endif
+
+// histogram bucket n counts times under 2^n milliseconds, the last one everything longer
+#define STATS_BUCKETS           14
+#define STATS_STATES_PER_SEND   6
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;               // microseconds
+    uint32_t max;
+    uint64_t total;
+    uint16_t histogram[STATS_BUCKETS];
+} PropTiming;
+
+// where the time goes in a load, kept across loads until reset
+typedef struct {
+    PropTiming states[stMAX];   // time spent in each state, stIdle isn't timed
+    PropTiming packetAck;       // from sending a data packet (or resending it) to its ack
+    PropTiming load;            // from reset to launch for loads through the second-stage loader
+    PropTiming romLoad;         // the same for loads sent straight to the ROM
+    PropTiming stepLate;        // how long after its time each scheduled step ran
+    PropTiming checksumWait;    // from the end of the stream to the checksum reply
+    PropTiming eeprom;          // from the program command to the EEPROM verified, either path
+    uint32_t eepromBytes;       // what those wrote, to give the time per 32K
+    uint32_t timeouts[stMAX];
+    uint32_t loads;
+    uint32_t loadsCompleted;
+    uint32_t loadsFailed;
+    uint32_t checksumPolls;
+    uint32_t dataResends;
+    uint32_t requestsLost;
+    uint32_t baudFallbacks;
+    uint32_t eepromSkips;       // program commands for an image the EEPROM already held
+    LoadState state;            // the state being timed
+    uint32_t stateStart;
+    uint32_t packetStart;
+    uint32_t loadStart;
+    uint32_t stepDue;           // when the scheduled step is due, 0 when none is
+    uint32_t drainDue;          // when the last of the stream will have gone out
+    uint32_t eepromStart;
+} PropStats;
+
+static PropStats stats;
+
+#define BAUD_COUNT(rates)       ((int)(sizeof(rates) / sizeof((rates)[0])))
+#define BAUD_PROBE_LOADS        16  // loads at a lowered initial rate before the next one up is tried again
+
+static const int initialBaudRates[] = INITIAL_BAUD_RATES;
+static const int secondStageBaudRates[] = SECOND_STAGE_BAUD_RATES;
+
+// the fastest rates known to work, tried first on each load and lowered when a load fails, and
+// what the EEPROM holds when a client has asked to skip programming it with the same image
+static PropConfig loaderConfig;
+static PropConfig savedLoaderConfig;
+static int loadsAtLoweredRate;
+
+// the load in progress
+static int loadImageSize;       // to rebuild the loader image for another initial rate
+static int initialBaudGiven;    // the client chose the initial rate, so don't fall back from it
+static int directLoad;          // the image goes straight to the ROM, gathered in the packet buffer
+static int earlyStart;          // begun without image-size, the loader takes a full RAM's worth of packets
+static uint32_t loadImageHash;  // of the image bytes so far, to compare with the last image programmed
+static int skipUnchanged;       // remember the image programmed and don't program it again
+static int eepromProgrammed;    // what this load does with the EEPROM, reported by load-end
+static int eepromSkipped;
+
+// FNV-1a, the image hash only has to tell a changed image from the one programmed last
+#define IMAGE_HASH_INIT         0x811C9DC5
+#define IMAGE_HASH_PRIME        0x01000193
+
+// Choosing between sending an image straight to the ROM and booting the second-stage loader to
+// take it. Times are in microseconds and only what differs between the two paths is counted, the
+// reset, handshake and checksum wait are the same either way.
+#define ROM_BITS_PER_BYTE       3       // the fewest image bits a byte of the ROM's encoding carries
+#define ROM_HEADER_SIZE         22      // the command and length fields
+#define LOADER_OVERHEAD_TIME    10000   // loader startup and the verify-RAM and launch exchanges
+#define PACKET_OVERHEAD_TIME    1000    // each packet's header, ack and turnaround
+#define EEPROM_PAGE_SIZE        64
+#define EEPROM_PAGE_TIME        5000
+#define ROM_EEPROM_SIZE         32768   // the ROM programs all of the EEPROM whatever the image size
+
+extern char *esp_link_version;
 
 static void getLoadParameters(HttpdConnData *connData);
+static int getLoadType(HttpdConnData *connData, LoadType *pLoadType);
+static int chooseDirectLoad(PropellerConnection *connection, int imageSize, LoadType loadType);
+static uint32_t romStreamTime(int imageSize, int baudRate);
+static uint32_t lineTime(int byteCount, int baudRate);
+static int startLoader(PropellerConnection *connection);
+static int restartLoad(PropellerConnection *connection);
+static void startRomPoll(PropellerConnection *connection, LoadState state, int timeout);
 static void startLoading(PropellerConnection *connection, const uint8_t *image, int imageSize);
+static void loadFailed(PropellerConnection *connection, char *message);
+static void chooseEEPROMProgramming(PropellerConnection *connection);
+static void forgetEEPROMImage(void);
+static uint32_t imageHash(uint32_t hash, const uint8_t *data, int size);
+static void sendLoadEndResponse(PropellerConnection *connection);
+static int nextBaudRate(const int *rates, int count, int baudRate, int up);
+static void saveLoaderConfig(void);
 static void finishLoading(PropellerConnection *connection);
 static void abortLoading(PropellerConnection *connection);
 static void httpdSendResponse(HttpdConnData *connData, int code, char *message);
+static void sendLoadBeginResponse(PropellerConnection *connection);
+static void sendLoadDataResponse(HttpdConnData *connData, int code, int bytesLoaded);
+static int detachConnection(HttpdConnData *connData);
 static void timerCallback(void *data);
 static void readCallback(char *buf, short length);
+static void scheduleStep(PropellerConnection *connection, uint32_t us);
+static void statsNoteState(PropellerConnection *connection);
+static void statsAddTiming(PropTiming *timing, uint32_t elapsed);
+static void statsNoteEEPROM(int byteCount);
+static uint32_t statsSince(uint32_t time);
+static void statsSendTiming(HttpdConnData *connData, const char *name, PropTiming *timing, int timeouts);
 
-#if 0
 static const ICACHE_FLASH_ATTR char *stateName(LoadState state)
 {
     return state >= 0 && state < stMAX ? stateNames[state] : "Unknown";
 }
-#endif
 
 int8_t ICACHE_FLASH_ATTR getIntArg(HttpdConnData *connData, char *name, int *pValue)
 {
@@ -75,19 +179,43 @@ int8_t ICACHE_FLASH_ATTR getIntArg(HttpdConnData *connData, char *name, int *pVa
 // this is statically allocated because the serial read callback has no context parameter
 PropellerConnection myConnection;
 
-int ICACHE_FLASH_ATTR cgiPropInit()
+int ICACHE_FLASH_ATTR cgiPropInit(void)
 {
     memset(&myConnection, 0, sizeof(PropellerConnection));
     myConnection.state = stIdle;
+    memset(&stats, 0, sizeof(stats));
+    stats.state = stIdle;
+
+    // start at the top of the ladders until a load shows the line can't take it
+    if (propConfigLoad(&loaderConfig) != 0) {
+        loaderConfig.initialBaudRate = initialBaudRates[BAUD_COUNT(initialBaudRates) - 1];
+        loaderConfig.secondStageBaudRate = secondStageBaudRates[BAUD_COUNT(secondStageBaudRates) - 1];
+    }
+    savedLoaderConfig = loaderConfig;
+    loadsAtLoweredRate = 0;
     return 1;
 }
 
+// the rates discovery reports, so clients that pass them along get the remembered ones
+int ICACHE_FLASH_ATTR cgiPropInitialBaudRate(void)
+{
+    return loaderConfig.initialBaudRate;
+}
+
+int ICACHE_FLASH_ATTR cgiPropSecondStageBaudRate(void)
+{
+    return loaderConfig.secondStageBaudRate;
+}
+
 int ICACHE_FLASH_ATTR cgiPropLoadBegin(HttpdConnData *connData)
 {
     PropellerConnection *connection = &myConnection;
-    PropellerImage image;
+    LoadType loadType;
     int imageSize;
     
+    if (connData->conn == NULL)
+        return detachConnection(connData);
+
     if (connection->state != stIdle) {
         errorResponse(connData, 400, "Transfer already in progress\r\n");
         abortLoading(connection);
@@ -96,24 +224,62 @@ int ICACHE_FLASH_ATTR cgiPropLoadBegin(HttpdConnData *connData)
     connData->cgiPrivData = connection;
     connection->connData = connData;
     
-    if (!getIntArg(connData, "image-size", &imageSize)) {
-        errorResponse(connData, 400, "image-size parameter missing\r\n");
+    // Without image-size the loader is booted while the image is still being built. It can't be
+    // told the packet count later, so it's built for the largest image and the packets the image
+    // doesn't need are padded out at load-end, and it waits long enough for the build to finish.
+    if ((earlyStart = !getIntArg(connData, "image-size", &imageSize)) != 0)
+        imageSize = MAX_IMAGE_SIZE;
+    else if (imageSize <= 0 || imageSize > MAX_IMAGE_SIZE) {
+        errorResponse(connData, 400, "Invalid image-size\r\n");
         return HTTPD_CGI_DONE;
     }
+    connection->failsafeTimeout = earlyStart ? EARLY_START_TIMEOUT / 1000 : 0;
     
     getLoadParameters(connData);
     if (!getIntArg(connData, "second-stage-baud", &connection->secondStageBaudRate))
-        connection->secondStageBaudRate = 921600;
+        connection->secondStageBaudRate = loaderConfig.secondStageBaudRate;
+    if (!getIntArg(connData, "packet-size", &connection->packetSize))
+        connection->packetSize = MAX_PACKET_SIZE;
+    else if (connection->packetSize < 1 || connection->packetSize > MAX_PACKET_SIZE) {
+        errorResponse(connData, 400, "Invalid packet-size\r\n");
+        return HTTPD_CGI_DONE;
+    }
+    if (connection->eepromClock <= 0 || connection->eepromClock > MAX_EEPROM_CLOCK) {
+        errorResponse(connData, 400, "Invalid eeprom-clock\r\n");
+        return HTTPD_CGI_DONE;
+    }
+    
+    // the client can say what it will ask for at load-end, programming favours the loader
+    if (getLoadType(connData, &loadType) != 0) {
+        errorResponse(connData, 400, "Unknown command\r\n");
+        return HTTPD_CGI_DONE;
+    }
         
-    DBG("load-begin: image-size %d, baud %d, second-stage-baud %d, final-baud %d\n", imageSize, connection->baudRate, connection->secondStageBaudRate, connection->finalBaudRate);
+    DBG("load-begin: %simage-size %d, packet-size %d, baud %d, second-stage-baud %d, final-baud %d\n", earlyStart ? "early, " : "", imageSize, connection->packetSize, connection->baudRate, connection->secondStageBaudRate, connection->finalBaudRate);
     
-    if (fplGenerateInitialLoaderImage(connection, imageSize, &image) != 0) {
-        errorResponse(connData, 400, "Generate loader image failed\r\n");
+    loadImageSize = imageSize;
+    loadImageHash = IMAGE_HASH_INIT;
+    
+    // a small image is gathered here and sent to the ROM at load-end, nothing to wait for yet
+    if ((directLoad = !earlyStart && chooseDirectLoad(connection, imageSize, loadType)) != 0) {
+        ++stats.loads;
+        connection->bytesLoaded = 0;
+        connection->state = stData;
+        os_timer_disarm(&connection->timer);
+        os_timer_setfn(&connection->timer, timerCallback, connection);
+        os_timer_arm(&connection->timer, DATA_IDLE_TIMEOUT, 0);
+        statsNoteState(connection);
+        sendLoadBeginResponse(connection);
+        connection->connData = NULL;
         return HTTPD_CGI_DONE;
     }
     
-    connection->stateAfterLoadFinishes = stStartAck;
-    startLoading(connection, image.imageData, image.imageSize);
+    if (startLoader(connection) != 0) {
+        errorResponse(connData, 400, "Generate loader image failed\r\n");
+        return HTTPD_CGI_DONE;
+    }
+    ++stats.loads;
+    stats.loadStart = system_get_time();
 
     return HTTPD_CGI_MORE;
 }
@@ -121,12 +287,46 @@ int ICACHE_FLASH_ATTR cgiPropLoadBegin(HttpdConnData *connData)
 int ICACHE_FLASH_ATTR cgiPropLoadData(HttpdConnData *connData)
 {
     PropellerConnection *connection = &myConnection;
+    int offset;
     
-    if (connection->state != stData) {
+    if (connData->conn == NULL)
+        return detachConnection(connData);
+
+    if (connection->state != stData && connection->state != stDataAck) {
         errorResponse(connData, 400, "Not ready for a data transfer\r\n");
         abortLoading(connection);
         return HTTPD_CGI_DONE;
     }
+    
+    // clients that don't send an offset always send the next packet
+    if (!getIntArg(connData, "offset", &offset))
+        offset = connection->bytesLoaded;
+    
+    // a retry of the packet in flight waits for its ack in place of the lost request
+    if (connection->state == stDataAck) {
+        if (offset != connection->bytesLoaded || connData->post->buffLen != connection->packetLength) {
+            sendLoadDataResponse(connData, 400, connection->bytesLoaded);
+            return HTTPD_CGI_DONE;
+        }
+        DBG("load-data: retry at offset %d\n", offset);
+        connData->cgiPrivData = connection;
+        connection->connData = connData;
+        return HTTPD_CGI_MORE;
+    }
+    
+    // a retry of a packet that was acked after its request was lost
+    if (offset < connection->bytesLoaded && offset + connData->post->buffLen <= connection->bytesLoaded) {
+        DBG("load-data: offset %d already loaded\n", offset);
+        sendLoadDataResponse(connData, 200, connection->bytesLoaded);
+        return HTTPD_CGI_DONE;
+    }
+    
+    // tell the client where to resume
+    else if (offset != connection->bytesLoaded) {
+        sendLoadDataResponse(connData, 400, connection->bytesLoaded);
+        return HTTPD_CGI_DONE;
+    }
+    
     connData->cgiPrivData = connection;
     connection->connData = connData;
     
@@ -136,10 +336,49 @@ int ICACHE_FLASH_ATTR cgiPropLoadData(HttpdConnData *connData)
         return HTTPD_CGI_DONE;
     }
     
-    DBG("load-data: size %d\n", connData->post->buffLen);
+    // the loader has had all the packets it expects
+    if (!directLoad && connection->packetID <= 0) {
+        errorResponse(connData, 400, "More data than image-size\r\n");
+        abortLoading(connection);
+        return HTTPD_CGI_DONE;
+    }
+    
+    // each load-data request must fit in a single second-stage packet
+    if (connData->post->len > connection->packetSize) {
+        errorResponse(connData, 400, "Packet too large\r\n");
+        abortLoading(connection);
+        return HTTPD_CGI_DONE;
+    }
     
-    fplUpdateChecksum(connection, (uint8_t *)connData->post->buff, connData->post->buffLen);
-    fplData(connection, (uint8_t *)connData->post->buff, connData->post->buffLen);
+    DBG("load-data: offset %d, size %d\n", offset, connData->post->buffLen);
+    
+    // the packet buffer holds the whole of an image going straight to the ROM
+    if (directLoad) {
+        if (offset + connData->post->buffLen > loadImageSize) {
+            errorResponse(connData, 400, "More data than image-size\r\n");
+            abortLoading(connection);
+            return HTTPD_CGI_DONE;
+        }
+        os_memcpy(&connection->packet[offset], connData->post->buff, connData->post->buffLen);
+        connection->bytesLoaded += connData->post->buffLen;
+        os_timer_disarm(&connection->timer);
+        os_timer_arm(&connection->timer, DATA_IDLE_TIMEOUT, 0);
+        sendLoadDataResponse(connData, 200, connection->bytesLoaded);
+        connection->connData = NULL;
+        return HTTPD_CGI_DONE;
+    }
+    
+    // keep a copy so the packet can be resent if the request goes away
+    os_memcpy(connection->packet, connData->post->buff, connData->post->buffLen);
+    connection->packetLength = connData->post->buffLen;
+    connection->dataRetriesRemaining = DATA_RETRIES;
+    
+    os_timer_disarm(&connection->timer);
+    fplUpdateChecksum(connection, connection->packet, connection->packetLength);
+    loadImageHash = imageHash(loadImageHash, connection->packet, connection->packetLength);
+    fplData(connection, connection->packet, connection->packetLength);
+    stats.packetStart = system_get_time();
+    statsNoteState(connection);
     
     return HTTPD_CGI_MORE;
 }
@@ -147,14 +386,17 @@ int ICACHE_FLASH_ATTR cgiPropLoadData(HttpdConnData *connData)
 int ICACHE_FLASH_ATTR cgiPropLoadEnd(HttpdConnData *connData)
 {
     PropellerConnection *connection = &myConnection;
-    char cmd[32];
     
+    if (connData->conn == NULL)
+        return detachConnection(connData);
+
     if (connection->state != stData) {
         errorResponse(connData, 400, "Not ready for a data transfer\r\n");
         abortLoading(connection);
         return HTTPD_CGI_DONE;
     }
-    else if (connection->packetID != 0) {
+    else if (directLoad ? connection->bytesLoaded != loadImageSize
+                        : earlyStart ? connection->bytesLoaded == 0 : connection->packetID != 0) {
         errorResponse(connData, 400, "More data expected\r\n");
         abortLoading(connection);
         return HTTPD_CGI_DONE;
@@ -162,28 +404,90 @@ int ICACHE_FLASH_ATTR cgiPropLoadEnd(HttpdConnData *connData)
     connData->cgiPrivData = connection;
     connection->connData = connData;
     
-    if (httpdFindArg(connData->getArgs, "command", cmd, sizeof(cmd)) < 0)
-        os_strcpy(cmd, "run");
-
-    DBG("load-end: command '%s'\n", cmd);
-
-    if (os_strcmp(cmd, "run") == 0)
-        connection->loadType = ltDownloadAndRun;
-    else if (os_strcmp(cmd, "program-and-run") == 0)
-        connection->loadType = ltDownloadAndProgramAndRun;
-    else if (os_strcmp(cmd, "program") == 0)
-        connection->loadType = ltDownloadAndProgram;
-    else {
+    if (getLoadType(connData, &connection->loadType) != 0) {
         errorResponse(connData, 400, "Unknown command\r\n");
         abortLoading(connection);
         return HTTPD_CGI_DONE;
     }
     
-    fplVerifyRAM(connection);
+    if (directLoad)
+        loadImageHash = imageHash(loadImageHash, connection->packet, loadImageSize);
+    chooseEEPROMProgramming(connection);
+    
+    DBG("load-end: load type %d\n", connection->loadType);
+    
+    if (directLoad) {
+        connection->stateAfterLoadFinishes = stIdle;
+        startLoading(connection, connection->packet, loadImageSize);
+        stats.loadStart = system_get_time();
+        return HTTPD_CGI_MORE;
+    }
+    
+    os_timer_disarm(&connection->timer);
+    if (connection->packetID > 0) {
+        connection->dataRetriesRemaining = DATA_RETRIES;
+        fplPad(connection);
+    }
+    else
+        fplVerifyRAM(connection);
+    statsNoteState(connection);
     
     return HTTPD_CGI_MORE;
 }
 
+// GET /propeller/stats - where the time went in the loads so far, as JSON
+int ICACHE_FLASH_ATTR cgiPropStats(HttpdConnData *connData)
+{
+    char buf[384];
+    int next = (int)(intptr_t)connData->cgiData;
+    int len, i;
+
+    if (connData->conn == NULL)
+        return HTTPD_CGI_DONE;
+
+    // the summary, then the states a few at a time to stay within the send buffer
+    if (next == 0) {
+        jsonHeader(connData, 200);
+        len = os_sprintf(buf,
+            "{\"loads\":%d,\"completed\":%d,\"failed\":%d,"
+            "\"checksum-polls\":%d,\"data-resends\":%d,\"requests-lost\":%d,\"baud-fallbacks\":%d,"
+            "\"eeprom-skips\":%d,\"eeprom-us-per-32k\":%d,\"histogram-ms\":[",
+            (int)stats.loads, (int)stats.loadsCompleted, (int)stats.loadsFailed,
+            (int)stats.checksumPolls, (int)stats.dataResends, (int)stats.requestsLost, (int)stats.baudFallbacks,
+            (int)stats.eepromSkips, stats.eepromBytes > 0 ? (int)(stats.eeprom.total * 32768 / stats.eepromBytes) : 0);
+        for (i = 0; i < STATS_BUCKETS - 1; ++i)
+            len += os_sprintf(&buf[len], i == 0 ? "%d" : ",%d", 1 << i);
+        len += os_sprintf(&buf[len], "],");
+        httpdSend(connData, buf, len);
+        statsSendTiming(connData, "load", &stats.load, 0);
+        httpdSend(connData, ",", 1);
+        statsSendTiming(connData, "rom-load", &stats.romLoad, 0);
+        httpdSend(connData, ",", 1);
+        statsSendTiming(connData, "packet-ack", &stats.packetAck, 0);
+        httpdSend(connData, ",", 1);
+        statsSendTiming(connData, "step-late", &stats.stepLate, 0);
+        httpdSend(connData, ",", 1);
+        statsSendTiming(connData, "checksum-wait", &stats.checksumWait, 0);
+        httpdSend(connData, ",", 1);
+        statsSendTiming(connData, "eeprom", &stats.eeprom, 0);
+        httpdSend(connData, ",\"states\":{", -1);
+        connData->cgiData = (void *)(intptr_t)(stIdle + 1);
+        return HTTPD_CGI_MORE;
+    }
+
+    for (i = 0; i < STATS_STATES_PER_SEND && next < stMAX; ++i, ++next) {
+        if (next > stIdle + 1)
+            httpdSend(connData, ",", 1);
+        statsSendTiming(connData, stateName(next), &stats.states[next], stats.timeouts[next]);
+    }
+    if (next >= stMAX) {
+        httpdSend(connData, "}}", 2);
+        return HTTPD_CGI_DONE;
+    }
+    connData->cgiData = (void *)(intptr_t)next;
+    return HTTPD_CGI_MORE;
+}
+
 #if 0
 int ICACHE_FLASH_ATTR cgiPropBlinkFast(HttpdConnData *connData)
 {
@@ -198,6 +502,7 @@ int ICACHE_FLASH_ATTR cgiPropBlinkFast(HttpdConnData *connData)
     
     getLoadParameters(connData);
     
+    connection->loadType = ltDownloadAndRun;
     connection->stateAfterLoadFinishes = stIdle;
     startLoading(connection, blink_fast_array, sizeof(blink_fast_array));
 
@@ -217,6 +522,7 @@ int ICACHE_FLASH_ATTR cgiPropBlinkSlow(HttpdConnData *connData)
     
     getLoadParameters(connData);
     
+    connection->loadType = ltDownloadAndRun;
     connection->stateAfterLoadFinishes = stIdle;
     startLoading(connection, blink_slow_array, sizeof(blink_slow_array));
 
@@ -227,12 +533,105 @@ int ICACHE_FLASH_ATTR cgiPropBlinkSlow(HttpdConnData *connData)
 static void ICACHE_FLASH_ATTR getLoadParameters(HttpdConnData *connData)
 {
     PropellerConnection *connection = (PropellerConnection *)connData->cgiPrivData;
-    if (!getIntArg(connData, "initial-baud", &connection->baudRate))
-        connection->baudRate = 115200;
+    int clockFreq;
+    initialBaudGiven = getIntArg(connData, "initial-baud", &connection->baudRate);
+    if (!initialBaudGiven)
+        connection->baudRate = loaderConfig.initialBaudRate;
+    // the console stays at the usual rate whatever rate the load started at
     if (!getIntArg(connData, "final-baud", &connection->finalBaudRate))
-        connection->finalBaudRate = connection->baudRate;
+        connection->finalBaudRate = DEFAULT_BAUD_RATE;
     if (!getIntArg(connData, "reset-pin", &connection->resetPin))
-        connection->resetPin = 12;
+        connection->resetPin = DEFAULT_RESET_PIN;
+    // the target image's clock from its header, the loader runs at it when it's crystal driven
+    if (!getIntArg(connData, "clock-freq", &clockFreq) || clockFreq < 0)
+        clockFreq = 0;
+    connection->clockFreq = clockFreq;
+    if (!getIntArg(connData, "clock-mode", &connection->clockMode))
+        connection->clockMode = 0;
+    // a board whose EEPROM can take fast mode plus, or can't take fast mode, can say so
+    if (!getIntArg(connData, "eeprom-clock", &connection->eepromClock))
+        connection->eepromClock = DEFAULT_EEPROM_CLOCK;
+}
+
+// build the second-stage loader for the current initial rate and have the ROM load it
+static int ICACHE_FLASH_ATTR startLoader(PropellerConnection *connection)
+{
+    PropellerImage image;
+    
+    if (fplGenerateInitialLoaderImage(connection, loadImageSize, &image) != 0)
+        return -1;
+    
+    connection->bytesLoaded = 0;
+    connection->loadType = ltDownloadAndRun;
+    connection->stateAfterLoadFinishes = stStartAck;
+    startLoading(connection, image.imageData, image.imageSize);
+    return 0;
+}
+
+// start the load over, at another initial rate
+static int ICACHE_FLASH_ATTR restartLoad(PropellerConnection *connection)
+{
+    if (!directLoad)
+        return startLoader(connection);
+    startLoading(connection, connection->packet, loadImageSize);
+    return 0;
+}
+
+// the command given at load-begin or load-end, run when there isn't one
+static int ICACHE_FLASH_ATTR getLoadType(HttpdConnData *connData, LoadType *pLoadType)
+{
+    char cmd[32];
+    
+    if (httpdFindArg(connData->getArgs, "command", cmd, sizeof(cmd)) < 0)
+        os_strcpy(cmd, "run");
+
+    if (os_strcmp(cmd, "run") == 0)
+        *pLoadType = ltDownloadAndRun;
+    else if (os_strcmp(cmd, "program-and-run") == 0)
+        *pLoadType = ltDownloadAndProgramAndRun;
+    else if (os_strcmp(cmd, "program") == 0)
+        *pLoadType = ltDownloadAndProgram;
+    else
+        return -1;
+    return 0;
+}
+
+// Booting the second-stage loader costs a stream of a little over 2K at the initial rate, which
+// is more than a tiny image takes to send to the ROM itself. Programming goes the other way, the
+// ROM writes every page of the EEPROM where the loader only writes the image's.
+static int ICACHE_FLASH_ATTR chooseDirectLoad(PropellerConnection *connection, int imageSize, LoadType loadType)
+{
+    int packetCount = (imageSize + connection->packetSize - 1) / connection->packetSize;
+    uint32_t romTime, loaderTime;
+    
+    // the ROM takes whole longs, and the image has to fit in the packet buffer
+    if (imageSize <= 0 || imageSize % 4 != 0 || imageSize > (int)sizeof(connection->packet))
+        return 0;
+    if (connection->baudRate < 1000 || connection->secondStageBaudRate < 1000)
+        return 0;
+    
+    romTime = romStreamTime(imageSize, connection->baudRate);
+    loaderTime = romStreamTime(fplLoaderImageSize(), connection->baudRate) + LOADER_OVERHEAD_TIME
+               + lineTime(imageSize + packetCount * 8, connection->secondStageBaudRate)
+               + packetCount * PACKET_OVERHEAD_TIME;
+    if (loadType & ltDownloadAndProgram) {
+        romTime += ROM_EEPROM_SIZE / EEPROM_PAGE_SIZE * EEPROM_PAGE_TIME;
+        loaderTime += (imageSize + EEPROM_PAGE_SIZE - 1) / EEPROM_PAGE_SIZE * EEPROM_PAGE_TIME;
+    }
+    
+    DBG("prop: %d bytes, rom %d us, loader %d us\n", imageSize, (int)romTime, (int)loaderTime);
+    return romTime < loaderTime;
+}
+
+static uint32_t ICACHE_FLASH_ATTR romStreamTime(int imageSize, int baudRate)
+{
+    return lineTime(ROM_HEADER_SIZE + (imageSize * 8 + ROM_BITS_PER_BYTE - 1) / ROM_BITS_PER_BYTE, baudRate);
+}
+
+// ten bits to a byte, in 32 bits for anything up to a full 32K image at any of the rates
+static uint32_t ICACHE_FLASH_ATTR lineTime(int byteCount, int baudRate)
+{
+    return (uint32_t)byteCount * 10000 / (baudRate / 1000);
 }
 
 static void ICACHE_FLASH_ATTR startLoading(PropellerConnection *connection, const uint8_t *image, int imageSize)
@@ -249,7 +648,8 @@ static void ICACHE_FLASH_ATTR startLoading(PropellerConnection *connection, cons
     
     os_timer_disarm(&connection->timer);
     os_timer_setfn(&connection->timer, timerCallback, connection);
-    os_timer_arm(&connection->timer, RESET_DELAY_1, 0);
+    scheduleStep(connection, RESET_DELAY_1 * 1000);
+    statsNoteState(connection);
 }
 
 static void ICACHE_FLASH_ATTR finishLoading(PropellerConnection *connection)
@@ -257,41 +657,253 @@ static void ICACHE_FLASH_ATTR finishLoading(PropellerConnection *connection)
     uart0_baud(connection->finalBaudRate);
     programmingCB = NULL;
     myConnection.state = stIdle;
+    ++stats.loadsCompleted;
+    statsAddTiming(directLoad ? &stats.romLoad : &stats.load, system_get_time() - stats.loadStart);
+    statsNoteState(connection);
+
+    // a client that asked for faster rates than the remembered ones has shown they work
+    if (connection->baudRate > loaderConfig.initialBaudRate)
+        loaderConfig.initialBaudRate = connection->baudRate;
+    if (connection->stateAfterLoadFinishes != stIdle && connection->secondStageBaudRate > loaderConfig.secondStageBaudRate)
+        loaderConfig.secondStageBaudRate = connection->secondStageBaudRate;
+    
+    // the EEPROM now holds the image, for the next load that asks to skip programming the same one
+    if (skipUnchanged && eepromProgrammed) {
+        loaderConfig.eepromImageSize = connection->bytesLoaded;
+        loaderConfig.eepromImageHash = loadImageHash;
+    }
+
+    // a failure at the faster initial rate may have been a fluke, and trying it again costs little
+    if (loaderConfig.initialBaudRate < initialBaudRates[BAUD_COUNT(initialBaudRates) - 1]) {
+        if (++loadsAtLoweredRate >= BAUD_PROBE_LOADS) {
+            loaderConfig.initialBaudRate = nextBaudRate(initialBaudRates, BAUD_COUNT(initialBaudRates), loaderConfig.initialBaudRate, 1);
+            loadsAtLoweredRate = 0;
+        }
+    }
+    saveLoaderConfig();
+}
+
+// fail the load, first stepping down the baud ladder for the stage that failed
+static void ICACHE_FLASH_ATTR loadFailed(PropellerConnection *connection, char *message)
+{
+    char buf[120];
+    int lower;
+    
+    switch (connection->state) {
+    case stRxHandshake:
+    case stVerifyChecksum:
+    case stStartAck:
+        // the ROM or the second-stage loader didn't follow the initial rate
+        lower = nextBaudRate(initialBaudRates, BAUD_COUNT(initialBaudRates), connection->baudRate, 0);
+        if (lower && loaderConfig.initialBaudRate >= connection->baudRate) {
+            loaderConfig.initialBaudRate = lower;
+            loadsAtLoweredRate = 0;
+        }
+        // nothing has reached the client yet, so the loader can start over at the lower rate
+        if (lower && !initialBaudGiven && (connection->stateAfterLoadFinishes == stStartAck || directLoad)) {
+            DBG("prop: %s at %d baud, retrying at %d\n", message, connection->baudRate, lower);
+            ++stats.baudFallbacks;
+            connection->baudRate = lower;
+            if (restartLoad(connection) == 0)
+                return;
+        }
+        os_sprintf(buf, "%s\r\n", message);
+        break;
+    case stDataAck:
+    case stPadAck:
+    case stVerifyRAMAck:
+        // the image data is gone by now, so the lower rate is for the next load
+        lower = nextBaudRate(secondStageBaudRates, BAUD_COUNT(secondStageBaudRates), connection->secondStageBaudRate, 0);
+        if (lower && loaderConfig.secondStageBaudRate >= connection->secondStageBaudRate) {
+            loaderConfig.secondStageBaudRate = lower;
+            ++stats.baudFallbacks;
+            os_sprintf(buf, "%s (second-stage-baud=%d next time)\r\n", message, lower);
+        }
+        else
+            os_sprintf(buf, "%s\r\n", message);
+        break;
+    default:
+        os_sprintf(buf, "%s\r\n", message);
+        break;
+    }
+    
+    saveLoaderConfig();
+    httpdSendResponse(connection->connData, 400, buf);
+    abortLoading(connection);
+}
+
+// Skip programming the EEPROM when the image is the one this module last programmed and verified.
+// The EEPROM itself is never read: the check is the size and hash of that image kept in flash,
+// and the second-stage loader programs all of an image or none of it, so it is skipped or
+// written whole. Any other program this module runs may write the EEPROM itself, so every load
+// that isn't a skip forgets the image. Only the client knows whether nothing else has changed
+// the EEPROM since, the program itself or another programmer, so it has to ask with
+// skip-unchanged. A program command alone is always written since skipping it would leave the
+// old program running rather than the Propeller stopped.
+static void ICACHE_FLASH_ATTR chooseEEPROMProgramming(PropellerConnection *connection)
+{
+    int skip;
+    
+    eepromProgrammed = eepromSkipped = 0;
+    skipUnchanged = 0;
+    if (!(connection->loadType & ltDownloadAndProgram)) {
+        forgetEEPROMImage();
+        return;
+    }
+    getIntArg(connection->connData, "skip-unchanged", &skipUnchanged);
+    // an early session's loadImageSize is the most it could have been, bytesLoaded is what it was
+    skip = skipUnchanged && connection->loadType == ltDownloadAndProgramAndRun
+        && loaderConfig.eepromImageSize == connection->bytesLoaded && loaderConfig.eepromImageHash == loadImageHash;
+    
+    if (skip) {
+        DBG("prop: image matches the last one programmed, running it from RAM\n");
+        connection->loadType = ltDownloadAndRun;
+        eepromSkipped = 1;
+        ++stats.eepromSkips;
+        return;
+    }
+    eepromProgrammed = 1;
+    
+    // until this load has been verified the EEPROM holds nothing known
+    forgetEEPROMImage();
+}
+
+static void ICACHE_FLASH_ATTR forgetEEPROMImage(void)
+{
+    if (loaderConfig.eepromImageSize != 0) {
+        loaderConfig.eepromImageSize = 0;
+        loaderConfig.eepromImageHash = 0;
+        saveLoaderConfig();
+    }
+}
+
+static uint32_t ICACHE_FLASH_ATTR imageHash(uint32_t hash, const uint8_t *data, int size)
+{
+    int i;
+    for (i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * IMAGE_HASH_PRIME;
+    return hash;
+}
+
+// the next rate up or down from baudRate in an ascending ladder, or 0 if there isn't one
+static int ICACHE_FLASH_ATTR nextBaudRate(const int *rates, int count, int baudRate, int up)
+{
+    int i;
+    if (up) {
+        for (i = 0; i < count; ++i)
+            if (rates[i] > baudRate)
+                return rates[i];
+    }
+    else {
+        for (i = count; --i >= 0; )
+            if (rates[i] < baudRate)
+                return rates[i];
+    }
+    return 0;
+}
+
+// write the remembered rates back only when they change, flash wears
+static void ICACHE_FLASH_ATTR saveLoaderConfig(void)
+{
+    if (memcmp(&loaderConfig, &savedLoaderConfig, sizeof(loaderConfig)) != 0) {
+        propConfigSave(&loaderConfig);
+        savedLoaderConfig = loaderConfig;
+    }
 }
 
 static void ICACHE_FLASH_ATTR abortLoading(PropellerConnection *connection)
 {
     programmingCB = NULL;
+    if (myConnection.state != stIdle)
+        ++stats.loadsFailed;
     myConnection.state = stIdle;
+    statsNoteState(connection);
 }
 
 static void ICACHE_FLASH_ATTR httpdSendResponse(HttpdConnData *connData, int code, char *message)
 {
+    // the request may have been lost while waiting for the Propeller
+    if (!connData)
+        return;
     errorResponse(connData, code, message);
     httpdFlush(connData);
     connData->cgi = NULL;
 }
 
+// tell the client what it can tune on later loads: packet size limits and firmware version
+static void ICACHE_FLASH_ATTR sendLoadBeginResponse(PropellerConnection *connection)
+{
+    char buf[160];
+    os_sprintf(buf, "packet-size=%d\r\nmax-packet-size=%d\r\nversion=%s\r\npath=%s\r\n",
+               connection->packetSize, MAX_PACKET_SIZE, esp_link_version, directLoad ? "rom" : "loader");
+    httpdSendResponse(connection->connData, 200, buf);
+}
+
+// the image is running, say what was done with the EEPROM for a program command and, when the
+// client asked to skip an unchanged image, that it was judged by the remembered hash
+static void ICACHE_FLASH_ATTR sendLoadEndResponse(PropellerConnection *connection)
+{
+    char buf[80];
+    int len = 0;
+    buf[0] = '\0';
+    if (eepromProgrammed || eepromSkipped)
+        len = os_sprintf(buf, "eeprom-skipped=%d\r\n", eepromSkipped);
+    if (skipUnchanged && (eepromProgrammed || eepromSkipped))
+        os_sprintf(&buf[len], "eeprom-check=cached-hash\r\n");
+    httpdSendResponse(connection->connData, 200, buf);
+}
+
+// tell the client how much of the image has been acknowledged so it can resume after a failure
+static void ICACHE_FLASH_ATTR sendLoadDataResponse(HttpdConnData *connData, int code, int bytesLoaded)
+{
+    char buf[40];
+    os_sprintf(buf, "bytes-loaded=%d\r\n", bytesLoaded);
+    httpdSendResponse(connData, code, buf);
+}
+
+// the client went away, keep loading so a retried request can pick up the result
+static int ICACHE_FLASH_ATTR detachConnection(HttpdConnData *connData)
+{
+    PropellerConnection *connection = &myConnection;
+    if (connection->connData == connData) {
+        DBG("prop: request lost in state %d\n", connection->state);
+        connection->connData = NULL;
+        ++stats.requestsLost;
+    }
+    return HTTPD_CGI_DONE;
+}
+
 static void ICACHE_FLASH_ATTR timerCallback(void *data)
 {
     PropellerConnection *connection = (PropellerConnection *)data;
     
     os_timer_disarm(&connection->timer);
     
+    // the time lost to the timer, for the steps that were scheduled rather than timeouts
+    if (stats.stepDue != 0) {
+        statsAddTiming(&stats.stepLate, statsSince(stats.stepDue));
+        stats.stepDue = 0;
+    }
+    
     switch (connection->state) {
     case stIdle:
-    case stData:
         // shouldn't happen
         break;
+    case stData:
+        // the second-stage loader has given up waiting for the next packet
+        DBG("prop: no data from client, abandoning load\n");
+        ++stats.timeouts[stData];
+        abortLoading(connection);
+        break;
     case stReset1:
         connection->state = stReset2;
         GPIO_OUTPUT_SET(connection->resetPin, 0);
-        os_timer_arm(&connection->timer, RESET_DELAY_2, 0);
+        scheduleStep(connection, RESET_DELAY_2 * 1000);
         break;
     case stReset2:
         connection->state = stTxHandshake;
         GPIO_OUTPUT_SET(connection->resetPin, 1);
-        os_timer_arm(&connection->timer, RESET_DELAY_3, 0);
+        scheduleStep(connection, RESET_DELAY_3 * 1000);
         break;
     case stTxHandshake:
         connection->state = stRxHandshake;
@@ -299,43 +911,80 @@ static void ICACHE_FLASH_ATTR timerCallback(void *data)
         os_timer_arm(&connection->timer, RX_HANDSHAKE_TIMEOUT, 0);
         break;
     case stRxHandshake:
-        httpdSendResponse(connection->connData, 400, "RX handshake timeout\r\n");
-        abortLoading(connection);
+        ++stats.timeouts[stRxHandshake];
+        loadFailed(connection, "RX handshake timeout");
         break;
     case stVerifyChecksum:
         if (connection->retriesRemaining > 0) {
             uart_tx_one_char(UART0, 0xF9);
-            os_timer_arm(&connection->timer, connection->retryDelay, 0);
+            scheduleStep(connection, connection->retryDelay);
             --connection->retriesRemaining;
+            ++stats.checksumPolls;
         }
         else {
-            httpdSendResponse(connection->connData, 400, "Checksum timeout\r\n");
-            abortLoading(connection);
+            ++stats.timeouts[stVerifyChecksum];
+            loadFailed(connection, "Checksum timeout");
         }
         break;
     case stStartAck:
-        httpdSendResponse(connection->connData, 400, "Second-stage loader startup timeout\r\n");
-        abortLoading(connection);
+        ++stats.timeouts[stStartAck];
+        loadFailed(connection, "Second-stage loader startup timeout");
         break;
     case stDataAck:
-        httpdSendResponse(connection->connData, 400, "Second-stage loader data timeout\r\n");
-        abortLoading(connection);
+        ++stats.timeouts[stDataAck];
+        if (connection->dataRetriesRemaining > 0) {
+            DBG("prop: resending packet at offset %d\n", connection->bytesLoaded);
+            fplData(connection, connection->packet, connection->packetLength);
+            --connection->dataRetriesRemaining;
+            ++stats.dataResends;
+            stats.packetStart = system_get_time();
+        }
+        else {
+            loadFailed(connection, "Second-stage loader data timeout");
+        }
+        break;
+    case stPadAck:
+        ++stats.timeouts[stPadAck];
+        if (connection->dataRetriesRemaining > 0) {
+            fplPad(connection);
+            --connection->dataRetriesRemaining;
+            ++stats.dataResends;
+        }
+        else {
+            loadFailed(connection, "Second-stage loader padding timeout");
+        }
         break;
     case stVerifyRAMAck:
-        httpdSendResponse(connection->connData, 400, "Second-stage verify RAM timeout\r\n");
-        abortLoading(connection);
+        ++stats.timeouts[stVerifyRAMAck];
+        loadFailed(connection, "Second-stage verify RAM timeout");
         break;
     case stProgramVerifyEEPROMAck:
+        ++stats.timeouts[stProgramVerifyEEPROMAck];
         httpdSendResponse(connection->connData, 400, "Second-stage program and verify EEPROM timeout\r\n");
         abortLoading(connection);
         break;
     case stReadyToLaunchAck:
+        ++stats.timeouts[stReadyToLaunchAck];
         httpdSendResponse(connection->connData, 400, "Second-stage ready to launch timeout\r\n");
         abortLoading(connection);
         break;
+    case stRomProgramAck:
+    case stRomVerifyAck:
+        if (connection->retriesRemaining > 0) {
+            uart_tx_one_char(UART0, 0xF9);
+            scheduleStep(connection, EEPROM_POLL_INTERVAL);
+            --connection->retriesRemaining;
+        }
+        else {
+            ++stats.timeouts[connection->state];
+            loadFailed(connection, connection->state == stRomProgramAck ? "ROM EEPROM program timeout" : "ROM EEPROM verify timeout");
+        }
+        break;
     default:
         break;
     }
+
+    statsNoteState(connection);
 }
 
 static void ICACHE_FLASH_ATTR readCallback(char *buf, short length)
@@ -344,6 +993,7 @@ static void ICACHE_FLASH_ATTR readCallback(char *buf, short length)
     int cnt, version;
     
     os_timer_disarm(&connection->timer);
+    stats.stepDue = 0;
     
     switch (connection->state) {
     case stIdle:
@@ -359,8 +1009,10 @@ static void ICACHE_FLASH_ATTR readCallback(char *buf, short length)
         connection->bytesReceived += cnt;
         if ((connection->bytesRemaining -= cnt) == 0) {
             if (ploadVerifyHandshakeResponse(connection, &version) == 0) {
-                if (ploadLoadImage(connection, ltDownloadAndRun, connection->image, connection->imageSize) == 0) {
-                    os_timer_arm(&connection->timer, connection->retryDelay, 0);
+                if (ploadLoadImage(connection, connection->loadType, connection->image, connection->imageSize) == 0) {
+                    // the first poll goes out as the stream finishes, any sooner and it waits behind it
+                    scheduleStep(connection, connection->drainDelay);
+                    stats.drainDue = stats.stepDue;
                     connection->state = stVerifyChecksum;
                 }
                 else {
@@ -369,15 +1021,20 @@ static void ICACHE_FLASH_ATTR readCallback(char *buf, short length)
                 }
             }
             else {
-                httpdSendResponse(connection->connData, 400, "RX handshake failed\r\n");
-                abortLoading(connection);
+                loadFailed(connection, "RX handshake failed");
             }
         }
         break;
     case stVerifyChecksum:
         if (buf[0] == 0xFE) {
-            if ((connection->state = connection->stateAfterLoadFinishes) == stIdle) {
-                httpdSendResponse(connection->connData, 200, "");
+            statsAddTiming(&stats.checksumWait, statsSince(stats.drainDue));
+            // the ROM goes on to write the EEPROM for an image sent to it with a program command
+            if (connection->stateAfterLoadFinishes == stIdle && (connection->loadType & ltDownloadAndProgram)) {
+                stats.eepromStart = system_get_time();
+                startRomPoll(connection, stRomProgramAck, EEPROM_PROGRAM_TIMEOUT);
+            }
+            else if ((connection->state = connection->stateAfterLoadFinishes) == stIdle) {
+                sendLoadEndResponse(connection);
                 finishLoading(connection);
             }
             else {
@@ -388,12 +1045,28 @@ static void ICACHE_FLASH_ATTR readCallback(char *buf, short length)
             }
         }
         else {
-            httpdSendResponse(connection->connData, 400, "Checksum error\r\n");
-            abortLoading(connection);
+            loadFailed(connection, "Checksum error");
+        }
+        break;
+    case stRomProgramAck:
+        if (buf[0] == 0xFE)
+            startRomPoll(connection, stRomVerifyAck, EEPROM_VERIFY_TIMEOUT);
+        else
+            loadFailed(connection, "ROM EEPROM program failed");
+        break;
+    case stRomVerifyAck:
+        if (buf[0] == 0xFE) {
+            // the ROM writes the whole of the EEPROM whatever the image size
+            statsNoteEEPROM(ROM_EEPROM_SIZE);
+            sendLoadEndResponse(connection);
+            finishLoading(connection);
         }
+        else
+            loadFailed(connection, "ROM EEPROM verify failed");
         break;
     case stStartAck:
     case stDataAck:
+    case stPadAck:
     case stVerifyRAMAck:
     case stProgramVerifyEEPROMAck:
     case stReadyToLaunchAck:
@@ -404,48 +1077,62 @@ static void ICACHE_FLASH_ATTR readCallback(char *buf, short length)
         if ((connection->bytesRemaining -= cnt) == 0) {
             if (fplGetLong(&connection->buffer[4]) != connection->packetTag) {
                 char buf[80];
-                os_sprintf(buf, "FPL wrong tag: expected %d, got %d, state %d\r\n",
+                os_sprintf(buf, "FPL wrong tag: expected %d, got %d, state %d",
                            (int)connection->packetTag,
                            (int)fplGetLong(&connection->buffer[4]),
 //                           stateName(connection->state));
                            connection->state);
-                httpdSendResponse(connection->connData, 400, buf);
-                abortLoading(connection);
+                loadFailed(connection, buf);
             }
             else if (fplGetLong(&connection->buffer[0]) != connection->expectedID) {
                 char buf[80];
-                os_sprintf(buf, "FPL wrong id: expected %d, got %d, state %d\r\n",
+                os_sprintf(buf, "FPL wrong id: expected %d, got %d, state %d",
                            (int)connection->expectedID,
                            (int)fplGetLong(&connection->buffer[0]),
 //                           stateName(connection->state));
                            connection->state);
-                httpdSendResponse(connection->connData, 400, buf);
-                abortLoading(connection);
+                loadFailed(connection, buf);
             }
             else {
                 connection->packetID = connection->expectedID;
                 switch (connection->state) {
                 case stStartAck:
                     uart0_baud(connection->secondStageBaudRate);
-                    httpdSendResponse(connection->connData, 200, "");
+                    sendLoadBeginResponse(connection);
+                    connection->connData = NULL;
                     connection->state = stData;
+                    os_timer_arm(&connection->timer, earlyStart ? EARLY_START_TIMEOUT : DATA_IDLE_TIMEOUT, 0);
                     break;
                 case stDataAck:
-                    httpdSendResponse(connection->connData, 200, "");
+                    statsAddTiming(&stats.packetAck, system_get_time() - stats.packetStart);
+                    connection->bytesLoaded += connection->packetLength;
+                    sendLoadDataResponse(connection->connData, 200, connection->bytesLoaded);
+                    connection->connData = NULL;
                     connection->state = stData;
+                    os_timer_arm(&connection->timer, DATA_IDLE_TIMEOUT, 0);
+                    break;
+                case stPadAck:
+                    connection->dataRetriesRemaining = DATA_RETRIES;
+                    if (connection->packetID > 0)
+                        fplPad(connection);
+                    else
+                        fplVerifyRAM(connection);
                     break;
                 case stVerifyRAMAck:
-                    if (connection->loadType & ltDownloadAndProgram)
+                    if (connection->loadType & ltDownloadAndProgram) {
+                        stats.eepromStart = system_get_time();
                         fplProgramVerifyEEPROM(connection);
+                    }
                     else
                         fplReadyToLaunch(connection);
                     break;
                 case stProgramVerifyEEPROMAck:
+                    statsNoteEEPROM(connection->bytesLoaded);
                     fplReadyToLaunch(connection);
                     break;
                 case stReadyToLaunchAck:
                     fplLaunchNow(connection);
-                    httpdSendResponse(connection->connData, 200, "");
+                    sendLoadEndResponse(connection);
                     finishLoading(connection);
                     break;
                 default:
@@ -457,8 +1144,84 @@ static void ICACHE_FLASH_ATTR readCallback(char *buf, short length)
     default:
         break;
     }
+
+    statsNoteState(connection);
+}
+
+// the ROM answers a poll once it is done with the EEPROM, timeout is in milliseconds
+static void ICACHE_FLASH_ATTR startRomPoll(PropellerConnection *connection, LoadState state, int timeout)
+{
+    connection->state = state;
+    connection->retriesRemaining = timeout * 1000 / EEPROM_POLL_INTERVAL;
+    scheduleStep(connection, EEPROM_POLL_INTERVAL);
 }
 
+// arm the timer for a step that has to wait, noting when it's due so the dead time can be measured
+static void ICACHE_FLASH_ATTR scheduleStep(PropellerConnection *connection, uint32_t us)
+{
+    stats.stepDue = system_get_time() + us;
+    os_timer_arm_us(&connection->timer, us, 0);
+}
 
+// time the state that just ended, called wherever the state may have changed
+static void ICACHE_FLASH_ATTR statsNoteState(PropellerConnection *connection)
+{
+    uint32_t now;
 
+    if (connection->state == stats.state)
+        return;
+    now = system_get_time();
+    if (stats.state != stIdle)
+        statsAddTiming(&stats.states[stats.state], now - stats.stateStart);
+    stats.state = connection->state;
+    stats.stateStart = now;
+}
 
+static void ICACHE_FLASH_ATTR statsAddTiming(PropTiming *timing, uint32_t elapsed)
+{
+    uint32_t ms = elapsed / 1000;
+    int bucket = 0;
+
+    if (timing->count == 0 || elapsed < timing->min)
+        timing->min = elapsed;
+    if (elapsed > timing->max)
+        timing->max = elapsed;
+    timing->total += elapsed;
+    ++timing->count;
+
+    while (ms > 0 && bucket < STATS_BUCKETS - 1) {
+        ms >>= 1;
+        ++bucket;
+    }
+    if (timing->histogram[bucket] < 0xFFFF)
+        ++timing->histogram[bucket];
+}
+
+// the EEPROM has been programmed and verified
+static void ICACHE_FLASH_ATTR statsNoteEEPROM(int byteCount)
+{
+    statsAddTiming(&stats.eeprom, system_get_time() - stats.eepromStart);
+    stats.eepromBytes += byteCount;
+}
+
+// microseconds since a time, 0 if it hasn't come yet
+static uint32_t ICACHE_FLASH_ATTR statsSince(uint32_t time)
+{
+    int32_t elapsed = (int32_t)(system_get_time() - time);
+    return elapsed > 0 ? elapsed : 0;
+}
+
+static void ICACHE_FLASH_ATTR statsSendTiming(HttpdConnData *connData, const char *name, PropTiming *timing, int timeouts)
+{
+    int avg = timing->count > 0 ? (int)(timing->total / timing->count) : 0;
+    // at worst a 22 character state name, five 11 digit numbers and 14 five digit buckets, 231 bytes
+    char buf[256];
+    int len, i;
+
+    len = os_sprintf(buf, "\"%s\":{\"count\":%d,\"min-us\":%d,\"avg-us\":%d,\"max-us\":%d,\"timeouts\":%d,\"histogram\":[",
+                     name, (int)timing->count, (int)timing->min, avg, (int)timing->max, timeouts);
+    for (i = 0; i < STATS_BUCKETS; ++i)
+        len += os_sprintf(&buf[len], i == 0 ? "%d" : ",%d", timing->histogram[i]);
+    len += os_sprintf(&buf[len], "]}");
+    httpdSend(connData, buf, len);
+}
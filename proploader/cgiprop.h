@@ -3,11 +3,15 @@
 
 #include <httpd.h>
 
+int cgiPropInit(void);
 int cgiPropLoadBegin(HttpdConnData *connData);
 int cgiPropLoadData(HttpdConnData *connData);
 int cgiPropLoadEnd(HttpdConnData *connData);
+int cgiPropStats(HttpdConnData *connData);
 int cgiPropBlinkFast(HttpdConnData *connData);
 int cgiPropBlinkSlow(HttpdConnData *connData);
+int cgiPropInitialBaudRate(void);
+int cgiPropSecondStageBaudRate(void);
 
 #endif
 
@@ -1,14 +1,55 @@
+#ifndef LINUX
 #include <esp8266.h>
+#endif
 #include <stdlib.h>
-#include <math.h>
 #include "proploader.h"
 #include "fastproploader.h"
 #include "propimage.h"
-#include "uart.h"
 
-#define FAILSAFE_TIMEOUT    2.0         /* Number of seconds to wait for a packet from the host */
+#define FAILSAFE_TIMEOUT    2           /* Number of seconds to wait for a packet from the host */
+#define MAX_FAILSAFE_TIMEOUT 32         /* the most seconds that fit in the timeout at MAX_CLOCK_FREQ */
 #define MAX_RX_SENSE_ERROR  23          /* Maximum number of cycles by which the detection of a start bit could be off (as affected by the Loader code) */
-#define MAX_PACKET_SIZE     1024        /* size of data buffer in the second-stage loader */
+
+/* The clock the loader image is built for (a 5MHz crystal with PLL16X) and the fastest a Propeller
+   crystal and PLL can give. The ROM starts the loader with the clock in its header, so a target
+   with a faster crystal lets the second stage run at a faster rate. */
+#define LOADER_CLOCK_FREQ   80000000
+#define LOADER_CLOCK_MODE   0x6F
+#define MAX_CLOCK_FREQ      128000000
+
+/* clkmode CLKSEL values from XINPUT up are driven by the crystal or an external clock, RCFAST
+   and RCSLOW are too rough to time serial bits against */
+#define CLKSEL_MASK         0x07
+#define CLKSEL_XINPUT       0x02
+
+/* Minimum I2C times in nanoseconds for each EEPROM clock rate: start and stop condition setup and hold,
+   SCL high and SCL low. The loader waits at least this long for each, however fast the clock. */
+typedef struct {
+    int maxClock;
+    int setupHold;
+    int sclHigh;
+    int sclLow;
+} I2CTiming;
+
+static const I2CTiming i2cTimings[] = {
+    {  100000, 4700, 4000, 4700 },      /* standard mode */
+    {  400000,  600,  600, 1300 },      /* fast mode */
+    { 1000000,  260,  260,  500 }       /* fast mode plus */
+};
+
+/* the fewest cycles the loader's I2C code can take for each */
+#define MIN_SETUP_HOLD_CYCLES   14
+#define MIN_SCL_HIGH_CYCLES     14
+#define MIN_SCL_LOW_CYCLES      26
+
+/* Programming is a page write per 64 bytes of a full RAM, each taking at most EEPROM_WRITE_TIME, then
+   a read back of nine clocks a byte. The timeout allows half again and a second on top. */
+#define EEPROM_WRITE_TIME   5           /* milliseconds */
+#define EEPROM_PAGE_SIZE    64
+
+/* The loader samples the first data bit 1.5 bit times after it senses a start bit, less the sense
+   error, so a bit has to last longer than twice the sense error for that to land past the start bit */
+#define MIN_BIT_TIME        (2 * MAX_RX_SENSE_ERROR + 1)
 
 // Offset (in bytes) from end of Loader Image pointing to where most host-initialized values exist.
 // Host-Initialized values are: Initial Bit Time, Final Bit Time, 1.5x Bit Time, Failsafe timeout,
@@ -26,17 +67,57 @@
 #include "IP_Loader.h"
 
 static uint8_t initCallFrame[] = {0xFF, 0xFF, 0xF9, 0xFF, 0xFF, 0xFF, 0xF9, 0xFF};
+static uint8_t padLong[4];
 
-double ClockSpeed = 80000000.0;
+static uint32_t ICACHE_FLASH_ATTR BitTime(uint32_t clockFreq, int baudRate)
+{
+    return (clockFreq + baudRate / 2) / baudRate;
+}
+
+/* cycles of at least ns nanoseconds, clockFreq / 1000 times 4700 still fits in 32 bits */
+static uint32_t ICACHE_FLASH_ATTR I2CCycles(uint32_t clockFreq, int ns, uint32_t minCycles)
+{
+    uint32_t cycles = (clockFreq / 1000 * ns + 999999) / 1000000;
+    return cycles > minCycles ? cycles : minCycles;
+}
+
+static const I2CTiming * ICACHE_FLASH_ATTR GetI2CTiming(int eepromClock)
+{
+    int i;
+    for (i = 0; i < (int)(sizeof(i2cTimings) / sizeof(i2cTimings[0])); ++i)
+        if (eepromClock <= i2cTimings[i].maxClock)
+            return &i2cTimings[i];
+    return NULL;
+}
 
 int ICACHE_FLASH_ATTR fplGenerateInitialLoaderImage(PropellerConnection *connection, int imageSize, PropellerImage *image)
 {
     int initAreaOffset = sizeof(rawLoaderImage) + RAW_LOADER_INIT_OFFSET_FROM_END;
-    int initialBaudRate = connection->baudRate;
-    int finalBaudRate = connection->secondStageBaudRate;
+    uint32_t initialBaudRate = connection->baudRate;
+    uint32_t finalBaudRate = connection->secondStageBaudRate;
+    uint32_t clockFreq = LOADER_CLOCK_FREQ;
+    int clockMode = LOADER_CLOCK_MODE;
+    int failsafeTimeout = connection->failsafeTimeout > 0 ? connection->failsafeTimeout : FAILSAFE_TIMEOUT;
+    const I2CTiming *i2cTiming = GetI2CTiming(connection->eepromClock > 0 ? connection->eepromClock : DEFAULT_EEPROM_CLOCK);
     int i;
     
-    connection->expectedID = (imageSize + MAX_PACKET_SIZE - 1) / MAX_PACKET_SIZE;
+    if (initialBaudRate == 0 || finalBaudRate == 0)
+        return -1;
+    
+    // run the loader at the target's clock when it is crystal driven and fast enough for both rates,
+    // a slower crystal leaves it at its own clock
+    if (connection->clockFreq > 0 && connection->clockFreq <= MAX_CLOCK_FREQ
+    &&  (connection->clockMode & CLKSEL_MASK) >= CLKSEL_XINPUT
+    &&  BitTime(connection->clockFreq, initialBaudRate) >= MIN_BIT_TIME
+    &&  BitTime(connection->clockFreq, finalBaudRate) >= MIN_BIT_TIME) {
+        clockFreq = connection->clockFreq;
+        clockMode = connection->clockMode;
+    }
+    if (BitTime(clockFreq, initialBaudRate) < MIN_BIT_TIME || BitTime(clockFreq, finalBaudRate) < MIN_BIT_TIME
+    ||  failsafeTimeout > MAX_FAILSAFE_TIMEOUT || !i2cTiming)
+        return -1;
+    
+    connection->expectedID = (imageSize + connection->packetSize - 1) / connection->packetSize;
     
     connection->checksum = 0;
     for (i = 0; i < (int)sizeof(initCallFrame); ++i)
@@ -44,37 +125,41 @@ int ICACHE_FLASH_ATTR fplGenerateInitialLoaderImage(PropellerConnection *connect
  
     // Make an image from the loader template
     pimageSetImage(image, rawLoaderImage, sizeof(rawLoaderImage));
+    pimageSetClkFreq(image, clockFreq);
+    pimageSetClkMode(image, clockMode);
  
     // Clock mode
     //PropellerImageSetLong(image, initAreaOffset +  0, 0);
 
+    // The timing values are rounded to the nearest clock, all in integer arithmetic (clockFreq is
+    // at most MAX_CLOCK_FREQ so ten times it still fits in 32 bits).
+
     // Initial Bit Time.
-    pimageSetLong(image, initAreaOffset +  4, (int)trunc(80000000.0 / initialBaudRate + 0.5));
+    pimageSetLong(image, initAreaOffset +  4, BitTime(clockFreq, initialBaudRate));
 
     // Final Bit Time.
-    pimageSetLong(image, initAreaOffset +  8, (int)trunc(80000000.0 / finalBaudRate + 0.5));
+    pimageSetLong(image, initAreaOffset +  8, BitTime(clockFreq, finalBaudRate));
 
     // 1.5x Final Bit Time minus maximum start bit sense error.
-    pimageSetLong(image, initAreaOffset + 12, (int)trunc(1.5 * ClockSpeed / finalBaudRate - MAX_RX_SENSE_ERROR + 0.5));
+    pimageSetLong(image, initAreaOffset + 12, (3 * clockFreq + finalBaudRate) / (2 * finalBaudRate) - MAX_RX_SENSE_ERROR);
 
     // Failsafe Timeout (seconds-worth of Loader's Receive loop iterations).
-    pimageSetLong(image, initAreaOffset + 16, (int)trunc(FAILSAFE_TIMEOUT * ClockSpeed / (3 * 4) + 0.5));
+    pimageSetLong(image, initAreaOffset + 16, (failsafeTimeout * clockFreq + 6) / (3 * 4));
 
     // EndOfPacket Timeout (2 bytes worth of Loader's Receive loop iterations).
-    pimageSetLong(image, initAreaOffset + 20, (int)trunc((2.0 * ClockSpeed / finalBaudRate) * (10.0 / 12.0) + 0.5));
+    pimageSetLong(image, initAreaOffset + 20, (10 * clockFreq + 3 * finalBaudRate) / (6 * finalBaudRate));
 
-    // PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 24, Max(Round(ClockSpeed * SSSHTime), 14));
-    // PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 28, Max(Round(ClockSpeed * SCLHighTime), 14));
-    // PatchLoaderLongValue(RawSize*4+RawLoaderInitOffset + 32, Max(Round(ClockSpeed * SCLLowTime), 26));
+    // The EEPROM times are rounded up, the template's are for fast mode at 80MHz and would be too short
+    // at a faster target clock.
 
     // Minimum EEPROM Start/Stop Condition setup/hold time (400 KHz = 1/0.6 µS); Minimum 14 cycles
-    //pimageSetLong(image, initAreaOffset + 24, 14);
+    pimageSetLong(image, initAreaOffset + 24, I2CCycles(clockFreq, i2cTiming->setupHold, MIN_SETUP_HOLD_CYCLES));
 
     // Minimum EEPROM SCL high time (400 KHz = 1/0.6 µS); Minimum 14 cycles
-    //pimageSetLong(image, initAreaOffset + 28, 14);
+    pimageSetLong(image, initAreaOffset + 28, I2CCycles(clockFreq, i2cTiming->sclHigh, MIN_SCL_HIGH_CYCLES));
 
     // Minimum EEPROM SCL low time (400 KHz = 1/1.3 µS); Minimum 26 cycles
-    //pimageSetLong(image, initAreaOffset + 32, 26);
+    pimageSetLong(image, initAreaOffset + 32, I2CCycles(clockFreq, i2cTiming->sclLow, MIN_SCL_LOW_CYCLES));
 
     // First Expected Packet ID; total packet count.
     pimageSetLong(image, initAreaOffset + 36, connection->expectedID);
@@ -86,6 +171,20 @@ int ICACHE_FLASH_ATTR fplGenerateInitialLoaderImage(PropellerConnection *connect
     return 0;
 }
 
+/* how long programming and verifying the EEPROM can take at the connection's I2C clock, milliseconds */
+int ICACHE_FLASH_ATTR fplEEPROMTimeout(PropellerConnection *connection)
+{
+    int eepromClock = connection->eepromClock > 0 ? connection->eepromClock : DEFAULT_EEPROM_CLOCK;
+    int writeTime = MAX_IMAGE_SIZE / EEPROM_PAGE_SIZE * EEPROM_WRITE_TIME;
+    int readTime = (int)((uint32_t)MAX_IMAGE_SIZE * 9 * 1000 / eepromClock);
+    return (writeTime + readTime) * 3 / 2 + 1000;
+}
+
+int ICACHE_FLASH_ATTR fplLoaderImageSize(void)
+{
+    return sizeof(rawLoaderImage);
+}
+
 static void ICACHE_FLASH_ATTR TransmitPacket(PropellerConnection *connection, uint8_t *payload, int payloadSize, int timeout)
 {
     uint8_t hdr[8];
@@ -96,12 +195,12 @@ static void ICACHE_FLASH_ATTR TransmitPacket(PropellerConnection *connection, ui
     fplSetLong(&hdr[4], connection->packetTag);
         
     /* send the header and data */
-    uart0_tx_buffer((char *)hdr, sizeof(hdr));
-    uart0_tx_buffer((char *)payload, payloadSize);
+    halSerialTx(hdr, sizeof(hdr));
+    halSerialTx(payload, payloadSize);
     
     /* setup to receive the ack */
     if (timeout > 0) {
-        os_timer_arm(&connection->timer, timeout, 0);
+        halTimerArm(&connection->timer, timeout);
         connection->bytesRemaining = sizeof(fplResponse);
         connection->bytesReceived = 0;
     }
@@ -109,11 +208,20 @@ static void ICACHE_FLASH_ATTR TransmitPacket(PropellerConnection *connection, ui
 
 void ICACHE_FLASH_ATTR fplData(PropellerConnection *connection, uint8_t *payload, int payloadSize)
 {
-    TransmitPacket(connection, payload, payloadSize, PACKET_TIMEOUT);
+    TransmitPacket(connection, payload, payloadSize, DATA_ACK_TIMEOUT);
     connection->expectedID = connection->packetID - 1;
     connection->state = stDataAck;
 }
 
+/* A long of zeros in place of a data packet, for the packets an image turned out not to need. It
+   lands in RAM past the image, which is zeros anyway, so the checksum is unchanged. */
+void ICACHE_FLASH_ATTR fplPad(PropellerConnection *connection)
+{
+    TransmitPacket(connection, padLong, sizeof(padLong), DATA_ACK_TIMEOUT);
+    connection->expectedID = connection->packetID - 1;
+    connection->state = stPadAck;
+}
+
 void ICACHE_FLASH_ATTR fplUpdateChecksum(PropellerConnection *connection, uint8_t *payload, int payloadSize)
 {
     int i;
@@ -130,7 +238,7 @@ void ICACHE_FLASH_ATTR fplVerifyRAM(PropellerConnection *connection)
 
 void ICACHE_FLASH_ATTR fplProgramVerifyEEPROM(PropellerConnection *connection)
 {
-    TransmitPacket(connection, programVerifyEEPROM, sizeof(programVerifyEEPROM), FLASH_TIMEOUT);
+    TransmitPacket(connection, programVerifyEEPROM, sizeof(programVerifyEEPROM), fplEEPROMTimeout(connection));
     connection->expectedID = -connection->checksum * 2;
     connection->state = stProgramVerifyEEPROMAck;
 }
@@ -2,21 +2,28 @@
 #define FASTPROPLOADER_H
 
 //#include <stdint.h>
-#include "os_type.h"
+#include "prophal.h"
 
 #include "propimage.h"
 #include "proploader.h"
 
 #define STARTUP_TIMEOUT     2000
 #define PACKET_TIMEOUT      2000
-#define FLASH_TIMEOUT       8000
+
+#define DATA_ACK_TIMEOUT    500         /* short enough to resend a data packet within the failsafe timeout */
+#define DATA_RETRIES        2           /* times a data packet is resent when its ack is lost */
+#define DATA_IDLE_TIMEOUT   2000        /* the second-stage loader's failsafe timeout */
+#define EARLY_START_TIMEOUT 30000       /* the same for a load begun before the image is built, whole seconds */
 
 typedef struct {
     uint32_t data[2];
 } fplResponse;
 
 int fplGenerateInitialLoaderImage(PropellerConnection *connection, int imageSize, PropellerImage *image);
+int fplLoaderImageSize(void);
+int fplEEPROMTimeout(PropellerConnection *connection);
 void fplData(PropellerConnection *connection, uint8_t *payload, int payloadSize);
+void fplPad(PropellerConnection *connection);
 void fplUpdateChecksum(PropellerConnection *connection, uint8_t *payload, int payloadSize);
 void fplVerifyRAM(PropellerConnection *connection);
 void fplProgramVerifyEEPROM(PropellerConnection *connection);
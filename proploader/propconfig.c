@@ -0,0 +1,43 @@
+#include <esp8266.h>
+#include <stddef.h>
+#include <spi_flash.h>
+#include "propconfig.h"
+
+#define PROP_CONFIG_MAGIC   0x50524F50  // "PROP"
+
+// The first sector of the 16KB reserved after the first firmware partition, esp-link's own
+// config takes the upper two sectors.
+#ifndef PROP_CONFIG_ADDR
+#define PROP_CONFIG_ADDR    (SPI_FLASH_SEC_SIZE + FIRMWARE_SIZE)
+#endif
+
+static uint32_t ICACHE_FLASH_ATTR configChecksum(PropConfig *config)
+{
+    uint32_t *p = (uint32_t *)config;
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i < (int)(offsetof(PropConfig, checksum) / sizeof(uint32_t)); ++i)
+        sum = (sum << 1 | sum >> 31) ^ p[i];
+    return sum;
+}
+
+// returns -1 when the sector has never been written or doesn't hold a valid config
+int ICACHE_FLASH_ATTR propConfigLoad(PropConfig *config)
+{
+    if (spi_flash_read(PROP_CONFIG_ADDR, (uint32_t *)config, sizeof(PropConfig)) != SPI_FLASH_RESULT_OK
+    ||  config->magic != PROP_CONFIG_MAGIC
+    ||  config->checksum != configChecksum(config)) {
+        os_memset(config, 0, sizeof(PropConfig));
+        return -1;
+    }
+    return 0;
+}
+
+void ICACHE_FLASH_ATTR propConfigSave(PropConfig *config)
+{
+    config->magic = PROP_CONFIG_MAGIC;
+    config->checksum = configChecksum(config);
+    if (spi_flash_erase_sector(PROP_CONFIG_ADDR / SPI_FLASH_SEC_SIZE) != SPI_FLASH_RESULT_OK
+    ||  spi_flash_write(PROP_CONFIG_ADDR, (uint32_t *)config, sizeof(PropConfig)) != SPI_FLASH_RESULT_OK)
+        os_printf("prop: saving the loader config failed\n");
+}
@@ -0,0 +1,19 @@
+#ifndef PROPCONFIG_H
+#define PROPCONFIG_H
+
+#include <esp8266.h>
+
+// the Propeller loader's settings that outlive a reset, kept in their own flash sector
+typedef struct {
+    uint32_t magic;
+    int32_t initialBaudRate;        // fastest initial rate the ROM has followed
+    int32_t secondStageBaudRate;    // fastest rate the second-stage loader has taken data at
+    int32_t eepromImageSize;        // the image last programmed into the EEPROM, 0 when unknown
+    uint32_t eepromImageHash;
+    uint32_t checksum;
+} PropConfig;
+
+int propConfigLoad(PropConfig *config);
+void propConfigSave(PropConfig *config);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef PROPHAL_H
+#define PROPHAL_H
+
+// Serial port, reset pin and timer access for the loader core (proploader.c, fastproploader.c
+// and propimage.c). The firmware maps these straight onto the SDK; building with LINUX uses
+// the termios backend in espload/src/prophal_linux.c so the same loader runs from a host.
+
+#ifdef LINUX
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ICACHE_FLASH_ATTR
+#define os_printf printf
+
+// the host has no event loop, the driver waits on the serial port until the timer expires
+typedef struct {
+    uint64_t deadline;          // milliseconds on halMilliseconds' clock, 0 when disarmed
+} HalTimer;
+
+// the host side has no web server, the connection data is never looked at
+typedef struct HttpdConnData HttpdConnData;
+
+void halSerialTx(const uint8_t *buf, int len);
+void halSerialTxByte(uint8_t byte);
+void halSerialSetBaud(int baudRate);
+int halSerialTxQueued(void);
+void halResetPin(int pin, int level);
+void halTimerArm(HalTimer *timer, int ms);
+void halTimerDisarm(HalTimer *timer);
+
+// only on the host
+int halSerialOpen(const char *port, const char *reset, int baudRate);
+void halSerialClose(void);
+int halSerialRx(uint8_t *buf, int len, int timeout);
+uint64_t halMilliseconds(void);
+
+#else
+
+#include <osapi.h>
+#include "os_type.h"
+#include "uart.h"
+#include "httpd.h"
+
+typedef ETSTimer HalTimer;
+
+#define halSerialTx(buf, len)       uart0_tx_buffer((char *)(buf), (uint16_t)(len))
+#define halSerialTxByte(byte)       uart_tx_one_char(UART0, (byte))
+#define halSerialSetBaud(baudRate)  uart0_baud(baudRate)
+#define halSerialTxQueued()         ((READ_PERI_REG(UART_STATUS(UART0)) >> UART_TXFIFO_CNT_S) & UART_TXFIFO_CNT)
+#define halResetPin(pin, level)     GPIO_OUTPUT_SET((pin), (level))
+#define halTimerArm(timer, ms)      os_timer_arm((timer), (ms), 0)
+#define halTimerDisarm(timer)       os_timer_disarm(timer)
+
+#endif
+
+#endif
@@ -1,6 +1,7 @@
+#include <stddef.h>
 #include "propimage.h"
 
-#define OFFSET_OF(_s, _f) ((int)&((_s *)0)->_f)
+#define OFFSET_OF(_s, _f) ((int)offsetof(_s, _f))
 
 void ICACHE_FLASH_ATTR pimageSetImage(PropellerImage *image, uint8_t *imageData, int imageSize)
 {
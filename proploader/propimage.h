@@ -2,7 +2,7 @@
 #define PROPIMAGE_H
 
 //#include <stdint.h>
-#include "os_type.h"
+#include "prophal.h"
 
 /* target checksum for a binary file */
 #define SPIN_TARGET_CHECKSUM    0x14
@@ -1,6 +1,5 @@
 #include <string.h>
 #include "proploader.h"
-#include "uart.h"
 
 #define LENGTH_FIELD_SIZE       11          /* number of bytes in the length field */
 
@@ -134,7 +133,7 @@ static const uint8_t rxHandshake[] = {
 
 int ICACHE_FLASH_ATTR ploadInitiateHandshake(PropellerConnection *connection)
 {
-    uart0_tx_buffer((char *)txHandshake, (uint16_t)sizeof(txHandshake));
+    halSerialTx(txHandshake, sizeof(txHandshake));
     connection->bytesRemaining = sizeof(rxHandshake) + 4;
     connection->bytesReceived = 0;
     return 0;
@@ -162,16 +161,16 @@ int ICACHE_FLASH_ATTR ploadLoadImage(PropellerConnection *connection, LoadType l
 {
     switch (loadType) {
     case ltShutdown:
-        uart0_tx_buffer((char *)shutdownCmd, (uint16_t)sizeof(shutdownCmd));
+        halSerialTx(shutdownCmd, sizeof(shutdownCmd));
         break;
     case ltDownloadAndRun:
-        uart0_tx_buffer((char *)loadRunCmd, (uint16_t)sizeof(loadRunCmd));
+        halSerialTx(loadRunCmd, sizeof(loadRunCmd));
         break;
     case ltDownloadAndProgram:
-        uart0_tx_buffer((char *)programShutdownCmd, (uint16_t)sizeof(loadRunCmd));
+        halSerialTx(programShutdownCmd, sizeof(programShutdownCmd));
         break;
     case ltDownloadAndProgramAndRun:
-        uart0_tx_buffer((char *)programRunCmd, (uint16_t)sizeof(loadRunCmd));
+        halSerialTx(programRunCmd, sizeof(programRunCmd));
         break;
     default:
         return -1;
@@ -180,12 +179,11 @@ int ICACHE_FLASH_ATTR ploadLoadImage(PropellerConnection *connection, LoadType l
     if (loadType != ltShutdown) {
         static uint8_t masks[] = { 0x00, 0x01, 0x03, 0x07, 0x0f, 0x1f };
         int bitCount = imageSize * 8;
-        int byteCount = 0;
         int nextBit = 0;
         int tmp, i;
         
         for (i = 0, tmp = imageSize / 4; i < LENGTH_FIELD_SIZE; ++i) {
-            uart_tx_one_char(UART0, 0x92 
+            halSerialTxByte(0x92 
                                   | (i == 10 ? 0x60 : 0x00)
                                   |  (tmp & 1)
                                   | ((tmp & 2) << 2)
@@ -207,17 +205,16 @@ int ICACHE_FLASH_ATTR ploadLoadImage(PropellerConnection *connection, LoadType l
                   | (image[nextBit / 8 + 1] << (8 - (nextBit % 8)))) & masks[bitsIn];
 
             /* transmit the encoded value */
-            uart_tx_one_char(UART0, PDSTx[bits][bitsIn - 1].encoding);
-            ++byteCount;
+            halSerialTxByte(PDSTx[bits][bitsIn - 1].encoding);
 
             /* advance to the next group of bits */
             nextBit += PDSTx[bits][bitsIn - 1].bitCount;
         }
 
-        /* calculate the number of retries required */
-        tmp = (byteCount * 10 * 1000) / connection->baudRate;
-        connection->retriesRemaining = (tmp + 250) / CALIBRATE_DELAY;
-        connection->retryDelay = CALIBRATE_DELAY;
+        /* the checksum can be polled for once what's still queued has gone out */
+        connection->drainDelay = (int)((uint64_t)halSerialTxQueued() * 10 * 1000000 / connection->baudRate);
+        connection->retriesRemaining = RX_CHECKSUM_TIMEOUT * 1000 / CHECKSUM_POLL_INTERVAL;
+        connection->retryDelay = CHECKSUM_POLL_INTERVAL;
     }
 
     return 0;
@@ -2,9 +2,7 @@
 #define PROPLOADER_H
 
 //#include <stdint.h>
-#include <osapi.h>
-#include "os_type.h"
-#include "httpd.h"
+#include "prophal.h"
 
 #define PROP_DBG
 
@@ -14,6 +12,27 @@
 #define DBG(format, ...)
 #endif
 
+// size of the data buffer in the second-stage loader
+#define MAX_PACKET_SIZE         1024
+
+// the Propeller's hub RAM, the largest image there is
+#define MAX_IMAGE_SIZE          32768
+
+// load parameters used when the client doesn't give them (also reported by discovery)
+#define DEFAULT_RESET_PIN           12
+#define DEFAULT_BAUD_RATE           115200
+#define DEFAULT_SECOND_STAGE_BAUD   921600
+
+// second-stage baud rates known to work with the IP_Loader bit timing
+#define SECOND_STAGE_BAUD_RATES     { 115200, 230400, 460800, 921600 }
+
+// initial baud rates the ROM loader can follow on RCFAST, slowest first
+#define INITIAL_BAUD_RATES          { 115200, 230400 }
+
+// I2C clock the second-stage loader programs the EEPROM at, fast mode unless the client asks
+#define DEFAULT_EEPROM_CLOCK        400000
+#define MAX_EEPROM_CLOCK            1000000
+
 typedef enum {
     ltShutdown = 0,
     ltDownloadAndRun = (1 << 0),
@@ -34,23 +53,36 @@ typedef enum {
 /*  9 */    stVerifyRAMAck,
 /* 10 */    stProgramVerifyEEPROMAck,
 /* 11 */    stReadyToLaunchAck,
+/* 12 */    stRomProgramAck,
+/* 13 */    stRomVerifyAck,
+/* 14 */    stPadAck,
             stMAX
 } LoadState;
 
 typedef struct {
     HttpdConnData *connData;
-    ETSTimer timer;
+    HalTimer timer;
     int resetPin;
     int baudRate;
     int secondStageBaudRate;
     int finalBaudRate;
+    uint32_t clockFreq;         // the target image's clkfreq and clkmode, 0 to run the loader at its own
+    int clockMode;
+    int failsafeTimeout;        // seconds the second-stage loader waits for a packet, 0 for the usual
+    int eepromClock;            // I2C clock rate for programming the EEPROM (0 for the default)
     LoadType loadType;
     const uint8_t *image;
     int imageSize;
+    int packetSize;
+    int bytesLoaded;            // image bytes acknowledged by the second-stage loader
+    uint8_t packet[MAX_PACKET_SIZE]; // copy of the data packet in flight for retransmission
+    int packetLength;
+    int dataRetriesRemaining;
     LoadState state;
     LoadState stateAfterLoadFinishes;
     int retriesRemaining;
-    int retryDelay;
+    int retryDelay;             // microseconds between checksum polls
+    int drainDelay;             // microseconds until the stream ploadLoadImage queued has gone out
     uint8_t buffer[125 + 4]; // sizeof(rxHandshake) + 4
     int bytesReceived;
     int bytesRemaining;
@@ -63,7 +95,8 @@ typedef struct {
 #define RESET_DELAY_1           10
 #define RESET_DELAY_2           10
 #define RESET_DELAY_3           100
-#define CALIBRATE_DELAY         10
+#define CHECKSUM_POLL_INTERVAL  1000        // microseconds between 0xF9 polls for the checksum reply
+#define EEPROM_POLL_INTERVAL    10000       // microseconds between polls while the ROM writes the EEPROM
 
 #define RX_HANDSHAKE_TIMEOUT    2000
 #define RX_CHECKSUM_TIMEOUT     250
@@ -0,0 +1,39 @@
+#!/bin/sh
+# bench-check.sh - compare bench.sh results against a baseline
+#
+# usage: bench-check.sh <baseline> <results> [ <tolerance-percent> [ <slack-ms> ] ]
+#
+# A phase regresses when it takes more than <tolerance-percent> (default 10) longer than
+# the baseline and more than <slack-ms> (default 20) longer, so that the few milliseconds
+# of scheduling noise on the short phases don't count. Exits with 1 on any regression or
+# on a load that is in the baseline but missing from the results.
+
+if [ $# -lt 2 ]; then
+    echo "usage: bench-check.sh <baseline> <results> [ <tolerance-percent> [ <slack-ms> ] ]" >&2
+    exit 1
+fi
+
+awk -v tolerance=${3:-10} -v slack=${4:-20} '
+    BEGIN { split("begin data end total", phase, " ") }
+    NR == FNR { for (i = 3; i <= 6; ++i) base[$1 " " $2, i] = $i; loads[$1 " " $2] = 1; next }
+    {
+        key = $1 " " $2
+        if (!(key in loads))
+            next
+        seen[key] = 1
+        for (i = 3; i <= 6; ++i) {
+            old = base[key, i]
+            if ($i > old * (1 + tolerance / 100) && $i - old > slack) {
+                printf("regression: %s %s: %d ms, baseline %d ms\n", key, phase[i - 2], $i, old)
+                failed = 1
+            }
+        }
+    }
+    END {
+        for (key in loads)
+            if (!(key in seen)) {
+                printf("missing: %s\n", key)
+                failed = 1
+            }
+        exit failed
+    }' "$1" "$2"
@@ -0,0 +1,102 @@
+#!/bin/sh
+# bench.sh - time loading each test image with run and program-and-run
+#
+# usage: bench.sh [ <results-file> ]
+#
+# Loads against the module named by $MODULE (a name, address or address:port) or, when
+# that isn't set, against a local esphttpd: esp-link's httpd and Propeller loader driving
+# a simulated Propeller, so the suite runs without hardware. Each load is repeated $RUNS
+# times and the fastest kept. Results are one line per load:
+#
+#   <image> <mode> <begin-ms> <data-ms> <end-ms> <total-ms>
+#
+# Without $MODULE each image is also loaded by propload over a pty to a simulated Propeller,
+# the wired path, as modes wired-run and wired-program-and-run with the loader boot as begin.
+
+OS=${OS:-linux}
+ESPLOAD=${ESPLOAD:-../espload-$OS-build/bin/espload}
+ESPHTTPD=${ESPHTTPD:-../espsim-$OS-build/bin/esphttpd}
+PROPLOAD=${PROPLOAD:-../espload-$OS-build/bin/propload}
+PROPSIM=${PROPSIM:-../espload-$OS-build/bin/propsim}
+PORT=${PORT:-18080}
+RUNS=${RUNS:-3}
+CHUNK=${CHUNK:-1024}
+RESULTS=${1:-/dev/stdout}
+
+cd "$(dirname "$0")"
+
+# keep the tuning and discovery files of a real user out of it
+HOME=$(mktemp -d)
+export HOME
+
+SERVER=
+PTYSIM=
+if [ -z "$MODULE" ]; then
+    $ESPHTTPD -p $PORT > "$HOME/esphttpd.log" &
+    SERVER=$!
+    MODULE=127.0.0.1:$PORT
+    $PROPSIM -l "$HOME/pty" -r "$HOME/reset" > "$HOME/propsim.log" &
+    PTYSIM=$!
+    sleep 1
+fi
+
+status=0
+: > "$HOME/results"
+for image in *.binary; do
+    for mode in run program-and-run; do
+        flags=
+        [ $mode = program-and-run ] && flags=-e
+        best=
+        i=0
+        while [ $i -lt $RUNS ]; do
+            line=$($ESPLOAD -i $MODULE -c $CHUNK -p $flags $image | grep '^timing:')
+            if [ -z "$line" ]; then
+                echo "error: loading $image ($mode) failed" >&2
+                status=1
+                break
+            fi
+            # timing: <n> bytes, begin <n> ms, data <n> ms, end <n> ms, total <n> ms, path <path>
+            set -- $line
+            row="${image%.binary} $mode $5 $8 ${11} ${14}"
+            if [ -z "$best" ] || [ ${14} -lt $(echo $best | cut -d' ' -f6) ]; then
+                best=$row
+            fi
+            i=$((i + 1))
+        done
+        [ -n "$best" ] && echo "$best" >> "$HOME/results"
+    done
+done
+
+# the same loads over the wire, through the loader core propload shares with the firmware
+if [ -n "$PTYSIM" ]; then
+    for image in *.binary; do
+        for mode in run program-and-run; do
+            flags=
+            [ $mode = program-and-run ] && flags=-e
+            best=
+            i=0
+            while [ $i -lt $RUNS ]; do
+                line=$($PROPLOAD -p "$HOME/pty" -r "$HOME/reset" $flags $image | grep '^loaded')
+                if [ -z "$line" ]; then
+                    echo "error: propload of $image ($mode) failed" >&2
+                    status=1
+                    break
+                fi
+                # loaded <n> bytes in <n> ms: loader <n> ms, data <n> ms (<n> bytes/sec), launch <n> ms
+                set -- $line
+                row="${image%.binary} wired-$mode $8 ${11} ${16} $5"
+                if [ -z "$best" ] || [ $5 -lt $(echo $best | cut -d' ' -f6) ]; then
+                    best=$row
+                fi
+                i=$((i + 1))
+            done
+            [ -n "$best" ] && echo "$best" >> "$HOME/results"
+        done
+    done
+fi
+
+[ -n "$SERVER" ] && kill $SERVER
+[ -n "$PTYSIM" ] && kill $PTYSIM
+cat "$HOME/results" > "$RESULTS"
+rm -r -f "$HOME"
+exit $status
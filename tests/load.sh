@@ -1,2 +1 @@
-espload -i $MODULE -r 15 $1.binary
-telnet $MODULE
+espload -i $MODULE -r 15 -t $1.binary
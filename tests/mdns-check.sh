@@ -0,0 +1,52 @@
+#!/bin/sh
+# mdns-check.sh - check that espload resolves and browses esp-link's mDNS records
+#
+# usage: mdns-check.sh
+#
+# Runs mockesp as an mDNS responder on this host, answering for $NAME.local and its
+# _esp-link._tcp service the way esp-link/mdns.c does, then checks that espload -m finds
+# it with the TXT record's MAC address and the records' TTL, and that a load by
+# $NAME.local resolves it with mDNS.
+
+OS=${OS:-linux}
+ESPLOAD=${ESPLOAD:-../espload-$OS-build/bin/espload}
+MOCKESP=${MOCKESP:-../espload-$OS-build/bin/mockesp}
+PORT=${PORT:-18081}
+NAME=${NAME:-espmock}
+
+cd "$(dirname "$0")"
+
+# keep the registry of a real user out of it
+HOME=$(mktemp -d)
+export HOME
+
+$MOCKESP -p $PORT -m $NAME > "$HOME/mockesp.log" &
+SERVER=$!
+sleep 1
+
+status=0
+fail() {
+    echo "error: $*" >&2
+    status=1
+}
+
+# browse: the module, its TXT record and the TTL of its host records
+$ESPLOAD -m > "$HOME/browse" 2>&1
+grep -q "^found $NAME at 127.0.0.1: mockesp" "$HOME/browse" || fail "espload -m didn't find $NAME: $(cat "$HOME/browse")"
+# <name> <address> <mac> <last-seen> <reset-pin> <max-packet> <baud> <ttl> <version>
+set -- $(grep "^$NAME " "$HOME/.espload-modules" 2>/dev/null)
+[ "$3" = 02:00:00:00:00:01 ] || fail "browse didn't record the mac TXT key: $*"
+[ "$6" = 1024 ] || fail "browse didn't record max-packet-size: $*"
+[ "$8" = 120 ] || fail "browse didn't record the A and SRV records' TTL: $*"
+
+# resolve: a load by name asks for the A record when the registry doesn't know it
+rm -f "$HOME/.espload-modules"
+$ESPLOAD -v -i $NAME.local "$HOME/none.binary" > "$HOME/resolve" 2>&1
+grep -q "^'$NAME.local' is 127.0.0.1 from mDNS" "$HOME/resolve" || fail "espload didn't resolve $NAME.local: $(cat "$HOME/resolve")"
+set -- $(grep "^$NAME " "$HOME/.espload-modules" 2>/dev/null)
+[ "$8" = 120 ] || fail "resolve didn't record the A record's TTL: $*"
+
+kill $SERVER
+[ $status -eq 0 ] && echo "mDNS resolve and browse of $NAME.local match"
+rm -r -f "$HOME"
+exit $status